@@ -58,6 +58,26 @@ struct kmem_cache *blk_requestq_cachep;
  */
 static struct workqueue_struct *kblockd_workqueue;
 
+#ifdef CONFIG_BLK_DEV_IO_HIST
+/*
+ * Classify @rq for the latency histograms while its flags are still as
+ * submitted: the flush machinery strips REQ_FLUSH before completion.
+ */
+static void blk_set_hist_op(struct request *rq)
+{
+	if (rq->cmd_flags & REQ_DISCARD)
+		rq->hist_op = DISK_HIST_DISCARD;
+	else if ((rq->cmd_flags & REQ_FLUSH) && !blk_rq_sectors(rq))
+		rq->hist_op = DISK_HIST_FLUSH;
+	else if (rq_data_dir(rq) == WRITE)
+		rq->hist_op = DISK_HIST_WRITE;
+	else
+		rq->hist_op = DISK_HIST_READ;
+}
+#else
+static inline void blk_set_hist_op(struct request *rq) { }
+#endif
+
 static void drive_stat_acct(struct request *rq, int new_io)
 {
 	struct hd_struct *part;
@@ -89,6 +109,7 @@ static void drive_stat_acct(struct request *rq, int new_io)
 		part_round_stats(cpu, part);
 		part_inc_in_flight(part, rw);
 		rq->part = part;
+		blk_set_hist_op(rq);
 	}
 
 	part_stat_unlock();
@@ -1977,6 +1998,54 @@ static void blk_account_io_completion(struct request *req, unsigned int bytes)
 	}
 }
 
+#ifdef CONFIG_BLK_DEV_IO_HIST
+static inline u64 blk_hist_delta(u64 now, u64 start)
+{
+	/* sched_clock() of different cpus may be slightly off */
+	return now > start ? now - start : 0;
+}
+
+/*
+ * Must be called with preemption disabled.
+ */
+static void blk_account_io_hist(struct request *req)
+{
+	struct disk_hist __percpu *hist = req->rq_disk->hist;
+	u64 now = sched_clock();
+	int op = req->hist_op;
+
+	__this_cpu_inc(hist->q2c[op][disk_hist_bucket(
+			blk_hist_delta(now, rq_start_time_ns(req)))]);
+
+	/* a flush without data is never dispatched itself: its d2c is
+	 * that of the flush_rq it waited for, see blk_account_flush_hist()
+	 */
+	if (rq_io_start_time_ns(req))
+		__this_cpu_inc(hist->d2c[op][disk_hist_bucket(
+			blk_hist_delta(now, rq_io_start_time_ns(req)))]);
+}
+
+/*
+ * The flush_rq issued by the flush machinery stands for all the requests
+ * waiting on it, which account their own q2c.  Only its time on the
+ * device goes into the histogram.
+ *
+ * Called with the queue lock held.
+ */
+void blk_account_flush_hist(struct request *flush_rq)
+{
+	if (!flush_rq->rq_disk || !blk_queue_io_stat(flush_rq->q) ||
+	    !rq_io_start_time_ns(flush_rq))
+		return;
+
+	__this_cpu_inc(flush_rq->rq_disk->hist->d2c[DISK_HIST_FLUSH][
+		disk_hist_bucket(blk_hist_delta(sched_clock(),
+					rq_io_start_time_ns(flush_rq)))]);
+}
+#else
+static inline void blk_account_io_hist(struct request *req) { }
+#endif
+
 static void blk_account_io_done(struct request *req)
 {
 	/*
@@ -1997,6 +2066,7 @@ static void blk_account_io_done(struct request *req)
 		part_stat_add(cpu, part, ticks[rw], duration);
 		part_round_stats(cpu, part);
 		part_dec_in_flight(part, rw);
+		blk_account_io_hist(req);
 
 		hd_struct_put(part);
 		part_stat_unlock();
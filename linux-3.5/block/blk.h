@@ -63,6 +63,11 @@ static inline void blk_clear_rq_complete(struct request *rq)
 
 void blk_insert_flush(struct request *rq);
 void blk_abort_flushes(struct request_queue *q);
+#ifdef CONFIG_BLK_DEV_IO_HIST
+void blk_account_flush_hist(struct request *flush_rq);
+#else
+static inline void blk_account_flush_hist(struct request *flush_rq) { }
+#endif
 
 static inline struct request *__elv_next_request(struct request_queue *q)
 {
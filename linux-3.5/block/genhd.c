@@ -1023,8 +1023,92 @@ static struct attribute_group disk_attr_group = {
 	.attrs = disk_attrs,
 };
 
+#ifdef CONFIG_BLK_DEV_IO_HIST
+static const char *disk_hist_op_names[DISK_HIST_NR_OPS] = {
+	[DISK_HIST_READ]	= "read",
+	[DISK_HIST_WRITE]	= "write",
+	[DISK_HIST_FLUSH]	= "flush",
+	[DISK_HIST_DISCARD]	= "discard",
+};
+
+static ssize_t disk_hist_show(struct gendisk *disk, char *buf,
+			      size_t offset)
+{
+	ssize_t len = 0;
+	int op, bucket, cpu;
+
+	for (op = 0; op < DISK_HIST_NR_OPS; op++) {
+		len += sprintf(buf + len, "%-8s", disk_hist_op_names[op]);
+		for (bucket = 0; bucket < DISK_HIST_BUCKETS; bucket++) {
+			unsigned long count = 0;
+
+			for_each_possible_cpu(cpu) {
+				unsigned long *counts = (void *)
+					per_cpu_ptr(disk->hist, cpu) + offset;
+
+				count += counts[op * DISK_HIST_BUCKETS + bucket];
+			}
+			len += sprintf(buf + len, " %lu", count);
+		}
+		len += sprintf(buf + len, "\n");
+	}
+	return len;
+}
+
+/*
+ * Any write resets the histogram. Increments racing with the reset
+ * may survive it, which doesn't matter for statistics.
+ */
+static void disk_hist_reset(struct gendisk *disk, size_t offset)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset((void *) per_cpu_ptr(disk->hist, cpu) + offset, 0,
+		       DISK_HIST_NR_OPS * DISK_HIST_BUCKETS *
+		       sizeof(unsigned long));
+}
+
+#define DISK_HIST_ATTR(name)						\
+static ssize_t disk_hist_##name##_show(struct device *dev,		\
+				       struct device_attribute *attr,	\
+				       char *buf)			\
+{									\
+	return disk_hist_show(dev_to_disk(dev), buf,			\
+			      offsetof(struct disk_hist, name));	\
+}									\
+static ssize_t disk_hist_##name##_store(struct device *dev,		\
+					struct device_attribute *attr,	\
+					const char *buf, size_t count)	\
+{									\
+	disk_hist_reset(dev_to_disk(dev),				\
+			offsetof(struct disk_hist, name));		\
+	return count;							\
+}									\
+static struct device_attribute dev_attr_hist_##name =			\
+	__ATTR(name, S_IRUGO|S_IWUSR, disk_hist_##name##_show,		\
+	       disk_hist_##name##_store)
+DISK_HIST_ATTR(q2c);
+DISK_HIST_ATTR(d2c);
+#undef DISK_HIST_ATTR
+
+static struct attribute *disk_hist_attrs[] = {
+	&dev_attr_hist_q2c.attr,
+	&dev_attr_hist_d2c.attr,
+	NULL
+};
+
+static struct attribute_group disk_hist_attr_group = {
+	.name = "stats_hist",
+	.attrs = disk_hist_attrs,
+};
+#endif
+
 static const struct attribute_group *disk_attr_groups[] = {
 	&disk_attr_group,
+#ifdef CONFIG_BLK_DEV_IO_HIST
+	&disk_hist_attr_group,
+#endif
 	NULL
 };
 
@@ -1105,6 +1189,9 @@ static void disk_release(struct device *dev)
 	disk_replace_part_tbl(disk, NULL);
 	free_part_stats(&disk->part0);
 	free_part_info(&disk->part0);
+#ifdef CONFIG_BLK_DEV_IO_HIST
+	free_percpu(disk->hist);
+#endif
 	if (disk->queue)
 		blk_put_queue(disk->queue);
 	kfree(disk);
@@ -1266,6 +1353,15 @@ struct gendisk *alloc_disk_node(int minors, int node_id)
 			kfree(disk);
 			return NULL;
 		}
+#ifdef CONFIG_BLK_DEV_IO_HIST
+		disk->hist = alloc_percpu(struct disk_hist);
+		if (!disk->hist) {
+			disk_replace_part_tbl(disk, NULL);
+			free_part_stats(&disk->part0);
+			kfree(disk);
+			return NULL;
+		}
+#endif
 		disk->part_tbl->part[0] = &disk->part0;
 
 		hd_ref_init(&disk->part0);
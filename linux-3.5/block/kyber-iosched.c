@@ -0,0 +1,482 @@
+/*
+ *  Kyber i/o scheduler.
+ *
+ *  A lightweight scheduler for fast devices. Requests are split into
+ *  read, synchronous write and other domains, each of which may only
+ *  have a limited number of requests (tokens) inside the driver. The
+ *  token depths are resized periodically from the observed completion
+ *  latencies, so that a domain missing its latency target throttles
+ *  the others instead of all of them queueing up in the device.
+ *
+ *  See Documentation/block/kyber-iosched.txt
+ */
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/timer.h>
+
+enum {
+	KYBER_READ,
+	KYBER_SYNC_WRITE,
+	KYBER_OTHER,	/* async writes, discards */
+	KYBER_NUM_DOMAINS,
+};
+
+/*
+ * Maximum number of requests in the driver per domain. The depth of a
+ * domain is scaled between 1/4 of this and this.
+ */
+static const unsigned int kyber_depth[KYBER_NUM_DOMAINS] = {
+	[KYBER_READ] = 64,
+	[KYBER_SYNC_WRITE] = 32,
+	[KYBER_OTHER] = 16,
+};
+
+/*
+ * Number of requests dispatched from a domain before moving on to the
+ * next one with pending requests.
+ */
+static const unsigned int kyber_batch_size[KYBER_NUM_DOMAINS] = {
+	[KYBER_READ] = 16,
+	[KYBER_SYNC_WRITE] = 8,
+	[KYBER_OTHER] = 8,
+};
+
+/* default completion latency targets, in nsec */
+static const u64 kyber_lat_target[KYBER_NUM_DOMAINS] = {
+	[KYBER_READ] = 2ULL * NSEC_PER_MSEC,
+	[KYBER_SYNC_WRITE] = 10ULL * NSEC_PER_MSEC,
+	[KYBER_OTHER] = 5ULL * NSEC_PER_SEC,
+};
+
+/*
+ * Latencies are recorded in buckets of target / 4. The first
+ * KYBER_GOOD_BUCKETS buckets meet the target, the rest miss it by up
+ * to 2x (the last bucket also catches everything slower).
+ */
+#define KYBER_LATENCY_SHIFT	2
+#define KYBER_GOOD_BUCKETS	(1 << KYBER_LATENCY_SHIFT)
+#define KYBER_LATENCY_BUCKETS	(2 << KYBER_LATENCY_SHIFT)
+
+/* don't resize on fewer samples than this, percentiles are meaningless */
+#define KYBER_MIN_SAMPLES	32
+
+/* how often the latency histograms are evaluated */
+static const int kyber_stat_interval = HZ / 10;
+
+struct kyber_cpu_latency {
+	unsigned int buckets[KYBER_NUM_DOMAINS][KYBER_LATENCY_BUCKETS];
+};
+
+struct kyber_data {
+	struct request_queue *queue;
+
+	/*
+	 * requests not yet dispatched, in fifo order
+	 */
+	struct list_head rqs[KYBER_NUM_DOMAINS];
+
+	/*
+	 * tokens: requests in the driver and the current limit
+	 */
+	unsigned int inflight[KYBER_NUM_DOMAINS];
+	unsigned int depth[KYBER_NUM_DOMAINS];
+
+	unsigned int cur_domain;
+	unsigned int batching;
+
+	/*
+	 * latency statistics, recorded per cpu on completion and folded
+	 * into latency_buckets from the stat timer
+	 */
+	struct kyber_cpu_latency __percpu *cpu_latency;
+	unsigned int latency_buckets[KYBER_NUM_DOMAINS][KYBER_LATENCY_BUCKETS];
+	struct timer_list stat_timer;
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	u64 lat_target[KYBER_NUM_DOMAINS];
+};
+
+/*
+ * The domain and the time the request was handed to the driver live in
+ * the elevator private pointers. Only the low bits of the timestamp
+ * survive on 32-bit, which is fine for latency deltas below 4 seconds;
+ * anything slower lands in the last bucket anyway.
+ */
+#define RQ_KYBER_DOMAIN(rq)	((unsigned long) (rq)->elv.priv[0])
+#define RQ_KYBER_START(rq)	((unsigned long) (rq)->elv.priv[1])
+
+static unsigned int kyber_rq_domain(struct request *rq)
+{
+	if (rq->cmd_flags & REQ_DISCARD)
+		return KYBER_OTHER;
+	if (rq_data_dir(rq) == READ)
+		return KYBER_READ;
+	if (rq_is_sync(rq))
+		return KYBER_SYNC_WRITE;
+	return KYBER_OTHER;
+}
+
+static void kyber_add_request(struct request_queue *q, struct request *rq)
+{
+	struct kyber_data *kd = q->elevator->elevator_data;
+	unsigned int domain = kyber_rq_domain(rq);
+
+	rq->elv.priv[0] = (void *) (unsigned long) domain;
+	list_add_tail(&rq->queuelist, &kd->rqs[domain]);
+}
+
+static void kyber_merged_requests(struct request_queue *q, struct request *rq,
+				  struct request *next)
+{
+	list_del_init(&next->queuelist);
+}
+
+static int kyber_allow_merge(struct request_queue *q, struct request *rq,
+			     struct bio *bio)
+{
+	/*
+	 * don't let a bio change the domain of the request it lands in
+	 */
+	return rw_is_sync(bio->bi_rw) == rq_is_sync(rq);
+}
+
+static inline bool kyber_has_token(struct kyber_data *kd, unsigned int domain)
+{
+	return kd->inflight[domain] < kd->depth[domain];
+}
+
+/*
+ * Dispatch one request. Domains are served round robin, kyber_batch_size
+ * requests at a time, skipping those that have run out of tokens. When
+ * forced (draining the queue), the token limits are ignored.
+ */
+static int kyber_dispatch(struct request_queue *q, int force)
+{
+	struct kyber_data *kd = q->elevator->elevator_data;
+	unsigned int domain = kd->cur_domain;
+	struct request *rq;
+	int i;
+
+	for (i = 0; i < KYBER_NUM_DOMAINS; i++) {
+		if (!list_empty(&kd->rqs[domain]) &&
+		    (force || kyber_has_token(kd, domain)))
+			goto dispatch_request;
+
+		domain = (domain + 1) % KYBER_NUM_DOMAINS;
+	}
+
+	return 0;
+
+dispatch_request:
+	if (domain != kd->cur_domain) {
+		kd->cur_domain = domain;
+		kd->batching = 0;
+	}
+
+	rq = list_entry(kd->rqs[domain].next, struct request, queuelist);
+	list_del_init(&rq->queuelist);
+	elv_dispatch_add_tail(q, rq);
+
+	if (++kd->batching >= kyber_batch_size[domain]) {
+		kd->cur_domain = (domain + 1) % KYBER_NUM_DOMAINS;
+		kd->batching = 0;
+	}
+
+	return 1;
+}
+
+static void kyber_activate_request(struct request_queue *q, struct request *rq)
+{
+	struct kyber_data *kd = q->elevator->elevator_data;
+
+	kd->inflight[RQ_KYBER_DOMAIN(rq)]++;
+	rq->elv.priv[1] = (void *) (unsigned long) ktime_to_ns(ktime_get());
+}
+
+static void kyber_deactivate_request(struct request_queue *q,
+				     struct request *rq)
+{
+	struct kyber_data *kd = q->elevator->elevator_data;
+
+	WARN_ON(!kd->inflight[RQ_KYBER_DOMAIN(rq)]);
+	kd->inflight[RQ_KYBER_DOMAIN(rq)]--;
+}
+
+static unsigned int kyber_latency_bucket(struct kyber_data *kd,
+					 unsigned int domain, u64 latency)
+{
+	u64 divisor = max_t(u64, kd->lat_target[domain] >> KYBER_LATENCY_SHIFT,
+			    1);
+	u64 bucket;
+
+	if (!latency)
+		return 0;
+
+	bucket = div64_u64(latency - 1, divisor);
+	return min_t(u64, bucket, KYBER_LATENCY_BUCKETS - 1);
+}
+
+static void kyber_completed_request(struct request_queue *q,
+				    struct request *rq)
+{
+	struct kyber_data *kd = q->elevator->elevator_data;
+	unsigned int domain = RQ_KYBER_DOMAIN(rq);
+	unsigned long now = (unsigned long) ktime_to_ns(ktime_get());
+	unsigned int bucket;
+
+	WARN_ON(!kd->inflight[domain]);
+	kd->inflight[domain]--;
+
+	bucket = kyber_latency_bucket(kd, domain, now - RQ_KYBER_START(rq));
+	this_cpu_inc(kd->cpu_latency->buckets[domain][bucket]);
+
+	if (!timer_pending(&kd->stat_timer))
+		mod_timer(&kd->stat_timer, jiffies + kyber_stat_interval);
+
+	/*
+	 * The driver may not rerun the queue when it goes idle, so kick it
+	 * if requests were held back for lack of tokens.
+	 */
+	if (kd->inflight[domain] == kd->depth[domain] - 1 &&
+	    !list_empty(&kd->rqs[domain]))
+		blk_run_queue_async(q);
+}
+
+/*
+ * Return the bucket holding the given percentile of the collected
+ * samples of a domain, or -1 if there are not enough samples yet.
+ */
+static int kyber_percentile(struct kyber_data *kd, unsigned int domain,
+			    unsigned int percentile)
+{
+	unsigned int *buckets = kd->latency_buckets[domain];
+	unsigned int samples = 0, percentile_samples;
+	int bucket;
+
+	for (bucket = 0; bucket < KYBER_LATENCY_BUCKETS; bucket++)
+		samples += buckets[bucket];
+
+	if (samples < KYBER_MIN_SAMPLES)
+		return -1;
+
+	percentile_samples = DIV_ROUND_UP(samples * percentile, 100);
+	for (bucket = 0; bucket < KYBER_LATENCY_BUCKETS - 1; bucket++) {
+		if (buckets[bucket] >= percentile_samples)
+			break;
+		percentile_samples -= buckets[bucket];
+	}
+
+	return bucket;
+}
+
+/*
+ * Fold the per-cpu histograms into the queue wide ones. Increments
+ * racing with the reset are lost, which doesn't matter for statistics.
+ */
+static void kyber_collect_latencies(struct kyber_data *kd)
+{
+	int cpu, domain, bucket;
+
+	for_each_possible_cpu(cpu) {
+		struct kyber_cpu_latency *cpu_latency;
+
+		cpu_latency = per_cpu_ptr(kd->cpu_latency, cpu);
+		for (domain = 0; domain < KYBER_NUM_DOMAINS; domain++) {
+			for (bucket = 0; bucket < KYBER_LATENCY_BUCKETS; bucket++) {
+				kd->latency_buckets[domain][bucket] +=
+					cpu_latency->buckets[domain][bucket];
+				cpu_latency->buckets[domain][bucket] = 0;
+			}
+		}
+	}
+}
+
+static void kyber_stat_timer(unsigned long data)
+{
+	struct kyber_data *kd = (struct kyber_data *) data;
+	struct request_queue *q = kd->queue;
+	int p90[KYBER_NUM_DOMAINS], p99[KYBER_NUM_DOMAINS];
+	bool congested = false, kick = false;
+	unsigned long flags;
+	int domain;
+
+	kyber_collect_latencies(kd);
+
+	/*
+	 * Use the p90 to decide whether the device is congested, we don't
+	 * want to throttle on outliers.
+	 */
+	for (domain = 0; domain < KYBER_NUM_DOMAINS; domain++) {
+		p90[domain] = kyber_percentile(kd, domain, 90);
+		if (p90[domain] >= KYBER_GOOD_BUCKETS)
+			congested = true;
+	}
+
+	spin_lock_irqsave(q->queue_lock, flags);
+	for (domain = 0; domain < KYBER_NUM_DOMAINS; domain++) {
+		unsigned int depth;
+
+		p99[domain] = kyber_percentile(kd, domain, 99);
+		if (p99[domain] >= 0)
+			memset(kd->latency_buckets[domain], 0,
+			       sizeof(kd->latency_buckets[domain]));
+
+		/*
+		 * If the device is congested, throttle the domains meeting
+		 * their target. Domains missing it get their depth raised
+		 * back up, as starving them would only make matters worse.
+		 */
+		if (p99[domain] < 0 ||
+		    (!congested && p99[domain] < KYBER_GOOD_BUCKETS))
+			continue;
+
+		depth = (kyber_depth[domain] * (p99[domain] + 1)) >>
+			KYBER_LATENCY_SHIFT;
+		depth = clamp(depth, 1U, kyber_depth[domain]);
+		if (depth > kd->depth[domain])
+			kick = true;
+		kd->depth[domain] = depth;
+	}
+
+	if (kick)
+		blk_run_queue_async(q);
+	spin_unlock_irqrestore(q->queue_lock, flags);
+}
+
+static int kyber_init_queue(struct request_queue *q)
+{
+	struct kyber_data *kd;
+	int i;
+
+	kd = kmalloc_node(sizeof(*kd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!kd)
+		return -ENOMEM;
+
+	kd->cpu_latency = alloc_percpu(struct kyber_cpu_latency);
+	if (!kd->cpu_latency) {
+		kfree(kd);
+		return -ENOMEM;
+	}
+
+	kd->queue = q;
+	for (i = 0; i < KYBER_NUM_DOMAINS; i++) {
+		INIT_LIST_HEAD(&kd->rqs[i]);
+		kd->depth[i] = kyber_depth[i];
+		kd->lat_target[i] = kyber_lat_target[i];
+	}
+
+	setup_timer(&kd->stat_timer, kyber_stat_timer, (unsigned long) kd);
+
+	q->elevator->elevator_data = kd;
+	return 0;
+}
+
+static void kyber_exit_queue(struct elevator_queue *e)
+{
+	struct kyber_data *kd = e->elevator_data;
+	int i;
+
+	del_timer_sync(&kd->stat_timer);
+
+	for (i = 0; i < KYBER_NUM_DOMAINS; i++)
+		BUG_ON(!list_empty(&kd->rqs[i]));
+
+	free_percpu(kd->cpu_latency);
+	kfree(kd);
+}
+
+/*
+ * sysfs parts below
+ */
+
+#define KYBER_LAT_SHOW_STORE(__NAME, __DOMAIN)				\
+static ssize_t kyber_##__NAME##_show(struct elevator_queue *e,		\
+				     char *page)			\
+{									\
+	struct kyber_data *kd = e->elevator_data;			\
+									\
+	return sprintf(page, "%llu\n",					\
+		       (unsigned long long) kd->lat_target[__DOMAIN]);	\
+}									\
+static ssize_t kyber_##__NAME##_store(struct elevator_queue *e,	\
+				      const char *page, size_t count)	\
+{									\
+	struct kyber_data *kd = e->elevator_data;			\
+	unsigned long long nsec;					\
+	int ret;							\
+									\
+	ret = kstrtoull(page, 10, &nsec);				\
+	if (ret)							\
+		return ret;						\
+	if (!nsec)							\
+		return -EINVAL;						\
+	kd->lat_target[__DOMAIN] = nsec;				\
+	return count;							\
+}
+KYBER_LAT_SHOW_STORE(read_lat_nsec, KYBER_READ);
+KYBER_LAT_SHOW_STORE(write_lat_nsec, KYBER_SYNC_WRITE);
+KYBER_LAT_SHOW_STORE(other_lat_nsec, KYBER_OTHER);
+#undef KYBER_LAT_SHOW_STORE
+
+static ssize_t kyber_depth_show(struct elevator_queue *e, char *page)
+{
+	struct kyber_data *kd = e->elevator_data;
+
+	return sprintf(page, "%u %u %u\n", kd->depth[KYBER_READ],
+		       kd->depth[KYBER_SYNC_WRITE], kd->depth[KYBER_OTHER]);
+}
+
+#define KYBER_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, kyber_##name##_show, \
+				      kyber_##name##_store)
+
+static struct elv_fs_entry kyber_attrs[] = {
+	KYBER_ATTR(read_lat_nsec),
+	KYBER_ATTR(write_lat_nsec),
+	KYBER_ATTR(other_lat_nsec),
+	__ATTR(depth, S_IRUGO, kyber_depth_show, NULL),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_kyber = {
+	.ops = {
+		.elevator_allow_merge_fn =	kyber_allow_merge,
+		.elevator_merge_req_fn =	kyber_merged_requests,
+		.elevator_dispatch_fn =		kyber_dispatch,
+		.elevator_add_req_fn =		kyber_add_request,
+		.elevator_activate_req_fn =	kyber_activate_request,
+		.elevator_deactivate_req_fn =	kyber_deactivate_request,
+		.elevator_completed_req_fn =	kyber_completed_request,
+		.elevator_init_fn =		kyber_init_queue,
+		.elevator_exit_fn =		kyber_exit_queue,
+	},
+
+	.elevator_attrs = kyber_attrs,
+	.elevator_name = "kyber",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init kyber_init(void)
+{
+	return elv_register(&iosched_kyber);
+}
+
+static void __exit kyber_exit(void)
+{
+	elv_unregister(&iosched_kyber);
+}
+
+module_init(kyber_init);
+module_exit(kyber_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Kyber IO scheduler");
@@ -43,6 +43,9 @@
  * operations write_begin is not available on the backing filesystem.
  * Anton Altaparmakov, 16 Feb 2005
  *
+ * Optional direct I/O to the backing file through kernel iocbs, with many
+ * requests in flight and no double caching (LO_FLAGS_DIRECT_IO).
+ *
  * Still To Fix:
  * - Advisory locking is ignored here.
  * - Should use an own CAP_* category instead of CAP_SYS_ADMIN
@@ -76,6 +79,8 @@
 #include <linux/sysfs.h>
 #include <linux/miscdevice.h>
 #include <linux/falloc.h>
+#include <linux/aio.h>
+#include <linux/mount.h>
 
 #include <asm/uaccess.h>
 
@@ -403,6 +408,152 @@ lo_receive(struct loop_device *lo, struct bio *bio, int bsize, loff_t pos)
 	return 0;
 }
 
+/*
+ * Direct I/O: the bio pages are handed to the O_DIRECT twin of the
+ * backing file as a kernel iocb, so the data bypasses the page cache
+ * of the backing file and many bios can be in flight at once. Bios the
+ * backing device can't do direct I/O on go the buffered way instead.
+ */
+struct loop_dio {
+	struct kiocb		iocb;
+	struct loop_device	*lo;
+	struct bio		*bio;
+	struct iovec		iov[0];
+};
+
+static bool lo_can_direct_io(struct loop_device *lo, struct bio *bio,
+			     loff_t pos)
+{
+	struct bio_vec *bvec;
+	int i;
+
+	if (!(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		return false;
+	/* pairs with smp_wmb() in loop_set_direct_io() */
+	smp_rmb();
+
+	if (!bio->bi_size || (bio->bi_rw & REQ_FUA) ||
+	    lo->transfer != transfer_none || (pos & lo->lo_dio_align))
+		return false;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (PageHighMem(bvec->bv_page) ||
+		    ((bvec->bv_offset | bvec->bv_len) & lo->lo_dio_align))
+			return false;
+	}
+	return true;
+}
+
+static void lo_zero_fill_bio_tail(struct bio *bio, unsigned int done)
+{
+	struct bio_vec *bvec;
+	int i;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (done >= bvec->bv_len) {
+			done -= bvec->bv_len;
+			continue;
+		}
+		zero_user(bvec->bv_page, bvec->bv_offset + done,
+			  bvec->bv_len - done);
+		done = 0;
+	}
+}
+
+/*
+ * May be called from interrupt context.
+ */
+static void lo_dio_end_io(struct loop_dio *dio, long res)
+{
+	struct loop_device *lo = dio->lo;
+	struct bio *bio = dio->bio;
+	int ret = 0;
+
+	if (res < 0) {
+		ret = -EIO;
+	} else if (res < bio->bi_size) {
+		/* short reads happen at the end of the backing file */
+		if (bio_rw(bio) == WRITE)
+			ret = -EIO;
+		else
+			lo_zero_fill_bio_tail(bio, res);
+	}
+
+	bio_endio(bio, ret);
+	kfree(dio);
+
+	if (atomic_dec_and_test(&lo->lo_dio_pending))
+		wake_up(&lo->lo_dio_wait);
+}
+
+static void lo_dio_complete(struct kiocb *iocb, long res)
+{
+	lo_dio_end_io(container_of(iocb, struct loop_dio, iocb), res);
+}
+
+/*
+ * Returns -EIOCBQUEUED once the bio has been taken care of, it is ended
+ * from the completion of the iocb.  Any other return means the direct
+ * I/O failed without touching the bio, which is then left to the caller
+ * to redo through the page cache.
+ */
+static int lo_submit_dio(struct loop_device *lo, struct bio *bio, loff_t pos)
+{
+	struct file *file = lo->lo_dio_file;
+	struct loop_dio *dio;
+	struct bio_vec *bvec;
+	unsigned long nr_segs = 0;
+	mm_segment_t old_fs;
+	ssize_t ret;
+	int i;
+
+	dio = kmalloc(sizeof(*dio) + bio_segments(bio) * sizeof(struct iovec),
+		      GFP_NOIO);
+	if (!dio)
+		return -ENOMEM;
+
+	bio_for_each_segment(bvec, bio, i) {
+		dio->iov[nr_segs].iov_base = page_address(bvec->bv_page) +
+					     bvec->bv_offset;
+		dio->iov[nr_segs].iov_len = bvec->bv_len;
+		nr_segs++;
+	}
+
+	init_kernel_kiocb(&dio->iocb, file, lo_dio_complete);
+	dio->iocb.ki_pos = pos;
+	dio->iocb.ki_nbytes = dio->iocb.ki_left = bio->bi_size;
+	dio->lo = lo;
+	dio->bio = bio;
+
+	atomic_inc(&lo->lo_dio_pending);
+
+	old_fs = get_fs();
+	set_fs(get_ds());
+	if (bio_rw(bio) == WRITE)
+		ret = file->f_op->aio_write(&dio->iocb, dio->iov, nr_segs, pos);
+	else
+		ret = file->f_op->aio_read(&dio->iocb, dio->iov, nr_segs, pos);
+	set_fs(old_fs);
+
+	if (ret == -EIOCBQUEUED)
+		return ret;
+
+	/*
+	 * Anything not queued was completed synchronously, e.g. writes
+	 * extending the file.  A failed or short write is retried through
+	 * the page cache, as is a failed read.
+	 */
+	if (ret < 0 || (bio_rw(bio) == WRITE && ret < bio->bi_size)) {
+		kfree(dio);
+		if (atomic_dec_and_test(&lo->lo_dio_pending))
+			wake_up(&lo->lo_dio_wait);
+		return ret < 0 ? ret : -EIO;
+	}
+
+	lo_dio_end_io(dio, ret);
+	return -EIOCBQUEUED;
+}
+
 static int do_bio_filebacked(struct loop_device *lo, struct bio *bio)
 {
 	loff_t pos;
@@ -444,6 +595,12 @@ static int do_bio_filebacked(struct loop_device *lo, struct bio *bio)
 			goto out;
 		}
 
+		if (lo_can_direct_io(lo, bio, pos)) {
+			ret = lo_submit_dio(lo, bio, pos);
+			if (ret == -EIOCBQUEUED)
+				goto out;
+		}
+
 		ret = lo_send(lo, bio, pos);
 
 		if ((bio->bi_rw & REQ_FUA) && !ret) {
@@ -451,8 +608,15 @@ static int do_bio_filebacked(struct loop_device *lo, struct bio *bio)
 			if (unlikely(ret && ret != -EINVAL))
 				ret = -EIO;
 		}
-	} else
+	} else {
+		if (lo_can_direct_io(lo, bio, pos)) {
+			ret = lo_submit_dio(lo, bio, pos);
+			if (ret == -EIOCBQUEUED)
+				goto out;
+		}
+
 		ret = lo_receive(lo, bio, lo->lo_blocksize, pos);
+	}
 
 out:
 	return ret;
@@ -513,7 +677,8 @@ static inline void loop_handle_bio(struct loop_device *lo, struct bio *bio)
 		bio_put(bio);
 	} else {
 		int ret = do_bio_filebacked(lo, bio);
-		bio_endio(bio, ret);
+		if (ret != -EIOCBQUEUED)
+			bio_endio(bio, ret);
 	}
 }
 
@@ -580,11 +745,15 @@ static int loop_switch(struct loop_device *lo, struct file *file)
  */
 static int loop_flush(struct loop_device *lo)
 {
+	int ret;
+
 	/* loop not yet configured, no running thread, nothing to flush */
 	if (!lo->lo_thread)
 		return 0;
 
-	return loop_switch(lo, NULL);
+	ret = loop_switch(lo, NULL);
+	wait_event(lo->lo_dio_wait, !atomic_read(&lo->lo_dio_pending));
+	return ret;
 }
 
 /*
@@ -636,6 +805,10 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY))
 		goto out;
 
+	/* the O_DIRECT twin stays open until the fd is cleared */
+	if (lo->lo_dio_file)
+		goto out;
+
 	error = -EBADF;
 	file = fget(arg);
 	if (!file)
@@ -743,11 +916,19 @@ static ssize_t loop_attr_partscan_show(struct loop_device *lo, char *buf)
 	return sprintf(buf, "%s\n", partscan ? "1" : "0");
 }
 
+static ssize_t loop_attr_dio_show(struct loop_device *lo, char *buf)
+{
+	int dio = (lo->lo_flags & LO_FLAGS_DIRECT_IO);
+
+	return sprintf(buf, "%s\n", dio ? "1" : "0");
+}
+
 LOOP_ATTR_RO(backing_file);
 LOOP_ATTR_RO(offset);
 LOOP_ATTR_RO(sizelimit);
 LOOP_ATTR_RO(autoclear);
 LOOP_ATTR_RO(partscan);
+LOOP_ATTR_RO(dio);
 
 static struct attribute *loop_attrs[] = {
 	&loop_attr_backing_file.attr,
@@ -755,6 +936,7 @@ static struct attribute *loop_attrs[] = {
 	&loop_attr_sizelimit.attr,
 	&loop_attr_autoclear.attr,
 	&loop_attr_partscan.attr,
+	&loop_attr_dio.attr,
 	NULL,
 };
 
@@ -804,6 +986,51 @@ static void loop_config_discard(struct loop_device *lo)
 	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, q);
 }
 
+/*
+ * Direct I/O is done through a private O_DIRECT file opened on the
+ * backing file, which is kept until the loop device is cleared. It is
+ * only supported for block devices and block based filesystems, whose
+ * direct I/O goes through the generic code that understands kernel
+ * iocbs, and not together with a transfer function.
+ */
+static int loop_set_direct_io(struct loop_device *lo, bool enable)
+{
+	struct file *file = lo->lo_backing_file;
+	struct inode *inode = file->f_mapping->host;
+	struct block_device *bdev;
+	struct file *dio_file;
+
+	if (!enable) {
+		lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+		return 0;
+	}
+
+	if (lo->transfer != transfer_none)
+		return -EINVAL;
+
+	if (S_ISBLK(inode->i_mode))
+		bdev = inode->i_bdev;
+	else
+		bdev = inode->i_sb->s_bdev;
+	if (!bdev || !file->f_op->aio_read || !file->f_op->aio_write)
+		return -EINVAL;
+
+	if (!lo->lo_dio_file) {
+		dio_file = dentry_open(dget(file->f_path.dentry),
+				       mntget(file->f_path.mnt),
+				       file->f_flags | O_DIRECT, file->f_cred);
+		if (IS_ERR(dio_file))
+			return PTR_ERR(dio_file);
+		lo->lo_dio_file = dio_file;
+	}
+	lo->lo_dio_align = bdev_logical_block_size(bdev) - 1;
+
+	/* pairs with smp_rmb() in lo_can_direct_io() */
+	smp_wmb();
+	lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+	return 0;
+}
+
 static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 		       struct block_device *bdev, unsigned int arg)
 {
@@ -970,6 +1197,7 @@ loop_init_xfer(struct loop_device *lo, struct loop_func_table *xfer,
 static int loop_clr_fd(struct loop_device *lo)
 {
 	struct file *filp = lo->lo_backing_file;
+	struct file *dio_filp = lo->lo_dio_file;
 	gfp_t gfp = lo->old_gfp_mask;
 	struct block_device *bdev = lo->lo_device;
 
@@ -988,8 +1216,12 @@ static int loop_clr_fd(struct loop_device *lo)
 
 	kthread_stop(lo->lo_thread);
 
+	/* no more bios are coming, wait for direct I/O still in flight */
+	wait_event(lo->lo_dio_wait, !atomic_read(&lo->lo_dio_pending));
+
 	spin_lock_irq(&lo->lo_lock);
 	lo->lo_backing_file = NULL;
+	lo->lo_dio_file = NULL;
 	spin_unlock_irq(&lo->lo_lock);
 
 	loop_release_xfer(lo);
@@ -1030,6 +1262,8 @@ static int loop_clr_fd(struct loop_device *lo)
 	 * bd_mutex which is usually taken before lo_ctl_mutex.
 	 */
 	fput(filp);
+	if (dio_filp)
+		fput(dio_filp);
 	return 0;
 }
 
@@ -1089,6 +1323,14 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 	     (info->lo_flags & LO_FLAGS_AUTOCLEAR))
 		lo->lo_flags ^= LO_FLAGS_AUTOCLEAR;
 
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) !=
+	     (info->lo_flags & LO_FLAGS_DIRECT_IO)) {
+		err = loop_set_direct_io(lo,
+				info->lo_flags & LO_FLAGS_DIRECT_IO);
+		if (err)
+			return err;
+	}
+
 	if ((info->lo_flags & LO_FLAGS_PARTSCAN) &&
 	     !(lo->lo_flags & LO_FLAGS_PARTSCAN)) {
 		lo->lo_flags |= LO_FLAGS_PARTSCAN;
@@ -1660,6 +1902,8 @@ static int loop_add(struct loop_device **l, int i)
 	lo->lo_number		= i;
 	lo->lo_thread		= NULL;
 	init_waitqueue_head(&lo->lo_event);
+	init_waitqueue_head(&lo->lo_dio_wait);
+	atomic_set(&lo->lo_dio_pending, 0);
 	spin_lock_init(&lo->lo_lock);
 	disk->major		= LOOP_MAJOR;
 	disk->first_minor	= i << part_shift;
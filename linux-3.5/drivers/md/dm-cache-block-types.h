@@ -0,0 +1,22 @@
+/*
+ * This file is released under the GPL.
+ */
+
+#ifndef DM_CACHE_BLOCK_TYPES_H
+#define DM_CACHE_BLOCK_TYPES_H
+
+#include "persistent-data/dm-block-manager.h"
+
+/*----------------------------------------------------------------*/
+
+/*
+ * It's helpful to get sparse to differentiate between indexes into the
+ * origin device, and indexes into the cache device.
+ */
+
+typedef dm_block_t dm_oblock_t;
+typedef uint32_t dm_cblock_t;
+
+/*----------------------------------------------------------------*/
+
+#endif
@@ -0,0 +1,608 @@
+/*
+ * This file is released under the GPL.
+ */
+
+#include "dm-cache-metadata.h"
+#include "persistent-data/dm-btree.h"
+#include "persistent-data/dm-space-map.h"
+#include "persistent-data/dm-transaction-manager.h"
+
+#include <linux/device-mapper.h>
+#include <linux/slab.h>
+
+/*--------------------------------------------------------------------------
+ * As far as the metadata goes, there is:
+ *
+ * - A superblock in block zero, taking up fewer than 512 bytes for
+ *   atomic writes.
+ *
+ * - A space map managing the metadata blocks.
+ *
+ * - A btree mapping cache blocks onto a 64-bit value holding the origin
+ *   block in the top 48 bits and some flags in the bottom 16 bits.
+ *
+ * The dirty flag stored with each mapping is only trustworthy if the
+ * superblock's CLEAN_SHUTDOWN flag is set.  That flag is cleared, and
+ * committed, before any io reaches the cache, so if we crash every
+ * mapped block is treated as dirty when the metadata is next opened.
+ * No dirty data can therefore be lost, at worst some clean blocks get
+ * written back unnecessarily.
+ *--------------------------------------------------------------------------*/
+
+#define DM_MSG_PREFIX   "cache metadata"
+
+#define CACHE_SUPERBLOCK_MAGIC 8021973
+#define CACHE_SUPERBLOCK_LOCATION 0
+#define CACHE_VERSION 1
+#define CACHE_METADATA_CACHE_SIZE 64
+#define SECTOR_TO_BLOCK_SHIFT 3
+
+/* This should be plenty */
+#define SPACE_MAP_ROOT_SIZE 128
+
+/*
+ * Superblock flags.
+ */
+#define CLEAN_SHUTDOWN (1 << 0)
+
+/*
+ * Mapping flags.
+ */
+#define M_VALID (1 << 0)
+#define M_DIRTY (1 << 1)
+
+struct cache_disk_superblock {
+	__le32 csum;	/* Checksum of superblock except for this field. */
+	__le32 flags;
+	__le64 blocknr;	/* This block number, dm_block_t. */
+
+	__u8 uuid[16];
+	__le64 magic;
+	__le32 version;
+
+	__u8 metadata_space_map_root[SPACE_MAP_ROOT_SIZE];
+
+	/*
+	 * btree mapping cblock -> (oblock, flags)
+	 */
+	__le64 mapping_root;
+
+	__le32 data_block_size;		/* In 512-byte sectors. */
+	__le32 cache_blocks;
+
+	__le32 metadata_block_size;	/* In 512-byte sectors. */
+	__le64 metadata_nr_blocks;
+
+	__le32 compat_flags;
+	__le32 compat_ro_flags;
+	__le32 incompat_flags;
+} __packed;
+
+struct dm_cache_metadata {
+	struct block_device *bdev;
+	struct dm_block_manager *bm;
+	struct dm_space_map *metadata_sm;
+	struct dm_transaction_manager *tm;
+
+	struct dm_btree_info info;
+
+	struct rw_semaphore root_lock;
+	int need_commit;
+	dm_block_t root;
+	unsigned long flags;
+	sector_t data_block_size;
+	dm_cblock_t cache_blocks;
+};
+
+/*----------------------------------------------------------------
+ * superblock validator
+ *--------------------------------------------------------------*/
+
+#define SUPERBLOCK_CSUM_XOR 9031977
+
+static void sb_prepare_for_write(struct dm_block_validator *v,
+				 struct dm_block *b,
+				 size_t block_size)
+{
+	struct cache_disk_superblock *disk_super = dm_block_data(b);
+
+	disk_super->blocknr = cpu_to_le64(dm_block_location(b));
+	disk_super->csum = cpu_to_le32(dm_bm_checksum(&disk_super->flags,
+						      block_size - sizeof(__le32),
+						      SUPERBLOCK_CSUM_XOR));
+}
+
+static int sb_check(struct dm_block_validator *v,
+		    struct dm_block *b,
+		    size_t block_size)
+{
+	struct cache_disk_superblock *disk_super = dm_block_data(b);
+	__le32 csum_le;
+
+	if (dm_block_location(b) != le64_to_cpu(disk_super->blocknr)) {
+		DMERR("sb_check failed: blocknr %llu: "
+		      "wanted %llu", le64_to_cpu(disk_super->blocknr),
+		      (unsigned long long)dm_block_location(b));
+		return -ENOTBLK;
+	}
+
+	if (le64_to_cpu(disk_super->magic) != CACHE_SUPERBLOCK_MAGIC) {
+		DMERR("sb_check failed: magic %llu: "
+		      "wanted %llu", le64_to_cpu(disk_super->magic),
+		      (unsigned long long)CACHE_SUPERBLOCK_MAGIC);
+		return -EILSEQ;
+	}
+
+	csum_le = cpu_to_le32(dm_bm_checksum(&disk_super->flags,
+					     block_size - sizeof(__le32),
+					     SUPERBLOCK_CSUM_XOR));
+	if (csum_le != disk_super->csum) {
+		DMERR("sb_check failed: csum %u: wanted %u",
+		      le32_to_cpu(csum_le), le32_to_cpu(disk_super->csum));
+		return -EILSEQ;
+	}
+
+	return 0;
+}
+
+static struct dm_block_validator sb_validator = {
+	.name = "superblock",
+	.prepare_for_write = sb_prepare_for_write,
+	.check = sb_check
+};
+
+/*----------------------------------------------------------------*/
+
+static __le64 pack_value(dm_oblock_t block, unsigned flags)
+{
+	uint64_t value = block;
+
+	value <<= 16;
+	value = value | (flags & ((1 << 16) - 1));
+
+	return cpu_to_le64(value);
+}
+
+static void unpack_value(__le64 value_le, dm_oblock_t *block, unsigned *flags)
+{
+	uint64_t value = le64_to_cpu(value_le);
+
+	*block = value >> 16;
+	*flags = value & ((1 << 16) - 1);
+}
+
+static int superblock_all_zeroes(struct dm_block_manager *bm, int *result)
+{
+	int r;
+	unsigned i;
+	struct dm_block *b;
+	__le64 *data_le, zero = cpu_to_le64(0);
+	unsigned block_size = dm_bm_block_size(bm) / sizeof(__le64);
+
+	/*
+	 * We can't use a validator here - it may be all zeroes.
+	 */
+	r = dm_bm_read_lock(bm, CACHE_SUPERBLOCK_LOCATION, NULL, &b);
+	if (r)
+		return r;
+
+	data_le = dm_block_data(b);
+	*result = 1;
+	for (i = 0; i < block_size; i++) {
+		if (data_le[i] != zero) {
+			*result = 0;
+			break;
+		}
+	}
+
+	return dm_bm_unlock(b);
+}
+
+static int check_features(struct cache_disk_superblock *disk_super,
+			  struct block_device *bdev)
+{
+	unsigned long features;
+
+	features = le32_to_cpu(disk_super->incompat_flags) & ~DM_CACHE_FEATURE_INCOMPAT_SUPP;
+	if (features) {
+		DMERR("could not access metadata due to "
+		      "unsupported optional features (%lx).", features);
+		return -EINVAL;
+	}
+
+	/*
+	 * Check for read-only metadata to skip the following RDWR checks.
+	 */
+	if (get_disk_ro(bdev->bd_disk))
+		return 0;
+
+	features = le32_to_cpu(disk_super->compat_ro_flags) & ~DM_CACHE_FEATURE_COMPAT_RO_SUPP;
+	if (features) {
+		DMERR("could not access metadata RDWR due to "
+		      "unsupported optional features (%lx).", features);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int __format_metadata(struct dm_cache_metadata *cmd)
+{
+	int r;
+	struct dm_block *sblock;
+	struct cache_disk_superblock *disk_super;
+	sector_t bdev_size = i_size_read(cmd->bdev->bd_inode) >> SECTOR_SHIFT;
+
+	r = dm_tm_create_with_sm(cmd->bm, CACHE_SUPERBLOCK_LOCATION,
+				 &sb_validator, &cmd->tm,
+				 &cmd->metadata_sm, &sblock);
+	if (r < 0) {
+		DMERR("tm_create_with_sm failed");
+		return r;
+	}
+
+	if (bdev_size > DM_CACHE_METADATA_MAX_SECTORS)
+		bdev_size = DM_CACHE_METADATA_MAX_SECTORS;
+
+	disk_super = dm_block_data(sblock);
+	disk_super->magic = cpu_to_le64(CACHE_SUPERBLOCK_MAGIC);
+	disk_super->version = cpu_to_le32(CACHE_VERSION);
+	disk_super->metadata_block_size = cpu_to_le32(DM_CACHE_METADATA_BLOCK_SIZE >> SECTOR_SHIFT);
+	disk_super->metadata_nr_blocks = cpu_to_le64(bdev_size >> SECTOR_TO_BLOCK_SHIFT);
+	disk_super->data_block_size = cpu_to_le32(cmd->data_block_size);
+	disk_super->cache_blocks = cpu_to_le32(cmd->cache_blocks);
+
+	r = dm_tm_unlock(cmd->tm, sblock);
+	if (r < 0) {
+		DMERR("couldn't unlock superblock");
+		goto bad;
+	}
+
+	cmd->info.tm = cmd->tm;
+	r = dm_btree_empty(&cmd->info, &cmd->root);
+	if (r < 0)
+		goto bad;
+
+	cmd->flags = 0;
+	cmd->need_commit = 1;
+
+	return 0;
+
+bad:
+	dm_tm_destroy(cmd->tm);
+	dm_sm_destroy(cmd->metadata_sm);
+
+	return r;
+}
+
+static int __open_metadata(struct dm_cache_metadata *cmd)
+{
+	int r;
+	struct dm_block *sblock;
+	struct cache_disk_superblock *disk_super;
+	size_t space_map_root_offset =
+		offsetof(struct cache_disk_superblock, metadata_space_map_root);
+
+	r = dm_tm_open_with_sm(cmd->bm, CACHE_SUPERBLOCK_LOCATION,
+			       &sb_validator, space_map_root_offset,
+			       SPACE_MAP_ROOT_SIZE, &cmd->tm,
+			       &cmd->metadata_sm, &sblock);
+	if (r < 0) {
+		DMERR("tm_open_with_sm failed");
+		return r;
+	}
+
+	disk_super = dm_block_data(sblock);
+
+	r = check_features(disk_super, cmd->bdev);
+	if (r)
+		goto bad_locked;
+
+	if (le32_to_cpu(disk_super->data_block_size) != cmd->data_block_size) {
+		DMERR("data block size (%llu) differs from the one in the "
+		      "superblock (%u)", (unsigned long long)cmd->data_block_size,
+		      le32_to_cpu(disk_super->data_block_size));
+		r = -EINVAL;
+		goto bad_locked;
+	}
+
+	if (le32_to_cpu(disk_super->cache_blocks) != cmd->cache_blocks) {
+		DMERR("cache device size (%u blocks) differs from the one in "
+		      "the superblock (%u blocks)", cmd->cache_blocks,
+		      le32_to_cpu(disk_super->cache_blocks));
+		r = -EINVAL;
+		goto bad_locked;
+	}
+
+	cmd->root = le64_to_cpu(disk_super->mapping_root);
+	cmd->flags = le32_to_cpu(disk_super->flags);
+	cmd->info.tm = cmd->tm;
+	cmd->need_commit = 0;
+
+	r = dm_tm_unlock(cmd->tm, sblock);
+	if (r < 0) {
+		DMERR("couldn't unlock superblock");
+		goto bad;
+	}
+
+	return 0;
+
+bad_locked:
+	dm_tm_unlock(cmd->tm, sblock);
+bad:
+	dm_tm_destroy(cmd->tm);
+	dm_sm_destroy(cmd->metadata_sm);
+
+	return r;
+}
+
+static int __commit_transaction(struct dm_cache_metadata *cmd)
+{
+	int r;
+	size_t metadata_len;
+	struct cache_disk_superblock *disk_super;
+	struct dm_block *sblock;
+
+	/*
+	 * We need to know if the cache_disk_superblock exceeds a 512-byte sector.
+	 */
+	BUILD_BUG_ON(sizeof(struct cache_disk_superblock) > 512);
+
+	if (!cmd->need_commit)
+		return 0;
+
+	r = dm_tm_pre_commit(cmd->tm);
+	if (r < 0)
+		return r;
+
+	r = dm_sm_root_size(cmd->metadata_sm, &metadata_len);
+	if (r < 0)
+		return r;
+
+	r = dm_bm_write_lock(cmd->bm, CACHE_SUPERBLOCK_LOCATION,
+			     &sb_validator, &sblock);
+	if (r)
+		return r;
+
+	disk_super = dm_block_data(sblock);
+	disk_super->mapping_root = cpu_to_le64(cmd->root);
+	disk_super->flags = cpu_to_le32(cmd->flags);
+
+	r = dm_sm_copy_root(cmd->metadata_sm, &disk_super->metadata_space_map_root,
+			    metadata_len);
+	if (r < 0) {
+		dm_bm_unlock(sblock);
+		return r;
+	}
+
+	r = dm_tm_commit(cmd->tm, sblock);
+	if (!r)
+		cmd->need_commit = 0;
+
+	return r;
+}
+
+struct dm_cache_metadata *dm_cache_metadata_open(struct block_device *bdev,
+						 sector_t data_block_size,
+						 dm_cblock_t cache_size)
+{
+	int r, create;
+	struct dm_cache_metadata *cmd;
+
+	cmd = kzalloc(sizeof(*cmd), GFP_KERNEL);
+	if (!cmd) {
+		DMERR("could not allocate metadata struct");
+		return ERR_PTR(-ENOMEM);
+	}
+
+	cmd->bdev = bdev;
+	cmd->data_block_size = data_block_size;
+	cmd->cache_blocks = cache_size;
+	init_rwsem(&cmd->root_lock);
+
+	cmd->info.levels = 1;
+	cmd->info.value_type.context = NULL;
+	cmd->info.value_type.size = sizeof(__le64);
+	cmd->info.value_type.inc = NULL;
+	cmd->info.value_type.dec = NULL;
+	cmd->info.value_type.equal = NULL;
+
+	/*
+	 * Max hex locks:
+	 *  3 for btree insert +
+	 *  2 for btree lookup used within space map
+	 */
+	cmd->bm = dm_block_manager_create(bdev, DM_CACHE_METADATA_BLOCK_SIZE,
+					  CACHE_METADATA_CACHE_SIZE, 5);
+	if (!cmd->bm) {
+		DMERR("could not create block manager");
+		kfree(cmd);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	r = superblock_all_zeroes(cmd->bm, &create);
+	if (r)
+		goto bad;
+
+	r = create ? __format_metadata(cmd) : __open_metadata(cmd);
+	if (r)
+		goto bad;
+
+	if (create) {
+		r = __commit_transaction(cmd);
+		if (r < 0) {
+			DMERR("%s: __commit_transaction() failed, error = %d",
+			      __func__, r);
+			dm_cache_metadata_close(cmd);
+			return ERR_PTR(r);
+		}
+	}
+
+	return cmd;
+
+bad:
+	dm_block_manager_destroy(cmd->bm);
+	kfree(cmd);
+	return ERR_PTR(r);
+}
+
+void dm_cache_metadata_close(struct dm_cache_metadata *cmd)
+{
+	int r;
+
+	r = __commit_transaction(cmd);
+	if (r < 0)
+		DMWARN("%s: __commit_transaction() failed, error = %d",
+		       __func__, r);
+
+	dm_tm_destroy(cmd->tm);
+	dm_block_manager_destroy(cmd->bm);
+	dm_sm_destroy(cmd->metadata_sm);
+	kfree(cmd);
+}
+
+int dm_cache_insert_mapping(struct dm_cache_metadata *cmd,
+			    dm_cblock_t cblock, dm_oblock_t oblock)
+{
+	int r;
+	uint64_t key = cblock;
+	__le64 value = pack_value(oblock, M_VALID);
+
+	__dm_bless_for_disk(&value);
+
+	down_write(&cmd->root_lock);
+	r = dm_btree_insert(&cmd->info, cmd->root, &key, &value, &cmd->root);
+	if (!r)
+		cmd->need_commit = 1;
+	up_write(&cmd->root_lock);
+
+	return r;
+}
+
+int dm_cache_remove_mapping(struct dm_cache_metadata *cmd, dm_cblock_t cblock)
+{
+	int r;
+	uint64_t key = cblock;
+
+	down_write(&cmd->root_lock);
+	r = dm_btree_remove(&cmd->info, cmd->root, &key, &cmd->root);
+	if (!r)
+		cmd->need_commit = 1;
+	up_write(&cmd->root_lock);
+
+	return r;
+}
+
+int dm_cache_load_mappings(struct dm_cache_metadata *cmd,
+			   load_mapping_fn fn, void *context)
+{
+	int r = 0;
+	uint64_t key;
+	__le64 value;
+	dm_oblock_t oblock;
+	unsigned flags;
+	bool clean_shutdown;
+
+	down_read(&cmd->root_lock);
+	clean_shutdown = cmd->flags & CLEAN_SHUTDOWN;
+
+	for (key = 0; key < cmd->cache_blocks; key++) {
+		r = dm_btree_lookup(&cmd->info, cmd->root, &key, &value);
+		if (r == -ENODATA)
+			continue;
+		if (r)
+			break;
+
+		unpack_value(value, &oblock, &flags);
+		if (!(flags & M_VALID))
+			continue;
+
+		r = fn(context, oblock, key,
+		       clean_shutdown ? !!(flags & M_DIRTY) : true);
+		if (r)
+			break;
+	}
+	up_read(&cmd->root_lock);
+
+	return r == -ENODATA ? 0 : r;
+}
+
+int dm_cache_set_dirty(struct dm_cache_metadata *cmd,
+		       dm_cblock_t cblock, bool dirty)
+{
+	int r;
+	uint64_t key = cblock;
+	__le64 value;
+	dm_oblock_t oblock;
+	unsigned flags;
+
+	down_write(&cmd->root_lock);
+	r = dm_btree_lookup(&cmd->info, cmd->root, &key, &value);
+	if (r)
+		goto out;
+
+	unpack_value(value, &oblock, &flags);
+	if (!!(flags & M_DIRTY) == dirty)
+		goto out;
+
+	value = pack_value(oblock, dirty ? flags | M_DIRTY : flags & ~M_DIRTY);
+	__dm_bless_for_disk(&value);
+
+	r = dm_btree_insert(&cmd->info, cmd->root, &key, &value, &cmd->root);
+	if (!r)
+		cmd->need_commit = 1;
+out:
+	up_write(&cmd->root_lock);
+
+	return r;
+}
+
+int dm_cache_set_clean_shutdown(struct dm_cache_metadata *cmd, bool clean)
+{
+	down_write(&cmd->root_lock);
+	if (!!(cmd->flags & CLEAN_SHUTDOWN) != clean) {
+		if (clean)
+			cmd->flags |= CLEAN_SHUTDOWN;
+		else
+			cmd->flags &= ~CLEAN_SHUTDOWN;
+		cmd->need_commit = 1;
+	}
+	up_write(&cmd->root_lock);
+
+	return 0;
+}
+
+int dm_cache_commit(struct dm_cache_metadata *cmd)
+{
+	int r;
+
+	down_write(&cmd->root_lock);
+	r = __commit_transaction(cmd);
+	up_write(&cmd->root_lock);
+
+	return r;
+}
+
+int dm_cache_get_free_metadata_block_count(struct dm_cache_metadata *cmd,
+					   dm_block_t *result)
+{
+	int r;
+
+	down_read(&cmd->root_lock);
+	r = dm_sm_get_nr_free(cmd->metadata_sm, result);
+	up_read(&cmd->root_lock);
+
+	return r;
+}
+
+int dm_cache_get_metadata_dev_size(struct dm_cache_metadata *cmd,
+				   dm_block_t *result)
+{
+	int r;
+
+	down_read(&cmd->root_lock);
+	r = dm_sm_get_nr_blocks(cmd->metadata_sm, result);
+	up_read(&cmd->root_lock);
+
+	return r;
+}
@@ -0,0 +1,94 @@
+/*
+ * This file is released under the GPL.
+ */
+
+#ifndef DM_CACHE_METADATA_H
+#define DM_CACHE_METADATA_H
+
+#include "dm-cache-block-types.h"
+
+/*----------------------------------------------------------------*/
+
+#define DM_CACHE_METADATA_BLOCK_SIZE 4096
+
+/*
+ * The metadata device is currently limited in size.
+ *
+ * We have one block of index, which can hold 255 index entries.  Each
+ * index entry contains allocation info about 16k metadata blocks.
+ */
+#define DM_CACHE_METADATA_MAX_SECTORS (255 * (1 << 14) * (DM_CACHE_METADATA_BLOCK_SIZE / (1 << SECTOR_SHIFT)))
+
+/*
+ * A metadata device larger than 16GB triggers a warning.
+ */
+#define DM_CACHE_METADATA_MAX_SECTORS_WARNING (16 * (1024 * 1024 * 1024 >> SECTOR_SHIFT))
+
+/*
+ * Compat feature flags.  Any incompat flags beyond the ones
+ * specified below will prevent use of the cache metadata.
+ */
+#define DM_CACHE_FEATURE_COMPAT_SUPP	  0UL
+#define DM_CACHE_FEATURE_COMPAT_RO_SUPP	  0UL
+#define DM_CACHE_FEATURE_INCOMPAT_SUPP	  0UL
+
+/*----------------------------------------------------------------*/
+
+struct dm_cache_metadata;
+
+/*
+ * Reopens or creates a new, empty metadata volume.
+ *
+ * @data_block_size and @cache_size must match the values recorded in an
+ * existing superblock, otherwise -EINVAL is returned.
+ */
+struct dm_cache_metadata *dm_cache_metadata_open(struct block_device *bdev,
+						 sector_t data_block_size,
+						 dm_cblock_t cache_size);
+
+void dm_cache_metadata_close(struct dm_cache_metadata *cmd);
+
+/*
+ * Mappings are only ever changed between commits; the data they refer
+ * to must already be on the cache device before the mapping is inserted.
+ */
+int dm_cache_insert_mapping(struct dm_cache_metadata *cmd,
+			    dm_cblock_t cblock, dm_oblock_t oblock);
+int dm_cache_remove_mapping(struct dm_cache_metadata *cmd, dm_cblock_t cblock);
+
+/*
+ * Calls @fn once for every mapped cache block.  @dirty is the dirty state
+ * recorded at the last clean shutdown, or true for every block if the
+ * cache was not shut down cleanly.
+ */
+typedef int (*load_mapping_fn)(void *context, dm_oblock_t oblock,
+			       dm_cblock_t cblock, bool dirty);
+int dm_cache_load_mappings(struct dm_cache_metadata *cmd,
+			   load_mapping_fn fn, void *context);
+
+/*
+ * Records the dirty state of a mapped block.  Only consulted if the
+ * clean shutdown flag is set when the metadata is next opened.
+ * Returns -ENODATA if @cblock isn't mapped.
+ */
+int dm_cache_set_dirty(struct dm_cache_metadata *cmd,
+		       dm_cblock_t cblock, bool dirty);
+
+/*
+ * The clean shutdown flag is set when the cache is suspended, after all
+ * dirty state has been written with dm_cache_set_dirty(), and cleared
+ * again before any io is let through on resume.
+ */
+int dm_cache_set_clean_shutdown(struct dm_cache_metadata *cmd, bool clean);
+
+int dm_cache_commit(struct dm_cache_metadata *cmd);
+
+int dm_cache_get_free_metadata_block_count(struct dm_cache_metadata *cmd,
+					   dm_block_t *result);
+
+int dm_cache_get_metadata_dev_size(struct dm_cache_metadata *cmd,
+				   dm_block_t *result);
+
+/*----------------------------------------------------------------*/
+
+#endif /* DM_CACHE_METADATA_H */
@@ -0,0 +1,501 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Multiqueue cache policy: promotes origin blocks into the cache once
+ * they have been hit often enough, evicting the least recently used of
+ * the least frequently used cache blocks.
+ */
+
+#include "dm-cache-policy.h"
+
+#include <linux/hash.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "cache-policy-mq"
+
+/*
+ * Tunable defaults.
+ */
+#define MQ_PROMOTE_THRESHOLD 4
+#define MQ_SEQUENTIAL_THRESHOLD 512
+#define MQ_MIN_PRE_ENTRIES 1024
+
+/*
+ * Entries are kept on one of NR_QUEUE_LEVELS lru lists according to the
+ * log2 of their hit count, so finding a cold block is O(1).  Hit counts
+ * are halved for every tick that passes without the block being looked
+ * at; this is done lazily whenever an entry is touched.
+ */
+#define NR_QUEUE_LEVELS 16
+
+struct entry {
+	struct hlist_node hlist;
+	struct list_head list;
+	dm_oblock_t oblock;
+	unsigned hit_count;
+	unsigned tick;
+	bool in_cache;
+};
+
+struct mq_policy {
+	struct dm_cache_policy policy;
+
+	dm_cblock_t cache_size;
+	dm_cblock_t nr_allocated;
+
+	/*
+	 * One entry per cache block, indexed by cblock.
+	 */
+	struct entry *cache_entries;
+	struct list_head free_cache;
+	struct list_head cache_q[NR_QUEUE_LEVELS];
+
+	/*
+	 * Origin blocks that aren't in the cache but have been hit
+	 * recently.  These are the candidates for promotion.
+	 */
+	unsigned nr_pre_entries;
+	struct entry *pre_entries;
+	struct list_head free_pre;
+	struct list_head pre_q[NR_QUEUE_LEVELS];
+
+	unsigned hash_bits;
+	struct hlist_head *table;
+
+	unsigned tick;
+
+	/*
+	 * Streaming io would just flush the cache, so we don't promote
+	 * blocks once a run of sequential blocks is long enough.
+	 */
+	dm_oblock_t last_oblock;
+	unsigned nr_seq;
+
+	unsigned promote_threshold;
+	unsigned sequential_threshold;
+};
+
+static struct mq_policy *to_mq_policy(struct dm_cache_policy *p)
+{
+	return container_of(p, struct mq_policy, policy);
+}
+
+/*----------------------------------------------------------------*/
+
+static struct hlist_head *hash_bucket(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	return mq->table + hash_64(oblock, mq->hash_bits);
+}
+
+static struct entry *hash_lookup(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	struct entry *e;
+	struct hlist_node *tmp;
+
+	hlist_for_each_entry(e, tmp, hash_bucket(mq, oblock), hlist)
+		if (e->oblock == oblock)
+			return e;
+
+	return NULL;
+}
+
+static void hash_insert(struct mq_policy *mq, struct entry *e)
+{
+	hlist_add_head(&e->hlist, hash_bucket(mq, e->oblock));
+}
+
+static void hash_remove(struct entry *e)
+{
+	hlist_del(&e->hlist);
+}
+
+/*----------------------------------------------------------------*/
+
+static unsigned queue_level(struct entry *e)
+{
+	return min((unsigned) fls(e->hit_count), NR_QUEUE_LEVELS - 1U);
+}
+
+static void decay(struct mq_policy *mq, struct entry *e)
+{
+	unsigned delta = mq->tick - e->tick;
+
+	if (delta) {
+		e->hit_count = delta >= 32 ? 0 : e->hit_count >> delta;
+		e->tick = mq->tick;
+	}
+}
+
+static void requeue(struct mq_policy *mq, struct entry *e)
+{
+	struct list_head *q = e->in_cache ? mq->cache_q : mq->pre_q;
+
+	list_move_tail(&e->list, q + queue_level(e));
+}
+
+/*
+ * The least recently used entry from the lowest populated level.
+ */
+static struct entry *pop_coldest(struct mq_policy *mq, struct list_head *q)
+{
+	unsigned level;
+	struct entry *e;
+
+	for (level = 0; level < NR_QUEUE_LEVELS; level++) {
+		if (list_empty(q + level))
+			continue;
+
+		e = list_first_entry(q + level, struct entry, list);
+		decay(mq, e);
+		return e;
+	}
+
+	return NULL;
+}
+
+static dm_cblock_t infer_cblock(struct mq_policy *mq, struct entry *e)
+{
+	return e - mq->cache_entries;
+}
+
+/*----------------------------------------------------------------*/
+
+static struct entry *alloc_pre_entry(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	struct entry *e;
+
+	if (!list_empty(&mq->free_pre))
+		e = list_first_entry(&mq->free_pre, struct entry, list);
+	else {
+		e = pop_coldest(mq, mq->pre_q);
+		hash_remove(e);
+	}
+
+	e->oblock = oblock;
+	e->hit_count = 0;
+	e->tick = mq->tick;
+	e->in_cache = false;
+	hash_insert(mq, e);
+	list_move_tail(&e->list, mq->pre_q);
+
+	return e;
+}
+
+static void free_pre_entry(struct mq_policy *mq, struct entry *e)
+{
+	hash_remove(e);
+	list_move(&e->list, &mq->free_pre);
+}
+
+static void update_sequential(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	if (oblock == mq->last_oblock + 1)
+		mq->nr_seq++;
+	else if (oblock != mq->last_oblock)
+		mq->nr_seq = 0;
+
+	mq->last_oblock = oblock;
+}
+
+static bool is_sequential(struct mq_policy *mq)
+{
+	return mq->sequential_threshold &&
+		mq->nr_seq >= mq->sequential_threshold;
+}
+
+static void promote(struct mq_policy *mq, struct entry *pre,
+		    struct entry *e, struct policy_result *result)
+{
+	e->oblock = pre->oblock;
+	e->hit_count = pre->hit_count;
+	e->tick = mq->tick;
+	e->in_cache = true;
+	hash_insert(mq, e);
+	requeue(mq, e);
+
+	free_pre_entry(mq, pre);
+	result->cblock = infer_cblock(mq, e);
+}
+
+static int mq_map(struct dm_cache_policy *p, dm_oblock_t oblock,
+		  bool can_migrate, int data_dir,
+		  struct policy_result *result)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e, *victim;
+
+	update_sequential(mq, oblock);
+
+	e = hash_lookup(mq, oblock);
+	if (e && e->in_cache) {
+		decay(mq, e);
+		e->hit_count++;
+		requeue(mq, e);
+
+		result->op = POLICY_HIT;
+		result->cblock = infer_cblock(mq, e);
+		return 0;
+	}
+
+	result->op = POLICY_MISS;
+	if (is_sequential(mq))
+		return 0;
+
+	if (!e)
+		e = alloc_pre_entry(mq, oblock);
+
+	decay(mq, e);
+	e->hit_count++;
+	requeue(mq, e);
+
+	if (e->hit_count < mq->promote_threshold)
+		return 0;
+
+	if (!list_empty(&mq->free_cache)) {
+		if (!can_migrate)
+			return -EWOULDBLOCK;
+
+		promote(mq, e, list_first_entry(&mq->free_cache, struct entry, list),
+			result);
+		mq->nr_allocated++;
+		result->op = POLICY_NEW;
+		return 0;
+	}
+
+	/*
+	 * Only replace a block that is colder than the one coming in.
+	 */
+	victim = pop_coldest(mq, mq->cache_q);
+	if (!victim || victim->hit_count >= e->hit_count)
+		return 0;
+
+	if (!can_migrate)
+		return -EWOULDBLOCK;
+
+	result->old_oblock = victim->oblock;
+	hash_remove(victim);
+	promote(mq, e, victim, result);
+	result->op = POLICY_REPLACE;
+
+	return 0;
+}
+
+static int mq_load_mapping(struct dm_cache_policy *p, dm_oblock_t oblock,
+			   dm_cblock_t cblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e;
+
+	if (cblock >= mq->cache_size)
+		return -EINVAL;
+
+	e = mq->cache_entries + cblock;
+	if (e->in_cache || hash_lookup(mq, oblock))
+		return -EINVAL;
+
+	e->oblock = oblock;
+	e->hit_count = 1;
+	e->tick = mq->tick;
+	e->in_cache = true;
+	hash_insert(mq, e);
+	requeue(mq, e);
+	mq->nr_allocated++;
+
+	return 0;
+}
+
+static void mq_remove_mapping(struct dm_cache_policy *p, dm_oblock_t oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e = hash_lookup(mq, oblock);
+
+	BUG_ON(!e || !e->in_cache);
+
+	hash_remove(e);
+	e->in_cache = false;
+	list_move(&e->list, &mq->free_cache);
+	mq->nr_allocated--;
+}
+
+static void mq_force_mapping(struct dm_cache_policy *p,
+			     dm_oblock_t current_oblock, dm_oblock_t new_oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e = hash_lookup(mq, current_oblock);
+
+	BUG_ON(!e || !e->in_cache);
+
+	hash_remove(e);
+	e->oblock = new_oblock;
+	hash_insert(mq, e);
+}
+
+static int mq_cblock_to_oblock(struct dm_cache_policy *p, dm_cblock_t cblock,
+			       dm_oblock_t *oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e;
+
+	if (cblock >= mq->cache_size)
+		return -EINVAL;
+
+	e = mq->cache_entries + cblock;
+	if (!e->in_cache)
+		return -ENODATA;
+
+	*oblock = e->oblock;
+	return 0;
+}
+
+static dm_cblock_t mq_residency(struct dm_cache_policy *p)
+{
+	return to_mq_policy(p)->nr_allocated;
+}
+
+static void mq_tick(struct dm_cache_policy *p)
+{
+	to_mq_policy(p)->tick++;
+}
+
+static int mq_emit_config_values(struct dm_cache_policy *p, char *result,
+				 unsigned maxlen)
+{
+	ssize_t sz = 0;
+	struct mq_policy *mq = to_mq_policy(p);
+
+	DMEMIT("4 sequential_threshold %u promote_threshold %u",
+	       mq->sequential_threshold, mq->promote_threshold);
+
+	return 0;
+}
+
+static int mq_set_config_value(struct dm_cache_policy *p,
+			       const char *key, const char *value)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	unsigned tmp;
+
+	if (kstrtouint(value, 10, &tmp))
+		return -EINVAL;
+
+	if (!strcasecmp(key, "sequential_threshold"))
+		mq->sequential_threshold = tmp;
+	else if (!strcasecmp(key, "promote_threshold") && tmp)
+		mq->promote_threshold = tmp;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+static void mq_destroy(struct dm_cache_policy *p)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+
+	vfree(mq->table);
+	vfree(mq->pre_entries);
+	vfree(mq->cache_entries);
+	kfree(mq);
+}
+
+/*----------------------------------------------------------------*/
+
+static void init_entries(struct entry *entries, unsigned nr,
+			 struct list_head *free)
+{
+	unsigned i;
+
+	for (i = 0; i < nr; i++) {
+		INIT_HLIST_NODE(&entries[i].hlist);
+		list_add_tail(&entries[i].list, free);
+	}
+}
+
+static struct dm_cache_policy *mq_create(dm_cblock_t cache_size,
+					 sector_t origin_size,
+					 sector_t block_size)
+{
+	unsigned i;
+	struct mq_policy *mq = kzalloc(sizeof(*mq), GFP_KERNEL);
+
+	if (!mq)
+		return NULL;
+
+	mq->policy.destroy = mq_destroy;
+	mq->policy.map = mq_map;
+	mq->policy.load_mapping = mq_load_mapping;
+	mq->policy.remove_mapping = mq_remove_mapping;
+	mq->policy.force_mapping = mq_force_mapping;
+	mq->policy.cblock_to_oblock = mq_cblock_to_oblock;
+	mq->policy.residency = mq_residency;
+	mq->policy.tick = mq_tick;
+	mq->policy.emit_config_values = mq_emit_config_values;
+	mq->policy.set_config_value = mq_set_config_value;
+
+	mq->cache_size = cache_size;
+	mq->nr_pre_entries = max_t(unsigned, cache_size, MQ_MIN_PRE_ENTRIES);
+	mq->promote_threshold = MQ_PROMOTE_THRESHOLD;
+	mq->sequential_threshold = MQ_SEQUENTIAL_THRESHOLD;
+	mq->last_oblock = (dm_oblock_t) -2;
+
+	INIT_LIST_HEAD(&mq->free_cache);
+	INIT_LIST_HEAD(&mq->free_pre);
+	for (i = 0; i < NR_QUEUE_LEVELS; i++) {
+		INIT_LIST_HEAD(mq->cache_q + i);
+		INIT_LIST_HEAD(mq->pre_q + i);
+	}
+
+	mq->cache_entries = vzalloc(sizeof(*mq->cache_entries) * cache_size);
+	if (!mq->cache_entries)
+		goto bad;
+	init_entries(mq->cache_entries, cache_size, &mq->free_cache);
+
+	mq->pre_entries = vzalloc(sizeof(*mq->pre_entries) * mq->nr_pre_entries);
+	if (!mq->pre_entries)
+		goto bad;
+	init_entries(mq->pre_entries, mq->nr_pre_entries, &mq->free_pre);
+
+	mq->hash_bits = ilog2(roundup_pow_of_two(cache_size + mq->nr_pre_entries));
+	mq->table = vzalloc(sizeof(*mq->table) << mq->hash_bits);
+	if (!mq->table)
+		goto bad;
+
+	return &mq->policy;
+
+bad:
+	vfree(mq->pre_entries);
+	vfree(mq->cache_entries);
+	kfree(mq);
+	return NULL;
+}
+
+/*----------------------------------------------------------------*/
+
+static struct dm_cache_policy_type mq_policy_type = {
+	.name = "mq",
+	.owner = THIS_MODULE,
+	.create = mq_create
+};
+
+static int __init mq_init(void)
+{
+	int r = dm_cache_policy_register(&mq_policy_type);
+
+	if (!r)
+		DMINFO("version 1.0.0 loaded");
+
+	return r;
+}
+
+static void __exit mq_exit(void)
+{
+	dm_cache_policy_unregister(&mq_policy_type);
+}
+
+module_init(mq_init);
+module_exit(mq_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("mq cache policy");
@@ -0,0 +1,156 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Cache policy registration.
+ */
+
+#ifndef DM_CACHE_POLICY_H
+#define DM_CACHE_POLICY_H
+
+#include "dm-cache-block-types.h"
+
+#include <linux/device-mapper.h>
+
+/*----------------------------------------------------------------*/
+
+/*
+ * The policy decides which origin blocks are worth holding on the cache
+ * device.  The cache target asks it about every bio; the policy answers
+ * with one of the following operations:
+ *
+ * POLICY_HIT:
+ *   The block is in the cache, at result->cblock.
+ *
+ * POLICY_MISS:
+ *   The block isn't in the cache and should be left where it is.
+ *
+ * POLICY_NEW:
+ *   Promote the block into the free cache block result->cblock.
+ *
+ * POLICY_REPLACE:
+ *   Demote result->old_oblock from result->cblock (writing it back if
+ *   dirty) and then promote the block into it.
+ *
+ * NEW and REPLACE are only ever returned if the caller said it
+ * can_migrate.  The policy has already updated its own view of the
+ * mappings when it returns them; if the migration fails the target calls
+ * remove_mapping() or force_mapping() to put things right.
+ *
+ * All methods are called with the cache's spin lock held, with
+ * interrupts disabled, so they must not block and should be O(1).
+ */
+enum policy_operation {
+	POLICY_HIT,
+	POLICY_MISS,
+	POLICY_NEW,
+	POLICY_REPLACE
+};
+
+struct policy_result {
+	enum policy_operation op;
+	dm_oblock_t old_oblock;	/* POLICY_REPLACE */
+	dm_cblock_t cblock;	/* POLICY_HIT, POLICY_NEW, POLICY_REPLACE */
+};
+
+struct dm_cache_policy {
+	void (*destroy)(struct dm_cache_policy *p);
+
+	/*
+	 * Returns -EWOULDBLOCK if @can_migrate is false and the policy
+	 * would have liked to promote the block.  The caller will retry
+	 * later from a context that can perform the migration.
+	 */
+	int (*map)(struct dm_cache_policy *p, dm_oblock_t oblock,
+		   bool can_migrate, int data_dir,
+		   struct policy_result *result);
+
+	/*
+	 * Called when the cache is constructed to describe the mappings
+	 * held in the metadata.
+	 */
+	int (*load_mapping)(struct dm_cache_policy *p, dm_oblock_t oblock,
+			    dm_cblock_t cblock);
+
+	/*
+	 * Undoes a failed POLICY_NEW, freeing the cache block.
+	 */
+	void (*remove_mapping)(struct dm_cache_policy *p, dm_oblock_t oblock);
+
+	/*
+	 * Undoes a failed POLICY_REPLACE: the block mapped to
+	 * @current_oblock goes back to being @new_oblock.
+	 */
+	void (*force_mapping)(struct dm_cache_policy *p,
+			      dm_oblock_t current_oblock,
+			      dm_oblock_t new_oblock);
+
+	/*
+	 * Reverse lookup, used when writing back dirty blocks.
+	 * Returns -ENODATA if @cblock is unused.
+	 */
+	int (*cblock_to_oblock)(struct dm_cache_policy *p, dm_cblock_t cblock,
+				dm_oblock_t *oblock);
+
+	/*
+	 * The number of cache blocks in use.
+	 */
+	dm_cblock_t (*residency)(struct dm_cache_policy *p);
+
+	/*
+	 * Called roughly once a second so the policy can age its hit
+	 * counts.
+	 */
+	void (*tick)(struct dm_cache_policy *p);
+
+	/*
+	 * Configuration, both from the table line and from messages.
+	 * emit_config_values() writes "<#args> [<key> <value>]*".
+	 */
+	int (*emit_config_values)(struct dm_cache_policy *p, char *result,
+				  unsigned maxlen);
+	int (*set_config_value)(struct dm_cache_policy *p,
+				const char *key, const char *value);
+
+	/*
+	 * Book keeping ptr for the policy register, not for general use.
+	 */
+	void *private;
+};
+
+/*----------------------------------------------------------------*/
+
+#define CACHE_POLICY_NAME_SIZE 16
+
+struct dm_cache_policy_type {
+	/* For use by the register code only. */
+	struct list_head list;
+
+	/*
+	 * Policy writers should fill in these fields.  The name field is
+	 * what gets passed on the target line to select your policy.
+	 */
+	char name[CACHE_POLICY_NAME_SIZE];
+	struct module *owner;
+
+	struct dm_cache_policy *(*create)(dm_cblock_t cache_size,
+					  sector_t origin_size,
+					  sector_t block_size);
+};
+
+int dm_cache_policy_register(struct dm_cache_policy_type *type);
+void dm_cache_policy_unregister(struct dm_cache_policy_type *type);
+
+/*
+ * Loads the dm-cache-<name> module if the policy isn't registered yet.
+ */
+struct dm_cache_policy *dm_cache_policy_create(const char *name,
+					       dm_cblock_t cache_size,
+					       sector_t origin_size,
+					       sector_t block_size);
+void dm_cache_policy_destroy(struct dm_cache_policy *p);
+
+const char *dm_cache_policy_get_name(struct dm_cache_policy *p);
+
+/*----------------------------------------------------------------*/
+
+#endif /* DM_CACHE_POLICY_H */
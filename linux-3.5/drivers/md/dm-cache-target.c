@@ -0,0 +1,1825 @@
+/*
+ * This file is released under the GPL.
+ *
+ * A device-mapper target that uses a fast device, typically an SSD, as
+ * a cache for a slower origin device.
+ *
+ * See Documentation/device-mapper/cache.txt
+ */
+
+#include "dm-cache-metadata.h"
+#include "dm-cache-policy.h"
+#include "dm-bio-record.h"
+
+#include <linux/blkdev.h>
+#include <linux/device-mapper.h>
+#include <linux/dm-kcopyd.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/mempool.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "cache"
+
+/*
+ * Tunable constants
+ */
+#define ENDIO_HOOK_POOL_SIZE 1024
+#define MIGRATION_POOL_SIZE 128
+#define CELL_POOL_SIZE (MIGRATION_POOL_SIZE * 2)
+#define WRITETHROUGH_POOL_SIZE 16
+#define DEFERRED_SET_SIZE 64
+#define CELL_HASH_SIZE 256
+#define COMMIT_PERIOD HZ
+
+/*
+ * The maximum number of promotions, demotions and writebacks in flight
+ * at any one time.
+ */
+#define MAX_MIGRATIONS 64
+
+/*
+ * Dirty blocks looked at per worker pass when cleaning.
+ */
+#define WRITEBACK_SCAN 64
+
+/*
+ * The block size of the cache device must be a power of two between
+ * 32KB and 1GB.
+ */
+#define DATA_DEV_BLOCK_SIZE_MIN_SECTORS (32 * 1024 >> SECTOR_SHIFT)
+#define DATA_DEV_BLOCK_SIZE_MAX_SECTORS (1024 * 1024 * 1024 >> SECTOR_SHIFT)
+
+/*----------------------------------------------------------------*/
+
+/*
+ * We use the deferred set to keep track of io in flight.  A migration
+ * can't start copying until all the io that was issued before it was
+ * scheduled has completed, otherwise it could read stale data or race
+ * with a write to the block it is moving.
+ */
+
+struct deferred_set;
+struct deferred_entry {
+	struct deferred_set *ds;
+	unsigned count;
+	struct list_head work_items;
+};
+
+struct deferred_set {
+	spinlock_t lock;
+	unsigned current_entry;
+	unsigned sweeper;
+	struct deferred_entry entries[DEFERRED_SET_SIZE];
+};
+
+static void ds_init(struct deferred_set *ds)
+{
+	int i;
+
+	spin_lock_init(&ds->lock);
+	ds->current_entry = 0;
+	ds->sweeper = 0;
+	for (i = 0; i < DEFERRED_SET_SIZE; i++) {
+		ds->entries[i].ds = ds;
+		ds->entries[i].count = 0;
+		INIT_LIST_HEAD(&ds->entries[i].work_items);
+	}
+}
+
+static struct deferred_entry *ds_inc(struct deferred_set *ds)
+{
+	unsigned long flags;
+	struct deferred_entry *entry;
+
+	spin_lock_irqsave(&ds->lock, flags);
+	entry = ds->entries + ds->current_entry;
+	entry->count++;
+	spin_unlock_irqrestore(&ds->lock, flags);
+
+	return entry;
+}
+
+static unsigned ds_next(unsigned index)
+{
+	return (index + 1) % DEFERRED_SET_SIZE;
+}
+
+static void __sweep(struct deferred_set *ds, struct list_head *head)
+{
+	while ((ds->sweeper != ds->current_entry) &&
+	       !ds->entries[ds->sweeper].count) {
+		list_splice_init(&ds->entries[ds->sweeper].work_items, head);
+		ds->sweeper = ds_next(ds->sweeper);
+	}
+
+	if ((ds->sweeper == ds->current_entry) && !ds->entries[ds->sweeper].count)
+		list_splice_init(&ds->entries[ds->sweeper].work_items, head);
+}
+
+static void ds_dec(struct deferred_entry *entry, struct list_head *head)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&entry->ds->lock, flags);
+	BUG_ON(!entry->count);
+	--entry->count;
+	__sweep(entry->ds, head);
+	spin_unlock_irqrestore(&entry->ds->lock, flags);
+}
+
+/*
+ * Returns 1 if deferred or 0 if no pending items to delay job.
+ */
+static int ds_add_work(struct deferred_set *ds, struct list_head *work)
+{
+	int r = 1;
+	unsigned long flags;
+	unsigned next_entry;
+
+	spin_lock_irqsave(&ds->lock, flags);
+	if ((ds->sweeper == ds->current_entry) &&
+	    !ds->entries[ds->current_entry].count)
+		r = 0;
+	else {
+		list_add(work, &ds->entries[ds->current_entry].work_items);
+		next_entry = ds_next(ds->current_entry);
+		if (!ds->entries[next_entry].count)
+			ds->current_entry = next_entry;
+	}
+	spin_unlock_irqrestore(&ds->lock, flags);
+
+	return r;
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * Bios for an origin block that is being migrated are held in a cell
+ * until the migration completes.  Cells are only touched with the cache
+ * lock held.
+ */
+struct dm_cache_cell {
+	struct hlist_node list;
+	dm_oblock_t oblock;
+	struct bio_list bios;
+};
+
+enum cache_mode {
+	CM_WRITEBACK,
+	CM_WRITETHROUGH
+};
+
+struct cache_stats {
+	atomic_t read_hit;
+	atomic_t read_miss;
+	atomic_t write_hit;
+	atomic_t write_miss;
+	atomic_t demotion;
+	atomic_t promotion;
+	atomic_t writeback;
+};
+
+struct cache {
+	struct dm_target *ti;
+
+	struct dm_dev *metadata_dev;
+	struct dm_dev *origin_dev;
+	struct dm_dev *cache_dev;
+
+	struct dm_cache_metadata *cmd;
+	struct dm_cache_policy *policy;
+	enum cache_mode mode;
+
+	uint32_t sectors_per_block;
+	unsigned block_shift;
+	sector_t offset_mask;
+	dm_oblock_t origin_blocks;
+	dm_cblock_t cache_size;
+
+	/*
+	 * Only set while the cache is being suspended, stops the worker
+	 * starting any new writebacks.
+	 */
+	unsigned quiescing:1;
+
+	/*
+	 * Set when a migration has written to a device.  That device is
+	 * flushed before the metadata describing the migration is
+	 * committed.
+	 */
+	unsigned origin_needs_flush:1;
+	unsigned cache_needs_flush:1;
+
+	spinlock_t lock;
+	struct bio_list deferred_bios;
+	struct bio_list deferred_flush_bios;
+	struct bio_list deferred_writethrough_bios;
+	struct list_head quiesced_migrations;
+	struct list_head completed_migrations;
+	struct list_head need_commit_migrations;
+	struct hlist_head cells[CELL_HASH_SIZE];
+
+	atomic_t nr_migrations;
+	wait_queue_head_t migration_wait;
+
+	unsigned long *dirty_bitset;
+	atomic_t nr_dirty;
+	dm_cblock_t writeback_cursor;
+
+	struct dm_kcopyd_client *copier;
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+	struct delayed_work waker;
+	unsigned long last_commit_jiffies;
+
+	struct deferred_set all_io_ds;
+
+	mempool_t *endio_hook_pool;
+	mempool_t *migration_pool;
+	mempool_t *cell_pool;
+	mempool_t *writethrough_pool;
+
+	struct cache_stats stats;
+};
+
+struct dm_cache_endio_hook {
+	struct deferred_entry *all_io_entry;
+
+	/*
+	 * Set while a writethrough bio is on its way to the origin.  Once
+	 * that completes the bio is restored and sent to the cache.
+	 */
+	struct dm_bio_details *details;
+	dm_cblock_t cblock;
+};
+
+struct dm_cache_migration {
+	struct list_head list;
+	struct cache *cache;
+
+	unsigned writeback:1;
+	unsigned demote:1;
+	unsigned promote:1;
+	int err;
+
+	dm_oblock_t old_oblock;
+	dm_oblock_t new_oblock;
+	dm_cblock_t cblock;
+
+	struct dm_cache_cell *old_ocell;
+	struct dm_cache_cell *new_ocell;
+};
+
+/*
+ * Processing a bio in the worker may need a migration and two cells.
+ * These are allocated up front so they can be used with the cache lock
+ * held.
+ */
+struct prealloc {
+	struct dm_cache_migration *mg;
+	struct dm_cache_cell *cell1;
+	struct dm_cache_cell *cell2;
+};
+
+static struct kmem_cache *_endio_hook_cache;
+static struct kmem_cache *_migration_cache;
+static struct kmem_cache *_cell_cache;
+
+/*----------------------------------------------------------------*/
+
+static void wake_worker(struct cache *cache)
+{
+	queue_work(cache->wq, &cache->worker);
+}
+
+static dm_oblock_t get_bio_block(struct cache *cache, struct bio *bio)
+{
+	return bio->bi_sector >> cache->block_shift;
+}
+
+static void remap_to_origin(struct cache *cache, struct bio *bio)
+{
+	bio->bi_bdev = cache->origin_dev->bdev;
+}
+
+static void remap_to_cache(struct cache *cache, struct bio *bio,
+			   dm_cblock_t cblock)
+{
+	bio->bi_bdev = cache->cache_dev->bdev;
+	bio->bi_sector = ((sector_t) cblock << cache->block_shift) +
+		(bio->bi_sector & cache->offset_mask);
+}
+
+/*
+ * Batch together any FUA/FLUSH bios we find and then issue
+ * a single commit for them in process_deferred_flush_bios().
+ */
+static void issue(struct cache *cache, struct bio *bio)
+{
+	unsigned long flags;
+
+	if (bio->bi_rw & (REQ_FLUSH | REQ_FUA)) {
+		spin_lock_irqsave(&cache->lock, flags);
+		bio_list_add(&cache->deferred_flush_bios, bio);
+		spin_unlock_irqrestore(&cache->lock, flags);
+		wake_worker(cache);
+	} else
+		generic_make_request(bio);
+}
+
+static void defer_bio(struct cache *cache, struct bio *bio)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_add(&cache->deferred_bios, bio);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+/*----------------------------------------------------------------*/
+
+static void set_dirty(struct cache *cache, dm_cblock_t cblock)
+{
+	if (!test_and_set_bit(cblock, cache->dirty_bitset))
+		atomic_inc(&cache->nr_dirty);
+}
+
+static void clear_dirty(struct cache *cache, dm_cblock_t cblock)
+{
+	if (test_and_clear_bit(cblock, cache->dirty_bitset))
+		atomic_dec(&cache->nr_dirty);
+}
+
+static bool is_dirty(struct cache *cache, dm_cblock_t cblock)
+{
+	return test_bit(cblock, cache->dirty_bitset);
+}
+
+/*----------------------------------------------------------------*/
+
+static struct hlist_head *cell_bucket(struct cache *cache, dm_oblock_t oblock)
+{
+	return cache->cells + hash_64(oblock, ilog2(CELL_HASH_SIZE));
+}
+
+static struct dm_cache_cell *__find_cell(struct cache *cache, dm_oblock_t oblock)
+{
+	struct dm_cache_cell *cell;
+	struct hlist_node *tmp;
+
+	hlist_for_each_entry(cell, tmp, cell_bucket(cache, oblock), list)
+		if (cell->oblock == oblock)
+			return cell;
+
+	return NULL;
+}
+
+static void __insert_cell(struct cache *cache, struct dm_cache_cell *cell,
+			  dm_oblock_t oblock, struct bio *holder)
+{
+	cell->oblock = oblock;
+	bio_list_init(&cell->bios);
+	if (holder)
+		bio_list_add(&cell->bios, holder);
+	hlist_add_head(&cell->list, cell_bucket(cache, oblock));
+}
+
+/*
+ * Sends the bios in the cell back to the deferred_bios list.
+ */
+static void release_cell(struct cache *cache, struct dm_cache_cell *cell)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	hlist_del(&cell->list);
+	bio_list_merge(&cache->deferred_bios, &cell->bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	mempool_free(cell, cache->cell_pool);
+	wake_worker(cache);
+}
+
+/*----------------------------------------------------------------*/
+
+static struct dm_cache_endio_hook *hook_bio(struct cache *cache, struct bio *bio)
+{
+	struct dm_cache_endio_hook *h = mempool_alloc(cache->endio_hook_pool, GFP_NOIO);
+
+	h->all_io_entry = NULL;
+	h->details = NULL;
+
+	return h;
+}
+
+/*
+ * Remaps a bio that the policy has classified as a hit or a miss.  Must
+ * be called with the cache lock held, so that a migration can't be
+ * scheduled between the policy lookup and the io being accounted.
+ *
+ * Returns true if the bio is a writethrough write, in which case the
+ * caller must pass it to remap_writethrough() once the lock is dropped.
+ */
+static bool __remap_bio(struct cache *cache, struct bio *bio,
+			struct policy_result *lookup_result)
+{
+	struct dm_cache_endio_hook *h = dm_get_mapinfo(bio)->ptr;
+	bool is_write = bio_data_dir(bio) == WRITE;
+
+	h->all_io_entry = ds_inc(&cache->all_io_ds);
+
+	if (lookup_result->op == POLICY_HIT) {
+		atomic_inc(is_write ? &cache->stats.write_hit : &cache->stats.read_hit);
+
+		if (is_write && cache->mode == CM_WRITETHROUGH) {
+			h->cblock = lookup_result->cblock;
+			remap_to_origin(cache, bio);
+			return true;
+		}
+
+		if (is_write)
+			set_dirty(cache, lookup_result->cblock);
+		remap_to_cache(cache, bio, lookup_result->cblock);
+	} else {
+		atomic_inc(is_write ? &cache->stats.write_miss : &cache->stats.read_miss);
+		remap_to_origin(cache, bio);
+	}
+
+	return false;
+}
+
+/*
+ * The bio goes to the origin first; cache_end_io() then restores it and
+ * queues it for the cache.
+ */
+static void remap_writethrough(struct cache *cache, struct bio *bio)
+{
+	struct dm_cache_endio_hook *h = dm_get_mapinfo(bio)->ptr;
+	sector_t origin_sector = bio->bi_sector;
+	struct block_device *origin_bdev = bio->bi_bdev;
+
+	h->details = mempool_alloc(cache->writethrough_pool, GFP_NOIO);
+
+	/*
+	 * Record the bio as the cache will see it.
+	 */
+	remap_to_cache(cache, bio, h->cblock);
+	dm_bio_record(h->details, bio);
+
+	bio->bi_sector = origin_sector;
+	bio->bi_bdev = origin_bdev;
+}
+
+/*----------------------------------------------------------------
+ * Migration processing
+ *--------------------------------------------------------------*/
+
+static void free_migration(struct dm_cache_migration *mg)
+{
+	struct cache *cache = mg->cache;
+
+	mempool_free(mg, cache->migration_pool);
+	if (atomic_dec_and_test(&cache->nr_migrations))
+		wake_up(&cache->migration_wait);
+}
+
+static void __queue_migration(struct cache *cache, struct dm_cache_migration *mg,
+			      struct list_head *head)
+{
+	list_add_tail(&mg->list, head);
+	wake_worker(cache);
+}
+
+static void queue_migration(struct cache *cache, struct dm_cache_migration *mg,
+			    struct list_head *head)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	__queue_migration(cache, mg, head);
+	spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+/*
+ * Waits for io issued before the migration was scheduled to complete.
+ */
+static void quiesce_migration(struct cache *cache, struct dm_cache_migration *mg)
+{
+	if (!ds_add_work(&cache->all_io_ds, &mg->list))
+		queue_migration(cache, mg, &cache->quiesced_migrations);
+}
+
+static void copy_complete(int read_err, unsigned long write_err, void *context)
+{
+	struct dm_cache_migration *mg = context;
+
+	mg->err = read_err || write_err ? -EIO : 0;
+	queue_migration(mg->cache, mg, &mg->cache->completed_migrations);
+}
+
+static void issue_copy(struct dm_cache_migration *mg)
+{
+	int r;
+	struct dm_io_region o_region, c_region;
+	struct cache *cache = mg->cache;
+	bool writeback = mg->writeback || (mg->demote && is_dirty(cache, mg->cblock));
+
+	if (mg->demote && !writeback) {
+		/*
+		 * Clean blocks can be dropped without any io.
+		 */
+		mg->err = 0;
+		queue_migration(cache, mg, &cache->completed_migrations);
+		return;
+	}
+
+	o_region.bdev = cache->origin_dev->bdev;
+	o_region.sector = (mg->demote ? mg->old_oblock : mg->new_oblock) *
+		cache->sectors_per_block;
+	o_region.count = cache->sectors_per_block;
+
+	c_region.bdev = cache->cache_dev->bdev;
+	c_region.sector = (sector_t) mg->cblock * cache->sectors_per_block;
+	c_region.count = cache->sectors_per_block;
+
+	if (writeback)
+		r = dm_kcopyd_copy(cache->copier, &c_region, 1, &o_region,
+				   0, copy_complete, mg);
+	else
+		r = dm_kcopyd_copy(cache->copier, &o_region, 1, &c_region,
+				   0, copy_complete, mg);
+
+	if (r < 0) {
+		DMERR("dm_kcopyd_copy() failed");
+		copy_complete(1, 0, mg);
+	}
+}
+
+static void migration_failure(struct dm_cache_migration *mg)
+{
+	unsigned long flags;
+	struct cache *cache = mg->cache;
+
+	if (mg->writeback) {
+		DMWARN("writeback failed; couldn't copy block");
+		release_cell(cache, mg->new_ocell);
+
+	} else if (mg->demote) {
+		DMWARN("demotion failed; couldn't copy block");
+		spin_lock_irqsave(&cache->lock, flags);
+		cache->policy->force_mapping(cache->policy, mg->new_oblock,
+					     mg->old_oblock);
+		spin_unlock_irqrestore(&cache->lock, flags);
+
+		release_cell(cache, mg->old_ocell);
+		release_cell(cache, mg->new_ocell);
+
+	} else {
+		DMWARN("promotion failed; couldn't copy block");
+		spin_lock_irqsave(&cache->lock, flags);
+		cache->policy->remove_mapping(cache->policy, mg->new_oblock);
+		spin_unlock_irqrestore(&cache->lock, flags);
+
+		release_cell(cache, mg->new_ocell);
+	}
+
+	free_migration(mg);
+}
+
+static void complete_migration(struct dm_cache_migration *mg)
+{
+	int r;
+	unsigned long flags;
+	struct cache *cache = mg->cache;
+
+	if (mg->err) {
+		migration_failure(mg);
+		return;
+	}
+
+	if (mg->writeback) {
+		clear_dirty(cache, mg->cblock);
+		atomic_inc(&cache->stats.writeback);
+		release_cell(cache, mg->new_ocell);
+		free_migration(mg);
+
+	} else if (mg->demote) {
+		r = dm_cache_remove_mapping(cache->cmd, mg->cblock);
+		if (r) {
+			DMERR("dm_cache_remove_mapping() failed");
+			mg->err = r;
+			migration_failure(mg);
+			return;
+		}
+
+		if (is_dirty(cache, mg->cblock)) {
+			clear_dirty(cache, mg->cblock);
+			cache->origin_needs_flush = 1;
+		}
+		atomic_inc(&cache->stats.demotion);
+		release_cell(cache, mg->old_ocell);
+
+		/*
+		 * The cache block mustn't be reused until the removal of
+		 * the old mapping has been committed, otherwise a crash
+		 * could leave the old mapping pointing at the new data.
+		 */
+		mg->demote = 0;
+		spin_lock_irqsave(&cache->lock, flags);
+		list_add_tail(&mg->list, &cache->need_commit_migrations);
+		spin_unlock_irqrestore(&cache->lock, flags);
+
+	} else {
+		r = dm_cache_insert_mapping(cache->cmd, mg->cblock, mg->new_oblock);
+		if (r) {
+			DMERR("dm_cache_insert_mapping() failed");
+			mg->err = r;
+			migration_failure(mg);
+			return;
+		}
+
+		cache->cache_needs_flush = 1;
+		atomic_inc(&cache->stats.promotion);
+		release_cell(cache, mg->new_ocell);
+		free_migration(mg);
+	}
+}
+
+static void process_migrations(struct cache *cache, struct list_head *head,
+			       void (*fn)(struct dm_cache_migration *))
+{
+	unsigned long flags;
+	struct list_head list;
+	struct dm_cache_migration *mg, *tmp;
+
+	INIT_LIST_HEAD(&list);
+	spin_lock_irqsave(&cache->lock, flags);
+	list_splice_init(head, &list);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	list_for_each_entry_safe(mg, tmp, &list, list)
+		fn(mg);
+}
+
+/*----------------------------------------------------------------*/
+
+static struct dm_cache_migration *__new_migration(struct cache *cache,
+						  struct prealloc *structs)
+{
+	struct dm_cache_migration *mg = structs->mg;
+
+	structs->mg = NULL;
+	memset(mg, 0, sizeof(*mg));
+	INIT_LIST_HEAD(&mg->list);
+	mg->cache = cache;
+	atomic_inc(&cache->nr_migrations);
+
+	return mg;
+}
+
+static struct dm_cache_cell *__new_cell(struct prealloc *structs)
+{
+	struct dm_cache_cell *cell = structs->cell1;
+
+	if (cell)
+		structs->cell1 = NULL;
+	else {
+		cell = structs->cell2;
+		structs->cell2 = NULL;
+	}
+
+	return cell;
+}
+
+static bool can_migrate(struct cache *cache)
+{
+	return !cache->quiescing &&
+		atomic_read(&cache->nr_migrations) < MAX_MIGRATIONS;
+}
+
+static int prealloc_data_structs(struct cache *cache, struct prealloc *p)
+{
+	if (!p->mg) {
+		p->mg = mempool_alloc(cache->migration_pool, GFP_NOWAIT);
+		if (!p->mg)
+			return -ENOMEM;
+	}
+
+	if (!p->cell1) {
+		p->cell1 = mempool_alloc(cache->cell_pool, GFP_NOWAIT);
+		if (!p->cell1)
+			return -ENOMEM;
+	}
+
+	if (!p->cell2) {
+		p->cell2 = mempool_alloc(cache->cell_pool, GFP_NOWAIT);
+		if (!p->cell2)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void prealloc_free_structs(struct cache *cache, struct prealloc *p)
+{
+	if (p->cell2)
+		mempool_free(p->cell2, cache->cell_pool);
+
+	if (p->cell1)
+		mempool_free(p->cell1, cache->cell_pool);
+
+	if (p->mg)
+		mempool_free(p->mg, cache->migration_pool);
+}
+
+static void process_bio(struct cache *cache, struct prealloc *structs,
+			struct bio *bio)
+{
+	int r;
+	unsigned long flags;
+	bool migrate, writethrough = false;
+	dm_oblock_t oblock = get_bio_block(cache, bio);
+	struct dm_cache_cell *cell;
+	struct dm_cache_migration *mg = NULL;
+	struct policy_result lookup_result;
+
+	migrate = can_migrate(cache) && !prealloc_data_structs(cache, structs);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	cell = __find_cell(cache, oblock);
+	if (cell) {
+		bio_list_add(&cell->bios, bio);
+		spin_unlock_irqrestore(&cache->lock, flags);
+		return;
+	}
+
+	r = cache->policy->map(cache->policy, oblock, migrate,
+			       bio_data_dir(bio), &lookup_result);
+	if (r == -EWOULDBLOCK)
+		lookup_result.op = POLICY_MISS;
+
+	if (lookup_result.op == POLICY_REPLACE &&
+	    __find_cell(cache, lookup_result.old_oblock)) {
+		/*
+		 * The victim is already being migrated.  Leave it where
+		 * it is and treat this bio as a miss.
+		 */
+		cache->policy->force_mapping(cache->policy, oblock,
+					     lookup_result.old_oblock);
+		lookup_result.op = POLICY_MISS;
+	}
+
+	switch (lookup_result.op) {
+	case POLICY_HIT:
+	case POLICY_MISS:
+		writethrough = __remap_bio(cache, bio, &lookup_result);
+		break;
+
+	case POLICY_NEW:
+		atomic_inc(bio_data_dir(bio) == WRITE ?
+			   &cache->stats.write_miss : &cache->stats.read_miss);
+		mg = __new_migration(cache, structs);
+		mg->promote = 1;
+		mg->new_oblock = oblock;
+		mg->cblock = lookup_result.cblock;
+		mg->new_ocell = __new_cell(structs);
+		__insert_cell(cache, mg->new_ocell, oblock, bio);
+		break;
+
+	case POLICY_REPLACE:
+		atomic_inc(bio_data_dir(bio) == WRITE ?
+			   &cache->stats.write_miss : &cache->stats.read_miss);
+		mg = __new_migration(cache, structs);
+		mg->demote = 1;
+		mg->promote = 1;
+		mg->old_oblock = lookup_result.old_oblock;
+		mg->new_oblock = oblock;
+		mg->cblock = lookup_result.cblock;
+		mg->old_ocell = __new_cell(structs);
+		__insert_cell(cache, mg->old_ocell, mg->old_oblock, NULL);
+		mg->new_ocell = __new_cell(structs);
+		__insert_cell(cache, mg->new_ocell, oblock, bio);
+		break;
+	}
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	if (mg)
+		quiesce_migration(cache, mg);
+	else {
+		if (writethrough)
+			remap_writethrough(cache, bio);
+		issue(cache, bio);
+	}
+}
+
+/*
+ * Bios in the partial block at the end of the origin are never cached.
+ */
+static bool is_uncacheable(struct cache *cache, struct bio *bio)
+{
+	return get_bio_block(cache, bio) >= cache->origin_blocks;
+}
+
+static void remap_uncacheable(struct cache *cache, struct bio *bio)
+{
+	struct dm_cache_endio_hook *h = dm_get_mapinfo(bio)->ptr;
+
+	h->all_io_entry = ds_inc(&cache->all_io_ds);
+	remap_to_origin(cache, bio);
+}
+
+static void process_deferred_bios(struct cache *cache)
+{
+	unsigned long flags;
+	struct bio_list bios;
+	struct bio *bio;
+	struct prealloc structs;
+
+	memset(&structs, 0, sizeof(structs));
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&bios, &cache->deferred_bios);
+	bio_list_init(&cache->deferred_bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	while ((bio = bio_list_pop(&bios))) {
+		if (is_uncacheable(cache, bio)) {
+			remap_uncacheable(cache, bio);
+			issue(cache, bio);
+		} else
+			process_bio(cache, &structs, bio);
+	}
+
+	prealloc_free_structs(cache, &structs);
+}
+
+static void process_deferred_writethrough_bios(struct cache *cache)
+{
+	unsigned long flags;
+	struct bio_list bios;
+	struct bio *bio;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&bios, &cache->deferred_writethrough_bios);
+	bio_list_init(&cache->deferred_writethrough_bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	while ((bio = bio_list_pop(&bios)))
+		generic_make_request(bio);
+}
+
+/*
+ * In writethrough mode dirty blocks, left over from a crash or from
+ * running in writeback mode, are cleaned in the background.
+ */
+static void writeback_some_dirty_blocks(struct cache *cache)
+{
+	int r;
+	unsigned i;
+	unsigned long flags;
+	dm_cblock_t cblock;
+	dm_oblock_t oblock;
+	struct dm_cache_migration *mg;
+	struct prealloc structs;
+
+	if (cache->mode != CM_WRITETHROUGH || !atomic_read(&cache->nr_dirty))
+		return;
+
+	memset(&structs, 0, sizeof(structs));
+
+	for (i = 0; i < WRITEBACK_SCAN && atomic_read(&cache->nr_dirty); i++) {
+		if (!can_migrate(cache) || prealloc_data_structs(cache, &structs))
+			break;
+
+		cblock = find_next_bit(cache->dirty_bitset, cache->cache_size,
+				       cache->writeback_cursor);
+		if (cblock >= cache->cache_size) {
+			cache->writeback_cursor = 0;
+			continue;
+		}
+		cache->writeback_cursor = cblock + 1;
+
+		spin_lock_irqsave(&cache->lock, flags);
+		r = cache->policy->cblock_to_oblock(cache->policy, cblock, &oblock);
+		if (r || __find_cell(cache, oblock)) {
+			spin_unlock_irqrestore(&cache->lock, flags);
+			if (r)
+				clear_dirty(cache, cblock);
+			continue;
+		}
+
+		mg = __new_migration(cache, &structs);
+		mg->writeback = 1;
+		mg->new_oblock = oblock;
+		mg->cblock = cblock;
+		mg->new_ocell = __new_cell(&structs);
+		__insert_cell(cache, mg->new_ocell, oblock, NULL);
+		spin_unlock_irqrestore(&cache->lock, flags);
+
+		quiesce_migration(cache, mg);
+	}
+
+	prealloc_free_structs(cache, &structs);
+}
+
+/*----------------------------------------------------------------*/
+
+static int need_commit_due_to_time(struct cache *cache)
+{
+	return jiffies < cache->last_commit_jiffies ||
+	       jiffies > cache->last_commit_jiffies + COMMIT_PERIOD;
+}
+
+/*
+ * Data copied by a migration must be on stable storage before the
+ * metadata that refers to it.
+ */
+static int flush_migrated_data(struct cache *cache)
+{
+	int r;
+
+	if (cache->cache_needs_flush) {
+		r = blkdev_issue_flush(cache->cache_dev->bdev, GFP_NOIO, NULL);
+		if (r)
+			return r;
+		cache->cache_needs_flush = 0;
+	}
+
+	if (cache->origin_needs_flush) {
+		r = blkdev_issue_flush(cache->origin_dev->bdev, GFP_NOIO, NULL);
+		if (r)
+			return r;
+		cache->origin_needs_flush = 0;
+	}
+
+	return 0;
+}
+
+static int commit(struct cache *cache)
+{
+	int r;
+
+	r = flush_migrated_data(cache);
+	if (r) {
+		DMERR("%s: flushing migrated data failed, error = %d",
+		      __func__, r);
+		return r;
+	}
+
+	r = dm_cache_commit(cache->cmd);
+	if (r) {
+		DMERR("%s: dm_cache_commit() failed, error = %d",
+		      __func__, r);
+		return r;
+	}
+	cache->last_commit_jiffies = jiffies;
+
+	return 0;
+}
+
+/*
+ * If there are any deferred flush bios, or migrations waiting on a
+ * commit, we must commit the metadata before issuing them.
+ */
+static void process_deferred_flush_bios(struct cache *cache)
+{
+	unsigned long flags;
+	struct bio_list bios;
+	struct bio *bio;
+	struct list_head migrations;
+	struct dm_cache_migration *mg, *tmp;
+	int r;
+
+	bio_list_init(&bios);
+	INIT_LIST_HEAD(&migrations);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&bios, &cache->deferred_flush_bios);
+	bio_list_init(&cache->deferred_flush_bios);
+	list_splice_init(&cache->need_commit_migrations, &migrations);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	if (bio_list_empty(&bios) && list_empty(&migrations) &&
+	    !need_commit_due_to_time(cache))
+		return;
+
+	r = commit(cache);
+	if (r) {
+		while ((bio = bio_list_pop(&bios)))
+			bio_io_error(bio);
+
+		list_for_each_entry_safe(mg, tmp, &migrations, list) {
+			mg->err = r;
+			migration_failure(mg);
+		}
+		return;
+	}
+
+	while ((bio = bio_list_pop(&bios)))
+		generic_make_request(bio);
+
+	/*
+	 * The demotions are now on disk, go on to the promotions.
+	 */
+	list_for_each_entry_safe(mg, tmp, &migrations, list)
+		issue_copy(mg);
+}
+
+static void do_worker(struct work_struct *ws)
+{
+	struct cache *cache = container_of(ws, struct cache, worker);
+
+	process_deferred_bios(cache);
+	process_migrations(cache, &cache->quiesced_migrations, issue_copy);
+	process_migrations(cache, &cache->completed_migrations, complete_migration);
+	writeback_some_dirty_blocks(cache);
+	process_deferred_writethrough_bios(cache);
+	process_deferred_flush_bios(cache);
+}
+
+/*
+ * We want to commit periodically so that not too much
+ * unwritten metadata builds up.
+ */
+static void do_waker(struct work_struct *ws)
+{
+	unsigned long flags;
+	struct cache *cache = container_of(to_delayed_work(ws), struct cache, waker);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	cache->policy->tick(cache->policy);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+	queue_delayed_work(cache->wq, &cache->waker, COMMIT_PERIOD);
+}
+
+/*----------------------------------------------------------------
+ * Target methods
+ *--------------------------------------------------------------*/
+
+static sector_t get_dev_size(struct dm_dev *dev)
+{
+	return i_size_read(dev->bdev->bd_inode) >> SECTOR_SHIFT;
+}
+
+static void destroy(struct cache *cache)
+{
+	if (cache->policy)
+		dm_cache_policy_destroy(cache->policy);
+
+	if (cache->cmd)
+		dm_cache_metadata_close(cache->cmd);
+
+	if (cache->wq)
+		destroy_workqueue(cache->wq);
+
+	if (cache->copier)
+		dm_kcopyd_client_destroy(cache->copier);
+
+	if (cache->writethrough_pool)
+		mempool_destroy(cache->writethrough_pool);
+	if (cache->cell_pool)
+		mempool_destroy(cache->cell_pool);
+	if (cache->migration_pool)
+		mempool_destroy(cache->migration_pool);
+	if (cache->endio_hook_pool)
+		mempool_destroy(cache->endio_hook_pool);
+
+	vfree(cache->dirty_bitset);
+
+	if (cache->cache_dev)
+		dm_put_device(cache->ti, cache->cache_dev);
+	if (cache->origin_dev)
+		dm_put_device(cache->ti, cache->origin_dev);
+	if (cache->metadata_dev)
+		dm_put_device(cache->ti, cache->metadata_dev);
+
+	kfree(cache);
+}
+
+static void cache_dtr(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	destroy(cache);
+}
+
+static int parse_features(struct cache *cache, struct dm_arg_set *as)
+{
+	int r;
+	unsigned argc;
+	const char *arg;
+	struct dm_target *ti = cache->ti;
+
+	static struct dm_arg _args[] = {
+		{0, 1, "Invalid number of cache feature arguments"},
+	};
+
+	cache->mode = CM_WRITEBACK;
+
+	r = dm_read_arg_group(_args, as, &argc, &ti->error);
+	if (r)
+		return -EINVAL;
+
+	while (argc--) {
+		arg = dm_shift_arg(as);
+
+		if (!strcasecmp(arg, "writeback"))
+			cache->mode = CM_WRITEBACK;
+		else if (!strcasecmp(arg, "writethrough"))
+			cache->mode = CM_WRITETHROUGH;
+		else {
+			ti->error = "Unrecognised cache feature requested";
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int parse_policy(struct cache *cache, struct dm_arg_set *as)
+{
+	int r;
+	unsigned argc;
+	const char *key, *value;
+	struct dm_target *ti = cache->ti;
+
+	static struct dm_arg _args[] = {
+		{0, 1024, "Invalid number of policy arguments"},
+	};
+
+	if (!as->argc) {
+		ti->error = "Cache policy not specified";
+		return -EINVAL;
+	}
+
+	cache->policy = dm_cache_policy_create(dm_shift_arg(as), cache->cache_size,
+					       cache->origin_blocks << cache->block_shift,
+					       cache->sectors_per_block);
+	if (IS_ERR(cache->policy)) {
+		r = PTR_ERR(cache->policy);
+		cache->policy = NULL;
+		ti->error = "Error creating cache's policy";
+		return r;
+	}
+
+	r = dm_read_arg_group(_args, as, &argc, &ti->error);
+	if (r)
+		return -EINVAL;
+
+	if (argc & 1) {
+		ti->error = "Policy arguments must be <key> <value> pairs";
+		return -EINVAL;
+	}
+
+	while (argc) {
+		key = dm_shift_arg(as);
+		value = dm_shift_arg(as);
+		argc -= 2;
+
+		r = cache->policy->set_config_value(cache->policy, key, value);
+		if (r) {
+			ti->error = "Error setting cache policy's config value";
+			return r;
+		}
+	}
+
+	return 0;
+}
+
+static int load_mapping(void *context, dm_oblock_t oblock,
+			dm_cblock_t cblock, bool dirty)
+{
+	int r;
+	struct cache *cache = context;
+
+	if (oblock >= cache->origin_blocks) {
+		DMERR("mapping for cache block %u is beyond the origin device",
+		      cblock);
+		return -EINVAL;
+	}
+
+	r = cache->policy->load_mapping(cache->policy, oblock, cblock);
+	if (r)
+		return r;
+
+	if (dirty)
+		set_dirty(cache, cblock);
+
+	return 0;
+}
+
+static int create_cache_resources(struct cache *cache)
+{
+	struct dm_target *ti = cache->ti;
+	unsigned i;
+
+	cache->dirty_bitset = vzalloc(BITS_TO_LONGS(cache->cache_size) *
+				      sizeof(unsigned long));
+	if (!cache->dirty_bitset) {
+		ti->error = "Error allocating dirty bitset";
+		return -ENOMEM;
+	}
+
+	cache->endio_hook_pool = mempool_create_slab_pool(ENDIO_HOOK_POOL_SIZE,
+							  _endio_hook_cache);
+	if (!cache->endio_hook_pool) {
+		ti->error = "Error creating cache's endio_hook mempool";
+		return -ENOMEM;
+	}
+
+	cache->migration_pool = mempool_create_slab_pool(MIGRATION_POOL_SIZE,
+							 _migration_cache);
+	if (!cache->migration_pool) {
+		ti->error = "Error creating cache's migration mempool";
+		return -ENOMEM;
+	}
+
+	cache->cell_pool = mempool_create_slab_pool(CELL_POOL_SIZE, _cell_cache);
+	if (!cache->cell_pool) {
+		ti->error = "Error creating cache's cell mempool";
+		return -ENOMEM;
+	}
+
+	cache->writethrough_pool = mempool_create_kmalloc_pool(WRITETHROUGH_POOL_SIZE,
+							       sizeof(struct dm_bio_details));
+	if (!cache->writethrough_pool) {
+		ti->error = "Error creating cache's writethrough mempool";
+		return -ENOMEM;
+	}
+
+	cache->copier = dm_kcopyd_client_create();
+	if (IS_ERR(cache->copier)) {
+		int r = PTR_ERR(cache->copier);
+
+		cache->copier = NULL;
+		ti->error = "Error creating cache's kcopyd client";
+		return r;
+	}
+
+	cache->wq = alloc_ordered_workqueue("dm-" DM_MSG_PREFIX, WQ_MEM_RECLAIM);
+	if (!cache->wq) {
+		ti->error = "Error creating cache's workqueue";
+		return -ENOMEM;
+	}
+
+	INIT_WORK(&cache->worker, do_worker);
+	INIT_DELAYED_WORK(&cache->waker, do_waker);
+	spin_lock_init(&cache->lock);
+	bio_list_init(&cache->deferred_bios);
+	bio_list_init(&cache->deferred_flush_bios);
+	bio_list_init(&cache->deferred_writethrough_bios);
+	INIT_LIST_HEAD(&cache->quiesced_migrations);
+	INIT_LIST_HEAD(&cache->completed_migrations);
+	INIT_LIST_HEAD(&cache->need_commit_migrations);
+	for (i = 0; i < CELL_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(cache->cells + i);
+	atomic_set(&cache->nr_migrations, 0);
+	init_waitqueue_head(&cache->migration_wait);
+	atomic_set(&cache->nr_dirty, 0);
+	ds_init(&cache->all_io_ds);
+
+	atomic_set(&cache->stats.read_hit, 0);
+	atomic_set(&cache->stats.read_miss, 0);
+	atomic_set(&cache->stats.write_hit, 0);
+	atomic_set(&cache->stats.write_miss, 0);
+	atomic_set(&cache->stats.demotion, 0);
+	atomic_set(&cache->stats.promotion, 0);
+	atomic_set(&cache->stats.writeback, 0);
+
+	cache->last_commit_jiffies = jiffies;
+
+	return 0;
+}
+
+/*
+ * cache <metadata dev> <cache dev> <origin dev> <block size (sectors)>
+ *       <#feature args> [<feature arg>]*
+ *       <policy> <#policy args> [<key> <value>]*
+ *
+ * Optional feature arguments are:
+ *       writeback: write hits only go to the cache (the default).
+ *       writethrough: write hits go to the origin and the cache.
+ */
+static int cache_ctr(struct dm_target *ti, unsigned argc, char **argv)
+{
+	int r;
+	struct cache *cache;
+	struct dm_arg_set as;
+	unsigned long block_size;
+	sector_t metadata_dev_size;
+	char b[BDEVNAME_SIZE];
+
+	if (argc < 7) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache) {
+		ti->error = "Error allocating memory for cache";
+		return -ENOMEM;
+	}
+	cache->ti = ti;
+	ti->private = cache;
+
+	r = dm_get_device(ti, argv[0], FMODE_READ | FMODE_WRITE,
+			  &cache->metadata_dev);
+	if (r) {
+		ti->error = "Error opening metadata device";
+		goto bad;
+	}
+
+	metadata_dev_size = get_dev_size(cache->metadata_dev);
+	if (metadata_dev_size > DM_CACHE_METADATA_MAX_SECTORS_WARNING)
+		DMWARN("Metadata device %s is larger than %u sectors: excess space will not be used.",
+		       bdevname(cache->metadata_dev->bdev, b),
+		       DM_CACHE_METADATA_MAX_SECTORS);
+
+	r = dm_get_device(ti, argv[1], FMODE_READ | FMODE_WRITE,
+			  &cache->cache_dev);
+	if (r) {
+		ti->error = "Error opening cache device";
+		goto bad;
+	}
+
+	r = dm_get_device(ti, argv[2], FMODE_READ | FMODE_WRITE,
+			  &cache->origin_dev);
+	if (r) {
+		ti->error = "Error opening origin device";
+		goto bad;
+	}
+
+	if (ti->len > get_dev_size(cache->origin_dev)) {
+		ti->error = "Device size larger than origin device";
+		r = -EINVAL;
+		goto bad;
+	}
+
+	if (kstrtoul(argv[3], 10, &block_size) || !block_size ||
+	    block_size < DATA_DEV_BLOCK_SIZE_MIN_SECTORS ||
+	    block_size > DATA_DEV_BLOCK_SIZE_MAX_SECTORS ||
+	    !is_power_of_2(block_size)) {
+		ti->error = "Invalid block size";
+		r = -EINVAL;
+		goto bad;
+	}
+
+	cache->sectors_per_block = block_size;
+	cache->block_shift = ffs(block_size) - 1;
+	cache->offset_mask = block_size - 1;
+	cache->origin_blocks = ti->len >> cache->block_shift;
+	cache->cache_size = get_dev_size(cache->cache_dev) >> cache->block_shift;
+	if (!cache->cache_size) {
+		ti->error = "Cache device smaller than one block";
+		r = -EINVAL;
+		goto bad;
+	}
+
+	as.argc = argc;
+	as.argv = argv;
+	dm_consume_args(&as, 4);
+
+	r = parse_features(cache, &as);
+	if (r)
+		goto bad;
+
+	r = create_cache_resources(cache);
+	if (r)
+		goto bad;
+
+	r = parse_policy(cache, &as);
+	if (r)
+		goto bad;
+
+	if (as.argc) {
+		ti->error = "Too many arguments";
+		r = -EINVAL;
+		goto bad;
+	}
+
+	cache->cmd = dm_cache_metadata_open(cache->metadata_dev->bdev,
+					    cache->sectors_per_block,
+					    cache->cache_size);
+	if (IS_ERR(cache->cmd)) {
+		r = PTR_ERR(cache->cmd);
+		cache->cmd = NULL;
+		ti->error = "Error opening metadata";
+		goto bad;
+	}
+
+	r = dm_cache_load_mappings(cache->cmd, load_mapping, cache);
+	if (r) {
+		ti->error = "Error loading cache mappings";
+		goto bad;
+	}
+
+	ti->split_io = cache->sectors_per_block;
+	ti->num_flush_requests = 2;
+
+	return 0;
+
+bad:
+	destroy(cache);
+	return r;
+}
+
+static int cache_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	int r;
+	unsigned long flags;
+	bool writethrough;
+	struct cache *cache = ti->private;
+	dm_oblock_t oblock;
+	struct dm_cache_cell *cell;
+	struct policy_result lookup_result;
+
+	bio->bi_sector = dm_target_offset(ti, bio->bi_sector);
+	map_context->ptr = hook_bio(cache, bio);
+
+	/*
+	 * Flushes are sent to both devices, once the metadata has been
+	 * committed.
+	 */
+	if (bio->bi_rw & REQ_FLUSH) {
+		BUG_ON(bio->bi_size);
+		if (map_context->target_request_nr)
+			bio->bi_bdev = cache->cache_dev->bdev;
+		else
+			remap_to_origin(cache, bio);
+		issue(cache, bio);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	if (bio->bi_rw & REQ_FUA) {
+		defer_bio(cache, bio);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	if (is_uncacheable(cache, bio)) {
+		remap_uncacheable(cache, bio);
+		return DM_MAPIO_REMAPPED;
+	}
+
+	oblock = get_bio_block(cache, bio);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	cell = __find_cell(cache, oblock);
+	if (cell) {
+		bio_list_add(&cell->bios, bio);
+		spin_unlock_irqrestore(&cache->lock, flags);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	r = cache->policy->map(cache->policy, oblock, false,
+			       bio_data_dir(bio), &lookup_result);
+	if (r == -EWOULDBLOCK) {
+		/*
+		 * The policy wants to migrate the block, which has to be
+		 * done from the worker.
+		 */
+		spin_unlock_irqrestore(&cache->lock, flags);
+		defer_bio(cache, bio);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	writethrough = __remap_bio(cache, bio, &lookup_result);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	if (writethrough)
+		remap_writethrough(cache, bio);
+
+	return DM_MAPIO_REMAPPED;
+}
+
+static int cache_end_io(struct dm_target *ti, struct bio *bio,
+			int err, union map_info *map_context)
+{
+	unsigned long flags;
+	struct cache *cache = ti->private;
+	struct dm_cache_endio_hook *h = map_context->ptr;
+	struct list_head work;
+	struct dm_cache_migration *mg, *tmp;
+
+	if (h->details) {
+		if (!err) {
+			/*
+			 * The origin has the data, now write it to the
+			 * cache.  The io accounting entry stays held until
+			 * that completes.
+			 */
+			dm_bio_restore(h->details, bio);
+			mempool_free(h->details, cache->writethrough_pool);
+			h->details = NULL;
+
+			spin_lock_irqsave(&cache->lock, flags);
+			bio_list_add(&cache->deferred_writethrough_bios, bio);
+			spin_unlock_irqrestore(&cache->lock, flags);
+			wake_worker(cache);
+
+			return DM_ENDIO_INCOMPLETE;
+		}
+
+		mempool_free(h->details, cache->writethrough_pool);
+	}
+
+	if (h->all_io_entry) {
+		INIT_LIST_HEAD(&work);
+		ds_dec(h->all_io_entry, &work);
+
+		spin_lock_irqsave(&cache->lock, flags);
+		list_for_each_entry_safe(mg, tmp, &work, list)
+			__queue_migration(cache, mg, &cache->quiesced_migrations);
+		spin_unlock_irqrestore(&cache->lock, flags);
+	}
+
+	mempool_free(h, cache->endio_hook_pool);
+
+	return 0;
+}
+
+static void cache_presuspend(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	cache->quiescing = 1;
+}
+
+static int write_dirty_bits(struct cache *cache)
+{
+	int r;
+	dm_cblock_t cblock;
+
+	for (cblock = 0; cblock < cache->cache_size; cblock++) {
+		r = dm_cache_set_dirty(cache->cmd, cblock, is_dirty(cache, cblock));
+		if (r && r != -ENODATA)
+			return r;
+	}
+
+	return 0;
+}
+
+/*
+ * Once all io and migrations have drained, the dirty state is written
+ * to the metadata and the clean shutdown flag set.
+ */
+static void cache_postsuspend(struct dm_target *ti)
+{
+	int r;
+	struct cache *cache = ti->private;
+
+	cancel_delayed_work_sync(&cache->waker);
+	wait_event(cache->migration_wait, !atomic_read(&cache->nr_migrations));
+	flush_workqueue(cache->wq);
+
+	r = write_dirty_bits(cache);
+	if (r) {
+		DMERR("%s: could not write dirty bits, error = %d", __func__, r);
+		return;
+	}
+
+	cache->cache_needs_flush = 1;
+	cache->origin_needs_flush = 1;
+	r = flush_migrated_data(cache);
+	if (r) {
+		DMERR("%s: flushing data failed, error = %d", __func__, r);
+		return;
+	}
+
+	dm_cache_set_clean_shutdown(cache->cmd, true);
+	r = commit(cache);
+	if (r)
+		DMERR("%s: could not record clean shutdown", __func__);
+}
+
+/*
+ * The clean shutdown flag must be cleared on disk before any io is
+ * allowed through, otherwise a crash would lose track of dirty blocks.
+ */
+static int cache_preresume(struct dm_target *ti)
+{
+	int r;
+	struct cache *cache = ti->private;
+
+	dm_cache_set_clean_shutdown(cache->cmd, false);
+	r = dm_cache_commit(cache->cmd);
+	if (r)
+		DMERR("%s: dm_cache_commit() failed, error = %d", __func__, r);
+
+	return r;
+}
+
+static void cache_resume(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	cache->quiescing = 0;
+	cache->last_commit_jiffies = jiffies;
+	do_waker(&cache->waker.work);
+}
+
+/*
+ * Status format:
+ *
+ * <used metadata blocks>/<total metadata blocks>
+ * <read hits> <read misses> <write hits> <write misses>
+ * <demotions> <promotions> <writebacks>
+ * <used cache blocks>/<total cache blocks> <dirty blocks>
+ * <mode> <policy name> <#policy args> <policy args>*
+ */
+static int cache_status(struct dm_target *ti, status_type_t type,
+			char *result, unsigned maxlen)
+{
+	int r;
+	ssize_t sz = 0;
+	unsigned long flags;
+	dm_block_t nr_free_blocks_metadata, nr_blocks_metadata;
+	dm_cblock_t residency;
+	char buf[BDEVNAME_SIZE];
+	struct cache *cache = ti->private;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		r = dm_cache_get_free_metadata_block_count(cache->cmd,
+							   &nr_free_blocks_metadata);
+		if (r)
+			return r;
+
+		r = dm_cache_get_metadata_dev_size(cache->cmd, &nr_blocks_metadata);
+		if (r)
+			return r;
+
+		spin_lock_irqsave(&cache->lock, flags);
+		residency = cache->policy->residency(cache->policy);
+		spin_unlock_irqrestore(&cache->lock, flags);
+
+		DMEMIT("%llu/%llu %u %u %u %u %u %u %u %u/%u %u ",
+		       (unsigned long long)(nr_blocks_metadata - nr_free_blocks_metadata),
+		       (unsigned long long)nr_blocks_metadata,
+		       (unsigned) atomic_read(&cache->stats.read_hit),
+		       (unsigned) atomic_read(&cache->stats.read_miss),
+		       (unsigned) atomic_read(&cache->stats.write_hit),
+		       (unsigned) atomic_read(&cache->stats.write_miss),
+		       (unsigned) atomic_read(&cache->stats.demotion),
+		       (unsigned) atomic_read(&cache->stats.promotion),
+		       (unsigned) atomic_read(&cache->stats.writeback),
+		       residency, cache->cache_size,
+		       (unsigned) atomic_read(&cache->nr_dirty));
+
+		DMEMIT("%s %s ",
+		       cache->mode == CM_WRITETHROUGH ? "writethrough" : "writeback",
+		       dm_cache_policy_get_name(cache->policy));
+
+		spin_lock_irqsave(&cache->lock, flags);
+		r = cache->policy->emit_config_values(cache->policy, result + sz,
+						      maxlen - sz);
+		spin_unlock_irqrestore(&cache->lock, flags);
+		if (r)
+			return r;
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s ", format_dev_t(buf, cache->metadata_dev->bdev->bd_dev));
+		DMEMIT("%s ", format_dev_t(buf, cache->cache_dev->bdev->bd_dev));
+		DMEMIT("%s ", format_dev_t(buf, cache->origin_dev->bdev->bd_dev));
+		DMEMIT("%lu 1 %s %s ", (unsigned long)cache->sectors_per_block,
+		       cache->mode == CM_WRITETHROUGH ? "writethrough" : "writeback",
+		       dm_cache_policy_get_name(cache->policy));
+
+		spin_lock_irqsave(&cache->lock, flags);
+		r = cache->policy->emit_config_values(cache->policy, result + sz,
+						      maxlen - sz);
+		spin_unlock_irqrestore(&cache->lock, flags);
+		if (r)
+			return r;
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * Supports <key> <value>, passed on to the policy.
+ */
+static int cache_message(struct dm_target *ti, unsigned argc, char **argv)
+{
+	int r;
+	unsigned long flags;
+	struct cache *cache = ti->private;
+
+	if (argc != 2) {
+		DMWARN("Message received with %u arguments instead of 2.", argc);
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&cache->lock, flags);
+	r = cache->policy->set_config_value(cache->policy, argv[0], argv[1]);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	if (r)
+		DMWARN("Unrecognised cache message received.");
+
+	return r;
+}
+
+static int cache_iterate_devices(struct dm_target *ti,
+				 iterate_devices_callout_fn fn, void *data)
+{
+	int r;
+	struct cache *cache = ti->private;
+
+	r = fn(ti, cache->cache_dev, 0, get_dev_size(cache->cache_dev), data);
+	if (!r)
+		r = fn(ti, cache->origin_dev, 0, ti->len, data);
+
+	return r;
+}
+
+static void cache_io_hints(struct dm_target *ti, struct queue_limits *limits)
+{
+	struct cache *cache = ti->private;
+
+	blk_limits_io_min(limits, 0);
+	blk_limits_io_opt(limits, cache->sectors_per_block << SECTOR_SHIFT);
+}
+
+static struct target_type cache_target = {
+	.name = "cache",
+	.version = {1, 0, 0},
+	.module = THIS_MODULE,
+	.ctr = cache_ctr,
+	.dtr = cache_dtr,
+	.map = cache_map,
+	.end_io = cache_end_io,
+	.presuspend = cache_presuspend,
+	.postsuspend = cache_postsuspend,
+	.preresume = cache_preresume,
+	.resume = cache_resume,
+	.status = cache_status,
+	.message = cache_message,
+	.iterate_devices = cache_iterate_devices,
+	.io_hints = cache_io_hints,
+};
+
+/*----------------------------------------------------------------*/
+
+static int __init dm_cache_init(void)
+{
+	int r;
+
+	r = dm_register_target(&cache_target);
+	if (r) {
+		DMERR("cache target registration failed: %d", r);
+		return r;
+	}
+
+	r = -ENOMEM;
+
+	_endio_hook_cache = KMEM_CACHE(dm_cache_endio_hook, 0);
+	if (!_endio_hook_cache)
+		goto bad_endio_hook_cache;
+
+	_migration_cache = KMEM_CACHE(dm_cache_migration, 0);
+	if (!_migration_cache)
+		goto bad_migration_cache;
+
+	_cell_cache = KMEM_CACHE(dm_cache_cell, 0);
+	if (!_cell_cache)
+		goto bad_cell_cache;
+
+	return 0;
+
+bad_cell_cache:
+	kmem_cache_destroy(_migration_cache);
+bad_migration_cache:
+	kmem_cache_destroy(_endio_hook_cache);
+bad_endio_hook_cache:
+	dm_unregister_target(&cache_target);
+
+	return r;
+}
+
+static void __exit dm_cache_exit(void)
+{
+	dm_unregister_target(&cache_target);
+
+	kmem_cache_destroy(_endio_hook_cache);
+	kmem_cache_destroy(_migration_cache);
+	kmem_cache_destroy(_cell_cache);
+}
+
+module_init(dm_cache_init);
+module_exit(dm_cache_exit);
+
+MODULE_DESCRIPTION(DM_NAME " cache target");
+MODULE_LICENSE("GPL");
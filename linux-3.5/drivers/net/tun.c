@@ -64,6 +64,8 @@
 #include <linux/nsproxy.h>
 #include <linux/virtio_net.h>
 #include <linux/rcupdate.h>
+#include <linux/filter.h>
+#include <linux/bpf.h>
 #include <net/net_namespace.h>
 #include <net/netns/generic.h>
 #include <net/rtnetlink.h>
@@ -133,6 +135,9 @@ struct tun_struct {
 
 	int			vnet_hdr_sz;
 
+	/* XDP program run on frames written by userspace (TAP only) */
+	struct sk_filter __rcu	*xdp_prog;
+
 #ifdef TUN_DEBUG
 	int debug;
 #endif
@@ -357,6 +362,12 @@ static void tun_net_uninit(struct net_device *dev)
 static void tun_free_netdev(struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
+	struct sk_filter *xdp_prog;
+
+	/* The device is gone, nothing can run the program any more. */
+	xdp_prog = rcu_dereference_protected(tun->xdp_prog, 1);
+	if (xdp_prog)
+		sk_filter_release(xdp_prog);
 
 	sk_release_kernel(tun->socket.sk);
 }
@@ -376,9 +387,19 @@ static int tun_net_close(struct net_device *dev)
 }
 
 /* Net device start xmit */
+/* Notify and wake up reader process */
+static void tun_notify_reader(struct tun_struct *tun)
+{
+	if (tun->flags & TUN_FASYNC)
+		kill_fasync(&tun->fasync, SIGIO, POLL_IN);
+	wake_up_interruptible_poll(&tun->wq.wait, POLLIN |
+				   POLLRDNORM | POLLRDBAND);
+}
+
 static netdev_tx_t tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
+	bool more = skb->xmit_more;
 
 	tun_debug(KERN_INFO, tun, "tun_net_xmit %d\n", skb->len);
 
@@ -419,16 +440,19 @@ static netdev_tx_t tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 	/* Enqueue packet */
 	skb_queue_tail(&tun->socket.sk->sk_receive_queue, skb);
 
-	/* Notify and wake up reader process */
-	if (tun->flags & TUN_FASYNC)
-		kill_fasync(&tun->fasync, SIGIO, POLL_IN);
-	wake_up_interruptible_poll(&tun->wq.wait, POLLIN |
-				   POLLRDNORM | POLLRDBAND);
+	/* The reader is woken once for a whole batch of packets, unless
+	 * the queue was just stopped and no more can come.
+	 */
+	if (!more || netif_queue_stopped(dev))
+		tun_notify_reader(tun);
 	return NETDEV_TX_OK;
 
 drop:
 	dev->stats.tx_dropped++;
 	kfree_skb(skb);
+	/* packets queued earlier in the batch still need their wakeup */
+	if (!more)
+		tun_notify_reader(tun);
 	return NETDEV_TX_OK;
 }
 
@@ -460,6 +484,26 @@ static netdev_features_t tun_net_fix_features(struct net_device *dev,
 
 	return (features & tun->set_features) | (features & ~TUN_USER_FEATURES);
 }
+static int tun_xdp(struct net_device *dev, struct netdev_xdp *xdp)
+{
+	struct tun_struct *tun = netdev_priv(dev);
+	struct sk_filter *old_prog;
+
+	switch (xdp->command) {
+	case XDP_SETUP_PROG:
+		old_prog = rtnl_dereference(tun->xdp_prog);
+		rcu_assign_pointer(tun->xdp_prog, xdp->prog);
+		if (old_prog)
+			sk_filter_release(old_prog);
+		return 0;
+	case XDP_QUERY_PROG:
+		xdp->prog_attached = !!rtnl_dereference(tun->xdp_prog);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
 #ifdef CONFIG_NET_POLL_CONTROLLER
 static void tun_poll_controller(struct net_device *dev)
 {
@@ -502,6 +546,7 @@ static const struct net_device_ops tap_netdev_ops = {
 #ifdef CONFIG_NET_POLL_CONTROLLER
 	.ndo_poll_controller	= tun_poll_controller,
 #endif
+	.ndo_xdp		= tun_xdp,
 };
 
 /* Initialize net device. */
@@ -600,6 +645,50 @@ static struct sk_buff *tun_alloc_skb(struct tun_struct *tun,
 	return skb;
 }
 
+/*
+ * Run the XDP program on a linear frame freshly copied from userspace,
+ * before it is handed to the stack.  Returns true if the program
+ * consumed the frame.
+ */
+static bool tun_receive_xdp(struct tun_struct *tun, struct sk_buff *skb)
+{
+	struct netdev_queue *txq;
+	struct sk_filter *xdp_prog;
+	struct xdp_buff xdp;
+	u32 act = XDP_PASS;
+
+	rcu_read_lock();
+	xdp_prog = rcu_dereference(tun->xdp_prog);
+	if (xdp_prog) {
+		xdp.data = skb->data;
+		xdp.data_end = skb->data + skb->len;
+		act = bpf_prog_run_xdp(xdp_prog, &xdp);
+	}
+	rcu_read_unlock();
+
+	switch (act) {
+	case XDP_PASS:
+		return false;
+	case XDP_TX:
+		/* Bounce it straight back to the reader. */
+		skb->dev = tun->dev;
+		skb_reset_mac_header(skb);
+		skb->protocol = eth_hdr(skb)->h_proto;
+		txq = netdev_get_tx_queue(tun->dev, 0);
+		__netif_tx_lock_bh(txq);
+		tun_net_xmit(skb, tun->dev);
+		__netif_tx_unlock_bh(txq);
+		return true;
+	default:
+		bpf_warn_invalid_xdp_action(act);
+	case XDP_ABORTED:
+	case XDP_DROP:
+		tun->dev->stats.rx_dropped++;
+		kfree_skb(skb);
+		return true;
+	}
+}
+
 /* Get packet from user space buffer */
 static ssize_t tun_get_user(struct tun_struct *tun,
 			    const struct iovec *iv, size_t count,
@@ -665,6 +754,14 @@ static ssize_t tun_get_user(struct tun_struct *tun,
 		}
 	}
 
+	/* Only linear, non-GSO frames are shown to an XDP program. */
+	if ((tun->flags & TUN_TYPE_MASK) == TUN_TAP_DEV &&
+	    gso.gso_type == VIRTIO_NET_HDR_GSO_NONE &&
+	    !skb_is_nonlinear(skb) && rcu_access_pointer(tun->xdp_prog)) {
+		if (tun_receive_xdp(tun, skb))
+			return count;
+	}
+
 	switch (tun->flags & TUN_TYPE_MASK) {
 	case TUN_TUN_DEV:
 		if (tun->flags & TUN_NO_PI) {
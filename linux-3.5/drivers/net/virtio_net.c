@@ -26,6 +26,10 @@
 #include <linux/scatterlist.h>
 #include <linux/if_vlan.h>
 #include <linux/slab.h>
+#include <linux/filter.h>
+#include <linux/bpf.h>
+#include <net/busy_poll.h>
+#include <net/page_pool.h>
 
 static int napi_weight = 128;
 module_param(napi_weight, int, 0444);
@@ -70,6 +74,12 @@ struct virtnet_info {
 	/* enable config space updates */
 	bool config_enable;
 
+	/* XDP_TX frames were queued but the host was not kicked yet */
+	bool xdp_tx_pending;
+
+	/* XDP program run on every received frame, if any */
+	struct sk_filter __rcu *xdp_prog;
+
 	/* Active statistics */
 	struct virtnet_stats __percpu *stats;
 
@@ -85,6 +95,9 @@ struct virtnet_info {
 	/* Chain pages by the private ptr. */
 	struct page *pages;
 
+	/* Recycles receive pages freed by the stack */
+	struct page_pool *page_pool;
+
 	/* fragments + linear part + virtio header */
 	struct scatterlist rx_sg[MAX_SKB_FRAGS + 2];
 	struct scatterlist tx_sg[MAX_SKB_FRAGS + 2];
@@ -135,11 +148,21 @@ static struct page *get_a_page(struct virtnet_info *vi, gfp_t gfp_mask)
 		vi->pages = (struct page *)p->private;
 		/* clear private here, it is used to chain pages */
 		p->private = 0;
-	} else
-		p = alloc_page(gfp_mask);
+	} else {
+		p = page_pool_alloc_pages(vi->page_pool, gfp_mask);
+		/* a recycled page may still carry an old chain link */
+		if (p)
+			p->private = 0;
+	}
 	return p;
 }
 
+static void free_pages_list(struct virtnet_info *vi)
+{
+	while (vi->pages)
+		page_pool_put_page(vi->page_pool, get_a_page(vi, GFP_KERNEL));
+}
+
 static void skb_xmit_done(struct virtqueue *svq)
 {
 	struct virtnet_info *vi = svq->vdev->priv;
@@ -181,6 +204,7 @@ static struct sk_buff *page_to_skb(struct virtnet_info *vi,
 	skb = netdev_alloc_skb_ip_align(vi->dev, GOOD_COPY_LEN);
 	if (unlikely(!skb))
 		return NULL;
+	skb_mark_for_recycle(skb);
 
 	hdr = skb_vnet_hdr(skb);
 
@@ -262,6 +286,80 @@ static int receive_mergeable(struct virtnet_info *vi, struct sk_buff *skb)
 	return 0;
 }
 
+static bool virtnet_xdp_xmit(struct virtnet_info *vi, struct sk_buff *skb);
+
+/*
+ * Run the XDP program on a frame still sitting in its receive buffer.
+ * Returns true if the program consumed the frame (dropped or bounced
+ * it back out), false if it should continue up the stack.
+ */
+static bool receive_xdp(struct virtnet_info *vi, struct sk_filter *prog,
+			void *buf, unsigned int len)
+{
+	struct net_device *dev = vi->dev;
+	struct virtio_net_hdr_mrg_rxbuf *mhdr;
+	struct sk_buff *skb = NULL;
+	struct page *page = NULL;
+	struct xdp_buff xdp;
+	u32 act;
+
+	if (vi->mergeable_rx_bufs) {
+		page = buf;
+		mhdr = page_address(page);
+
+		/* Programs only ever see a single linear buffer.  Frames
+		 * spread over several are dropped; the MTU check done at
+		 * attach time keeps a sane host from sending them.
+		 */
+		if (unlikely(mhdr->num_buffers > 1)) {
+			skb = page_to_skb(vi, page, len);
+			if (!skb) {
+				give_pages(vi, page);
+			} else {
+				receive_mergeable(vi, skb);
+				dev_kfree_skb(skb);
+			}
+			dev->stats.rx_dropped++;
+			return true;
+		}
+		xdp.data = page_address(page) + sizeof(*mhdr);
+		xdp.data_end = xdp.data + len - sizeof(*mhdr);
+	} else {
+		skb = buf;
+		xdp.data = skb->data;
+		xdp.data_end = xdp.data + len - sizeof(struct virtio_net_hdr);
+	}
+
+	act = bpf_prog_run_xdp(prog, &xdp);
+	switch (act) {
+	case XDP_PASS:
+		return false;
+	case XDP_TX:
+		if (page) {
+			skb = page_to_skb(vi, page, len);
+			if (unlikely(!skb))
+				goto drop;
+		} else {
+			skb_trim(skb, len - sizeof(struct virtio_net_hdr));
+		}
+		virtnet_xdp_xmit(vi, skb);
+		return true;
+	default:
+		bpf_warn_invalid_xdp_action(act);
+	case XDP_ABORTED:
+	case XDP_DROP:
+		goto drop;
+	}
+
+drop:
+	dev->stats.rx_dropped++;
+	if (page)
+		give_pages(vi, page);
+	else
+		dev_kfree_skb(skb);
+	return true;
+}
+
 static void receive_buf(struct net_device *dev, void *buf, unsigned int len)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
@@ -269,6 +367,7 @@ static void receive_buf(struct net_device *dev, void *buf, unsigned int len)
 	struct sk_buff *skb;
 	struct page *page;
 	struct skb_vnet_hdr *hdr;
+	struct sk_filter *xdp_prog;
 
 	if (unlikely(len < sizeof(struct virtio_net_hdr) + ETH_HLEN)) {
 		pr_debug("%s: short packet %i\n", dev->name, len);
@@ -280,6 +379,14 @@ static void receive_buf(struct net_device *dev, void *buf, unsigned int len)
 		return;
 	}
 
+	rcu_read_lock();
+	xdp_prog = rcu_dereference(vi->xdp_prog);
+	if (xdp_prog && receive_xdp(vi, xdp_prog, buf, len)) {
+		rcu_read_unlock();
+		return;
+	}
+	rcu_read_unlock();
+
 	if (!vi->mergeable_rx_bufs && !vi->big_packets) {
 		skb = buf;
 		len -= sizeof(struct virtio_net_hdr);
@@ -355,6 +462,7 @@ static void receive_buf(struct net_device *dev, void *buf, unsigned int len)
 		skb_shinfo(skb)->gso_segs = 0;
 	}
 
+	skb_mark_napi_id(skb, &vi->napi);
 	netif_receive_skb(skb);
 	return;
 
@@ -508,6 +616,8 @@ static void virtnet_napi_enable(struct virtnet_info *vi)
 	}
 }
 
+static void virtnet_xdp_flush(struct virtnet_info *vi);
+
 static void refill_work(struct work_struct *work)
 {
 	struct virtnet_info *vi;
@@ -538,6 +648,9 @@ again:
 		received++;
 	}
 
+	if (vi->xdp_tx_pending)
+		virtnet_xdp_flush(vi);
+
 	if (vi->num < vi->max / 2) {
 		if (!try_fill_recv(vi, GFP_ATOMIC))
 			queue_delayed_work(system_nrt_wq, &vi->refill, 0);
@@ -557,6 +670,53 @@ again:
 	return received;
 }
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/* Packets to receive per busy poll call, so that one poll stays short. */
+#define VIRTNET_BUSY_POLL_BUDGET	4
+
+/* Called with bottom halves disabled */
+static int virtnet_busy_poll(struct napi_struct *napi)
+{
+	struct virtnet_info *vi = container_of(napi, struct virtnet_info, napi);
+	void *buf;
+	unsigned int len, received = 0;
+
+	/* Own the queue the way skb_recv_done() does.  If NAPI is already
+	 * scheduled or running, or disabled, it has the queue to itself.
+	 */
+	if (!napi_schedule_prep(napi))
+		return LL_FLUSH_BUSY;
+
+	while (received < VIRTNET_BUSY_POLL_BUDGET &&
+	       (buf = virtqueue_get_buf(vi->rvq, &len)) != NULL) {
+		receive_buf(vi->dev, buf, len);
+		--vi->num;
+		received++;
+	}
+
+	if (vi->xdp_tx_pending)
+		virtnet_xdp_flush(vi);
+
+	if (vi->num < vi->max / 2) {
+		if (!try_fill_recv(vi, GFP_ATOMIC))
+			queue_delayed_work(system_nrt_wq, &vi->refill, 0);
+	}
+
+	/* Give the queue back.  An interrupt that came in meanwhile found
+	 * NAPI scheduled and did nothing, so hand anything left to NAPI.
+	 */
+	smp_mb__before_clear_bit();
+	clear_bit(NAPI_STATE_SCHED, &napi->state);
+	if (unlikely(!virtqueue_enable_cb(vi->rvq)) &&
+	    napi_schedule_prep(napi)) {
+		virtqueue_disable_cb(vi->rvq);
+		__napi_schedule(napi);
+	}
+
+	return received;
+}
+#endif	/* CONFIG_NET_RX_BUSY_POLL */
+
 static unsigned int free_old_xmit_skbs(struct virtnet_info *vi)
 {
 	struct sk_buff *skb;
@@ -624,9 +784,57 @@ static int xmit_skb(struct virtnet_info *vi, struct sk_buff *skb)
 				 0, skb, GFP_ATOMIC);
 }
 
+/*
+ * Bounce a frame back out for XDP_TX.  There is a single send queue, so
+ * it is shared with the stack under the usual tx lock, and stopped the
+ * same way as start_xmit() does when it runs low.  The host is kicked
+ * once per poll by virtnet_xdp_flush().
+ */
+static bool virtnet_xdp_xmit(struct virtnet_info *vi, struct sk_buff *skb)
+{
+	struct netdev_queue *txq = netdev_get_tx_queue(vi->dev, 0);
+	int capacity;
+
+	__netif_tx_lock(txq, smp_processor_id());
+	free_old_xmit_skbs(vi);
+	capacity = xmit_skb(vi, skb);
+	if (likely(capacity >= 0)) {
+		vi->xdp_tx_pending = true;
+		if (capacity < 2+MAX_SKB_FRAGS) {
+			netif_stop_queue(vi->dev);
+			if (unlikely(!virtqueue_enable_cb_delayed(vi->svq))) {
+				capacity += free_old_xmit_skbs(vi);
+				if (capacity >= 2+MAX_SKB_FRAGS) {
+					netif_start_queue(vi->dev);
+					virtqueue_disable_cb(vi->svq);
+				}
+			}
+		}
+	}
+	__netif_tx_unlock(txq);
+
+	if (unlikely(capacity < 0)) {
+		vi->dev->stats.tx_dropped++;
+		dev_kfree_skb(skb);
+		return false;
+	}
+	return true;
+}
+
+static void virtnet_xdp_flush(struct virtnet_info *vi)
+{
+	struct netdev_queue *txq = netdev_get_tx_queue(vi->dev, 0);
+
+	__netif_tx_lock(txq, smp_processor_id());
+	virtqueue_kick(vi->svq);
+	__netif_tx_unlock(txq);
+	vi->xdp_tx_pending = false;
+}
+
 static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
+	bool kick = !skb->xmit_more;
 	int capacity;
 
 	/* Free up any pending old buffers before queueing new ones. */
@@ -650,9 +858,16 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 		}
 		dev->stats.tx_dropped++;
 		kfree_skb(skb);
+		/* buffers added earlier in the batch are still pending */
+		virtqueue_kick(vi->svq);
 		return NETDEV_TX_OK;
 	}
-	virtqueue_kick(vi->svq);
+
+	/* More packets are coming: the host is notified once for all of
+	 * them, or now if the queue is about to be stopped.
+	 */
+	if (kick || capacity < 2+MAX_SKB_FRAGS)
+		virtqueue_kick(vi->svq);
 
 	/* Don't wait up for transmitted skbs to be freed. */
 	skb_orphan(skb);
@@ -944,23 +1159,111 @@ static void virtnet_get_drvinfo(struct net_device *dev,
 
 }
 
+static int virtnet_get_sset_count(struct net_device *dev, int sset)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+
+	switch (sset) {
+	case ETH_SS_STATS:
+		return vi->page_pool ? page_pool_ethtool_stats_get_count() : 0;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void virtnet_get_strings(struct net_device *dev, u32 stringset, u8 *data)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+
+	if (stringset == ETH_SS_STATS && vi->page_pool)
+		page_pool_ethtool_stats_get_strings(data);
+}
+
+static void virtnet_get_ethtool_stats(struct net_device *dev,
+				      struct ethtool_stats *stats, u64 *data)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+	struct page_pool_stats pp_stats;
+
+	if (!vi->page_pool)
+		return;
+
+	memset(&pp_stats, 0, sizeof(pp_stats));
+	page_pool_get_stats(vi->page_pool, &pp_stats);
+	page_pool_ethtool_stats_get(data, &pp_stats);
+}
+
 static const struct ethtool_ops virtnet_ethtool_ops = {
 	.get_drvinfo = virtnet_get_drvinfo,
 	.get_link = ethtool_op_get_link,
 	.get_ringparam = virtnet_get_ringparam,
+	.get_sset_count = virtnet_get_sset_count,
+	.get_strings = virtnet_get_strings,
+	.get_ethtool_stats = virtnet_get_ethtool_stats,
 };
 
 #define MIN_MTU 68
 #define MAX_MTU 65535
 
+/* Largest MTU whose frames still fit one receive buffer */
+static int virtnet_xdp_max_mtu(struct virtnet_info *vi)
+{
+	if (vi->mergeable_rx_bufs)
+		return PAGE_SIZE - sizeof(struct virtio_net_hdr_mrg_rxbuf) -
+		       ETH_HLEN - VLAN_HLEN;
+	return MAX_PACKET_LEN - ETH_HLEN - VLAN_HLEN;
+}
+
 static int virtnet_change_mtu(struct net_device *dev, int new_mtu)
 {
+	struct virtnet_info *vi = netdev_priv(dev);
+
 	if (new_mtu < MIN_MTU || new_mtu > MAX_MTU)
 		return -EINVAL;
+	if (rtnl_dereference(vi->xdp_prog) &&
+	    new_mtu > virtnet_xdp_max_mtu(vi))
+		return -EINVAL;
 	dev->mtu = new_mtu;
 	return 0;
 }
 
+static int virtnet_xdp_set(struct net_device *dev, struct sk_filter *prog)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+	struct sk_filter *old_prog;
+
+	if (prog && vi->big_packets) {
+		netdev_warn(dev, "XDP is not supported with guest GSO offloads\n");
+		return -EOPNOTSUPP;
+	}
+	if (prog && dev->mtu > virtnet_xdp_max_mtu(vi)) {
+		netdev_warn(dev, "XDP requires MTU less than %d\n",
+			    virtnet_xdp_max_mtu(vi) + 1);
+		return -EINVAL;
+	}
+
+	old_prog = rtnl_dereference(vi->xdp_prog);
+	rcu_assign_pointer(vi->xdp_prog, prog);
+	if (old_prog)
+		sk_filter_release(old_prog);
+	return 0;
+}
+
+static int virtnet_xdp(struct net_device *dev, struct netdev_xdp *xdp)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+
+	switch (xdp->command) {
+	case XDP_SETUP_PROG:
+		return virtnet_xdp_set(dev, xdp->prog);
+	case XDP_QUERY_PROG:
+		xdp->prog_attached = !!rtnl_dereference(vi->xdp_prog);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
 static const struct net_device_ops virtnet_netdev = {
 	.ndo_open            = virtnet_open,
 	.ndo_stop   	     = virtnet_close,
@@ -975,6 +1278,10 @@ static const struct net_device_ops virtnet_netdev = {
 #ifdef CONFIG_NET_POLL_CONTROLLER
 	.ndo_poll_controller = virtnet_netpoll,
 #endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	.ndo_busy_poll       = virtnet_busy_poll,
+#endif
+	.ndo_xdp	     = virtnet_xdp,
 };
 
 static void virtnet_config_changed_work(struct work_struct *work)
@@ -1050,6 +1357,30 @@ static int init_vqs(struct virtnet_info *vi)
 	return 0;
 }
 
+static int virtnet_create_page_pool(struct virtnet_info *vi)
+{
+	struct page_pool_params pp = {
+		.order	= 0,
+		.nid	= dev_to_node(&vi->vdev->dev),
+	};
+	struct page_pool *pool;
+
+	/* Room to recycle every page the receive ring can hold; virtio
+	 * does not use the DMA API, so pages are not mapped by the pool.
+	 */
+	pp.pool_size = virtqueue_get_vring_size(vi->rvq);
+	if (!vi->mergeable_rx_bufs)
+		pp.pool_size *= MAX_SKB_FRAGS + 2;
+	pp.pool_size = min(pp.pool_size, 8192U);
+
+	pool = page_pool_create(&pp);
+	if (IS_ERR(pool))
+		return PTR_ERR(pool);
+
+	vi->page_pool = pool;
+	return 0;
+}
+
 static int virtnet_probe(struct virtio_device *vdev)
 {
 	int err;
@@ -1104,6 +1435,7 @@ static int virtnet_probe(struct virtio_device *vdev)
 	/* Set up our device-specific information */
 	vi = netdev_priv(dev);
 	netif_napi_add(dev, &vi->napi, virtnet_poll, napi_weight);
+	napi_hash_add(&vi->napi);
 	vi->dev = dev;
 	vi->vdev = vdev;
 	vdev->priv = vi;
@@ -1133,10 +1465,17 @@ static int virtnet_probe(struct virtio_device *vdev)
 	if (err)
 		goto free_stats;
 
+	/* Only big and mergeable buffers are built from pages. */
+	if (vi->big_packets || vi->mergeable_rx_bufs) {
+		err = virtnet_create_page_pool(vi);
+		if (err)
+			goto free_vqs;
+	}
+
 	err = register_netdev(dev);
 	if (err) {
 		pr_debug("virtio_net: registering device failed\n");
-		goto free_vqs;
+		goto free_pool;
 	}
 
 	/* Last of all, set up some receive buffers. */
@@ -1163,11 +1502,17 @@ static int virtnet_probe(struct virtio_device *vdev)
 
 unregister:
 	unregister_netdev(dev);
+free_pool:
+	if (vi->page_pool) {
+		free_pages_list(vi);
+		page_pool_destroy(vi->page_pool);
+	}
 free_vqs:
 	vdev->config->del_vqs(vdev);
 free_stats:
 	free_percpu(vi->stats);
 free:
+	napi_hash_del(&vi->napi);
 	free_netdev(dev);
 	return err;
 }
@@ -1203,22 +1548,31 @@ static void remove_vq_common(struct virtnet_info *vi)
 
 	vi->vdev->config->del_vqs(vi->vdev);
 
-	while (vi->pages)
-		__free_pages(get_a_page(vi, GFP_KERNEL), 0);
+	free_pages_list(vi);
 }
 
 static void __devexit virtnet_remove(struct virtio_device *vdev)
 {
 	struct virtnet_info *vi = vdev->priv;
+	struct sk_filter *xdp_prog;
 
 	/* Prevent config work handler from accessing the device. */
 	mutex_lock(&vi->config_lock);
 	vi->config_enable = false;
 	mutex_unlock(&vi->config_lock);
 
+	/* unregister_netdev() waits for busy pollers still using the napi */
+	napi_hash_del(&vi->napi);
 	unregister_netdev(vi->dev);
 
+	/* The device is gone, nothing can run the program any more. */
+	xdp_prog = rcu_dereference_protected(vi->xdp_prog, 1);
+	if (xdp_prog)
+		sk_filter_release(xdp_prog);
+
 	remove_vq_common(vi);
+	if (vi->page_pool)
+		page_pool_destroy(vi->page_pool);
 
 	flush_work(&vi->config_work);
 
@@ -64,7 +64,7 @@ static DEFINE_SPINLOCK(fput_lock);
 static LIST_HEAD(fput_head);
 
 static void aio_kick_handler(struct work_struct *);
-static void aio_queue_work(struct kioctx *);
+static void aio_queue_work(struct kioctx *, bool);
 
 /* aio_setup
  *	Creates the slab caches used by the aio routines, panic on
@@ -431,6 +431,8 @@ static struct kiocb *__aio_get_req(struct kioctx *ctx)
 	req->private = NULL;
 	req->ki_iovec = NULL;
 	INIT_LIST_HEAD(&req->ki_run_list);
+	INIT_LIST_HEAD(&req->ki_wait.wait.task_list);
+	req->ki_wait.key.flags = NULL;
 	req->ki_eventfd = NULL;
 
 	return req;
@@ -810,7 +812,8 @@ out:
 			 * be safe to unconditionally queue the context into the
 			 * work queue.
 			 */
-			aio_queue_work(ctx);
+			aio_queue_work(ctx, test_and_clear_bit(KIF_PAGE_WAIT,
+							       &iocb->ki_flags));
 		}
 	}
 	return ret;
@@ -847,15 +850,19 @@ static int __aio_run_iocbs(struct kioctx *ctx)
 	return 0;
 }
 
-static void aio_queue_work(struct kioctx * ctx)
+static void aio_queue_work(struct kioctx * ctx, bool now)
 {
 	unsigned long timeout;
 	/*
 	 * if someone is waiting, get the work started right
-	 * away, otherwise, use a longer delay
+	 * away, otherwise, use a longer delay.  A buffered read kicked
+	 * by a page unlock is retried straight away: its submitter may
+	 * poll an eventfd rather than sleep in io_getevents().
 	 */
 	smp_mb();
-	if (waitqueue_active(&ctx->wait))
+	if (now)
+		timeout = 0;
+	else if (waitqueue_active(&ctx->wait))
 		timeout = 1;
 	else
 		timeout = HZ/10;
@@ -919,6 +926,7 @@ static void try_queue_kicked_iocb(struct kiocb *iocb)
  	struct kioctx	*ctx = iocb->ki_ctx;
 	unsigned long flags;
 	int run = 0;
+	bool now = test_and_clear_bit(KIF_PAGE_WAIT, &iocb->ki_flags);
 
 	spin_lock_irqsave(&ctx->ctx_lock, flags);
 	/* set this inside the lock so that we can't race with aio_run_iocb()
@@ -927,7 +935,7 @@ static void try_queue_kicked_iocb(struct kiocb *iocb)
 		run = __queue_kicked_iocb(iocb);
 	spin_unlock_irqrestore(&ctx->ctx_lock, flags);
 	if (run)
-		aio_queue_work(ctx);
+		aio_queue_work(ctx, now);
 }
 
 /*
@@ -981,6 +989,15 @@ int aio_complete(struct kiocb *iocb, long res, long res2)
 		return 1;
 	}
 
+	/*
+	 * Kernel iocbs are owned by their submitter, which only wants to
+	 * hear about the result.
+	 */
+	if (is_kernel_kiocb(iocb)) {
+		iocb->ki_obj.complete(iocb, res);
+		return 1;
+	}
+
 	info = &ctx->ring_info;
 
 	/* add a completion event to the ring buffer.
@@ -153,6 +153,32 @@ static inline unsigned dio_pages_present(struct dio_submit *sdio)
 	return sdio->tail - sdio->head;
 }
 
+/*
+ * Kernel iocbs pass kernel virtual addresses of lowmem pages, which
+ * get_user_pages() can't pin. The submitter holds on to the pages for
+ * the duration of the I/O, we just need our own references.
+ */
+static int dio_get_kernel_pages(unsigned long addr, int nr_pages,
+				struct page **pages)
+{
+	int i;
+
+	for (i = 0; i < nr_pages; i++) {
+		pages[i] = virt_to_page(addr + i * PAGE_SIZE);
+		page_cache_get(pages[i]);
+	}
+	return nr_pages;
+}
+
+/*
+ * Pages read into are dirtied on completion, unless they belong to the
+ * kernel submitter: those may be page cache pages locked for the read.
+ */
+static inline int dio_should_dirty(struct dio *dio)
+{
+	return dio->rw == READ && !is_kernel_kiocb(dio->iocb);
+}
+
 /*
  * Go grab and pin some userspace pages.   Typically we'll get 64 at a time.
  */
@@ -162,11 +188,15 @@ static inline int dio_refill_pages(struct dio *dio, struct dio_submit *sdio)
 	int nr_pages;
 
 	nr_pages = min(sdio->total_pages - sdio->curr_page, DIO_PAGES);
-	ret = get_user_pages_fast(
-		sdio->curr_user_address,		/* Where from? */
-		nr_pages,			/* How many pages? */
-		dio->rw == READ,		/* Write to memory? */
-		&dio->pages[0]);		/* Put results here */
+	if (is_kernel_kiocb(dio->iocb))
+		ret = dio_get_kernel_pages(sdio->curr_user_address,
+					   nr_pages, &dio->pages[0]);
+	else
+		ret = get_user_pages_fast(
+			sdio->curr_user_address,	/* Where from? */
+			nr_pages,			/* How many pages? */
+			dio->rw == READ,		/* Write to memory? */
+			&dio->pages[0]);		/* Put results here */
 
 	if (ret < 0 && sdio->blocks_available && (dio->rw & WRITE)) {
 		struct page *page = ZERO_PAGE(0);
@@ -376,7 +406,7 @@ static inline void dio_bio_submit(struct dio *dio, struct dio_submit *sdio)
 	dio->refcount++;
 	spin_unlock_irqrestore(&dio->bio_lock, flags);
 
-	if (dio->is_async && dio->rw == READ)
+	if (dio->is_async && dio_should_dirty(dio))
 		bio_set_pages_dirty(bio);
 
 	if (sdio->submit_io)
@@ -447,13 +477,13 @@ static int dio_bio_complete(struct dio *dio, struct bio *bio)
 	if (!uptodate)
 		dio->io_error = -EIO;
 
-	if (dio->is_async && dio->rw == READ) {
+	if (dio->is_async && dio_should_dirty(dio)) {
 		bio_check_pages_dirty(bio);	/* transfers ownership */
 	} else {
 		for (page_no = 0; page_no < bio->bi_vcnt; page_no++) {
 			struct page *page = bvec[page_no].bv_page;
 
-			if (dio->rw == READ && !PageCompound(page))
+			if (dio_should_dirty(dio) && !PageCompound(page))
 				set_page_dirty_lock(page);
 			page_cache_release(page);
 		}
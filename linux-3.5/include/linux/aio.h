@@ -2,6 +2,7 @@
 #define __LINUX__AIO_H
 
 #include <linux/list.h>
+#include <linux/wait.h>
 #include <linux/workqueue.h>
 #include <linux/aio_abi.h>
 #include <linux/uio.h>
@@ -24,6 +25,7 @@ struct kioctx;
 #define KIOCB_C_COMPLETE	0x02
 
 #define KIOCB_SYNC_KEY		(~0U)
+#define KIOCB_KERNEL_KEY	(~1U)
 
 /* ki_flags bits */
 /*
@@ -34,6 +36,7 @@ struct kioctx;
 /* #define KIF_LOCKED		0 */
 #define KIF_KICKED		1
 #define KIF_CANCELLED		2
+#define KIF_PAGE_WAIT		3	/* kicked by a page unlock */
 
 #define kiocbTryLock(iocb)	test_and_set_bit(KIF_LOCKED, &(iocb)->ki_flags)
 #define kiocbTryKick(iocb)	test_and_set_bit(KIF_KICKED, &(iocb)->ki_flags)
@@ -41,6 +44,7 @@ struct kioctx;
 #define kiocbSetLocked(iocb)	set_bit(KIF_LOCKED, &(iocb)->ki_flags)
 #define kiocbSetKicked(iocb)	set_bit(KIF_KICKED, &(iocb)->ki_flags)
 #define kiocbSetCancelled(iocb)	set_bit(KIF_CANCELLED, &(iocb)->ki_flags)
+#define kiocbSetPageWait(iocb)	set_bit(KIF_PAGE_WAIT, &(iocb)->ki_flags)
 
 #define kiocbClearLocked(iocb)	clear_bit(KIF_LOCKED, &(iocb)->ki_flags)
 #define kiocbClearKicked(iocb)	clear_bit(KIF_KICKED, &(iocb)->ki_flags)
@@ -99,6 +103,7 @@ struct kiocb {
 	union {
 		void __user		*user;
 		struct task_struct	*tsk;
+		void			(*complete)(struct kiocb *, long);
 	} ki_obj;
 
 	__u64			ki_user_data;	/* user's data for completion */
@@ -119,6 +124,12 @@ struct kiocb {
 						 * for cancellation */
 	struct list_head	ki_batch;	/* batch allocation */
 
+	/*
+	 * Queued on a page's wait queue while a buffered read waits for
+	 * the page to be unlocked.  The wakeup kicks the iocb.
+	 */
+	struct wait_bit_queue	ki_wait;
+
 	/*
 	 * If the aio_resfd field of the userspace iocb is not zero,
 	 * this is the underlying eventfd context to deliver events to.
@@ -127,6 +138,10 @@ struct kiocb {
 };
 
 #define is_sync_kiocb(iocb)	((iocb)->ki_key == KIOCB_SYNC_KEY)
+#define is_kernel_kiocb(iocb)	((iocb)->ki_key == KIOCB_KERNEL_KEY)
+/* iocbs that ki_retry can return -EIOCBRETRY for rather than block */
+#define is_retryable_kiocb(iocb)	\
+	(!is_sync_kiocb(iocb) && !is_kernel_kiocb(iocb))
 #define init_sync_kiocb(x, filp)			\
 	do {						\
 		struct task_struct *tsk = current;	\
@@ -143,6 +158,29 @@ struct kiocb {
 		(x)->private = NULL;			\
 	} while (0)
 
+/*
+ * Kernel iocbs are asynchronous iocbs submitted from inside the kernel.
+ * Their iovecs hold kernel virtual addresses of lowmem pages (so they
+ * must be submitted with set_fs(KERNEL_DS)) and aio_complete() hands
+ * the result to the ki_obj.complete callback, possibly from interrupt
+ * context. Only direct I/O through the generic blockdev_direct_IO()
+ * code knows how to handle them.
+ */
+#define init_kernel_kiocb(x, filp, done)		\
+	do {						\
+		(x)->ki_flags = 0;			\
+		(x)->ki_users = 1;			\
+		(x)->ki_key = KIOCB_KERNEL_KEY;		\
+		(x)->ki_filp = (filp);			\
+		(x)->ki_ctx = NULL;			\
+		(x)->ki_cancel = NULL;			\
+		(x)->ki_retry = NULL;			\
+		(x)->ki_dtor = NULL;			\
+		(x)->ki_obj.complete = (done);		\
+		(x)->ki_user_data = 0;                  \
+		(x)->private = NULL;			\
+	} while (0)
+
 #define AIO_RING_MAGIC			0xa10a10a1
 #define AIO_RING_COMPAT_FEATURES	1
 #define AIO_RING_INCOMPAT_FEATURES	0
@@ -153,6 +153,33 @@ struct disk_part_tbl {
 
 struct disk_events;
 
+#ifdef CONFIG_BLK_DEV_IO_HIST
+enum {
+	DISK_HIST_READ,
+	DISK_HIST_WRITE,
+	DISK_HIST_FLUSH,
+	DISK_HIST_DISCARD,
+	DISK_HIST_NR_OPS,
+};
+
+/*
+ * Bucket 0 counts latencies below 1024ns, bucket n latencies in
+ * [2^(n-1), 2^n) * 1024ns. The last bucket also counts everything
+ * slower, which is above 4 seconds.
+ */
+#define DISK_HIST_BUCKETS	24
+
+struct disk_hist {
+	unsigned long q2c[DISK_HIST_NR_OPS][DISK_HIST_BUCKETS];
+	unsigned long d2c[DISK_HIST_NR_OPS][DISK_HIST_BUCKETS];
+};
+
+static inline unsigned int disk_hist_bucket(u64 nsec)
+{
+	return min_t(unsigned int, fls64(nsec >> 10), DISK_HIST_BUCKETS - 1);
+}
+#endif
+
 struct gendisk {
 	/* major, first_minor and minors are input parameters only,
 	 * don't use directly.  Use disk_devt() and disk_max_parts().
@@ -189,6 +216,9 @@ struct gendisk {
 	struct disk_events *ev;
 #ifdef  CONFIG_BLK_DEV_INTEGRITY
 	struct blk_integrity *integrity;
+#endif
+#ifdef CONFIG_BLK_DEV_IO_HIST
+	struct disk_hist __percpu *hist;
 #endif
 	int node_id;
 };
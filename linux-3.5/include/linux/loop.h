@@ -49,6 +49,10 @@ struct loop_device {
 				 unsigned long arg); 
 
 	struct file *	lo_backing_file;
+	struct file *	lo_dio_file;	/* O_DIRECT twin of lo_backing_file */
+	unsigned	lo_dio_align;	/* direct I/O alignment mask */
+	atomic_t	lo_dio_pending;
+	wait_queue_head_t lo_dio_wait;
 	struct block_device *lo_device;
 	unsigned	lo_blocksize;
 	void		*key_data; 
@@ -75,6 +79,7 @@ enum {
 	LO_FLAGS_READ_ONLY	= 1,
 	LO_FLAGS_AUTOCLEAR	= 4,
 	LO_FLAGS_PARTSCAN	= 8,
+	LO_FLAGS_DIRECT_IO	= 16,
 };
 
 #include <asm/posix_types.h>	/* for __kernel_old_dev_t */
@@ -110,6 +110,9 @@ enum {
 #define TCP_REPAIR_QUEUE	20
 #define TCP_QUEUE_SEQ		21
 #define TCP_REPAIR_OPTIONS	22
+#define TCP_FASTOPEN		23	/* Enable FastOpen on listeners */
+#define TCP_ULP			24	/* Attach a ULP to a TCP connection */
+#define TCP_ZEROCOPY_RECEIVE	25	/* Map received pages into an mmap()ed area */
 
 struct tcp_repair_opt {
 	__u32	opt_code;
@@ -143,6 +146,13 @@ enum tcp_ca_state {
 #define TCPF_CA_Loss	(1<<TCP_CA_Loss)
 };
 
+/* for TCP_ZEROCOPY_RECEIVE */
+struct tcp_zerocopy_receive {
+	__u64	address;		/* in: address of mapping */
+	__u32	length;			/* in/out: number of bytes to map/mapped */
+	__u32	recv_skip_hint;		/* out: amount of bytes to skip */
+};
+
 struct tcp_info {
 	__u8	tcpi_state;
 	__u8	tcpi_ca_state;
@@ -293,6 +303,26 @@ static inline void tcp_clear_options(struct tcp_options_received *rx_opt)
  * only four options will fit in a standard TCP header */
 #define TCP_NUM_SACKS 4
 
+/* TCP Fast Open (RFC 7413) */
+#define TCP_FASTOPEN_COOKIE_MIN	4	/* Min Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_MAX	16	/* Max Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_SIZE 8	/* the size employed by this impl. */
+
+/* A Fast Open cookie.  len is -1 when no cookie option is to be sent,
+ * 0 for a cookie request and the cookie length otherwise.
+ */
+struct tcp_fastopen_cookie {
+	s8	len;
+	u8	val[TCP_FASTOPEN_COOKIE_MAX];
+};
+
+/* Data to be sent in the SYN of an active Fast Open connect */
+struct tcp_fastopen_request {
+	struct tcp_fastopen_cookie	cookie;	/* Fast Open cookie to send */
+	struct msghdr			*data;	/* data in MSG_FASTOPEN */
+	int				copied;	/* queued in tcp_connect() */
+};
+
 struct tcp_cookie_values;
 struct tcp_request_sock_ops;
 
@@ -305,6 +335,10 @@ struct tcp_request_sock {
 	u32				rcv_isn;
 	u32				snt_isn;
 	u32				snt_synack; /* synack sent time */
+	u32				rcv_nxt; /* the ack # by SYNACK. For
+						  * FastOpen it's the seq#
+						  * after data-in-SYN.
+						  */
 };
 
 static inline struct tcp_request_sock *tcp_rsk(const struct request_sock *req)
@@ -339,6 +373,9 @@ struct tcp_sock {
 	u32	rcv_tstamp;	/* timestamp of last received ACK (for keepalives) */
 	u32	lsndtime;	/* timestamp of last sent data packet (for restart window) */
 
+	struct list_head tsq_node; /* anchor in tsq_tasklet.head list */
+	unsigned long	tsq_flags;
+
 	/* Data for direct copy to user */
 	struct {
 		struct sk_buff_head	prequeue;
@@ -373,7 +410,10 @@ struct tcp_sock {
 		unused      : 1;
 	u8	repair_queue;
 	u8	do_early_retrans:1,/* Enable RFC5827 early-retransmit  */
-		early_retrans_delayed:1; /* Delayed ER timer installed */
+		early_retrans_delayed:1, /* Delayed ER timer installed */
+		syn_fastopen:1,	/* SYN includes Fast Open option */
+		syn_data:1,	/* SYN includes data */
+		syn_data_acked:1;/* data in SYN is acked by SYN-ACK */
 
 /* RTT measurement */
 	u32	srtt;		/* smoothed round trip time << 3	*/
@@ -492,6 +532,18 @@ struct tcp_sock {
 	 * contains related tcp_cookie_transactions fields.
 	 */
 	struct tcp_cookie_values  *cookie_values;
+
+	/* Fast Open: data for the active side's SYN, and the request sock
+	 * of a passively opened socket until its SYN-ACK is acknowledged.
+	 */
+	struct tcp_fastopen_request *fastopen_req;
+	struct request_sock *fastopen_rsk;
+};
+
+enum tsq_flags {
+	TSQ_THROTTLED,	/* too many bytes queued below us, waiting for TX completion */
+	TSQ_QUEUED,	/* socket is on the per-cpu tasklet queue */
+	TSQ_OWNED,	/* tasklet found the socket owned, tcp_release_cb() sends */
 };
 
 static inline struct tcp_sock *tcp_sk(const struct sock *sk)
@@ -499,6 +551,15 @@ static inline struct tcp_sock *tcp_sk(const struct sock *sk)
 	return (struct tcp_sock *)sk;
 }
 
+/* A passively opened Fast Open socket may send and receive data before
+ * its SYN-ACK has been acknowledged.
+ */
+static inline bool tcp_passive_fastopen(const struct sock *sk)
+{
+	return sk->sk_state == TCP_SYN_RECV &&
+	       tcp_sk(sk)->fastopen_rsk != NULL;
+}
+
 struct tcp_timewait_sock {
 	struct inet_timewait_sock tw_sk;
 	u32			  tw_rcv_nxt;
@@ -339,6 +339,13 @@ static inline void __skb_tunnel_rx(struct sk_buff *skb, struct net_device *dev)
 	skb_set_queue_mapping(skb, 0);
 	skb_dst_drop(skb);
 	nf_reset(skb);
+
+	/* GRO aggregated the tunnel; the inner packet is plain GSO now */
+	if (skb->encapsulation) {
+		skb->encapsulation = 0;
+		skb_shinfo(skb)->gso_type &= ~(SKB_GSO_GRE |
+					       SKB_GSO_UDP_TUNNEL);
+	}
 }
 
 /**
@@ -37,12 +37,15 @@
 #include <asm/byteorder.h>
 
 /* This is for all connections with a full identity, no wildcards.
- * One chain is dedicated to TIME_WAIT sockets.
+ * One chain is dedicated to TIME_WAIT sockets, and one to pending
+ * connection requests, which hash to the same bucket as the socket they
+ * will become.
  * I'll experiment with dynamic table growth later.
  */
 struct inet_ehash_bucket {
 	struct hlist_nulls_head chain;
 	struct hlist_nulls_head twchain;
+	struct hlist_nulls_head reqchain;
 };
 
 /* There are a few simple rules, which allow for local port reuse by
@@ -53,7 +56,10 @@ struct inet_ehash_bucket {
  *	2) If all sockets have sk->sk_reuse set, and none of them are in
  *	   TCP_LISTEN state, the port may be shared.
  *	   Failing that, goto test 3.
- *	3) If all sockets are bound to a specific inet_sk(sk)->rcv_saddr local
+ *	3) If all sockets have sk->sk_reuseport set and were created by the
+ *	   same user, the port may be shared, listening sockets included.
+ *	   Failing that, goto test 4.
+ *	4) If all sockets are bound to a specific inet_sk(sk)->rcv_saddr local
  *	   address, and none of them are the same, the port may be
  *	   shared.
  *	   Failing this, the port cannot be shared.
@@ -82,6 +88,8 @@ struct inet_bind_bucket {
 #endif
 	unsigned short		port;
 	signed short		fastreuse;
+	signed short		fastreuseport;
+	int			fastuid;
 	int			num_owners;
 	struct hlist_node	node;
 	struct hlist_head	owners;
@@ -121,7 +129,8 @@ struct inet_hashinfo {
 	 *
 	 *          TCP_ESTABLISHED <= sk->sk_state < TCP_CLOSE
 	 *
-	 * TIME_WAIT sockets use a separate chain (twchain).
+	 * TIME_WAIT sockets use a separate chain (twchain), and so do
+	 * request socks (reqchain).
 	 */
 	struct inet_ehash_bucket	*ehash;
 	spinlock_t			*ehash_locks;
@@ -252,20 +261,30 @@ extern void inet_put_port(struct sock *sk);
 void inet_hashinfo_init(struct inet_hashinfo *h);
 
 extern int __inet_hash_nolisten(struct sock *sk, struct inet_timewait_sock *tw);
+extern bool __inet_hash_child(struct sock *sk, struct request_sock *req);
+extern bool inet_hash_child(struct sock *sk, struct request_sock *req);
+extern void inet_ehash_req(struct inet_hashinfo *hashinfo,
+			   struct request_sock *req);
+extern bool inet_unhash_req(struct inet_hashinfo *hashinfo,
+			    struct request_sock *req);
 extern void inet_hash(struct sock *sk);
 extern void inet_unhash(struct sock *sk);
 
 extern struct sock *__inet_lookup_listener(struct net *net,
 					   struct inet_hashinfo *hashinfo,
+					   const __be32 saddr,
+					   const __be16 sport,
 					   const __be32 daddr,
 					   const unsigned short hnum,
 					   const int dif);
 
 static inline struct sock *inet_lookup_listener(struct net *net,
 		struct inet_hashinfo *hashinfo,
+		__be32 saddr, __be16 sport,
 		__be32 daddr, __be16 dport, int dif)
 {
-	return __inet_lookup_listener(net, hashinfo, daddr, ntohs(dport), dif);
+	return __inet_lookup_listener(net, hashinfo, saddr, sport,
+				      daddr, ntohs(dport), dif);
 }
 
 /* Socket demux engine toys. */
@@ -346,6 +365,24 @@ static inline struct sock *
 					 ntohs(dport), dif);
 }
 
+/*
+ * Find the pending connection request for a segment, without touching
+ * the listener.  Returns the request with a reference held.
+ */
+extern struct request_sock *__inet_lookup_reqsk(struct net *net,
+		struct inet_hashinfo *hashinfo,
+		const __be32 saddr, const __be16 sport,
+		const __be32 daddr, const u16 hnum);
+
+static inline struct request_sock *
+	inet_lookup_reqsk(struct net *net, struct inet_hashinfo *hashinfo,
+			  const __be32 saddr, const __be16 sport,
+			  const __be32 daddr, const __be16 dport)
+{
+	return __inet_lookup_reqsk(net, hashinfo, saddr, sport, daddr,
+				   ntohs(dport));
+}
+
 static inline struct sock *__inet_lookup(struct net *net,
 					 struct inet_hashinfo *hashinfo,
 					 const __be32 saddr, const __be16 sport,
@@ -356,7 +393,8 @@ static inline struct sock *__inet_lookup(struct net *net,
 	struct sock *sk = __inet_lookup_established(net, hashinfo,
 				saddr, sport, daddr, hnum, dif);
 
-	return sk ? : __inet_lookup_listener(net, hashinfo, daddr, hnum, dif);
+	return sk ? : __inet_lookup_listener(net, hashinfo, saddr, sport,
+					     daddr, hnum, dif);
 }
 
 static inline struct sock *inet_lookup(struct net *net,
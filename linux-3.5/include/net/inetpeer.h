@@ -40,6 +40,11 @@ struct inet_peer {
 	u32			pmtu_orig;
 	u32			pmtu_learned;
 	struct inetpeer_addr_base redirect_learned;
+	/* TCP Fast Open client state, under tcp_fastopen.c's seqlock */
+	u16			tcp_fastopen_mss;
+	u16			tcp_fastopen_syn_loss;
+	unsigned long		tcp_fastopen_last_syn_loss;
+	struct tcp_fastopen_cookie tcp_fastopen_cookie;
 	union {
 		struct list_head	gc_list;
 		struct rcu_head     gc_rcu;
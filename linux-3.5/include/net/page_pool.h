@@ -0,0 +1,102 @@
+/*
+ * Page pool: a recycling page allocator for driver RX buffers.
+ *
+ * A pool hands out pages to one RX queue and takes them back, either
+ * from the driver or from the network stack when an skb built on them
+ * is freed.  Pages stay DMA mapped for as long as they belong to the
+ * pool.
+ *
+ * Allocation must be serialised by the driver, normally by calling
+ * page_pool_alloc_pages() only from its NAPI poll routine or with NAPI
+ * disabled.  Pages are returned from any context.  A page freed in
+ * softirq context goes to a small cache of the current CPU; everything
+ * else goes to a ring shared by all CPUs, which the allocator drains in
+ * batches.
+ */
+
+#ifndef _NET_PAGE_POOL_H
+#define _NET_PAGE_POOL_H
+
+#include <linux/mm.h>
+#include <linux/dma-mapping.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+#define PP_FLAG_DMA_MAP		0x1	/* Map pages with dma_map_page() */
+
+#define PP_ALLOC_CACHE_SIZE	128	/* per cpu cache entries */
+#define PP_ALLOC_CACHE_REFILL	64	/* pages moved from the ring at once */
+
+struct page_pool_params {
+	unsigned int		flags;		/* PP_FLAG_* */
+	unsigned int		order;		/* allocation order of pages */
+	unsigned int		pool_size;	/* entries of the recycle ring */
+	int			nid;		/* NUMA node to allocate from */
+	struct device		*dev;		/* device for DMA mapping */
+	enum dma_data_direction	dma_dir;	/* DMA mapping direction */
+};
+
+struct page_pool_stats {
+	u64	alloc_fast;	/* pages taken from the cpu cache */
+	u64	alloc_slow;	/* pages taken from the page allocator */
+	u64	alloc_refill;	/* pages moved from the ring to a cache */
+	u64	alloc_failed;	/* page allocator failures */
+	u64	recycle_cached;	/* pages recycled into a cpu cache */
+	u64	recycle_ring;	/* pages recycled into the ring */
+	u64	recycle_full;	/* recycling failed, the ring was full */
+	u64	released;	/* pages given back to the page allocator */
+};
+
+struct page_pool_cache {
+	unsigned int		count;
+	struct page		*pages[PP_ALLOC_CACHE_SIZE];
+};
+
+struct page_pool {
+	struct page_pool_params	p;
+
+	struct page_pool_cache __percpu *cache;
+	struct page_pool_stats __percpu *stats;
+	/* Only the allocating cpu caches pages, see page_pool_put_page() */
+	int			alloc_cpu;
+
+	/* Pages recycled outside softirq or from other CPUs */
+	spinlock_t		ring_lock;
+	struct page		**ring;
+	unsigned int		ring_head;
+	unsigned int		ring_count;
+	bool			destroying;
+
+	/* Pages owned by the pool, plus one for the pool itself */
+	atomic_t		inflight;
+	struct work_struct	release_work;
+};
+
+#ifdef CONFIG_PAGE_POOL
+extern struct page_pool *page_pool_create(const struct page_pool_params *params);
+extern void page_pool_destroy(struct page_pool *pool);
+extern struct page *page_pool_alloc_pages(struct page_pool *pool, gfp_t gfp);
+extern void page_pool_put_page(struct page_pool *pool, struct page *page);
+extern void page_pool_release_page(struct page_pool *pool, struct page *page);
+
+extern void page_pool_get_stats(const struct page_pool *pool,
+				struct page_pool_stats *stats);
+extern int page_pool_ethtool_stats_get_count(void);
+extern u8 *page_pool_ethtool_stats_get_strings(u8 *data);
+extern u64 *page_pool_ethtool_stats_get(u64 *data,
+					const struct page_pool_stats *stats);
+
+static inline struct page *page_pool_dev_alloc_pages(struct page_pool *pool)
+{
+	return page_pool_alloc_pages(pool, GFP_ATOMIC | __GFP_NOWARN);
+}
+#endif
+
+/* DMA address of a page allocated from a PP_FLAG_DMA_MAP pool */
+static inline dma_addr_t page_pool_get_dma_addr(const struct page *page)
+{
+	return (dma_addr_t)page->index;
+}
+
+#endif /* _NET_PAGE_POOL_H */
@@ -41,7 +41,8 @@ struct net_protocol {
 					       netdev_features_t features);
 	struct sk_buff	      **(*gro_receive)(struct sk_buff **head,
 					       struct sk_buff *skb);
-	int			(*gro_complete)(struct sk_buff *skb);
+	int			(*gro_complete)(struct sk_buff *skb,
+						int nhoff);
 	unsigned int		no_policy:1,
 				netns_ok:1;
 };
@@ -60,7 +61,7 @@ struct inet6_protocol {
 				       netdev_features_t features);
 	struct sk_buff **(*gro_receive)(struct sk_buff **head,
 					struct sk_buff *skb);
-	int	(*gro_complete)(struct sk_buff *skb);
+	int	(*gro_complete)(struct sk_buff *skb, int nhoff);
 
 	unsigned int	flags;	/* INET6_PROTO_xxx */
 };
@@ -71,6 +72,26 @@ struct inet6_protocol {
 #define INET6_PROTO_GSO_EXTHDR	0x4
 #endif
 
+/* GRO handlers of a UDP tunnel, looked up by UDP destination port.
+ * gro_receive() is called with the UDP header pulled; gro_complete()
+ * gets the offset of the tunnel header and must set the inner mac header.
+ * The tunnel receive path must clear skb->encapsulation and
+ * SKB_GSO_UDP_TUNNEL from aggregated skbs once it has decapsulated them,
+ * see __skb_tunnel_rx().
+ */
+struct udp_offload_callbacks {
+	struct sk_buff	      **(*gro_receive)(struct sk_buff **head,
+					       struct sk_buff *skb);
+	int			(*gro_complete)(struct sk_buff *skb,
+						int nhoff);
+};
+
+struct udp_offload {
+	__be16				port;
+	struct udp_offload_callbacks	callbacks;
+	struct list_head		list;
+};
+
 /* This is used to register socket interfaces for IP protocols.  */
 struct inet_protosw {
 	struct list_head list;
@@ -100,6 +121,9 @@ extern int	inet_del_protocol(const struct net_protocol *prot, unsigned char num)
 extern void	inet_register_protosw(struct inet_protosw *p);
 extern void	inet_unregister_protosw(struct inet_protosw *p);
 
+extern int	udp_add_offload(struct udp_offload *uo);
+extern void	udp_del_offload(struct udp_offload *uo);
+
 #if IS_ENABLED(CONFIG_IPV6)
 extern int	inet6_add_protocol(const struct inet6_protocol *prot, unsigned char num);
 extern int	inet6_del_protocol(const struct inet6_protocol *prot, unsigned char num);
@@ -19,6 +19,8 @@
 #include <linux/spinlock.h>
 #include <linux/types.h>
 #include <linux/bug.h>
+#include <linux/timer.h>
+#include <linux/list_nulls.h>
 
 #include <net/sock.h>
 
@@ -50,9 +52,18 @@ struct request_sock_ops {
 };
 
 /* struct request_sock - mini sock to represent a connection request
+ *
+ * Pending requests live in the established hash (reqchain) and are found
+ * there under RCU; @rsk_refcnt is held by the hash, by @rsk_timer while it
+ * is pending and by whoever looked the request up.  @rsk_listener is the
+ * listener the request was queued on and holds a reference to it; it is
+ * NULL for requests that were never hashed, such as syncookie ones.
  */
 struct request_sock {
 	struct request_sock		*dl_next; /* Must be first member! */
+	struct hlist_nulls_node		rsk_node;
+	u32				rsk_hash;
+	atomic_t			rsk_refcnt;
 	u16				mss;
 	u8				retrans;
 	u8				cookie_ts; /* syncookie: encode tcpopts in timestamp */
@@ -60,9 +71,10 @@ struct request_sock {
 	u32				window_clamp; /* window clamp at creation time */
 	u32				rcv_wnd;	  /* rcv_wnd offered first time */
 	u32				ts_recent;
-	unsigned long			expires;
 	const struct request_sock_ops	*rsk_ops;
 	struct sock			*sk;
+	struct sock			*rsk_listener;
+	struct timer_list		rsk_timer;
 	u32				secid;
 	u32				peer_secid;
 };
@@ -71,8 +83,12 @@ static inline struct request_sock *reqsk_alloc(const struct request_sock_ops *op
 {
 	struct request_sock *req = kmem_cache_alloc(ops->slab, GFP_ATOMIC);
 
-	if (req != NULL)
+	if (req != NULL) {
 		req->rsk_ops = ops;
+		req->rsk_listener = NULL;
+		req->rsk_node.pprev = NULL;
+		atomic_set(&req->rsk_refcnt, 0);
+	}
 
 	return req;
 }
@@ -85,64 +101,62 @@ static inline void __reqsk_free(struct request_sock *req)
 static inline void reqsk_free(struct request_sock *req)
 {
 	req->rsk_ops->destructor(req);
+	if (req->rsk_listener)
+		sock_put(req->rsk_listener);
 	__reqsk_free(req);
 }
 
-extern int sysctl_max_syn_backlog;
+static inline void reqsk_put(struct request_sock *req)
+{
+	if (atomic_dec_and_test(&req->rsk_refcnt))
+		reqsk_free(req);
+}
 
-/** struct listen_sock - listen state
- *
- * @max_qlen_log - log_2 of maximal queued SYNs/REQUESTs
- */
-struct listen_sock {
-	u8			max_qlen_log;
-	u8			synflood_warned;
-	/* 2 bytes hole, try to use */
-	int			qlen;
-	int			qlen_young;
-	int			clock_hand;
-	u32			hash_rnd;
-	u32			nr_table_entries;
-	struct request_sock	*syn_table[0];
-};
+extern int sysctl_max_syn_backlog;
 
 /** struct request_sock_queue - queue of request_socks
  *
+ * @rskq_lock - serializes the accept queue
  * @rskq_accept_head - FIFO head of established children
  * @rskq_accept_tail - FIFO tail of established children
  * @rskq_defer_accept - User waits for some data after accept()
- * @syn_wait_lock - serializer
- *
- * %syn_wait_lock is necessary only to avoid proc interface having to grab the main
- * lock sock while browsing the listening hash (otherwise it's deadlock prone).
+ * @max_qlen_log - log_2 of maximal queued SYNs/REQUESTs
+ * @qlen - number of pending requests
+ * @qlen_young - pending requests whose SYN-ACK was not retransmitted yet
+ * @fastopen_max_qlen - bound on @fastopen_qlen set by TCP_FASTOPEN, 0 if off
+ * @fastopen_qlen - Fast Open children whose SYN-ACK is not yet acked
  *
- * This lock is acquired in read mode only from listening_get_next() seq_file
- * op and it's acquired in write mode _only_ from code that is actively
- * changing rskq_accept_head. All readers that are holding the master sock lock
- * don't need to grab this lock in read mode too as rskq_accept_head. writes
- * are always protected from the main sock lock.
+ * Pending requests are kept in the established hash, not here; only their
+ * count is.  Children are added to the accept queue from softirq context
+ * without the listener lock, so the queue has its own lock, taken with BH
+ * disabled from process context.
  */
 struct request_sock_queue {
+	spinlock_t		rskq_lock;
+	u8			rskq_defer_accept;
+	u8			max_qlen_log;
+	u8			synflood_warned;
+	/* 1 byte hole, try to pack */
+	atomic_t		qlen;
+	atomic_t		qlen_young;
+	int			fastopen_max_qlen;
+	atomic_t		fastopen_qlen;
 	struct request_sock	*rskq_accept_head;
 	struct request_sock	*rskq_accept_tail;
-	rwlock_t		syn_wait_lock;
-	u8			rskq_defer_accept;
-	/* 3 bytes hole, try to pack */
-	struct listen_sock	*listen_opt;
 };
 
-extern int reqsk_queue_alloc(struct request_sock_queue *queue,
-			     unsigned int nr_table_entries);
-
-extern void __reqsk_queue_destroy(struct request_sock_queue *queue);
-extern void reqsk_queue_destroy(struct request_sock_queue *queue);
+extern void reqsk_queue_alloc(struct request_sock_queue *queue,
+			      unsigned int nr_table_entries);
 
 static inline struct request_sock *
 	reqsk_queue_yank_acceptq(struct request_sock_queue *queue)
 {
-	struct request_sock *req = queue->rskq_accept_head;
+	struct request_sock *req;
 
+	spin_lock_bh(&queue->rskq_lock);
+	req = queue->rskq_accept_head;
 	queue->rskq_accept_head = NULL;
+	spin_unlock_bh(&queue->rskq_lock);
 	return req;
 }
 
@@ -151,15 +165,6 @@ static inline int reqsk_queue_empty(struct request_sock_queue *queue)
 	return queue->rskq_accept_head == NULL;
 }
 
-static inline void reqsk_queue_unlink(struct request_sock_queue *queue,
-				      struct request_sock *req,
-				      struct request_sock **prev_req)
-{
-	write_lock(&queue->syn_wait_lock);
-	*prev_req = req->dl_next;
-	write_unlock(&queue->syn_wait_lock);
-}
-
 static inline void reqsk_queue_add(struct request_sock_queue *queue,
 				   struct request_sock *req,
 				   struct sock *parent,
@@ -193,66 +198,48 @@ static inline struct request_sock *reqsk_queue_remove(struct request_sock_queue
 static inline struct sock *reqsk_queue_get_child(struct request_sock_queue *queue,
 						 struct sock *parent)
 {
-	struct request_sock *req = reqsk_queue_remove(queue);
-	struct sock *child = req->sk;
+	struct request_sock *req;
+	struct sock *child;
 
+	spin_lock_bh(&queue->rskq_lock);
+	req = reqsk_queue_remove(queue);
+	sk_acceptq_removed(parent);
+	spin_unlock_bh(&queue->rskq_lock);
+
+	child = req->sk;
 	WARN_ON(child == NULL);
 
-	sk_acceptq_removed(parent);
-	__reqsk_free(req);
+	reqsk_put(req);
 	return child;
 }
 
-static inline int reqsk_queue_removed(struct request_sock_queue *queue,
-				      struct request_sock *req)
+static inline void reqsk_queue_removed(struct request_sock_queue *queue,
+				       struct request_sock *req)
 {
-	struct listen_sock *lopt = queue->listen_opt;
-
 	if (req->retrans == 0)
-		--lopt->qlen_young;
-
-	return --lopt->qlen;
+		atomic_dec(&queue->qlen_young);
+	atomic_dec(&queue->qlen);
 }
 
-static inline int reqsk_queue_added(struct request_sock_queue *queue)
+static inline void reqsk_queue_added(struct request_sock_queue *queue)
 {
-	struct listen_sock *lopt = queue->listen_opt;
-	const int prev_qlen = lopt->qlen;
-
-	lopt->qlen_young++;
-	lopt->qlen++;
-	return prev_qlen;
+	atomic_inc(&queue->qlen_young);
+	atomic_inc(&queue->qlen);
 }
 
 static inline int reqsk_queue_len(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt != NULL ? queue->listen_opt->qlen : 0;
+	return atomic_read(&queue->qlen);
 }
 
 static inline int reqsk_queue_len_young(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen_young;
+	return atomic_read(&queue->qlen_young);
 }
 
 static inline int reqsk_queue_is_full(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen >> queue->listen_opt->max_qlen_log;
-}
-
-static inline void reqsk_queue_hash_req(struct request_sock_queue *queue,
-					u32 hash, struct request_sock *req,
-					unsigned long timeout)
-{
-	struct listen_sock *lopt = queue->listen_opt;
-
-	req->expires = jiffies + timeout;
-	req->retrans = 0;
-	req->sk = NULL;
-	req->dl_next = lopt->syn_table[hash];
-
-	write_lock(&queue->syn_wait_lock);
-	lopt->syn_table[hash] = req;
-	write_unlock(&queue->syn_wait_lock);
+	return reqsk_queue_len(queue) >> queue->max_qlen_log;
 }
 
 #endif /* _REQUEST_SOCK_H */
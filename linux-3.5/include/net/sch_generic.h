@@ -25,6 +25,8 @@ enum qdisc_state_t {
 	__QDISC_STATE_SCHED,
 	__QDISC_STATE_DEACTIVATED,
 	__QDISC_STATE_THROTTLED,
+	__QDISC_STATE_RUNNING,	/* TCQ_F_NOLOCK qdiscs only */
+	__QDISC_STATE_MISSED,	/* TCQ_F_NOLOCK qdiscs only */
 };
 
 /*
@@ -50,6 +52,19 @@ struct Qdisc {
 #define TCQ_F_INGRESS		2
 #define TCQ_F_CAN_BYPASS	4
 #define TCQ_F_MQROOT		8
+#define TCQ_F_ONETXQUEUE	0x10 /* dequeue_skb() can assume all skbs are for
+				      * q->dev_queue : It can test
+				      * netif_xmit_frozen_or_stopped() before
+				      * dequeueing next packet.
+				      * Its true for MQ/MQPRIO slaves, or non
+				      * multiqueue device.
+				      */
+#define TCQ_F_NOLOCK		0x20 /* qdisc does not require the root lock:
+				      * enqueue may run on several cpus at once,
+				      * dequeue is serialized by
+				      * __QDISC_STATE_RUNNING, and queue
+				      * statistics are kept in cpu_qstats.
+				      */
 #define TCQ_F_WARN_NONWC	(1 << 16)
 	int			padded;
 	const struct Qdisc_ops	*ops;
@@ -72,6 +87,8 @@ struct Qdisc {
 	struct Qdisc		*next_sched;
 
 	struct sk_buff		*gso_skb;
+	struct sk_buff_head	requeue;	/* bulk dequeued skbs not sent yet */
+	struct gnet_stats_queue	__percpu *cpu_qstats;
 	/*
 	 * For performance sake on SMP, we put highly modified fields at the end
 	 */
@@ -87,11 +104,29 @@ struct Qdisc {
 
 static inline bool qdisc_is_running(const struct Qdisc *qdisc)
 {
+	if (qdisc->flags & TCQ_F_NOLOCK)
+		return test_bit(__QDISC_STATE_RUNNING, &qdisc->state);
 	return (qdisc->__state & __QDISC___STATE_RUNNING) ? true : false;
 }
 
 static inline bool qdisc_run_begin(struct Qdisc *qdisc)
 {
+	if (qdisc->flags & TCQ_F_NOLOCK) {
+		if (!test_and_set_bit(__QDISC_STATE_RUNNING, &qdisc->state))
+			goto nolock_running;
+
+		/* The owner may be about to stop without seeing our skb:
+		 * tell it to reschedule, then try once more in case it
+		 * already cleared RUNNING before it could see MISSED.
+		 */
+		set_bit(__QDISC_STATE_MISSED, &qdisc->state);
+		smp_mb();
+		if (test_and_set_bit(__QDISC_STATE_RUNNING, &qdisc->state))
+			return false;
+nolock_running:
+		clear_bit(__QDISC_STATE_MISSED, &qdisc->state);
+		return true;
+	}
 	if (qdisc_is_running(qdisc))
 		return false;
 	qdisc->__state |= __QDISC___STATE_RUNNING;
@@ -100,9 +135,32 @@ static inline bool qdisc_run_begin(struct Qdisc *qdisc)
 
 static inline void qdisc_run_end(struct Qdisc *qdisc)
 {
+	if (qdisc->flags & TCQ_F_NOLOCK) {
+		smp_mb__before_clear_bit();
+		clear_bit(__QDISC_STATE_RUNNING, &qdisc->state);
+		smp_mb__after_clear_bit();
+		if (unlikely(test_bit(__QDISC_STATE_MISSED, &qdisc->state)))
+			__netif_schedule(qdisc);
+		return;
+	}
 	qdisc->__state &= ~__QDISC___STATE_RUNNING;
 }
 
+static inline bool qdisc_may_bulk(const struct Qdisc *qdisc)
+{
+	return qdisc->flags & TCQ_F_ONETXQUEUE;
+}
+
+static inline int qdisc_avail_bulklimit(const struct netdev_queue *txq)
+{
+#ifdef CONFIG_BQL
+	/* Non-BQL migrated drivers will return 0, too. */
+	return dql_avail(&txq->dql);
+#else
+	return 0;
+#endif
+}
+
 static inline bool qdisc_is_throttled(const struct Qdisc *qdisc)
 {
 	return test_bit(__QDISC_STATE_THROTTLED, &qdisc->state) ? true : false;
@@ -233,11 +291,82 @@ static inline void qdisc_cb_private_validate(const struct sk_buff *skb, int sz)
 	BUILD_BUG_ON(sizeof(qcb->data) < sz);
 }
 
+/* The per-cpu counts of a TCQ_F_NOLOCK qdisc only add up to its length,
+ * a single one may well be negative.
+ */
+static inline int qdisc_qlen_sum(const struct Qdisc *q)
+{
+	u32 qlen = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		qlen += per_cpu_ptr(q->cpu_qstats, cpu)->qlen;
+	return qlen;
+}
+
 static inline int qdisc_qlen(const struct Qdisc *q)
 {
+	if (q->flags & TCQ_F_NOLOCK)
+		return qdisc_qlen_sum(q);
 	return q->q.qlen;
 }
 
+/* Queue length and queue statistics of a TCQ_F_NOLOCK qdisc are updated
+ * concurrently by several cpus and live in q->cpu_qstats.  qdisc_qlen()
+ * adds up the length; qdisc_qstats_fold() brings q->q.qlen and q->qstats
+ * up to date for dumps, but those copies are stale as soon as it returns.
+ */
+static inline void qdisc_qlen_inc(struct Qdisc *q)
+{
+	if (q->flags & TCQ_F_NOLOCK)
+		this_cpu_inc(q->cpu_qstats->qlen);
+	else
+		q->q.qlen++;
+}
+
+static inline void qdisc_qlen_dec(struct Qdisc *q)
+{
+	if (q->flags & TCQ_F_NOLOCK)
+		this_cpu_dec(q->cpu_qstats->qlen);
+	else
+		q->q.qlen--;
+}
+
+static inline void qdisc_qstats_backlog_inc(struct Qdisc *q, unsigned int len)
+{
+	if (q->flags & TCQ_F_NOLOCK)
+		this_cpu_add(q->cpu_qstats->backlog, len);
+	else
+		q->qstats.backlog += len;
+}
+
+static inline void qdisc_qstats_backlog_dec(struct Qdisc *q, unsigned int len)
+{
+	if (q->flags & TCQ_F_NOLOCK)
+		this_cpu_sub(q->cpu_qstats->backlog, len);
+	else
+		q->qstats.backlog -= len;
+}
+
+static inline void qdisc_qstats_drop(struct Qdisc *q)
+{
+	if (q->flags & TCQ_F_NOLOCK)
+		this_cpu_inc(q->cpu_qstats->drops);
+	else
+		q->qstats.drops++;
+}
+
+static inline void qdisc_qstats_requeue(struct Qdisc *q)
+{
+	if (q->flags & TCQ_F_NOLOCK)
+		this_cpu_inc(q->cpu_qstats->requeues);
+	else
+		q->qstats.requeues++;
+}
+
+extern void qdisc_qstats_fold(struct Qdisc *q);
+extern void qdisc_clear_nolock(struct Qdisc *q);
+
 static inline struct qdisc_skb_cb *qdisc_skb_cb(const struct sk_buff *skb)
 {
 	return (struct qdisc_skb_cb *)skb->cb;
@@ -395,7 +524,7 @@ static inline bool qdisc_all_tx_empty(const struct net_device *dev)
 		struct netdev_queue *txq = netdev_get_tx_queue(dev, i);
 		const struct Qdisc *q = txq->qdisc;
 
-		if (q->q.qlen)
+		if (qdisc_qlen(q))
 			return false;
 	}
 	return true;
@@ -0,0 +1,105 @@
+/*
+ * Kernel TLS (ktls) record layer.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _NET_TLS_H
+#define _NET_TLS_H
+
+#include <linux/types.h>
+#include <linux/crypto.h>
+#include <linux/scatterlist.h>
+#include <linux/skbuff.h>
+#include <linux/tls.h>
+#include <net/inet_connection_sock.h>
+#include <net/sock.h>
+
+/* Maximum data size carried in a TLS record */
+#define TLS_MAX_PAYLOAD_SIZE		((size_t)1 << 14)
+
+#define TLS_HEADER_SIZE			5
+#define TLS_NONCE_OFFSET		TLS_HEADER_SIZE
+
+#define TLS_RECORD_TYPE_DATA		0x17
+
+#define TLS_AAD_SPACE_SIZE		13
+
+/* Record header and explicit nonce, in front of the ciphertext */
+#define TLS_PREPEND_SIZE		(TLS_HEADER_SIZE + \
+					 TLS_CIPHER_AES_GCM_128_IV_SIZE)
+#define TLS_OVERHEAD_SIZE		(TLS_PREPEND_SIZE + \
+					 TLS_CIPHER_AES_GCM_128_TAG_SIZE)
+
+#define TLS_PAYLOAD_PAGES	DIV_ROUND_UP(TLS_MAX_PAYLOAD_SIZE, PAGE_SIZE)
+#define TLS_RECORD_PAGES	DIV_ROUND_UP(TLS_MAX_PAYLOAD_SIZE + \
+					     TLS_OVERHEAD_SIZE, PAGE_SIZE)
+
+struct tls_sw_context {
+	struct crypto_aead *aead_send;
+
+	/* Plaintext of the record being built: data written with
+	 * sendmsg() is copied to copy_pages, pages given to sendpage()
+	 * are referenced directly.
+	 */
+	unsigned int plain_size;
+	int plain_num_elem;
+	struct scatterlist sg_plain[MAX_SKB_FRAGS];
+	unsigned int copy_size;
+	struct page *copy_pages[TLS_PAYLOAD_PAGES];
+
+	/* The last encrypted record, and what TCP has yet to take of it */
+	struct page *rec_pages[TLS_RECORD_PAGES];
+	int rec_off;
+	int rec_size;
+
+	unsigned char aad_space[TLS_AAD_SPACE_SIZE];
+	struct scatterlist sg_aad[1];
+	struct scatterlist sg_encrypted[TLS_RECORD_PAGES];
+};
+
+struct tls_context {
+	struct tls12_crypto_info_aes_gcm_128 crypto_send;
+
+	void *priv_ctx;
+
+	unsigned char iv[TLS_CIPHER_AES_GCM_128_SALT_SIZE +
+			 TLS_CIPHER_AES_GCM_128_IV_SIZE];
+	unsigned char rec_seq[TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE];
+
+	bool in_tcp_sendpages;
+
+	void (*sk_write_space)(struct sock *sk);
+	void (*sk_proto_close)(struct sock *sk, long timeout);
+
+	int  (*setsockopt)(struct sock *sk, int level,
+			   int optname, char __user *optval,
+			   unsigned int optlen);
+	int  (*getsockopt)(struct sock *sk, int level,
+			   int optname, char __user *optval,
+			   int __user *optlen);
+};
+
+static inline struct tls_context *tls_get_ctx(const struct sock *sk)
+{
+	return inet_csk(sk)->icsk_ulp_data;
+}
+
+static inline struct tls_sw_context *tls_sw_ctx(const struct tls_context *ctx)
+{
+	return ctx->priv_ctx;
+}
+
+extern int tls_set_sw_offload(struct sock *sk, struct tls_context *ctx);
+extern void tls_sw_free_resources(struct sock *sk);
+extern int tls_sw_sendmsg(struct kiocb *iocb, struct sock *sk,
+			  struct msghdr *msg, size_t size);
+extern int tls_sw_sendpage(struct sock *sk, struct page *page,
+			   int offset, size_t size, int flags);
+extern int tls_sw_push_pending(struct sock *sk, int flags);
+extern int tls_sw_flush(struct sock *sk);
+
+#endif /* _NET_TLS_H */
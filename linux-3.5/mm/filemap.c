@@ -573,6 +573,101 @@ void add_page_wait_queue(struct page *page, wait_queue_t *waiter)
 }
 EXPORT_SYMBOL_GPL(add_page_wait_queue);
 
+#ifdef CONFIG_AIO
+static int kiocb_wake_page_function(wait_queue_t *wait, unsigned mode,
+				    int sync, void *arg)
+{
+	struct wait_bit_key *key = arg;
+	struct wait_bit_queue *wait_bit
+		= container_of(wait, struct wait_bit_queue, wait);
+	struct kiocb *iocb = container_of(wait_bit, struct kiocb, ki_wait);
+
+	if (wait_bit->key.flags != key->flags ||
+			wait_bit->key.bit_nr != key->bit_nr ||
+			test_bit(key->bit_nr, key->flags))
+		return 0;
+
+	list_del_init(&wait->task_list);
+	kick_iocb(iocb);
+	return 1;
+}
+
+/*
+ * Take @iocb off the page wait queue it was left on by an earlier
+ * -EIOCBRETRY, if the wakeup has not already done so.
+ */
+static void kiocb_cancel_page_wait(struct kiocb *iocb)
+{
+	struct wait_bit_queue *wait = &iocb->ki_wait;
+	wait_queue_head_t *q;
+	unsigned long flags;
+
+	if (!wait->key.flags)
+		return;
+	q = page_waitqueue(container_of(wait->key.flags, struct page, flags));
+	spin_lock_irqsave(&q->lock, flags);
+	if (!list_empty(&wait->wait.task_list)) {
+		list_del_init(&wait->wait.task_list);
+		clear_bit(KIF_PAGE_WAIT, &iocb->ki_flags);
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+	wait->key.flags = NULL;
+}
+
+/*
+ * Returns 0 if the page is not locked.  Otherwise @iocb is queued to be
+ * kicked when the page is unlocked, and -EIOCBRETRY is returned.
+ */
+static int wait_on_page_locked_async(struct page *page, struct kiocb *iocb)
+{
+	wait_queue_head_t *q = page_waitqueue(page);
+	struct wait_bit_queue *wait = &iocb->ki_wait;
+	unsigned long flags;
+	int ret = -EIOCBRETRY;
+
+	kiocb_cancel_page_wait(iocb);
+	init_waitqueue_func_entry(&wait->wait, kiocb_wake_page_function);
+	wait->key.flags = &page->flags;
+	wait->key.bit_nr = PG_locked;
+
+	spin_lock_irqsave(&q->lock, flags);
+	__add_wait_queue_tail(q, &wait->wait);
+	/* pairs with the barrier in unlock_page() */
+	smp_mb();
+	if (!PageLocked(page)) {
+		list_del_init(&wait->wait.task_list);
+		wait->key.flags = NULL;
+		ret = 0;
+	} else
+		kiocbSetPageWait(iocb);
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	return ret;
+}
+
+/*
+ * lock_page() for buffered aio reads: rather than sleep, arrange for the
+ * iocb to be retried once the page is unlocked.
+ */
+static int lock_page_async(struct page *page, struct kiocb *iocb)
+{
+	while (!trylock_page(page)) {
+		if (wait_on_page_locked_async(page, iocb))
+			return -EIOCBRETRY;
+	}
+	return 0;
+}
+#else
+static inline void kiocb_cancel_page_wait(struct kiocb *iocb)
+{
+}
+
+static inline int lock_page_async(struct page *page, struct kiocb *iocb)
+{
+	return lock_page_killable(page);
+}
+#endif
+
 /**
  * unlock_page - unlock a locked page
  * @page: the page
@@ -1071,15 +1166,21 @@ static void shrink_readahead_size_eio(struct file *filp,
  * @ppos:	current file position
  * @desc:	read_descriptor
  * @actor:	read method
+ * @iocb:	the aio request, or NULL
  *
  * This is a generic file read routine, and uses the
  * mapping->a_ops->readpage() function for the actual low-level stuff.
  *
+ * If @iocb can be retried, the read never sleeps waiting for a page to
+ * come uptodate.  It stops with desc->error set to -EIOCBRETRY and the
+ * page unlock will kick the iocb, by which time the page is in the cache.
+ *
  * This is really ugly. But the goto's actually try to clarify some
  * of the logic when it comes to error handling etc.
  */
 static void do_generic_file_read(struct file *filp, loff_t *ppos,
-		read_descriptor_t *desc, read_actor_t actor)
+		read_descriptor_t *desc, read_actor_t actor,
+		struct kiocb *iocb)
 {
 	struct address_space *mapping = filp->f_mapping;
 	struct inode *inode = mapping->host;
@@ -1089,6 +1190,7 @@ static void do_generic_file_read(struct file *filp, loff_t *ppos,
 	pgoff_t prev_index;
 	unsigned long offset;      /* offset into pagecache page */
 	unsigned int prev_offset;
+	bool async = iocb && is_retryable_kiocb(iocb);
 	int error;
 
 	index = *ppos >> PAGE_CACHE_SHIFT;
@@ -1199,7 +1301,10 @@ page_ok:
 
 page_not_up_to_date:
 		/* Get exclusive access to the page ... */
-		error = lock_page_killable(page);
+		if (async)
+			error = lock_page_async(page, iocb);
+		else
+			error = lock_page_killable(page);
 		if (unlikely(error))
 			goto readpage_error;
 
@@ -1236,7 +1341,10 @@ readpage:
 		}
 
 		if (!PageUptodate(page)) {
-			error = lock_page_killable(page);
+			if (async)
+				error = lock_page_async(page, iocb);
+			else
+				error = lock_page_killable(page);
 			if (unlikely(error))
 				goto readpage_error;
 			if (!PageUptodate(page)) {
@@ -1463,9 +1571,15 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 		if (desc.count == 0)
 			continue;
 		desc.error = 0;
-		do_generic_file_read(filp, ppos, &desc, file_read_actor);
+		do_generic_file_read(filp, ppos, &desc, file_read_actor, iocb);
 		retval += desc.written;
 		if (desc.error) {
+			/*
+			 * A partial read completes as such, so it must not
+			 * leave the iocb queued for a kick it won't wait for.
+			 */
+			if (retval && desc.error == -EIOCBRETRY)
+				kiocb_cancel_page_wait(iocb);
 			retval = retval ?: desc.error;
 			break;
 		}
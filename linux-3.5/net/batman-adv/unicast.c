@@ -240,7 +240,8 @@ int frag_send_skb(struct sk_buff *skb, struct bat_priv *bat_priv,
 
 	unicast_packet = (struct unicast_packet *)skb->data;
 	memcpy(&tmp_uc, unicast_packet, uc_hdr_len);
-	skb_split(skb, frag_skb, data_len / 2 + uc_hdr_len);
+	if (skb_split(skb, frag_skb, data_len / 2 + uc_hdr_len) < 0)
+		goto drop_frag;
 
 	if (my_skb_head_push(skb, ucf_hdr_len - uc_hdr_len) < 0 ||
 	    my_skb_head_push(frag_skb, ucf_hdr_len) < 0)
@@ -38,7 +38,7 @@
 #include <linux/filter.h>
 #include <linux/reciprocal_div.h>
 #include <linux/ratelimit.h>
-#include <linux/seccomp.h>
+#include <linux/bpf.h>
 
 /* No hurry in this branch
  *
@@ -72,9 +72,9 @@ static inline void *load_pointer(const struct sk_buff *skb, int k,
  *	@skb: buffer to filter
  *
  * Run the filter code and then cut skb->data to correct size returned by
- * sk_run_filter. If pkt_len is 0 we toss packet. If skb->len is smaller
+ * SK_RUN_FILTER. If pkt_len is 0 we toss packet. If skb->len is smaller
  * than pkt_len we keep whole skb->data. This is the socket level
- * wrapper to sk_run_filter. It returns 0 if the packet should
+ * wrapper to SK_RUN_FILTER. It returns 0 if the packet should
  * be accepted or -EPERM if the packet should be tossed.
  *
  */
@@ -356,11 +356,6 @@ load_b:
 				A = 0;
 			continue;
 		}
-#ifdef CONFIG_SECCOMP_FILTER
-		case BPF_S_ANC_SECCOMP_LD_W:
-			A = seccomp_bpf_load(fentry->k);
-			continue;
-#endif
 		default:
 			WARN_RATELIMIT(1, "Unknown code:%u jt:%u tf:%u k:%u\n",
 				       fentry->code, fentry->jt,
@@ -586,6 +581,503 @@ int sk_chk_filter(struct sock_filter *filter, unsigned int flen)
 }
 EXPORT_SYMBOL(sk_chk_filter);
 
+/* Classic opcodes of the BPF_S_* codes sk_chk_filter() rewrites to */
+static const u16 bpf_classic_codes[] = {
+	[BPF_S_ALU_ADD_K]	= BPF_ALU|BPF_ADD|BPF_K,
+	[BPF_S_ALU_ADD_X]	= BPF_ALU|BPF_ADD|BPF_X,
+	[BPF_S_ALU_SUB_K]	= BPF_ALU|BPF_SUB|BPF_K,
+	[BPF_S_ALU_SUB_X]	= BPF_ALU|BPF_SUB|BPF_X,
+	[BPF_S_ALU_MUL_K]	= BPF_ALU|BPF_MUL|BPF_K,
+	[BPF_S_ALU_MUL_X]	= BPF_ALU|BPF_MUL|BPF_X,
+	[BPF_S_ALU_DIV_X]	= BPF_ALU|BPF_DIV|BPF_X,
+	[BPF_S_ALU_AND_K]	= BPF_ALU|BPF_AND|BPF_K,
+	[BPF_S_ALU_AND_X]	= BPF_ALU|BPF_AND|BPF_X,
+	[BPF_S_ALU_OR_K]	= BPF_ALU|BPF_OR|BPF_K,
+	[BPF_S_ALU_OR_X]	= BPF_ALU|BPF_OR|BPF_X,
+	[BPF_S_ALU_LSH_K]	= BPF_ALU|BPF_LSH|BPF_K,
+	[BPF_S_ALU_LSH_X]	= BPF_ALU|BPF_LSH|BPF_X,
+	[BPF_S_ALU_RSH_K]	= BPF_ALU|BPF_RSH|BPF_K,
+	[BPF_S_ALU_RSH_X]	= BPF_ALU|BPF_RSH|BPF_X,
+	[BPF_S_ALU_NEG]		= BPF_ALU|BPF_NEG,
+	[BPF_S_LD_W_ABS]	= BPF_LD|BPF_W|BPF_ABS,
+	[BPF_S_LD_H_ABS]	= BPF_LD|BPF_H|BPF_ABS,
+	[BPF_S_LD_B_ABS]	= BPF_LD|BPF_B|BPF_ABS,
+	[BPF_S_LD_W_LEN]	= BPF_LD|BPF_W|BPF_LEN,
+	[BPF_S_LD_W_IND]	= BPF_LD|BPF_W|BPF_IND,
+	[BPF_S_LD_H_IND]	= BPF_LD|BPF_H|BPF_IND,
+	[BPF_S_LD_B_IND]	= BPF_LD|BPF_B|BPF_IND,
+	[BPF_S_LD_IMM]		= BPF_LD|BPF_IMM,
+	[BPF_S_LDX_W_LEN]	= BPF_LDX|BPF_W|BPF_LEN,
+	[BPF_S_LDX_B_MSH]	= BPF_LDX|BPF_B|BPF_MSH,
+	[BPF_S_LDX_IMM]		= BPF_LDX|BPF_IMM,
+	[BPF_S_MISC_TAX]	= BPF_MISC|BPF_TAX,
+	[BPF_S_MISC_TXA]	= BPF_MISC|BPF_TXA,
+	[BPF_S_RET_K]		= BPF_RET|BPF_K,
+	[BPF_S_RET_A]		= BPF_RET|BPF_A,
+	[BPF_S_ALU_DIV_K]	= BPF_ALU|BPF_DIV|BPF_K,
+	[BPF_S_LD_MEM]		= BPF_LD|BPF_MEM,
+	[BPF_S_LDX_MEM]		= BPF_LDX|BPF_MEM,
+	[BPF_S_ST]		= BPF_ST,
+	[BPF_S_STX]		= BPF_STX,
+	[BPF_S_JMP_JA]		= BPF_JMP|BPF_JA,
+	[BPF_S_JMP_JEQ_K]	= BPF_JMP|BPF_JEQ|BPF_K,
+	[BPF_S_JMP_JEQ_X]	= BPF_JMP|BPF_JEQ|BPF_X,
+	[BPF_S_JMP_JGE_K]	= BPF_JMP|BPF_JGE|BPF_K,
+	[BPF_S_JMP_JGE_X]	= BPF_JMP|BPF_JGE|BPF_X,
+	[BPF_S_JMP_JGT_K]	= BPF_JMP|BPF_JGT|BPF_K,
+	[BPF_S_JMP_JGT_X]	= BPF_JMP|BPF_JGT|BPF_X,
+	[BPF_S_JMP_JSET_K]	= BPF_JMP|BPF_JSET|BPF_K,
+	[BPF_S_JMP_JSET_X]	= BPF_JMP|BPF_JSET|BPF_X,
+};
+
+static u64 __skb_get_nlattr(u64 ctx, u64 A, u64 X, u64 r4, u64 r5)
+{
+	struct sk_buff *skb = (struct sk_buff *)(unsigned long) ctx;
+	struct nlattr *nla;
+
+	if (skb_is_nonlinear(skb))
+		return 0;
+
+	if (skb->len < sizeof(struct nlattr))
+		return 0;
+
+	if (A > skb->len - sizeof(struct nlattr))
+		return 0;
+
+	nla = nla_find((struct nlattr *) &skb->data[A], skb->len - A, X);
+	if (nla)
+		return (void *) nla - (void *) skb->data;
+
+	return 0;
+}
+
+static u64 __skb_get_nlattr_nest(u64 ctx, u64 A, u64 X, u64 r4, u64 r5)
+{
+	struct sk_buff *skb = (struct sk_buff *)(unsigned long) ctx;
+	struct nlattr *nla;
+
+	if (skb_is_nonlinear(skb))
+		return 0;
+
+	if (skb->len < sizeof(struct nlattr))
+		return 0;
+
+	if (A > skb->len - sizeof(struct nlattr))
+		return 0;
+
+	nla = (struct nlattr *) &skb->data[A];
+	if (nla->nla_len > skb->len - A)
+		return 0;
+
+	nla = nla_find_nested(nla, X);
+	if (nla)
+		return (void *) nla - (void *) skb->data;
+
+	return 0;
+}
+
+static u64 __get_raw_cpu_id(u64 ctx, u64 A, u64 X, u64 r4, u64 r5)
+{
+	return raw_smp_processor_id();
+}
+
+/* Pointers loaded from the context are machine words. */
+#define BPF_PTR_SIZE	(sizeof(void *) == 8 ? BPF_DW : BPF_W)
+
+static bool convert_bpf_extensions(struct sock_filter *fp,
+				   struct bpf_insn **insnp)
+{
+	struct bpf_insn *insn = *insnp;
+
+	switch (fp->code) {
+	case BPF_S_ANC_PROTOCOL:
+		BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, protocol) != 2);
+
+		/* A = *(u16 *) (CTX + offsetof(protocol)) */
+		*insn++ = BPF_LDX_MEM(BPF_H, BPF_REG_A, BPF_REG_CTX,
+				      offsetof(struct sk_buff, protocol));
+		/* A = ntohs(A) [emitting a nop or swap16] */
+		*insn = BPF_ENDIAN(BPF_FROM_BE, BPF_REG_A, 16);
+		break;
+
+	case BPF_S_ANC_PKTTYPE:
+		*insn++ = BPF_LDX_MEM(BPF_B, BPF_REG_A, BPF_REG_CTX,
+				      PKT_TYPE_OFFSET());
+		*insn = BPF_ALU32_IMM(BPF_AND, BPF_REG_A, PKT_TYPE_MAX);
+#ifdef __BIG_ENDIAN_BITFIELD
+		insn++;
+		*insn = BPF_ALU32_IMM(BPF_RSH, BPF_REG_A, 5);
+#endif
+		break;
+
+	case BPF_S_ANC_IFINDEX:
+	case BPF_S_ANC_HATYPE:
+		BUILD_BUG_ON(FIELD_SIZEOF(struct net_device, ifindex) != 4);
+		BUILD_BUG_ON(FIELD_SIZEOF(struct net_device, type) != 2);
+
+		/* tmp = skb->dev */
+		*insn++ = BPF_LDX_MEM(BPF_PTR_SIZE, BPF_REG_TMP, BPF_REG_CTX,
+				      offsetof(struct sk_buff, dev));
+		/* if (tmp != 0) goto pc + 2, else return 0 */
+		*insn++ = BPF_JMP_IMM(BPF_JNE, BPF_REG_TMP, 0, 2);
+		*insn++ = BPF_MOV32_IMM(BPF_REG_A, 0);
+		*insn++ = BPF_EXIT_INSN();
+		if (fp->code == BPF_S_ANC_IFINDEX)
+			*insn = BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_TMP,
+					    offsetof(struct net_device, ifindex));
+		else
+			*insn = BPF_LDX_MEM(BPF_H, BPF_REG_A, BPF_REG_TMP,
+					    offsetof(struct net_device, type));
+		break;
+
+	case BPF_S_ANC_MARK:
+		BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, mark) != 4);
+
+		*insn = BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_CTX,
+				    offsetof(struct sk_buff, mark));
+		break;
+
+	case BPF_S_ANC_RXHASH:
+		BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, rxhash) != 4);
+
+		*insn = BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_CTX,
+				    offsetof(struct sk_buff, rxhash));
+		break;
+
+	case BPF_S_ANC_QUEUE:
+		BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, queue_mapping) != 2);
+
+		*insn = BPF_LDX_MEM(BPF_H, BPF_REG_A, BPF_REG_CTX,
+				    offsetof(struct sk_buff, queue_mapping));
+		break;
+
+	case BPF_S_ANC_NLATTR:
+	case BPF_S_ANC_NLATTR_NEST:
+	case BPF_S_ANC_CPU:
+		/* arg1 = CTX */
+		*insn++ = BPF_MOV64_REG(BPF_REG_ARG1, BPF_REG_CTX);
+		/* arg2 = A */
+		*insn++ = BPF_MOV64_REG(BPF_REG_ARG2, BPF_REG_A);
+		/* arg3 = X */
+		*insn++ = BPF_MOV64_REG(BPF_REG_ARG3, BPF_REG_X);
+		/* Emit call(arg1=CTX, arg2=A, arg3=X) */
+		switch (fp->code) {
+		case BPF_S_ANC_NLATTR:
+			*insn = BPF_EMIT_CALL(__skb_get_nlattr);
+			break;
+		case BPF_S_ANC_NLATTR_NEST:
+			*insn = BPF_EMIT_CALL(__skb_get_nlattr_nest);
+			break;
+		case BPF_S_ANC_CPU:
+			*insn = BPF_EMIT_CALL(__get_raw_cpu_id);
+			break;
+		}
+		break;
+
+	case BPF_S_ANC_ALU_XOR_X:
+		/* A ^= X */
+		*insn = BPF_ALU32_REG(BPF_XOR, BPF_REG_A, BPF_REG_X);
+		break;
+
+	case BPF_S_ANC_SECCOMP_LD_W:
+		/* A = *(u32 *) (ctx + K), the context is struct seccomp_data */
+		*insn = BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_CTX, fp->k);
+		break;
+
+	default:
+		return false;
+	}
+
+	*insnp = insn;
+	return true;
+}
+
+/**
+ *	sk_convert_filter - convert filter program
+ *	@prog: the user passed filter program, checked by sk_chk_filter()
+ *	@len: the length of the user passed filter program
+ *	@new_prog: buffer where converted program will be stored
+ *	@new_len: pointer to store length of converted program
+ *
+ * Remap 'sock_filter' style classic BPF instruction set to 'bpf_insn'
+ * style eBPF.  Classic A and X live in BPF_REG_A and BPF_REG_X, the
+ * scratch memory words at the top of the stack frame, and ancillary
+ * loads become context loads or helper calls.
+ *
+ * Conversion workflow:
+ *
+ * 1) First pass for calculating the new program length:
+ *   sk_convert_filter(old_prog, old_len, NULL, &new_len)
+ *
+ * 2) 2nd call to remap, internally does two passes so that the jump
+ *    offsets are known:
+ *   sk_convert_filter(old_prog, old_len, new_prog, &new_len);
+ */
+int sk_convert_filter(struct sock_filter *prog, int len,
+		      struct bpf_insn *new_prog, int *new_len)
+{
+	int new_flen = 0, pass = 0, pos, target, i;
+	struct sock_filter *fp;
+	int *addrs = NULL;
+	u8 bpf_src;
+	u16 code;
+
+	BUILD_BUG_ON(BPF_MEMWORDS * sizeof(u32) > MAX_BPF_STACK);
+	BUILD_BUG_ON(BPF_REG_FP + 1 != MAX_BPF_REG);
+
+	if (len <= 0 || len > BPF_MAXINSNS)
+		return -EINVAL;
+
+	if (new_prog) {
+		addrs = kcalloc(len, sizeof(*addrs), GFP_KERNEL);
+		if (!addrs)
+			return -ENOMEM;
+	}
+
+do_pass:
+	/* Classic A and X start out as zero, the context moves to CTX. */
+	if (new_prog) {
+		new_prog[0] = BPF_ALU32_REG(BPF_XOR, BPF_REG_A, BPF_REG_A);
+		new_prog[1] = BPF_ALU32_REG(BPF_XOR, BPF_REG_X, BPF_REG_X);
+		new_prog[2] = BPF_MOV64_REG(BPF_REG_CTX, BPF_REG_ARG1);
+	}
+	pos = 3;
+
+	for (fp = prog, i = 0; i < len; fp++, i++) {
+		struct bpf_insn tmp_insns[6] = { };
+		struct bpf_insn *insn = tmp_insns;
+
+		if (addrs)
+			addrs[i] = pos;
+
+		if (convert_bpf_extensions(fp, &insn))
+			goto next;
+
+		if (fp->code >= ARRAY_SIZE(bpf_classic_codes))
+			goto err;
+		code = bpf_classic_codes[fp->code];
+
+		switch (code) {
+		/* All arithmetic insns map as-is. */
+		case BPF_ALU | BPF_ADD | BPF_X:
+		case BPF_ALU | BPF_ADD | BPF_K:
+		case BPF_ALU | BPF_SUB | BPF_X:
+		case BPF_ALU | BPF_SUB | BPF_K:
+		case BPF_ALU | BPF_AND | BPF_X:
+		case BPF_ALU | BPF_AND | BPF_K:
+		case BPF_ALU | BPF_OR | BPF_X:
+		case BPF_ALU | BPF_OR | BPF_K:
+		case BPF_ALU | BPF_LSH | BPF_X:
+		case BPF_ALU | BPF_LSH | BPF_K:
+		case BPF_ALU | BPF_RSH | BPF_X:
+		case BPF_ALU | BPF_RSH | BPF_K:
+		case BPF_ALU | BPF_MUL | BPF_X:
+		case BPF_ALU | BPF_MUL | BPF_K:
+		case BPF_ALU | BPF_DIV | BPF_X:
+		case BPF_ALU | BPF_NEG:
+			bpf_src = BPF_SRC(code);
+			*insn = BPF_RAW_INSN(code, BPF_REG_A,
+					     bpf_src == BPF_X ? BPF_REG_X : 0,
+					     0, fp->k);
+			break;
+
+		/* sk_chk_filter() replaced K by reciprocal_value(K):
+		 * A = ((u64) A * K) >> 32, just like reciprocal_divide().
+		 */
+		case BPF_ALU | BPF_DIV | BPF_K:
+			*insn++ = BPF_MOV32_IMM(BPF_REG_TMP, fp->k);
+			*insn++ = BPF_ALU64_REG(BPF_MUL, BPF_REG_A, BPF_REG_TMP);
+			*insn = BPF_ALU64_IMM(BPF_RSH, BPF_REG_A, 32);
+			break;
+
+		/* Packet loads, ancillary offsets were handled above. */
+		case BPF_LD | BPF_ABS | BPF_W:
+		case BPF_LD | BPF_ABS | BPF_H:
+		case BPF_LD | BPF_ABS | BPF_B:
+			*insn = BPF_LD_ABS(BPF_SIZE(code), fp->k);
+			break;
+		case BPF_LD | BPF_IND | BPF_W:
+		case BPF_LD | BPF_IND | BPF_H:
+		case BPF_LD | BPF_IND | BPF_B:
+			*insn = BPF_LD_IND(BPF_SIZE(code), BPF_REG_X, fp->k);
+			break;
+
+		/* Jump transformation cannot use BPF block macros
+		 * everywhere as offset calculation and target updates
+		 * require a bit more work than the rest, i.e. jump
+		 * opcodes map as-is, but offsets need adjustment.
+		 */
+
+#define BPF_EMIT_JMP							\
+	do {								\
+		if (target >= len || target < 0)			\
+			goto err;					\
+		insn->off = addrs ? addrs[target] - addrs[i] - 1 : 0;	\
+		/* Adjust pc relative offset for 2nd or 3rd insn. */	\
+		insn->off -= insn - tmp_insns;				\
+	} while (0)
+
+		case BPF_JMP | BPF_JA:
+			target = i + fp->k + 1;
+			insn->code = code;
+			BPF_EMIT_JMP;
+			break;
+
+		case BPF_JMP | BPF_JEQ | BPF_K:
+		case BPF_JMP | BPF_JEQ | BPF_X:
+		case BPF_JMP | BPF_JSET | BPF_K:
+		case BPF_JMP | BPF_JSET | BPF_X:
+		case BPF_JMP | BPF_JGT | BPF_K:
+		case BPF_JMP | BPF_JGT | BPF_X:
+		case BPF_JMP | BPF_JGE | BPF_K:
+		case BPF_JMP | BPF_JGE | BPF_X:
+			if (BPF_SRC(code) == BPF_K && (int) fp->k < 0) {
+				/* eBPF immediates are sign extended to 64
+				 * bits, classic ones are unsigned: zero
+				 * extend K into tmp and compare against it.
+				 */
+				*insn++ = BPF_MOV32_IMM(BPF_REG_TMP, fp->k);
+
+				insn->dst_reg = BPF_REG_A;
+				insn->src_reg = BPF_REG_TMP;
+				bpf_src = BPF_X;
+			} else {
+				insn->dst_reg = BPF_REG_A;
+				bpf_src = BPF_SRC(code);
+				if (bpf_src == BPF_X)
+					insn->src_reg = BPF_REG_X;
+				else
+					insn->imm = fp->k;
+			}
+
+			/* Common case where 'jump_false' is next insn. */
+			if (fp->jf == 0) {
+				insn->code = BPF_JMP | BPF_OP(code) | bpf_src;
+				target = i + fp->jt + 1;
+				BPF_EMIT_JMP;
+				break;
+			}
+
+			/* Convert JEQ into JNE when 'jump_true' is next insn. */
+			if (fp->jt == 0 && BPF_OP(code) == BPF_JEQ) {
+				insn->code = BPF_JMP | BPF_JNE | bpf_src;
+				target = i + fp->jf + 1;
+				BPF_EMIT_JMP;
+				break;
+			}
+
+			/* Other jumps are mapped into two insns: Jxx and JA. */
+			target = i + fp->jt + 1;
+			insn->code = BPF_JMP | BPF_OP(code) | bpf_src;
+			BPF_EMIT_JMP;
+			insn++;
+
+			insn->code = BPF_JMP | BPF_JA;
+			target = i + fp->jf + 1;
+			BPF_EMIT_JMP;
+			break;
+#undef BPF_EMIT_JMP
+
+		/* ldxb 4 * ([14] & 0xf) is remapped into 6 insns. */
+		case BPF_LDX | BPF_MSH | BPF_B:
+			/* tmp = A */
+			*insn++ = BPF_MOV64_REG(BPF_REG_TMP, BPF_REG_A);
+			/* A = BPF_R0 = *(u8 *) (skb->data + K) */
+			*insn++ = BPF_LD_ABS(BPF_B, fp->k);
+			/* A &= 0xf */
+			*insn++ = BPF_ALU32_IMM(BPF_AND, BPF_REG_A, 0xf);
+			/* A <<= 2 */
+			*insn++ = BPF_ALU32_IMM(BPF_LSH, BPF_REG_A, 2);
+			/* X = A */
+			*insn++ = BPF_MOV64_REG(BPF_REG_X, BPF_REG_A);
+			/* A = tmp */
+			*insn = BPF_MOV64_REG(BPF_REG_A, BPF_REG_TMP);
+			break;
+
+		/* RET_K, RET_A are remapped into 2 insns. */
+		case BPF_RET | BPF_A:
+		case BPF_RET | BPF_K:
+			if (BPF_RVAL(code) == BPF_K)
+				*insn++ = BPF_MOV32_IMM(BPF_REG_A, fp->k);
+			*insn = BPF_EXIT_INSN();
+			break;
+
+		/* Store to stack. */
+		case BPF_ST:
+		case BPF_STX:
+			*insn = BPF_STX_MEM(BPF_W, BPF_REG_FP,
+					    BPF_CLASS(code) == BPF_ST ?
+					    BPF_REG_A : BPF_REG_X,
+					    -(BPF_MEMWORDS - fp->k) * 4);
+			break;
+
+		/* Load from stack. */
+		case BPF_LD | BPF_MEM:
+		case BPF_LDX | BPF_MEM:
+			*insn = BPF_LDX_MEM(BPF_W, BPF_CLASS(code) == BPF_LD ?
+					    BPF_REG_A : BPF_REG_X, BPF_REG_FP,
+					    -(BPF_MEMWORDS - fp->k) * 4);
+			break;
+
+		/* A = K or X = K */
+		case BPF_LD | BPF_IMM:
+		case BPF_LDX | BPF_IMM:
+			*insn = BPF_MOV32_IMM(BPF_CLASS(code) == BPF_LD ?
+					      BPF_REG_A : BPF_REG_X, fp->k);
+			break;
+
+		/* X = A */
+		case BPF_MISC | BPF_TAX:
+			*insn = BPF_MOV64_REG(BPF_REG_X, BPF_REG_A);
+			break;
+
+		/* A = X */
+		case BPF_MISC | BPF_TXA:
+			*insn = BPF_MOV64_REG(BPF_REG_A, BPF_REG_X);
+			break;
+
+		/* A = skb->len or X = skb->len */
+		case BPF_LD | BPF_W | BPF_LEN:
+		case BPF_LDX | BPF_W | BPF_LEN:
+			*insn = BPF_LDX_MEM(BPF_W, BPF_CLASS(code) == BPF_LD ?
+					    BPF_REG_A : BPF_REG_X, BPF_REG_CTX,
+					    offsetof(struct sk_buff, len));
+			break;
+
+		default:
+			goto err;
+		}
+next:
+		insn++;
+		if (new_prog)
+			memcpy(new_prog + pos, tmp_insns,
+			       sizeof(*insn) * (insn - tmp_insns));
+		pos += insn - tmp_insns;
+	}
+
+	if (!new_prog) {
+		/* Only calculating new length. */
+		*new_len = pos;
+		return 0;
+	}
+
+	pass++;
+	if (new_flen != pos) {
+		new_flen = pos;
+		if (pass > 2)
+			goto err;
+		goto do_pass;
+	}
+
+	kfree(addrs);
+	BUG_ON(*new_len != new_flen);
+	return 0;
+err:
+	kfree(addrs);
+	return -EINVAL;
+}
+EXPORT_SYMBOL_GPL(sk_convert_filter);
+
 /**
  * 	sk_filter_release_rcu - Release a socket filter by rcu_head
  *	@rcu: rcu_head that contains the sk_filter to free
@@ -594,23 +1086,121 @@ void sk_filter_release_rcu(struct rcu_head *rcu)
 {
 	struct sk_filter *fp = container_of(rcu, struct sk_filter, rcu);
 
-	bpf_jit_free(fp);
-	kfree(fp);
+	sk_filter_free(fp);
 }
 EXPORT_SYMBOL(sk_filter_release_rcu);
 
-static int __sk_prepare_filter(struct sk_filter *fp)
+static void __sk_filter_release(struct sk_filter *fp, struct sock *sk)
+{
+	if (sk)
+		sk_filter_uncharge(sk, fp);
+	else
+		kfree(fp);
+}
+
+static struct sk_filter *__sk_migrate_realloc(struct sk_filter *fp,
+					      struct sock *sk,
+					      unsigned int len)
+{
+	struct sk_filter *fp_new;
+
+	if (sk == NULL)
+		return krealloc(fp, len, GFP_KERNEL);
+
+	fp_new = sock_kmalloc(sk, len, GFP_KERNEL);
+	if (fp_new) {
+		*fp_new = *fp;
+		sock_kfree_s(sk, fp, sk_filter_len(fp));
+	}
+
+	return fp_new;
+}
+
+static struct sk_filter *__sk_migrate_filter(struct sk_filter *fp,
+					     struct sock *sk)
+{
+	struct sock_filter *old_prog;
+	struct sk_filter *old_fp;
+	int err, new_len, old_len = fp->len;
+
+	/* The classic program is no longer needed once it has been
+	 * translated, the eBPF one takes its place in fp.
+	 */
+	BUILD_BUG_ON(sizeof(struct sock_filter) != sizeof(struct bpf_insn));
+
+	/* Conversion cannot happen on overlapping memory areas, so
+	 * keep a copy of the classic program around until the 2nd pass.
+	 */
+	old_prog = kmemdup(fp->insns, old_len * sizeof(struct sock_filter),
+			   GFP_KERNEL);
+	if (!old_prog) {
+		err = -ENOMEM;
+		goto out_err;
+	}
+
+	/* 1st pass: calculate the new program length. */
+	err = sk_convert_filter(old_prog, old_len, NULL, &new_len);
+	if (err)
+		goto out_err_free;
+
+	/* Expand fp for appending the new filter representation. */
+	old_fp = fp;
+	fp = __sk_migrate_realloc(old_fp, sk, sk_filter_size(new_len));
+	if (!fp) {
+		/* The old_fp is still around in case we couldn't
+		 * allocate new memory, so uncharge on that one.
+		 */
+		fp = old_fp;
+		err = -ENOMEM;
+		goto out_err_free;
+	}
+
+	fp->len = new_len;
+
+	/* 2nd pass: remap sock_filter insns into bpf_insn insns. */
+	err = sk_convert_filter(old_prog, old_len, fp->insnsi, &new_len);
+	if (err)
+		/* The 2nd sk_convert_filter() can only fail to allocate
+		 * memory, the remapping itself succeeded in the 1st pass.
+		 */
+		goto out_err_free;
+
+	sk_filter_select_runtime(fp);
+
+	kfree(old_prog);
+	return fp;
+
+out_err_free:
+	kfree(old_prog);
+out_err:
+	__sk_filter_release(fp, sk);
+	return ERR_PTR(err);
+}
+
+static struct sk_filter *__sk_prepare_filter(struct sk_filter *fp,
+					     struct sock *sk)
 {
 	int err;
 
-	fp->bpf_func = sk_run_filter;
+	fp->bpf_func = NULL;
+	fp->jited = 0;
+	fp->aux = NULL;
 
 	err = sk_chk_filter(fp->insns, fp->len);
-	if (err)
-		return err;
+	if (err) {
+		__sk_filter_release(fp, sk);
+		return ERR_PTR(err);
+	}
 
+	/* Architectures with a classic BPF JIT compile the filter as it
+	 * is; everything else runs it through the eBPF JIT or interpreter.
+	 */
 	bpf_jit_compile(fp);
-	return 0;
+
+	if (!fp->jited)
+		fp = __sk_migrate_filter(fp, sk);
+
+	return fp;
 }
 
 /**
@@ -626,15 +1216,14 @@ static int __sk_prepare_filter(struct sk_filter *fp)
 int sk_unattached_filter_create(struct sk_filter **pfp,
 				struct sock_fprog *fprog)
 {
-	struct sk_filter *fp;
 	unsigned int fsize = sizeof(struct sock_filter) * fprog->len;
-	int err;
+	struct sk_filter *fp;
 
 	/* Make sure new filter is there and in the right amounts. */
 	if (fprog->filter == NULL)
 		return -EINVAL;
 
-	fp = kmalloc(fsize + sizeof(*fp), GFP_KERNEL);
+	fp = kmalloc(sk_filter_size(fprog->len), GFP_KERNEL);
 	if (!fp)
 		return -ENOMEM;
 	memcpy(fp->insns, fprog->filter, fsize);
@@ -642,15 +1231,12 @@ int sk_unattached_filter_create(struct sk_filter **pfp,
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
 
-	err = __sk_prepare_filter(fp);
-	if (err)
-		goto free_mem;
+	fp = __sk_prepare_filter(fp, NULL);
+	if (IS_ERR(fp))
+		return PTR_ERR(fp);
 
 	*pfp = fp;
 	return 0;
-free_mem:
-	kfree(fp);
-	return err;
 }
 EXPORT_SYMBOL_GPL(sk_unattached_filter_create);
 
@@ -674,28 +1260,26 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 {
 	struct sk_filter *fp, *old_fp;
 	unsigned int fsize = sizeof(struct sock_filter) * fprog->len;
-	int err;
+	unsigned int sk_fsize = sk_filter_size(fprog->len);
 
 	/* Make sure new filter is there and in the right amounts. */
 	if (fprog->filter == NULL)
 		return -EINVAL;
 
-	fp = sock_kmalloc(sk, fsize+sizeof(*fp), GFP_KERNEL);
+	fp = sock_kmalloc(sk, sk_fsize, GFP_KERNEL);
 	if (!fp)
 		return -ENOMEM;
 	if (copy_from_user(fp->insns, fprog->filter, fsize)) {
-		sock_kfree_s(sk, fp, fsize+sizeof(*fp));
+		sock_kfree_s(sk, fp, sk_fsize);
 		return -EFAULT;
 	}
 
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
 
-	err = __sk_prepare_filter(fp);
-	if (err) {
-		sk_filter_uncharge(sk, fp);
-		return err;
-	}
+	fp = __sk_prepare_filter(fp, sk);
+	if (IS_ERR(fp))
+		return PTR_ERR(fp);
 
 	old_fp = rcu_dereference_protected(sk->sk_filter,
 					   sock_owned_by_user(sk));
@@ -707,6 +1291,45 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 }
 EXPORT_SYMBOL_GPL(sk_attach_filter);
 
+/**
+ *	sk_attach_bpf - attach an eBPF program to a socket
+ *	@ufd: file descriptor of a program loaded with bpf(BPF_PROG_LOAD)
+ *	@sk: the socket to use
+ *
+ * The socket holds its own reference to the program, the descriptor
+ * may be closed once this returns.  The program is charged to the
+ * socket's option memory like a classic filter.
+ */
+int sk_attach_bpf(u32 ufd, struct sock *sk)
+{
+	struct sk_filter *prog, *old_prog;
+
+	prog = bpf_prog_get(ufd);
+	if (IS_ERR(prog))
+		return PTR_ERR(prog);
+
+	if (prog->aux->prog_type != BPF_PROG_TYPE_SOCKET_FILTER) {
+		sk_filter_release(prog);
+		return -EINVAL;
+	}
+
+	if (atomic_read(&sk->sk_omem_alloc) + sk_filter_len(prog) >=
+	    sysctl_optmem_max) {
+		sk_filter_release(prog);
+		return -ENOMEM;
+	}
+	atomic_add(sk_filter_len(prog), &sk->sk_omem_alloc);
+
+	old_prog = rcu_dereference_protected(sk->sk_filter,
+					     sock_owned_by_user(sk));
+	rcu_assign_pointer(sk->sk_filter, prog);
+
+	if (old_prog)
+		sk_filter_uncharge(sk, old_prog);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sk_attach_bpf);
+
 int sk_detach_filter(struct sock *sk)
 {
 	int ret = -ENOENT;
@@ -722,3 +1345,103 @@ int sk_detach_filter(struct sock *sk)
 	return ret;
 }
 EXPORT_SYMBOL_GPL(sk_detach_filter);
+
+#ifdef CONFIG_BPF_SYSCALL
+static const struct bpf_func_proto *
+sock_filter_func_proto(enum bpf_func_id func_id)
+{
+	switch (func_id) {
+	case BPF_FUNC_map_lookup_elem:
+		return &bpf_map_lookup_elem_proto;
+	case BPF_FUNC_map_update_elem:
+		return &bpf_map_update_elem_proto;
+	case BPF_FUNC_map_delete_elem:
+		return &bpf_map_delete_elem_proto;
+	case BPF_FUNC_get_prandom_u32:
+		return &bpf_get_prandom_u32_proto;
+	case BPF_FUNC_get_smp_processor_id:
+		return &bpf_get_smp_processor_id_proto;
+	default:
+		return NULL;
+	}
+}
+
+static bool sock_filter_is_valid_access(int off, int size,
+					enum bpf_access_type type,
+					enum bpf_reg_type *reg_type)
+{
+	/* the skb is only reachable through ld_abs/ld_ind */
+	return false;
+}
+
+static const struct bpf_verifier_ops sock_filter_ops = {
+	.get_func_proto = sock_filter_func_proto,
+	.is_valid_access = sock_filter_is_valid_access,
+};
+
+static struct bpf_prog_type_list sock_filter_type __read_mostly = {
+	.ops = &sock_filter_ops,
+	.type = BPF_PROG_TYPE_SOCKET_FILTER,
+};
+
+static bool xdp_is_valid_access(int off, int size,
+				enum bpf_access_type type,
+				enum bpf_reg_type *reg_type)
+{
+	if (type != BPF_READ || size != sizeof(__u32))
+		return false;
+
+	switch (off) {
+	case offsetof(struct xdp_md, data):
+		*reg_type = PTR_TO_PACKET;
+		return true;
+	case offsetof(struct xdp_md, data_end):
+		*reg_type = PTR_TO_PACKET_END;
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void xdp_convert_ctx_access(int dst_reg, int src_reg, int ctx_off,
+				   struct bpf_insn *insn)
+{
+	int size = sizeof(void *) == 8 ? BPF_DW : BPF_W;
+
+	switch (ctx_off) {
+	case offsetof(struct xdp_md, data):
+		*insn = BPF_LDX_MEM(size, dst_reg, src_reg,
+				    offsetof(struct xdp_buff, data));
+		break;
+	case offsetof(struct xdp_md, data_end):
+		*insn = BPF_LDX_MEM(size, dst_reg, src_reg,
+				    offsetof(struct xdp_buff, data_end));
+		break;
+	}
+}
+
+static const struct bpf_verifier_ops xdp_ops = {
+	.get_func_proto = sock_filter_func_proto,
+	.is_valid_access = xdp_is_valid_access,
+	.convert_ctx_access = xdp_convert_ctx_access,
+};
+
+static struct bpf_prog_type_list xdp_type __read_mostly = {
+	.ops = &xdp_ops,
+	.type = BPF_PROG_TYPE_XDP,
+};
+
+static int __init register_sock_filter_ops(void)
+{
+	bpf_register_prog_type(&sock_filter_type);
+	bpf_register_prog_type(&xdp_type);
+	return 0;
+}
+late_initcall(register_sock_filter_ops);
+#endif
+
+void bpf_warn_invalid_xdp_action(u32 act)
+{
+	WARN_ONCE(1, "Illegal XDP return value %u, expect packet loss\n", act);
+}
+EXPORT_SYMBOL_GPL(bpf_warn_invalid_xdp_action);
@@ -0,0 +1,440 @@
+/*
+ * net/core/page_pool.c	Recycling page allocator for driver RX rings.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/export.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/poison.h>
+#include <linux/interrupt.h>
+#include <linux/ethtool.h>
+#include <linux/skbuff.h>
+#include <net/page_pool.h>
+
+/*
+ * page->lru is free while a page is owned by the pool or by an skb: it
+ * marks the page as ours and points back to the pool.  page->index holds
+ * the DMA address.
+ */
+#define PP_SIGNATURE	((struct list_head *)(0x40 + POISON_POINTER_DELTA))
+
+static inline void page_pool_set_owner(struct page *page,
+				       struct page_pool *pool)
+{
+	page->lru.next = PP_SIGNATURE;
+	page->lru.prev = (struct list_head *)pool;
+}
+
+static inline struct page_pool *page_pool_owner(struct page *page)
+{
+	if (page->lru.next != PP_SIGNATURE)
+		return NULL;
+	return (struct page_pool *)page->lru.prev;
+}
+
+static void page_pool_free(struct page_pool *pool)
+{
+	free_percpu(pool->stats);
+	free_percpu(pool->cache);
+	kfree(pool->ring);
+	kfree(pool);
+}
+
+static void page_pool_release_work(struct work_struct *work)
+{
+	page_pool_free(container_of(work, struct page_pool, release_work));
+}
+
+/**
+ *	page_pool_create - create a page pool for an RX queue
+ *	@params: size, allocation order, NUMA node and DMA setup of the pool
+ *
+ *	A @params->pool_size of zero selects a default ring size.
+ *	Returns the pool or an ERR_PTR().
+ */
+struct page_pool *page_pool_create(const struct page_pool_params *params)
+{
+	struct page_pool *pool;
+	unsigned int size = params->pool_size ? : 1024;
+
+	if (params->flags & ~PP_FLAG_DMA_MAP)
+		return ERR_PTR(-EINVAL);
+
+	if (params->flags & PP_FLAG_DMA_MAP) {
+		if (!params->dev ||
+		    (params->dma_dir != DMA_FROM_DEVICE &&
+		     params->dma_dir != DMA_BIDIRECTIONAL))
+			return ERR_PTR(-EINVAL);
+		/* The DMA address must fit in page->index */
+		if (sizeof(dma_addr_t) > sizeof(unsigned long))
+			return ERR_PTR(-EOPNOTSUPP);
+	}
+
+	if (size > 16384)
+		return ERR_PTR(-E2BIG);
+
+	pool = kzalloc_node(sizeof(*pool), GFP_KERNEL, params->nid);
+	if (!pool)
+		return ERR_PTR(-ENOMEM);
+
+	pool->p = *params;
+	pool->p.pool_size = size;
+
+	pool->ring = kzalloc_node(size * sizeof(struct page *), GFP_KERNEL,
+				  params->nid);
+	pool->cache = alloc_percpu(struct page_pool_cache);
+	pool->stats = alloc_percpu(struct page_pool_stats);
+	if (!pool->ring || !pool->cache || !pool->stats) {
+		page_pool_free(pool);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	pool->alloc_cpu = -1;
+	spin_lock_init(&pool->ring_lock);
+	atomic_set(&pool->inflight, 1);
+	INIT_WORK(&pool->release_work, page_pool_release_work);
+
+	return pool;
+}
+EXPORT_SYMBOL(page_pool_create);
+
+/* Move a batch of recycled pages from the ring to this cpu's cache */
+static void page_pool_refill(struct page_pool *pool,
+			     struct page_pool_cache *cache)
+{
+	unsigned long flags;
+	unsigned int n = 0;
+
+	if (!ACCESS_ONCE(pool->ring_count))
+		return;
+
+	spin_lock_irqsave(&pool->ring_lock, flags);
+	while (pool->ring_count && n < PP_ALLOC_CACHE_REFILL) {
+		cache->pages[n++] = pool->ring[pool->ring_head];
+		if (++pool->ring_head == pool->p.pool_size)
+			pool->ring_head = 0;
+		pool->ring_count--;
+	}
+	spin_unlock_irqrestore(&pool->ring_lock, flags);
+
+	cache->count = n;
+	__this_cpu_add(pool->stats->alloc_refill, n);
+}
+
+static struct page *page_pool_alloc_slow(struct page_pool *pool, gfp_t gfp)
+{
+	struct page *page;
+
+	if (pool->p.order)
+		gfp |= __GFP_COMP;
+
+	page = alloc_pages_node(pool->p.nid, gfp, pool->p.order);
+	if (unlikely(!page))
+		goto err;
+
+	if (pool->p.flags & PP_FLAG_DMA_MAP) {
+		dma_addr_t dma;
+
+		dma = dma_map_page(pool->p.dev, page, 0,
+				   PAGE_SIZE << pool->p.order,
+				   pool->p.dma_dir);
+		if (dma_mapping_error(pool->p.dev, dma)) {
+			__free_pages(page, pool->p.order);
+			goto err;
+		}
+		page->index = dma;
+	}
+
+	page_pool_set_owner(page, pool);
+	atomic_inc(&pool->inflight);
+	this_cpu_inc(pool->stats->alloc_slow);
+	return page;
+
+err:
+	this_cpu_inc(pool->stats->alloc_failed);
+	return NULL;
+}
+
+/**
+ *	page_pool_alloc_pages - allocate a page from a pool
+ *	@pool: pool to allocate from
+ *	@gfp: allocation mask used when the pool has no page to recycle
+ *
+ *	Callers must not run concurrently for the same pool.  Pages that
+ *	were recycled keep their DMA mapping; drivers must sync them for
+ *	the device before handing them to it again.
+ */
+struct page *page_pool_alloc_pages(struct page_pool *pool, gfp_t gfp)
+{
+	struct page_pool_cache *cache;
+	struct page *page = NULL;
+
+	local_bh_disable();
+	if (unlikely(pool->alloc_cpu != smp_processor_id()))
+		pool->alloc_cpu = smp_processor_id();
+	cache = this_cpu_ptr(pool->cache);
+	if (unlikely(!cache->count))
+		page_pool_refill(pool, cache);
+	if (likely(cache->count)) {
+		page = cache->pages[--cache->count];
+		__this_cpu_inc(pool->stats->alloc_fast);
+	}
+	local_bh_enable();
+
+	if (likely(page))
+		return page;
+
+	return page_pool_alloc_slow(pool, gfp);
+}
+EXPORT_SYMBOL(page_pool_alloc_pages);
+
+/**
+ *	page_pool_release_page - take a page out of a pool
+ *	@pool: pool owning the page
+ *	@page: page to release
+ *
+ *	Unmap @page and forget it, so that it is freed with put_page() like
+ *	any other page.  The caller's reference is left untouched.
+ */
+void page_pool_release_page(struct page_pool *pool, struct page *page)
+{
+	if (pool->p.flags & PP_FLAG_DMA_MAP) {
+		dma_unmap_page(pool->p.dev, page_pool_get_dma_addr(page),
+			       PAGE_SIZE << pool->p.order, pool->p.dma_dir);
+		page->index = 0;
+	}
+	page->lru.next = NULL;
+	page->lru.prev = NULL;
+
+	this_cpu_inc(pool->stats->released);
+
+	/* The last page of a destroyed pool frees it */
+	if (atomic_dec_and_test(&pool->inflight))
+		schedule_work(&pool->release_work);
+}
+EXPORT_SYMBOL(page_pool_release_page);
+
+static bool page_pool_recycle_in_ring(struct page_pool *pool,
+				      struct page *page)
+{
+	unsigned int size = pool->p.pool_size;
+	unsigned long flags;
+	bool ret = false;
+
+	spin_lock_irqsave(&pool->ring_lock, flags);
+	if (!pool->destroying && pool->ring_count < size) {
+		unsigned int tail = pool->ring_head + pool->ring_count;
+
+		if (tail >= size)
+			tail -= size;
+		pool->ring[tail] = page;
+		pool->ring_count++;
+		ret = true;
+	}
+	spin_unlock_irqrestore(&pool->ring_lock, flags);
+
+	if (ret)
+		this_cpu_inc(pool->stats->recycle_ring);
+	else
+		this_cpu_inc(pool->stats->recycle_full);
+	return ret;
+}
+
+/* Empty a cpu cache into the ring, or release what does not fit */
+static void page_pool_flush_cache(struct page_pool *pool,
+				  struct page_pool_cache *cache)
+{
+	struct page *page;
+
+	while (cache->count) {
+		page = cache->pages[--cache->count];
+		if (!page_pool_recycle_in_ring(pool, page)) {
+			page_pool_release_page(pool, page);
+			put_page(page);
+		}
+	}
+}
+
+/*
+ * Only the cpu that allocates from the pool keeps a cache: pages parked
+ * on any other cpu would sit there out of the allocator's reach.  A
+ * cache left behind when the allocator moved is flushed by the next
+ * recycle on its cpu, or by page_pool_destroy().
+ */
+static bool page_pool_recycle_in_cache(struct page_pool *pool,
+				       struct page *page)
+{
+	struct page_pool_cache *cache = this_cpu_ptr(pool->cache);
+
+	if (unlikely(ACCESS_ONCE(pool->destroying)))
+		return false;
+
+	if (unlikely(ACCESS_ONCE(pool->alloc_cpu) != smp_processor_id())) {
+		if (unlikely(cache->count))
+			page_pool_flush_cache(pool, cache);
+		return false;
+	}
+
+	if (cache->count == PP_ALLOC_CACHE_SIZE)
+		return false;
+
+	cache->pages[cache->count++] = page;
+	__this_cpu_inc(pool->stats->recycle_cached);
+	return true;
+}
+
+/**
+ *	page_pool_put_page - give a page back to its pool
+ *	@pool: pool owning the page
+ *	@page: page to recycle
+ *
+ *	Drops the caller's reference.  The page is recycled if that was the
+ *	last one, and released from the pool otherwise.  May be called from
+ *	any context.
+ */
+void page_pool_put_page(struct page_pool *pool, struct page *page)
+{
+	if (likely(page_count(page) == 1)) {
+		/* BHs are off, so nothing else on this cpu uses the cache */
+		if (in_serving_softirq() && !in_irq() &&
+		    page_pool_recycle_in_cache(pool, page))
+			return;
+		if (page_pool_recycle_in_ring(pool, page))
+			return;
+	}
+
+	page_pool_release_page(pool, page);
+	put_page(page);
+}
+EXPORT_SYMBOL(page_pool_put_page);
+
+/*
+ * Called when an skb marked with skb_mark_for_recycle() drops a page.
+ * Returns false if the page does not belong to a pool.
+ */
+bool page_pool_return_skb_page(struct page *page)
+{
+	struct page_pool *pool;
+
+	page = compound_head(page);
+	pool = page_pool_owner(page);
+	if (!pool)
+		return false;
+
+	page_pool_put_page(pool, page);
+	return true;
+}
+EXPORT_SYMBOL(page_pool_return_skb_page);
+
+/**
+ *	page_pool_destroy - free a page pool
+ *	@pool: pool to free
+ *
+ *	The caller must have stopped allocating from @pool.  Pages still
+ *	held by skbs are released as they come back, and the last of them
+ *	frees the pool.  Must be called from process context.
+ */
+void page_pool_destroy(struct page_pool *pool)
+{
+	struct page *page;
+	int cpu;
+
+	spin_lock_irq(&pool->ring_lock);
+	pool->destroying = true;
+	spin_unlock_irq(&pool->ring_lock);
+
+	/* Wait for softirqs still recycling into a cpu cache */
+	synchronize_sched();
+
+	for_each_possible_cpu(cpu) {
+		struct page_pool_cache *cache = per_cpu_ptr(pool->cache, cpu);
+
+		while (cache->count) {
+			page = cache->pages[--cache->count];
+			page_pool_release_page(pool, page);
+			put_page(page);
+		}
+	}
+
+	while (pool->ring_count) {
+		page = pool->ring[pool->ring_head];
+		if (++pool->ring_head == pool->p.pool_size)
+			pool->ring_head = 0;
+		pool->ring_count--;
+		page_pool_release_page(pool, page);
+		put_page(page);
+	}
+
+	if (atomic_dec_and_test(&pool->inflight))
+		page_pool_free(pool);
+}
+EXPORT_SYMBOL(page_pool_destroy);
+
+/**
+ *	page_pool_get_stats - add up the counters of a pool
+ *	@pool: pool to read
+ *	@stats: counters to add to
+ *
+ *	@stats is not cleared, so that a driver can sum up all its queues.
+ */
+void page_pool_get_stats(const struct page_pool *pool,
+			 struct page_pool_stats *stats)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		const struct page_pool_stats *s = per_cpu_ptr(pool->stats, cpu);
+
+		stats->alloc_fast	+= s->alloc_fast;
+		stats->alloc_slow	+= s->alloc_slow;
+		stats->alloc_refill	+= s->alloc_refill;
+		stats->alloc_failed	+= s->alloc_failed;
+		stats->recycle_cached	+= s->recycle_cached;
+		stats->recycle_ring	+= s->recycle_ring;
+		stats->recycle_full	+= s->recycle_full;
+		stats->released		+= s->released;
+	}
+}
+EXPORT_SYMBOL(page_pool_get_stats);
+
+/* Same order as struct page_pool_stats */
+static const char page_pool_stats_strings[][ETH_GSTRING_LEN] = {
+	"rx_pp_alloc_fast",
+	"rx_pp_alloc_slow",
+	"rx_pp_alloc_refill",
+	"rx_pp_alloc_failed",
+	"rx_pp_recycle_cached",
+	"rx_pp_recycle_ring",
+	"rx_pp_recycle_full",
+	"rx_pp_released",
+};
+
+int page_pool_ethtool_stats_get_count(void)
+{
+	return ARRAY_SIZE(page_pool_stats_strings);
+}
+EXPORT_SYMBOL(page_pool_ethtool_stats_get_count);
+
+u8 *page_pool_ethtool_stats_get_strings(u8 *data)
+{
+	memcpy(data, page_pool_stats_strings, sizeof(page_pool_stats_strings));
+	return data + sizeof(page_pool_stats_strings);
+}
+EXPORT_SYMBOL(page_pool_ethtool_stats_get_strings);
+
+u64 *page_pool_ethtool_stats_get(u64 *data,
+				 const struct page_pool_stats *stats)
+{
+	BUILD_BUG_ON(ARRAY_SIZE(page_pool_stats_strings) * sizeof(u64) !=
+		     sizeof(struct page_pool_stats));
+
+	memcpy(data, stats, sizeof(*stats));
+	return data + ARRAY_SIZE(page_pool_stats_strings);
+}
+EXPORT_SYMBOL(page_pool_ethtool_stats_get);
@@ -176,14 +176,11 @@ static void dccp_v6_err(struct sk_buff *skb, struct inet6_skb_parm *opt,
 
 	/* Might be for an request_sock */
 	switch (sk->sk_state) {
-		struct request_sock *req, **prev;
+		struct request_sock *req;
 	case DCCP_LISTEN:
-		if (sock_owned_by_user(sk))
-			goto out;
-
-		req = inet6_csk_search_req(sk, &prev, dh->dccph_dport,
-					   &hdr->daddr, &hdr->saddr,
-					   inet6_iif(skb));
+		req = inet6_lookup_reqsk(net, &dccp_hashinfo, &hdr->daddr,
+					 dh->dccph_dport, &hdr->saddr,
+					 dh->dccph_sport, inet6_iif(skb));
 		if (req == NULL)
 			goto out;
 
@@ -196,10 +193,12 @@ static void dccp_v6_err(struct sk_buff *skb, struct inet6_skb_parm *opt,
 		if (!between48(seq, dccp_rsk(req)->dreq_iss,
 				    dccp_rsk(req)->dreq_gss)) {
 			NET_INC_STATS_BH(net, LINUX_MIB_OUTOFWINDOWICMPS);
+			reqsk_put(req);
 			goto out;
 		}
 
-		inet_csk_reqsk_queue_drop(sk, req, prev);
+		inet_csk_reqsk_queue_drop(sk, req);
+		reqsk_put(req);
 		goto out;
 
 	case DCCP_REQUESTING:
@@ -351,15 +350,19 @@ static struct sock *dccp_v6_hnd_req(struct sock *sk,struct sk_buff *skb)
 	const struct dccp_hdr *dh = dccp_hdr(skb);
 	const struct ipv6hdr *iph = ipv6_hdr(skb);
 	struct sock *nsk;
-	struct request_sock **prev;
 	/* Find possible connection requests. */
-	struct request_sock *req = inet6_csk_search_req(sk, &prev,
-							dh->dccph_sport,
-							&iph->saddr,
-							&iph->daddr,
-							inet6_iif(skb));
-	if (req != NULL)
-		return dccp_check_req(sk, skb, req, prev);
+	struct request_sock *req = inet6_lookup_reqsk(sock_net(sk),
+						      &dccp_hashinfo,
+						      &iph->saddr,
+						      dh->dccph_sport,
+						      &iph->daddr,
+						      dh->dccph_dport,
+						      inet6_iif(skb));
+	if (req != NULL) {
+		nsk = dccp_check_req(sk, skb, req);
+		reqsk_put(req);
+		return nsk;
+	}
 
 	nsk = __inet6_lookup_established(sock_net(sk), &dccp_hashinfo,
 					 &iph->saddr, dh->dccph_sport,
@@ -450,10 +453,10 @@ static int dccp_v6_conn_request(struct sock *sk, struct sk_buff *skb)
 	dreq->dreq_gss     = dreq->dreq_iss;
 	dreq->dreq_service = service;
 
-	if (dccp_v6_send_response(sk, req, NULL))
-		goto drop_and_free;
-
+	/* Hash first; a lost Response is retransmitted by the timer. */
 	inet6_csk_reqsk_queue_hash_add(sk, req, DCCP_TIMEOUT_INIT);
+	dccp_v6_send_response(sk, req, NULL);
+	reqsk_put(req);
 	return 0;
 
 drop_and_free:
@@ -615,7 +618,11 @@ static struct sock *dccp_v6_request_recv_sock(struct sock *sk,
 		sock_put(newsk);
 		goto out;
 	}
-	__inet6_hash(newsk, NULL);
+	if (!inet6_hash_child(newsk, req)) {
+		bh_unlock_sock(newsk);
+		sock_put(newsk);
+		return NULL;
+	}
 
 	return newsk;
 
@@ -140,6 +140,29 @@ const struct fib_prop fib_props[RTN_MAX + 1] = {
 	},
 };
 
+static void rt_nexthop_free(struct rtable __rcu **rtp)
+{
+	struct rtable *rt = xchg((__force struct rtable **)rtp, NULL);
+
+	if (rt)
+		call_rcu(&rt->dst.rcu_head, dst_rcu_free);
+}
+
+/* Drop the routes cached on a nexthop.  Lockless users are covered by
+ * the RCU grace period, referenced ones see the route obsolete on their
+ * next dst_check().
+ */
+static void fib_nh_flush_routes(struct fib_nh *nh)
+{
+	int cpu;
+
+	rt_nexthop_free(&nh->nh_rth_input);
+	if (!nh->nh_pcpu_rth_output)
+		return;
+	for_each_possible_cpu(cpu)
+		rt_nexthop_free(per_cpu_ptr(nh->nh_pcpu_rth_output, cpu));
+}
+
 /* Release a nexthop info record */
 static void free_fib_info_rcu(struct rcu_head *head)
 {
@@ -148,6 +171,8 @@ static void free_fib_info_rcu(struct rcu_head *head)
 	change_nexthops(fi) {
 		if (nexthop_nh->nh_dev)
 			dev_put(nexthop_nh->nh_dev);
+		fib_nh_flush_routes(nexthop_nh);
+		free_percpu(nexthop_nh->nh_pcpu_rth_output);
 	} endfor_nexthops(fi);
 
 	release_net(fi->fib_net);
@@ -179,6 +204,11 @@ void fib_release_info(struct fib_info *fi)
 			hlist_del(&nexthop_nh->nh_hash);
 		} endfor_nexthops(fi)
 		fi->fib_dead = 1;
+		/* Pairs with the fib_dead check in rt_cache_route() */
+		smp_mb();
+		change_nexthops(fi) {
+			fib_nh_flush_routes(nexthop_nh);
+		} endfor_nexthops(fi)
 		fib_info_put(fi);
 	}
 	spin_unlock_bh(&fib_info_lock);
@@ -769,6 +799,9 @@ struct fib_info *fib_create_info(struct fib_config *cfg)
 	fi->fib_nhs = nhs;
 	change_nexthops(fi) {
 		nexthop_nh->nh_parent = fi;
+		nexthop_nh->nh_pcpu_rth_output = alloc_percpu(struct rtable __rcu *);
+		if (!nexthop_nh->nh_pcpu_rth_output)
+			goto failure;
 	} endfor_nexthops(fi)
 
 	if (cfg->fc_mx) {
@@ -1059,6 +1092,8 @@ int fib_sync_down_dev(struct net_device *dev, int force)
 			else if (nexthop_nh->nh_dev == dev &&
 				 nexthop_nh->nh_scope != scope) {
 				nexthop_nh->nh_flags |= RTNH_F_DEAD;
+				smp_mb();
+				fib_nh_flush_routes(nexthop_nh);
 #ifdef CONFIG_IP_ROUTE_MULTIPATH
 				spin_lock_bh(&fib_multipath_lock);
 				fi->fib_power -= nexthop_nh->nh_power;
@@ -14,7 +14,6 @@
  */
 
 #include <linux/module.h>
-#include <linux/jhash.h>
 
 #include <net/inet_connection_sock.h>
 #include <net/inet_hashtables.h>
@@ -22,6 +21,7 @@
 #include <net/ip.h>
 #include <net/route.h>
 #include <net/tcp_states.h>
+#include <net/tcp.h>
 #include <net/xfrm.h>
 
 #ifdef INET_CSK_DEBUG
@@ -59,6 +59,8 @@ int inet_csk_bind_conflict(const struct sock *sk,
 	struct sock *sk2;
 	struct hlist_node *node;
 	int reuse = sk->sk_reuse;
+	int reuseport = sk->sk_reuseport;
+	int uid = sock_i_uid((struct sock *)sk);
 
 	/*
 	 * Unlike other sk lookup places we do not check
@@ -73,8 +75,11 @@ int inet_csk_bind_conflict(const struct sock *sk,
 		    (!sk->sk_bound_dev_if ||
 		     !sk2->sk_bound_dev_if ||
 		     sk->sk_bound_dev_if == sk2->sk_bound_dev_if)) {
-			if (!reuse || !sk2->sk_reuse ||
-			    sk2->sk_state == TCP_LISTEN) {
+			if ((!reuse || !sk2->sk_reuse ||
+			    sk2->sk_state == TCP_LISTEN) &&
+			    (!reuseport || !sk2->sk_reuseport ||
+			    (sk2->sk_state != TCP_TIME_WAIT &&
+			     uid != sock_i_uid(sk2)))) {
 				const __be32 sk2_rcv_saddr = sk_rcv_saddr(sk2);
 				if (!sk2_rcv_saddr || !sk_rcv_saddr(sk) ||
 				    sk2_rcv_saddr == sk_rcv_saddr(sk))
@@ -106,6 +111,7 @@ int inet_csk_get_port(struct sock *sk, unsigned short snum)
 	int ret, attempts = 5;
 	struct net *net = sock_net(sk);
 	int smallest_size = -1, smallest_rover;
+	int uid = sock_i_uid(sk);
 
 	local_bh_disable();
 	if (!snum) {
@@ -125,9 +131,12 @@ again:
 			spin_lock(&head->lock);
 			inet_bind_bucket_for_each(tb, node, &head->chain)
 				if (net_eq(ib_net(tb), net) && tb->port == rover) {
-					if (tb->fastreuse > 0 &&
-					    sk->sk_reuse &&
-					    sk->sk_state != TCP_LISTEN &&
+					if (((tb->fastreuse > 0 &&
+					      sk->sk_reuse &&
+					      sk->sk_state != TCP_LISTEN) ||
+					     (tb->fastreuseport > 0 &&
+					      sk->sk_reuseport &&
+					      tb->fastuid == uid)) &&
 					    (tb->num_owners < smallest_size || smallest_size == -1)) {
 						smallest_size = tb->num_owners;
 						smallest_rover = rover;
@@ -185,14 +194,18 @@ tb_found:
 		if (sk->sk_reuse == SK_FORCE_REUSE)
 			goto success;
 
-		if (tb->fastreuse > 0 &&
-		    sk->sk_reuse && sk->sk_state != TCP_LISTEN &&
+		if (((tb->fastreuse > 0 &&
+		      sk->sk_reuse && sk->sk_state != TCP_LISTEN) ||
+		     (tb->fastreuseport > 0 &&
+		      sk->sk_reuseport && tb->fastuid == uid)) &&
 		    smallest_size == -1) {
 			goto success;
 		} else {
 			ret = 1;
 			if (inet_csk(sk)->icsk_af_ops->bind_conflict(sk, tb, true)) {
-				if (sk->sk_reuse && sk->sk_state != TCP_LISTEN &&
+				if (((sk->sk_reuse && sk->sk_state != TCP_LISTEN) ||
+				     (tb->fastreuseport > 0 &&
+				      sk->sk_reuseport && tb->fastuid == uid)) &&
 				    smallest_size != -1 && --attempts >= 0) {
 					spin_unlock(&head->lock);
 					goto again;
@@ -212,9 +225,19 @@ tb_not_found:
 			tb->fastreuse = 1;
 		else
 			tb->fastreuse = 0;
-	} else if (tb->fastreuse &&
-		   (!sk->sk_reuse || sk->sk_state == TCP_LISTEN))
-		tb->fastreuse = 0;
+		if (sk->sk_reuseport) {
+			tb->fastreuseport = 1;
+			tb->fastuid = uid;
+		} else
+			tb->fastreuseport = 0;
+	} else {
+		if (tb->fastreuse &&
+		    (!sk->sk_reuse || sk->sk_state == TCP_LISTEN))
+			tb->fastreuse = 0;
+		if (tb->fastreuseport &&
+		    (!sk->sk_reuseport || tb->fastuid != uid))
+			tb->fastreuseport = 0;
+	}
 success:
 	if (!inet_csk(sk)->icsk_bind_hash)
 		inet_bind_hash(sk, tb, snum);
@@ -310,7 +333,6 @@ struct sock *inet_csk_accept(struct sock *sk, int flags, int *err)
 	}
 
 	newsk = reqsk_queue_get_child(&icsk->icsk_accept_queue, sk);
-	WARN_ON(newsk->sk_state == TCP_SYN_RECV);
 out:
 	release_sock(sk);
 	return newsk;
@@ -385,7 +407,7 @@ struct dst_entry *inet_csk_route_req(struct sock *sk,
 	rt = ip_route_output_flow(net, fl4, sk);
 	if (IS_ERR(rt))
 		goto no_route;
-	if (opt && opt->opt.is_strictroute && fl4->daddr != rt->rt_gateway)
+	if (opt && opt->opt.is_strictroute && fl4->daddr != rt_nexthop(rt, fl4->daddr))
 		goto route_err;
 	return &rt->dst;
 
@@ -418,7 +440,7 @@ struct dst_entry *inet_csk_route_child_sock(struct sock *sk,
 	rt = ip_route_output_flow(net, fl4, sk);
 	if (IS_ERR(rt))
 		goto no_route;
-	if (opt && opt->opt.is_strictroute && fl4->daddr != rt->rt_gateway)
+	if (opt && opt->opt.is_strictroute && fl4->daddr != rt_nexthop(rt, fl4->daddr))
 		goto route_err;
 	return &rt->dst;
 
@@ -430,64 +452,6 @@ no_route:
 }
 EXPORT_SYMBOL_GPL(inet_csk_route_child_sock);
 
-static inline u32 inet_synq_hash(const __be32 raddr, const __be16 rport,
-				 const u32 rnd, const u32 synq_hsize)
-{
-	return jhash_2words((__force u32)raddr, (__force u32)rport, rnd) & (synq_hsize - 1);
-}
-
-#if IS_ENABLED(CONFIG_IPV6)
-#define AF_INET_FAMILY(fam) ((fam) == AF_INET)
-#else
-#define AF_INET_FAMILY(fam) 1
-#endif
-
-struct request_sock *inet_csk_search_req(const struct sock *sk,
-					 struct request_sock ***prevp,
-					 const __be16 rport, const __be32 raddr,
-					 const __be32 laddr)
-{
-	const struct inet_connection_sock *icsk = inet_csk(sk);
-	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
-	struct request_sock *req, **prev;
-
-	for (prev = &lopt->syn_table[inet_synq_hash(raddr, rport, lopt->hash_rnd,
-						    lopt->nr_table_entries)];
-	     (req = *prev) != NULL;
-	     prev = &req->dl_next) {
-		const struct inet_request_sock *ireq = inet_rsk(req);
-
-		if (ireq->rmt_port == rport &&
-		    ireq->rmt_addr == raddr &&
-		    ireq->loc_addr == laddr &&
-		    AF_INET_FAMILY(req->rsk_ops->family)) {
-			WARN_ON(req->sk);
-			*prevp = prev;
-			break;
-		}
-	}
-
-	return req;
-}
-EXPORT_SYMBOL_GPL(inet_csk_search_req);
-
-void inet_csk_reqsk_queue_hash_add(struct sock *sk, struct request_sock *req,
-				   unsigned long timeout)
-{
-	struct inet_connection_sock *icsk = inet_csk(sk);
-	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
-	const u32 h = inet_synq_hash(inet_rsk(req)->rmt_addr, inet_rsk(req)->rmt_port,
-				     lopt->hash_rnd, lopt->nr_table_entries);
-
-	reqsk_queue_hash_req(&icsk->icsk_accept_queue, h, req, timeout);
-	inet_csk_reqsk_queue_added(sk, timeout);
-}
-EXPORT_SYMBOL_GPL(inet_csk_reqsk_queue_hash_add);
-
-/* Only thing we need from tcp.h */
-extern int sysctl_tcp_synack_retries;
-
-
 /* Decide when to expire the request and when to resend SYN-ACK */
 static inline void syn_ack_recalc(struct request_sock *req, const int thresh,
 				  const int max_retries,
@@ -510,22 +474,23 @@ static inline void syn_ack_recalc(struct request_sock *req, const int thresh,
 		  req->retrans >= rskq_defer_accept - 1;
 }
 
-void inet_csk_reqsk_queue_prune(struct sock *parent,
-				const unsigned long interval,
-				const unsigned long timeout,
-				const unsigned long max_rto)
+/*
+ * Per-request SYN-ACK retransmit timer.  It owns one reference to the
+ * request, and uses the listener without locking it.
+ */
+static void reqsk_timer_handler(unsigned long data)
 {
+	struct request_sock *req = (struct request_sock *)data;
+	struct sock *parent = req->rsk_listener;
 	struct inet_connection_sock *icsk = inet_csk(parent);
 	struct request_sock_queue *queue = &icsk->icsk_accept_queue;
-	struct listen_sock *lopt = queue->listen_opt;
 	int max_retries = icsk->icsk_syn_retries ? : sysctl_tcp_synack_retries;
 	int thresh = max_retries;
-	unsigned long now = jiffies;
-	struct request_sock **reqp, *req;
-	int i, budget;
+	int qlen, expire = 0, resend = 0;
+	u8 defer_accept;
 
-	if (lopt == NULL || lopt->qlen == 0)
-		return;
+	if (parent->sk_state != TCP_LISTEN)
+		goto drop;
 
 	/* Normally all the openreqs are young and become mature
 	 * (i.e. converted to established socket) for first timeout.
@@ -544,66 +509,149 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 	 * embrions; and abort old ones without pity, if old
 	 * ones are about to clog our table.
 	 */
-	if (lopt->qlen>>(lopt->max_qlen_log-1)) {
-		int young = (lopt->qlen_young<<1);
+	qlen = reqsk_queue_len(queue);
+	if (qlen >> (queue->max_qlen_log - 1)) {
+		int young = reqsk_queue_len_young(queue) << 1;
 
 		while (thresh > 2) {
-			if (lopt->qlen < young)
+			if (qlen < young)
 				break;
 			thresh--;
 			young <<= 1;
 		}
 	}
 
-	if (queue->rskq_defer_accept)
-		max_retries = queue->rskq_defer_accept;
+	defer_accept = ACCESS_ONCE(queue->rskq_defer_accept);
+	if (defer_accept)
+		max_retries = defer_accept;
+
+	syn_ack_recalc(req, thresh, max_retries, defer_accept,
+		       &expire, &resend);
+	req->rsk_ops->syn_ack_timeout(parent, req);
+	if (!expire &&
+	    (!resend ||
+	     !req->rsk_ops->rtx_syn_ack(parent, req, NULL) ||
+	     inet_rsk(req)->acked)) {
+		unsigned long timeo;
+
+		if (req->retrans++ == 0)
+			atomic_dec(&queue->qlen_young);
+		timeo = min(TCP_TIMEOUT_INIT << req->retrans, TCP_RTO_MAX);
+		mod_timer_pinned(&req->rsk_timer, jiffies + timeo);
+		return;
+	}
 
-	budget = 2 * (lopt->nr_table_entries / (timeout / interval));
-	i = lopt->clock_hand;
+drop:
+	/* Drop this request */
+	if (inet_unhash_req(parent->sk_prot->h.hashinfo, req)) {
+		reqsk_queue_removed(queue, req);
+		reqsk_put(req);
+	}
+	reqsk_put(req);
+}
 
-	do {
-		reqp=&lopt->syn_table[i];
-		while ((req = *reqp) != NULL) {
-			if (time_after_eq(now, req->expires)) {
-				int expire = 0, resend = 0;
-
-				syn_ack_recalc(req, thresh, max_retries,
-					       queue->rskq_defer_accept,
-					       &expire, &resend);
-				req->rsk_ops->syn_ack_timeout(parent, req);
-				if (!expire &&
-				    (!resend ||
-				     !req->rsk_ops->rtx_syn_ack(parent, req, NULL) ||
-				     inet_rsk(req)->acked)) {
-					unsigned long timeo;
-
-					if (req->retrans++ == 0)
-						lopt->qlen_young--;
-					timeo = min((timeout << req->retrans), max_rto);
-					req->expires = now + timeo;
-					reqp = &req->dl_next;
-					continue;
-				}
+void __inet_csk_reqsk_queue_hash_add(struct sock *sk, struct request_sock *req,
+				     u32 hash, unsigned long timeout)
+{
+	req->rsk_hash = hash;
+	req->retrans = 0;
+	req->sk = NULL;
+	sock_hold(sk);
+	req->rsk_listener = sk;
+	setup_timer(&req->rsk_timer, reqsk_timer_handler, (unsigned long)req);
+
+	/* One reference for the hash, one for the timer and one for the
+	 * caller, who is still sending the SYN-ACK.  The count must be set
+	 * before the request becomes visible to lookups.
+	 */
+	smp_wmb();
+	atomic_set(&req->rsk_refcnt, 2 + 1);
 
-				/* Drop this request */
-				inet_csk_reqsk_queue_unlink(parent, req, reqp);
-				reqsk_queue_removed(queue, req);
-				reqsk_free(req);
-				continue;
-			}
-			reqp = &req->dl_next;
-		}
+	inet_csk_reqsk_queue_added(sk);
+	mod_timer_pinned(&req->rsk_timer, jiffies + timeout);
+	inet_ehash_req(sk->sk_prot->h.hashinfo, req);
+}
+EXPORT_SYMBOL_GPL(__inet_csk_reqsk_queue_hash_add);
+
+void inet_csk_reqsk_queue_hash_add(struct sock *sk, struct request_sock *req,
+				   unsigned long timeout)
+{
+	const struct inet_request_sock *ireq = inet_rsk(req);
+	const u32 hash = inet_ehashfn(sock_net(sk), ireq->loc_addr,
+				      ntohs(ireq->loc_port),
+				      ireq->rmt_addr, ireq->rmt_port);
+
+	__inet_csk_reqsk_queue_hash_add(sk, req, hash, timeout);
+}
+EXPORT_SYMBOL_GPL(inet_csk_reqsk_queue_hash_add);
+
+/*
+ * Take a request out of the hash and stop its timer.  Returns true if
+ * this call unhashed it; the caller then owns the hash's reference.
+ * Must not be called from the request's own timer.
+ */
+bool inet_csk_reqsk_queue_unlink(struct sock *sk, struct request_sock *req)
+{
+	bool found = inet_unhash_req(sk->sk_prot->h.hashinfo, req);
+
+	if (del_timer_sync(&req->rsk_timer))
+		reqsk_put(req);
+	return found;
+}
+EXPORT_SYMBOL_GPL(inet_csk_reqsk_queue_unlink);
+
+void inet_csk_reqsk_queue_drop(struct sock *sk, struct request_sock *req)
+{
+	if (inet_csk_reqsk_queue_unlink(sk, req)) {
+		inet_csk_reqsk_queue_removed(sk, req);
+		reqsk_put(req);
+	}
+}
+EXPORT_SYMBOL_GPL(inet_csk_reqsk_queue_drop);
 
-		i = (i + 1) & (lopt->nr_table_entries - 1);
+static void inet_child_forget(struct sock *sk, struct sock *child)
+{
+	sk->sk_prot->disconnect(child, O_NONBLOCK);
 
-	} while (--budget > 0);
+	sock_orphan(child);
 
-	lopt->clock_hand = i;
+	percpu_counter_inc(sk->sk_prot->orphan_count);
 
-	if (lopt->qlen)
-		inet_csk_reset_keepalive_timer(parent, interval);
+	inet_csk_destroy_sock(child);
 }
-EXPORT_SYMBOL_GPL(inet_csk_reqsk_queue_prune);
+
+/*
+ * Queue an established child for accept().  Runs without the listener
+ * lock, so the listener may have been closed meanwhile; the child is
+ * then destroyed and NULL returned.  Either way the request's hash
+ * reference now belongs to the accept queue.
+ */
+struct sock *inet_csk_reqsk_queue_add(struct sock *sk,
+				      struct request_sock *req,
+				      struct sock *child)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	bool queued = false;
+
+	spin_lock(&queue->rskq_lock);
+	if (likely(sk->sk_state == TCP_LISTEN)) {
+		reqsk_queue_add(queue, req, sk, child);
+		queued = true;
+	} else {
+		inet_child_forget(sk, child);
+	}
+	spin_unlock(&queue->rskq_lock);
+
+	if (queued)
+		return child;
+
+	/* The child came to us locked and with the caller's reference. */
+	bh_unlock_sock(child);
+	sock_put(child);
+	reqsk_put(req);
+	return NULL;
+}
+EXPORT_SYMBOL(inet_csk_reqsk_queue_add);
 
 /**
  *	inet_csk_clone_lock - clone an inet socket, and lock its clone
@@ -677,10 +725,8 @@ int inet_csk_listen_start(struct sock *sk, const int nr_table_entries)
 {
 	struct inet_sock *inet = inet_sk(sk);
 	struct inet_connection_sock *icsk = inet_csk(sk);
-	int rc = reqsk_queue_alloc(&icsk->icsk_accept_queue, nr_table_entries);
 
-	if (rc != 0)
-		return rc;
+	reqsk_queue_alloc(&icsk->icsk_accept_queue, nr_table_entries);
 
 	sk->sk_max_ack_backlog = 0;
 	sk->sk_ack_backlog = 0;
@@ -702,7 +748,6 @@ int inet_csk_listen_start(struct sock *sk, const int nr_table_entries)
 	}
 
 	sk->sk_state = TCP_CLOSE;
-	__reqsk_queue_destroy(&icsk->icsk_accept_queue);
 	return -EADDRINUSE;
 }
 EXPORT_SYMBOL_GPL(inet_csk_listen_start);
@@ -719,7 +764,10 @@ void inet_csk_listen_stop(struct sock *sk)
 
 	inet_csk_delete_keepalive_timer(sk);
 
-	/* make all the listen_opt local to us */
+	/* Children that complete their handshake from now on see that we
+	 * are no longer listening and are destroyed in
+	 * inet_csk_reqsk_queue_add(); take the ones already queued.
+	 */
 	acc_req = reqsk_queue_yank_acceptq(&icsk->icsk_accept_queue);
 
 	/* Following specs, it would be better either to send FIN
@@ -729,9 +777,10 @@ void inet_csk_listen_stop(struct sock *sk)
 	 * bad justification for our negligence 8)
 	 * To be honest, we are not able to make either
 	 * of the variants now.			--ANK
+	 *
+	 * Pending requests are left in the hash; their timers drop them
+	 * once they notice the listener is gone.
 	 */
-	reqsk_queue_destroy(&icsk->icsk_accept_queue);
-
 	while ((req = acc_req) != NULL) {
 		struct sock *child = req->sk;
 
@@ -742,20 +791,14 @@ void inet_csk_listen_stop(struct sock *sk)
 		WARN_ON(sock_owned_by_user(child));
 		sock_hold(child);
 
-		sk->sk_prot->disconnect(child, O_NONBLOCK);
-
-		sock_orphan(child);
-
-		percpu_counter_inc(sk->sk_prot->orphan_count);
-
-		inet_csk_destroy_sock(child);
+		inet_child_forget(sk, child);
 
 		bh_unlock_sock(child);
 		local_bh_enable();
 		sock_put(child);
 
 		sk_acceptq_removed(sk);
-		__reqsk_free(req);
+		reqsk_put(req);
 	}
 	WARN_ON(sk->sk_ack_backlog);
 }
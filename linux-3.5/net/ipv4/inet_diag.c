@@ -586,12 +586,11 @@ static int inet_twsk_diag_dump(struct inet_timewait_sock *tw,
 				   cb->nlh->nlmsg_seq, NLM_F_MULTI, cb->nlh);
 }
 
-static int inet_diag_fill_req(struct sk_buff *skb, struct sock *sk,
-			      struct request_sock *req, u32 pid, u32 seq,
-			      const struct nlmsghdr *unlh)
+static int inet_diag_fill_req(struct sk_buff *skb, struct request_sock *req,
+			      u32 pid, u32 seq, const struct nlmsghdr *unlh)
 {
 	const struct inet_request_sock *ireq = inet_rsk(req);
-	struct inet_sock *inet = inet_sk(sk);
+	struct sock *sk = req->rsk_listener;
 	unsigned char *b = skb_tail_pointer(skb);
 	struct inet_diag_msg *r;
 	struct nlmsghdr *nlh;
@@ -601,7 +600,7 @@ static int inet_diag_fill_req(struct sk_buff *skb, struct sock *sk,
 	nlh->nlmsg_flags = NLM_F_MULTI;
 	r = NLMSG_DATA(nlh);
 
-	r->idiag_family = sk->sk_family;
+	r->idiag_family = req->rsk_ops->family;
 	r->idiag_state = TCP_SYN_RECV;
 	r->idiag_timer = 1;
 	r->idiag_retrans = req->retrans;
@@ -609,11 +608,11 @@ static int inet_diag_fill_req(struct sk_buff *skb, struct sock *sk,
 	r->id.idiag_if = sk->sk_bound_dev_if;
 	sock_diag_save_cookie(req, r->id.idiag_cookie);
 
-	tmo = req->expires - jiffies;
+	tmo = req->rsk_timer.expires - jiffies;
 	if (tmo < 0)
 		tmo = 0;
 
-	r->id.idiag_sport = inet->inet_sport;
+	r->id.idiag_sport = ireq->loc_port;
 	r->id.idiag_dport = ireq->rmt_port;
 	r->id.idiag_src[0] = ireq->loc_addr;
 	r->id.idiag_dst[0] = ireq->rmt_addr;
@@ -637,87 +636,37 @@ nlmsg_failure:
 	return -1;
 }
 
-static int inet_diag_dump_reqs(struct sk_buff *skb, struct sock *sk,
-			       struct netlink_callback *cb,
-			       struct inet_diag_req_v2 *r,
-			       const struct nlattr *bc)
+static int inet_diag_dump_req(struct request_sock *req,
+			      struct sk_buff *skb,
+			      struct netlink_callback *cb,
+			      struct inet_diag_req_v2 *r,
+			      const struct nlattr *bc)
 {
-	struct inet_diag_entry entry;
-	struct inet_connection_sock *icsk = inet_csk(sk);
-	struct listen_sock *lopt;
-	struct inet_sock *inet = inet_sk(sk);
-	int j, s_j;
-	int reqnum, s_reqnum;
-	int err = 0;
-
-	s_j = cb->args[3];
-	s_reqnum = cb->args[4];
-
-	if (s_j > 0)
-		s_j--;
-
-	entry.family = sk->sk_family;
-
-	read_lock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
-
-	lopt = icsk->icsk_accept_queue.listen_opt;
-	if (!lopt || !lopt->qlen)
-		goto out;
-
 	if (bc != NULL) {
-		entry.sport = inet->inet_num;
-		entry.userlocks = sk->sk_userlocks;
-	}
-
-	for (j = s_j; j < lopt->nr_table_entries; j++) {
-		struct request_sock *req, *head = lopt->syn_table[j];
-
-		reqnum = 0;
-		for (req = head; req; reqnum++, req = req->dl_next) {
-			struct inet_request_sock *ireq = inet_rsk(req);
-
-			if (reqnum < s_reqnum)
-				continue;
-			if (r->id.idiag_dport != ireq->rmt_port &&
-			    r->id.idiag_dport)
-				continue;
+		struct inet_request_sock *ireq = inet_rsk(req);
+		struct inet_diag_entry entry;
 
-			if (bc) {
-				entry.saddr =
+		entry.family = req->rsk_ops->family;
 #if IS_ENABLED(CONFIG_IPV6)
-					(entry.family == AF_INET6) ?
-					inet6_rsk(req)->loc_addr.s6_addr32 :
-#endif
-					&ireq->loc_addr;
-				entry.daddr =
-#if IS_ENABLED(CONFIG_IPV6)
-					(entry.family == AF_INET6) ?
-					inet6_rsk(req)->rmt_addr.s6_addr32 :
+		if (entry.family == AF_INET6) {
+			entry.saddr = inet6_rsk(req)->loc_addr.s6_addr32;
+			entry.daddr = inet6_rsk(req)->rmt_addr.s6_addr32;
+		} else
 #endif
-					&ireq->rmt_addr;
-				entry.dport = ntohs(ireq->rmt_port);
-
-				if (!inet_diag_bc_run(bc, &entry))
-					continue;
-			}
-
-			err = inet_diag_fill_req(skb, sk, req,
-					       NETLINK_CB(cb->skb).pid,
-					       cb->nlh->nlmsg_seq, cb->nlh);
-			if (err < 0) {
-				cb->args[3] = j + 1;
-				cb->args[4] = reqnum;
-				goto out;
-			}
+		{
+			entry.saddr = &ireq->loc_addr;
+			entry.daddr = &ireq->rmt_addr;
 		}
+		entry.sport = ntohs(ireq->loc_port);
+		entry.dport = ntohs(ireq->rmt_port);
+		entry.userlocks = req->rsk_listener->sk_userlocks;
 
-		s_reqnum = 0;
+		if (!inet_diag_bc_run(bc, &entry))
+			return 0;
 	}
 
-out:
-	read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
-
-	return err;
+	return inet_diag_fill_req(skb, req, NETLINK_CB(cb->skb).pid,
+				  cb->nlh->nlmsg_seq, cb->nlh);
 }
 
 void inet_diag_dump_icsk(struct inet_hashinfo *hashinfo, struct sk_buff *skb,
@@ -730,7 +679,7 @@ void inet_diag_dump_icsk(struct inet_hashinfo *hashinfo, struct sk_buff *skb,
 	s_num = num = cb->args[2];
 
 	if (cb->args[0] == 0) {
-		if (!(r->idiag_states & (TCPF_LISTEN | TCPF_SYN_RECV)))
+		if (!(r->idiag_states & TCPF_LISTEN) || r->id.idiag_dport)
 			goto skip_listen_ht;
 
 		for (i = s_i; i < INET_LHTABLE_SIZE; i++) {
@@ -757,42 +706,24 @@ void inet_diag_dump_icsk(struct inet_hashinfo *hashinfo, struct sk_buff *skb,
 				    r->id.idiag_sport)
 					goto next_listen;
 
-				if (!(r->idiag_states & TCPF_LISTEN) ||
-				    r->id.idiag_dport ||
-				    cb->args[3] > 0)
-					goto syn_recv;
-
 				if (inet_csk_diag_dump(sk, skb, cb, r, bc) < 0) {
 					spin_unlock_bh(&ilb->lock);
 					goto done;
 				}
 
-syn_recv:
-				if (!(r->idiag_states & TCPF_SYN_RECV))
-					goto next_listen;
-
-				if (inet_diag_dump_reqs(skb, sk, cb, r, bc) < 0) {
-					spin_unlock_bh(&ilb->lock);
-					goto done;
-				}
-
 next_listen:
-				cb->args[3] = 0;
-				cb->args[4] = 0;
 				++num;
 			}
 			spin_unlock_bh(&ilb->lock);
 
 			s_num = 0;
-			cb->args[3] = 0;
-			cb->args[4] = 0;
 		}
 skip_listen_ht:
 		cb->args[0] = 1;
 		s_i = num = s_num = 0;
 	}
 
-	if (!(r->idiag_states & ~(TCPF_LISTEN | TCPF_SYN_RECV)))
+	if (!(r->idiag_states & ~TCPF_LISTEN))
 		goto out;
 
 	for (i = s_i; i <= hashinfo->ehash_mask; i++) {
@@ -804,6 +735,7 @@ skip_listen_ht:
 		num = 0;
 
 		if (hlist_nulls_empty(&head->chain) &&
+			hlist_nulls_empty(&head->reqchain) &&
 			hlist_nulls_empty(&head->twchain))
 			continue;
 
@@ -835,6 +767,34 @@ next_normal:
 			++num;
 		}
 
+		/* Connection requests live in their own chain. */
+		if (r->idiag_states & TCPF_SYN_RECV) {
+			struct request_sock *req;
+
+			hlist_nulls_for_each_entry(req, node, &head->reqchain,
+						   rsk_node) {
+				struct inet_request_sock *ireq = inet_rsk(req);
+
+				if (num < s_num)
+					goto next_req;
+				if (r->sdiag_family != AF_UNSPEC &&
+				    req->rsk_ops->family != r->sdiag_family)
+					goto next_req;
+				if (r->id.idiag_sport != ireq->loc_port &&
+				    r->id.idiag_sport)
+					goto next_req;
+				if (r->id.idiag_dport != ireq->rmt_port &&
+				    r->id.idiag_dport)
+					goto next_req;
+				if (inet_diag_dump_req(req, skb, cb, r, bc) < 0) {
+					spin_unlock_bh(lock);
+					goto done;
+				}
+next_req:
+				++num;
+			}
+		}
+
 		if (r->idiag_states & TCPF_TIME_WAIT) {
 			struct inet_timewait_sock *tw;
 
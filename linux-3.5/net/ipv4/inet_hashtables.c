@@ -39,6 +39,7 @@ struct inet_bind_bucket *inet_bind_bucket_create(struct kmem_cache *cachep,
 		write_pnet(&tb->ib_net, hold_net(net));
 		tb->port      = snum;
 		tb->fastreuse = 0;
+		tb->fastreuseport = 0;
 		tb->num_owners = 0;
 		INIT_HLIST_HEAD(&tb->owners);
 		hlist_add_head(&tb->node, &head->chain);
@@ -171,11 +172,16 @@ static inline int compute_score(struct sock *sk, struct net *net,
  * BSD API does not allow a listening sock to specify the remote port nor the
  * remote address for the connection. So always assume those are both
  * wildcarded during the search since they can never be otherwise.
+ *
+ * When several SO_REUSEPORT listeners tie for the best score, the flow
+ * hash picks one of them, so each connection from a given peer keeps
+ * going to the same socket while the group as a whole is load balanced.
  */
 
 
 struct sock *__inet_lookup_listener(struct net *net,
 				    struct inet_hashinfo *hashinfo,
+				    const __be32 saddr, __be16 sport,
 				    const __be32 daddr, const unsigned short hnum,
 				    const int dif)
 {
@@ -183,17 +189,30 @@ struct sock *__inet_lookup_listener(struct net *net,
 	struct hlist_nulls_node *node;
 	unsigned int hash = inet_lhashfn(net, hnum);
 	struct inet_listen_hashbucket *ilb = &hashinfo->listening_hash[hash];
-	int score, hiscore;
+	int score, hiscore, matches = 0, reuseport = 0;
+	u32 phash = 0;
 
 	rcu_read_lock();
 begin:
 	result = NULL;
 	hiscore = -1;
+	reuseport = 0;
 	sk_nulls_for_each_rcu(sk, node, &ilb->head) {
 		score = compute_score(sk, net, hnum, daddr, dif);
 		if (score > hiscore) {
 			result = sk;
 			hiscore = score;
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				phash = inet_ehashfn(net, daddr, hnum,
+						     saddr, sport);
+				matches = 1;
+			}
+		} else if (score == hiscore && reuseport) {
+			matches++;
+			if (((u64)phash * matches) >> 32 == 0)
+				result = sk;
+			phash = next_pseudo_random32(phash);
 		}
 	}
 	/*
@@ -288,6 +307,66 @@ out:
 }
 EXPORT_SYMBOL_GPL(__inet_lookup_established);
 
+static inline bool inet_req_match(const struct request_sock *req,
+				  const unsigned int hash,
+				  const __be32 saddr, const __be16 sport,
+				  const __be32 daddr, const __be16 dport)
+{
+	const struct inet_request_sock *ireq = inet_rsk(req);
+
+	return req->rsk_hash == hash &&
+	       ireq->rmt_addr == saddr && ireq->loc_addr == daddr &&
+	       ireq->rmt_port == sport && ireq->loc_port == dport &&
+	       req->rsk_ops->family == AF_INET;
+}
+
+struct request_sock *__inet_lookup_reqsk(struct net *net,
+					 struct inet_hashinfo *hashinfo,
+					 const __be32 saddr, const __be16 sport,
+					 const __be32 daddr, const u16 hnum)
+{
+	const __be16 dport = htons(hnum);
+	struct request_sock *req;
+	const struct hlist_nulls_node *node;
+	unsigned int hash = inet_ehashfn(net, daddr, hnum, saddr, sport);
+	unsigned int slot = hash & hashinfo->ehash_mask;
+	struct inet_ehash_bucket *head = &hashinfo->ehash[slot];
+
+	rcu_read_lock();
+begin:
+	hlist_nulls_for_each_entry_rcu(req, node, &head->reqchain, rsk_node) {
+		if (inet_req_match(req, hash, saddr, sport, daddr, dport)) {
+			if (unlikely(!atomic_inc_not_zero(&req->rsk_refcnt))) {
+				req = NULL;
+				goto out;
+			}
+			/* The slab is SLAB_DESTROY_BY_RCU: recheck now that
+			 * the request cannot be freed under us, this time
+			 * including its (now pinned) listener's namespace.
+			 */
+			if (unlikely(!inet_req_match(req, hash, saddr, sport,
+						     daddr, dport) ||
+				     !net_eq(sock_net(req->rsk_listener), net))) {
+				reqsk_put(req);
+				goto begin;
+			}
+			goto out;
+		}
+	}
+	/*
+	 * if the nulls value we got at the end of this lookup is
+	 * not the expected one, we must restart lookup.
+	 * We probably met an item that was moved to another chain.
+	 */
+	if (get_nulls_value(node) != slot)
+		goto begin;
+	req = NULL;
+out:
+	rcu_read_unlock();
+	return req;
+}
+EXPORT_SYMBOL_GPL(__inet_lookup_reqsk);
+
 /* called with local bh disabled */
 static int __inet_check_established(struct inet_timewait_death_row *death_row,
 				    struct sock *sk, __u16 lport,
@@ -400,6 +479,83 @@ int __inet_hash_nolisten(struct sock *sk, struct inet_timewait_sock *tw)
 }
 EXPORT_SYMBOL_GPL(__inet_hash_nolisten);
 
+/*
+ * Hash a child socket in place of the request it was created from.  Both
+ * hash to the same bucket, and the child goes in before the request goes
+ * out, so a lookup that misses the request will find the child.
+ *
+ * Returns false if the request was unhashed already, because it expired
+ * or another CPU completed the handshake first.  The child is then
+ * destroyed; the caller must still unlock it and drop its reference.
+ * Requests that were never hashed (syncookies) are not looked for.
+ */
+bool __inet_hash_child(struct sock *sk, struct request_sock *req)
+{
+	struct inet_hashinfo *hashinfo = sk->sk_prot->h.hashinfo;
+	struct inet_ehash_bucket *head = inet_ehash_bucket(hashinfo, sk->sk_hash);
+	spinlock_t *lock = inet_ehash_lockp(hashinfo, sk->sk_hash);
+	bool own_req = true;
+
+	WARN_ON(!sk_unhashed(sk));
+
+	spin_lock(lock);
+	if (req->rsk_listener) {
+		WARN_ON(req->rsk_hash != sk->sk_hash);
+		own_req = !hlist_nulls_unhashed(&req->rsk_node);
+	}
+	if (own_req) {
+		__sk_nulls_add_node_rcu(sk, &head->chain);
+		if (req->rsk_listener)
+			hlist_nulls_del_init_rcu(&req->rsk_node);
+	}
+	spin_unlock(lock);
+
+	if (own_req) {
+		sock_prot_inuse_add(sock_net(sk), sk->sk_prot, 1);
+	} else {
+		sk->sk_state = TCP_CLOSE;
+		sock_set_flag(sk, SOCK_DEAD);
+		percpu_counter_inc(sk->sk_prot->orphan_count);
+		inet_csk_destroy_sock(sk);
+	}
+	return own_req;
+}
+EXPORT_SYMBOL_GPL(__inet_hash_child);
+
+bool inet_hash_child(struct sock *sk, struct request_sock *req)
+{
+	sk->sk_hash = inet_sk_ehashfn(sk);
+	return __inet_hash_child(sk, req);
+}
+EXPORT_SYMBOL_GPL(inet_hash_child);
+
+void inet_ehash_req(struct inet_hashinfo *hashinfo, struct request_sock *req)
+{
+	struct inet_ehash_bucket *head = inet_ehash_bucket(hashinfo, req->rsk_hash);
+	spinlock_t *lock = inet_ehash_lockp(hashinfo, req->rsk_hash);
+
+	spin_lock(lock);
+	hlist_nulls_add_head_rcu(&req->rsk_node, &head->reqchain);
+	spin_unlock(lock);
+}
+EXPORT_SYMBOL_GPL(inet_ehash_req);
+
+/* Returns true if this call took the request out of the hash. */
+bool inet_unhash_req(struct inet_hashinfo *hashinfo, struct request_sock *req)
+{
+	spinlock_t *lock = inet_ehash_lockp(hashinfo, req->rsk_hash);
+	bool found = false;
+
+	spin_lock(lock);
+	if (!hlist_nulls_unhashed(&req->rsk_node)) {
+		hlist_nulls_del_init_rcu(&req->rsk_node);
+		found = true;
+	}
+	spin_unlock(lock);
+	return found;
+}
+EXPORT_SYMBOL_GPL(inet_unhash_req);
+
 static void __inet_hash(struct sock *sk)
 {
 	struct inet_hashinfo *hashinfo = sk->sk_prot->h.hashinfo;
@@ -491,7 +647,8 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 			inet_bind_bucket_for_each(tb, node, &head->chain) {
 				if (net_eq(ib_net(tb), net) &&
 				    tb->port == port) {
-					if (tb->fastreuse >= 0)
+					if (tb->fastreuse >= 0 ||
+					    tb->fastreuseport >= 0)
 						goto next_port;
 					WARN_ON(hlist_empty(&tb->owners));
 					if (!check_established(death_row, sk,
@@ -508,6 +665,7 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 				break;
 			}
 			tb->fastreuse = -1;
+			tb->fastreuseport = -1;
 			goto ok;
 
 		next_port:
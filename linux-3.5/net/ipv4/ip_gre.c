@@ -125,6 +125,14 @@ static int ipgre_tunnel_init(struct net_device *dev);
 static void ipgre_tunnel_setup(struct net_device *dev);
 static int ipgre_tunnel_bind_dev(struct net_device *dev);
 
+/* Offloads of an ARPHRD_IPGRE tunnel: TSO packets are segmented by
+ * gre_gso_segment() on the way out of the underlying device.
+ */
+#define IPGRE_FEATURES (NETIF_F_SG |		\
+			NETIF_F_HW_CSUM |	\
+			NETIF_F_HIGHDMA |	\
+			NETIF_F_ALL_TSO)
+
 /* Fallback tunnel: no source, no destination, no key, no options */
 
 #define HASH_SIZE  16
@@ -753,7 +761,7 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 
 		if (skb->protocol == htons(ETH_P_IP)) {
 			rt = skb_rtable(skb);
-			dst = rt->rt_gateway;
+			dst = rt_nexthop(rt, old_iph->daddr);
 		}
 #if IS_ENABLED(CONFIG_IPV6)
 		else if (skb->protocol == htons(ETH_P_IPV6)) {
@@ -826,7 +834,8 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 		df |= (old_iph->frag_off&htons(IP_DF));
 
 		if ((old_iph->frag_off&htons(IP_DF)) &&
-		    mtu < ntohs(old_iph->tot_len)) {
+		    mtu < (skb_is_gso(skb) ? skb_gso_network_seglen(skb) :
+					     ntohs(old_iph->tot_len))) {
 			icmp_send(skb, ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED, htonl(mtu));
 			ip_rt_put(rt);
 			goto tx_error;
@@ -845,7 +854,9 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 			}
 		}
 
-		if (mtu >= IPV6_MIN_MTU && mtu < skb->len - tunnel->hlen + gre_hlen) {
+		if (mtu >= IPV6_MIN_MTU &&
+		    mtu < (skb_is_gso(skb) ? skb_gso_network_seglen(skb) :
+					     skb->len - tunnel->hlen + gre_hlen)) {
 			icmpv6_send(skb, ICMPV6_PKT_TOOBIG, 0, mtu);
 			ip_rt_put(rt);
 			goto tx_error;
@@ -865,8 +876,10 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 
 	max_headroom = LL_RESERVED_SPACE(tdev) + gre_hlen + rt->dst.header_len;
 
+	/* GSO packets get SKB_GSO_GRE below, so they need a private shinfo */
 	if (skb_headroom(skb) < max_headroom || skb_shared(skb)||
-	    (skb_cloned(skb) && !skb_clone_writable(skb, 0))) {
+	    (skb_cloned(skb) && !skb_clone_writable(skb, 0)) ||
+	    (skb_cloned(skb) && skb_is_gso(skb))) {
 		struct sk_buff *new_skb = skb_realloc_headroom(skb, max_headroom);
 		if (max_headroom > dev->needed_headroom)
 			dev->needed_headroom = max_headroom;
@@ -883,6 +896,19 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 		old_iph = ip_hdr(skb);
 	}
 
+	if (skb_is_gso(skb)) {
+		/* Let gre_gso_segment() find the inner packet */
+		skb->encapsulation = 1;
+		skb->inner_transport_header = skb->transport_header;
+		skb->inner_network_header = skb->network_header;
+		skb_reset_inner_mac_header(skb);
+		skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+	} else if (skb->ip_summed == CHECKSUM_PARTIAL &&
+		   skb_checksum_help(skb)) {
+		ip_rt_put(rt);
+		goto tx_error;
+	}
+
 	skb_reset_transport_header(skb);
 	skb_push(skb, gre_hlen);
 	skb_reset_network_header(skb);
@@ -934,7 +960,12 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 		}
 		if (tunnel->parms.o_flags&GRE_CSUM) {
 			*ptr = 0;
-			*(__sum16 *)ptr = ip_compute_csum((void *)(iph+1), skb->len - sizeof(struct iphdr));
+			/* GSO segments are summed in gre_gso_segment() */
+			if (!skb_is_gso(skb))
+				*(__sum16 *)ptr = csum_fold(skb_checksum(skb,
+						sizeof(struct iphdr),
+						skb->len - sizeof(struct iphdr),
+						0));
 		}
 	}
 
@@ -1324,6 +1355,14 @@ static int ipgre_tunnel_init(struct net_device *dev)
 	} else
 		dev->header_ops = &ipgre_header_ops;
 
+	/* Segments of one GSO packet would share a sequence number, and
+	 * header_ops build the outer header before we see the packet.
+	 */
+	if (!(tunnel->parms.o_flags & GRE_SEQ) && !dev->header_ops) {
+		dev->hw_features |= IPGRE_FEATURES;
+		dev->features |= IPGRE_FEATURES;
+	}
+
 	dev->tstats = alloc_percpu(struct pcpu_tstats);
 	if (!dev->tstats)
 		return -ENOMEM;
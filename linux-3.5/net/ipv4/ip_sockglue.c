@@ -35,6 +35,7 @@
 #include <linux/mroute.h>
 #include <net/inet_ecn.h>
 #include <net/route.h>
+#include <net/ip_fib.h>
 #include <net/xfrm.h>
 #include <net/compat.h>
 #if IS_ENABLED(CONFIG_IPV6)
@@ -376,6 +377,7 @@ int ip_recv_error(struct sock *sk, struct msghdr *msg, int len)
 		struct sock_extended_err ee;
 		struct sockaddr_in	 offender;
 	} errhdr;
+	bool zerocopy;
 	int err;
 	int copied;
 
@@ -396,9 +398,11 @@ int ip_recv_error(struct sock *sk, struct msghdr *msg, int len)
 	sock_recv_timestamp(msg, sk, skb);
 
 	serr = SKB_EXT_ERR(skb);
+	/* MSG_ZEROCOPY completions carry no packet and no socket error */
+	zerocopy = serr->ee.ee_origin == SO_EE_ORIGIN_ZEROCOPY;
 
 	sin = (struct sockaddr_in *)msg->msg_name;
-	if (sin) {
+	if (sin && !zerocopy) {
 		sin->sin_family = AF_INET;
 		sin->sin_addr.s_addr = *(__be32 *)(skb_network_header(skb) +
 						   serr->addr_offset);
@@ -427,6 +431,9 @@ int ip_recv_error(struct sock *sk, struct msghdr *msg, int len)
 	msg->msg_flags |= MSG_ERRQUEUE;
 	err = copied;
 
+	if (zerocopy)
+		goto out_free_skb;
+
 	/* Reset and regenerate socket error */
 	spin_lock_bh(&sk->sk_error_queue.lock);
 	sk->sk_err = 0;
@@ -1019,18 +1026,20 @@ e_inval:
  * @sk: socket
  * @skb: buffer
  *
- * To support IP_CMSG_PKTINFO option, we store rt_iif and rt_spec_dst
- * in skb->cb[] before dst drop.
- * This way, receiver doesnt make cache line misses to read rtable.
+ * To support IP_CMSG_PKTINFO option, we store the input interface and
+ * the specific destination in skb->cb[] before dst drop.
+ * The latter costs a FIB lookup now that routes are shared, so it is
+ * only done for sockets which asked for IP_PKTINFO.
  */
-void ipv4_pktinfo_prepare(struct sk_buff *skb)
+void ipv4_pktinfo_prepare(const struct sock *sk, struct sk_buff *skb)
 {
 	struct in_pktinfo *pktinfo = PKTINFO_SKB_CB(skb);
-	const struct rtable *rt = skb_rtable(skb);
 
-	if (rt) {
-		pktinfo->ipi_ifindex = rt->rt_iif;
-		pktinfo->ipi_spec_dst.s_addr = rt->rt_spec_dst;
+	if ((inet_sk(sk)->cmsg_flags & IP_CMSG_PKTINFO) && skb_rtable(skb)) {
+		pktinfo->ipi_ifindex = inet_iif(skb);
+		rcu_read_lock();
+		pktinfo->ipi_spec_dst.s_addr = fib_compute_spec_dst(skb);
+		rcu_read_unlock();
 	} else {
 		pktinfo->ipi_ifindex = 0;
 		pktinfo->ipi_spec_dst.s_addr = 0;
@@ -0,0 +1,139 @@
+/*
+ * nf_tables IPv4 address family
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/ip.h>
+#include <linux/netfilter_ipv4.h>
+#include <net/netfilter/nf_tables.h>
+#include <net/net_namespace.h>
+#include <net/ip.h>
+
+static unsigned int nft_ipv4_hook(unsigned int hooknum, struct sk_buff *skb,
+				  const struct net_device *in,
+				  const struct net_device *out,
+				  int (*okfn)(struct sk_buff *))
+{
+	const struct net *net;
+	struct nft_pktinfo pkt;
+
+	if (hooknum == NF_INET_LOCAL_OUT &&
+	    (skb->len < sizeof(struct iphdr) ||
+	     ip_hdrlen(skb) < sizeof(struct iphdr)))
+		/* root is playing with raw sockets. */
+		return NF_ACCEPT;
+
+	net = dev_net((in != NULL) ? in : out);
+	if (unlikely(net->nft.ipv4 == NULL))
+		return NF_ACCEPT;
+
+	nft_set_pktinfo(&pkt, skb, hooknum, in, out);
+	pkt.tprot = ip_hdr(skb)->protocol;
+	pkt.thoff = ip_hdrlen(skb);
+
+	return nft_do_hook(net, net->nft.ipv4, &pkt);
+}
+
+/*
+ * All base chains attached to a hook run from a single netfilter hook at
+ * filter priority; their own priorities only order them among each other.
+ */
+static struct nf_hook_ops nft_ipv4_ops[] __read_mostly = {
+	{
+		.hook		= nft_ipv4_hook,
+		.owner		= THIS_MODULE,
+		.pf		= NFPROTO_IPV4,
+		.hooknum	= NF_INET_PRE_ROUTING,
+		.priority	= NF_IP_PRI_FILTER,
+	},
+	{
+		.hook		= nft_ipv4_hook,
+		.owner		= THIS_MODULE,
+		.pf		= NFPROTO_IPV4,
+		.hooknum	= NF_INET_LOCAL_IN,
+		.priority	= NF_IP_PRI_FILTER,
+	},
+	{
+		.hook		= nft_ipv4_hook,
+		.owner		= THIS_MODULE,
+		.pf		= NFPROTO_IPV4,
+		.hooknum	= NF_INET_FORWARD,
+		.priority	= NF_IP_PRI_FILTER,
+	},
+	{
+		.hook		= nft_ipv4_hook,
+		.owner		= THIS_MODULE,
+		.pf		= NFPROTO_IPV4,
+		.hooknum	= NF_INET_LOCAL_OUT,
+		.priority	= NF_IP_PRI_FILTER,
+	},
+	{
+		.hook		= nft_ipv4_hook,
+		.owner		= THIS_MODULE,
+		.pf		= NFPROTO_IPV4,
+		.hooknum	= NF_INET_POST_ROUTING,
+		.priority	= NF_IP_PRI_FILTER,
+	},
+};
+
+static struct nft_af_info nft_af_ipv4 __read_mostly = {
+	.family		= NFPROTO_IPV4,
+	.nhooks		= NF_INET_NUMHOOKS,
+	.owner		= THIS_MODULE,
+};
+
+static int __net_init nf_tables_ipv4_init_net(struct net *net)
+{
+	net->nft.ipv4 = kmemdup(&nft_af_ipv4, sizeof(nft_af_ipv4), GFP_KERNEL);
+	if (net->nft.ipv4 == NULL)
+		return -ENOMEM;
+
+	nft_register_afinfo(net, net->nft.ipv4);
+	return 0;
+}
+
+static void __net_exit nf_tables_ipv4_exit_net(struct net *net)
+{
+	struct nft_af_info *afi = net->nft.ipv4;
+
+	nft_unregister_afinfo(afi);
+	net->nft.ipv4 = NULL;
+	kfree(afi);
+}
+
+static struct pernet_operations nf_tables_ipv4_net_ops = {
+	.init	= nf_tables_ipv4_init_net,
+	.exit	= nf_tables_ipv4_exit_net,
+};
+
+static int __init nf_tables_ipv4_init(void)
+{
+	int ret;
+
+	ret = register_pernet_subsys(&nf_tables_ipv4_net_ops);
+	if (ret < 0)
+		return ret;
+
+	ret = nf_register_hooks(nft_ipv4_ops, ARRAY_SIZE(nft_ipv4_ops));
+	if (ret < 0)
+		unregister_pernet_subsys(&nf_tables_ipv4_net_ops);
+	return ret;
+}
+
+static void __exit nf_tables_ipv4_exit(void)
+{
+	nf_unregister_hooks(nft_ipv4_ops, ARRAY_SIZE(nft_ipv4_ops));
+	unregister_pernet_subsys(&nf_tables_ipv4_net_ops);
+}
+
+module_init(nf_tables_ipv4_init);
+module_exit(nf_tables_ipv4_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_NFT_FAMILY(AF_INET);
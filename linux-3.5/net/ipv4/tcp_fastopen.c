@@ -0,0 +1,326 @@
+/*
+ * TCP Fast Open (RFC 7413)
+ *
+ * Cookie generation, the client side cookie cache and creation of
+ * sockets that are opened by a SYN carrying data.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#define pr_fmt(fmt) "TCP: " fmt
+
+#include <linux/crypto.h>
+#include <linux/cache.h>
+#include <linux/init.h>
+#include <linux/ipv6.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
+#include <net/inetpeer.h>
+#include <net/tcp.h>
+
+int sysctl_tcp_fastopen __read_mostly = TFO_CLIENT_ENABLE;
+
+struct tcp_fastopen_context __rcu *tcp_fastopen_ctx;
+
+static DEFINE_SPINLOCK(tcp_fastopen_ctx_lock);
+
+static void tcp_fastopen_ctx_free(struct rcu_head *head)
+{
+	struct tcp_fastopen_context *ctx =
+	    container_of(head, struct tcp_fastopen_context, rcu);
+
+	crypto_free_cipher(ctx->tfm);
+	kfree(ctx);
+}
+
+int tcp_fastopen_reset_cipher(void *key, unsigned int len)
+{
+	struct tcp_fastopen_context *ctx, *octx;
+	int err;
+
+	ctx = kmalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+	ctx->tfm = crypto_alloc_cipher("aes", 0, 0);
+	if (IS_ERR(ctx->tfm)) {
+		err = PTR_ERR(ctx->tfm);
+		goto error;
+	}
+	err = crypto_cipher_setkey(ctx->tfm, key, len);
+	if (err) {
+		crypto_free_cipher(ctx->tfm);
+		goto error;
+	}
+	memcpy(ctx->key, key, len);
+
+	spin_lock(&tcp_fastopen_ctx_lock);
+	octx = rcu_dereference_protected(tcp_fastopen_ctx,
+				lockdep_is_held(&tcp_fastopen_ctx_lock));
+	rcu_assign_pointer(tcp_fastopen_ctx, ctx);
+	spin_unlock(&tcp_fastopen_ctx_lock);
+
+	if (octx)
+		call_rcu(&octx->rcu, tcp_fastopen_ctx_free);
+	return 0;
+
+error:
+	kfree(ctx);
+	pr_err("Fast Open cipher setup failed: %d\n", err);
+	return err;
+}
+
+/* Computes the cookie of the SYN's source address: the address, zero
+ * padded to one AES block, encrypted with the server key.
+ */
+void tcp_fastopen_cookie_gen(const struct sk_buff *skb,
+			     struct tcp_fastopen_cookie *foc)
+{
+	__be32 peer_addr[4] = { 0, 0, 0, 0 };
+	struct tcp_fastopen_context *ctx;
+
+	if (ip_hdr(skb)->version == 4)
+		peer_addr[0] = ip_hdr(skb)->saddr;
+	else
+		memcpy(peer_addr, &ipv6_hdr(skb)->saddr, sizeof(peer_addr));
+
+	rcu_read_lock();
+	ctx = rcu_dereference(tcp_fastopen_ctx);
+	if (ctx) {
+		crypto_cipher_encrypt_one(ctx->tfm, foc->val,
+					  (__u8 *)peer_addr);
+		foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * Client side cookie cache.  Cookies and the MSS of the SYN-ACK that
+ * carried them are kept in the destination's inet_peer, together with
+ * a count of SYNs with data that went unanswered.
+ */
+static DEFINE_SEQLOCK(fastopen_seqlock);
+
+static struct inet_peer *tcp_fastopen_get_peer(struct sock *sk, int create)
+{
+#if IS_ENABLED(CONFIG_IPV6)
+	if (sk->sk_family == AF_INET6)
+		return inet_getpeer_v6(&inet6_sk(sk)->daddr, create);
+#endif
+	return inet_getpeer_v4(inet_sk(sk)->inet_daddr, create);
+}
+
+void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+			    struct tcp_fastopen_cookie *cookie,
+			    int *syn_loss, unsigned long *last_syn_loss)
+{
+	struct inet_peer *peer = tcp_fastopen_get_peer(sk, 0);
+	unsigned int seq;
+
+	if (!peer)
+		return;
+
+	do {
+		seq = read_seqbegin(&fastopen_seqlock);
+		if (peer->tcp_fastopen_mss)
+			*mss = peer->tcp_fastopen_mss;
+		*cookie = peer->tcp_fastopen_cookie;
+		*syn_loss = peer->tcp_fastopen_syn_loss;
+		*last_syn_loss = *syn_loss ?
+				 peer->tcp_fastopen_last_syn_loss : 0;
+	} while (read_seqretry(&fastopen_seqlock, seq));
+
+	inet_putpeer(peer);
+}
+
+void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+			    struct tcp_fastopen_cookie *cookie, bool syn_lost)
+{
+	struct inet_peer *peer = tcp_fastopen_get_peer(sk, 1);
+
+	if (!peer)
+		return;
+
+	write_seqlock_bh(&fastopen_seqlock);
+	if (mss)
+		peer->tcp_fastopen_mss = mss;
+	if (cookie->len > 0)
+		peer->tcp_fastopen_cookie = *cookie;
+	if (syn_lost) {
+		++peer->tcp_fastopen_syn_loss;
+		peer->tcp_fastopen_last_syn_loss = jiffies;
+	} else {
+		peer->tcp_fastopen_syn_loss = 0;
+	}
+	write_sequnlock_bh(&fastopen_seqlock);
+
+	inet_putpeer(peer);
+}
+
+/*
+ * Create the child of a SYN with a valid cookie, together with the data of
+ * the SYN.  The request is never hashed; the child retransmits the SYN-ACK
+ * from its own timer and keeps the request in fastopen_rsk until the
+ * SYN-ACK is acknowledged.  The child is returned locked, and is only
+ * queued for accept() by tcp_fastopen_queue_child() once the caller has
+ * sent the SYN-ACK.
+ */
+static struct sock *tcp_fastopen_create_child(struct sock *sk,
+					      struct sk_buff *skb,
+					      struct request_sock *req)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	u32 snt_synack = tcp_rsk(req)->snt_synack;
+	struct sk_buff *data = NULL;
+	struct tcp_sock *tp;
+	struct sock *child;
+
+	req->retrans = 0;
+	req->sk = NULL;
+
+	/* The SYN-ACK has not been sent yet: no RTT sample to take. */
+	tcp_rsk(req)->snt_synack = 0;
+	child = inet_csk(sk)->icsk_af_ops->syn_recv_sock(sk, skb, req, NULL);
+	tcp_rsk(req)->snt_synack = snt_synack;
+	if (child == NULL)
+		return NULL;
+
+	atomic_inc(&queue->fastopen_qlen);
+
+	tp = tcp_sk(child);
+	tp->fastopen_rsk = req;
+	sock_hold(sk);
+	req->rsk_listener = sk;
+	/* Held by the accept queue, by fastopen_rsk and by our caller. */
+	atomic_set(&req->rsk_refcnt, 3);
+
+	/* RFC1323: The window in SYN & SYN/ACK segments is never scaled. */
+	tp->snd_wnd = ntohs(tcp_hdr(skb)->window);
+
+	inet_csk_reset_xmit_timer(child, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT, TCP_RTO_MAX);
+
+	inet_csk(child)->icsk_af_ops->rebuild_header(child);
+	tcp_init_congestion_control(child);
+	tcp_mtup_init(child);
+	tcp_init_buffer_space(child);
+
+	/* Queue the data of the SYN.  A FIN in the SYN is left for the
+	 * peer to retransmit, and so is the data if it can't be queued:
+	 * the SYN-ACK acknowledges only what is on the receive queue.
+	 */
+	tcp_rsk(req)->rcv_nxt = TCP_SKB_CB(skb)->seq + 1;
+	if (skb->len > tcp_hdrlen(skb))
+		data = skb_clone(skb, GFP_ATOMIC);
+	if (data) {
+		skb_dst_drop(data);
+		__skb_pull(data, tcp_hdrlen(data));
+		skb_set_owner_r(data, child);
+		__skb_queue_tail(&child->sk_receive_queue, data);
+		tcp_rsk(req)->rcv_nxt += data->len;
+		tp->syn_data_acked = 1;
+	}
+	tp->rcv_nxt = tp->rcv_wup = tcp_rsk(req)->rcv_nxt;
+
+	return child;
+}
+
+/*
+ * Hand a Fast Open child to accept().  Called after the SYN-ACK went out,
+ * so that an application can't write to the child before it.
+ */
+void tcp_fastopen_queue_child(struct sock *sk, struct request_sock *req,
+			      struct sock *child)
+{
+	child = inet_csk_reqsk_queue_add(sk, req, child);
+	if (child) {
+		sk->sk_data_ready(sk, 0);
+		bh_unlock_sock(child);
+		sock_put(child);
+	}
+}
+EXPORT_SYMBOL(tcp_fastopen_queue_child);
+
+/*
+ * Decide whether a SYN opens a Fast Open connection.  Returns the locked
+ * child if it did; the caller then sends the SYN-ACK, queues the child
+ * with tcp_fastopen_queue_child() and drops its reference to @req.
+ * Otherwise @valid_foc holds the cookie, if any, that the SYN-ACK should
+ * return to the client.
+ */
+struct sock *tcp_try_fastopen(struct sock *sk, struct sk_buff *skb,
+			      struct request_sock *req,
+			      struct tcp_fastopen_cookie *foc,
+			      struct tcp_fastopen_cookie *valid_foc)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	struct sock *child;
+
+	if (foc->len < 0)
+		return NULL;
+
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVE);
+
+	if (!(sysctl_tcp_fastopen & TFO_SERVER_ENABLE) ||
+	    queue->fastopen_max_qlen == 0)
+		return NULL;
+
+	if (atomic_read(&queue->fastopen_qlen) >= queue->fastopen_max_qlen) {
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENLISTENOVERFLOW);
+		return NULL;
+	}
+
+	tcp_fastopen_cookie_gen(skb, valid_foc);
+
+	if (foc->len == 0) {
+		/* Client requesting a cookie */
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENCOOKIEREQD);
+		return NULL;
+	}
+
+	child = NULL;
+	if (foc->len == valid_foc->len &&
+	    memcmp(foc->val, valid_foc->val, foc->len) == 0)
+		child = tcp_fastopen_create_child(sk, skb, req);
+	if (child == NULL) {
+		/* Fall back to the regular handshake and hand out a
+		 * valid cookie for next time.
+		 */
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+		return NULL;
+	}
+
+	/* The client already has this cookie. */
+	valid_foc->len = -1;
+	return child;
+}
+EXPORT_SYMBOL(tcp_try_fastopen);
+
+/*
+ * A Fast Open child no longer needs its request once the SYN-ACK has been
+ * acknowledged, or when the child goes away first.
+ */
+void reqsk_fastopen_remove(struct sock *sk, struct request_sock *req)
+{
+	struct sock *lsk = req->rsk_listener;
+
+	atomic_dec(&inet_csk(lsk)->icsk_accept_queue.fastopen_qlen);
+	tcp_sk(sk)->fastopen_rsk = NULL;
+	reqsk_put(req);
+}
+
+static int __init tcp_fastopen_init(void)
+{
+	__u8 key[TCP_FASTOPEN_KEY_LENGTH];
+
+	get_random_bytes(key, sizeof(key));
+	tcp_fastopen_reset_cipher(key, sizeof(key));
+	return 0;
+}
+
+late_initcall(tcp_fastopen_init);
@@ -59,6 +59,13 @@ int __inet6_hash(struct sock *sk, struct inet_timewait_sock *tw)
 }
 EXPORT_SYMBOL(__inet6_hash);
 
+bool inet6_hash_child(struct sock *sk, struct request_sock *req)
+{
+	sk->sk_hash = inet6_sk_ehashfn(sk);
+	return __inet_hash_child(sk, req);
+}
+EXPORT_SYMBOL_GPL(inet6_hash_child);
+
 /*
  * Sockets in TCP_CLOSE state are _always_ taken out of the hash, so
  * we need not check it for TCP lookups anymore, thanks Alexey. -DaveM
@@ -125,6 +132,65 @@ out:
 }
 EXPORT_SYMBOL(__inet6_lookup_established);
 
+static inline bool inet6_req_match(const struct request_sock *req,
+				   const unsigned int hash,
+				   const struct in6_addr *saddr,
+				   const __be16 sport,
+				   const struct in6_addr *daddr,
+				   const __be16 dport, const int dif)
+{
+	const struct inet6_request_sock *treq = inet6_rsk(req);
+
+	return req->rsk_hash == hash &&
+	       inet_rsk(req)->rmt_port == sport &&
+	       inet_rsk(req)->loc_port == dport &&
+	       req->rsk_ops->family == AF_INET6 &&
+	       ipv6_addr_equal(&treq->rmt_addr, saddr) &&
+	       ipv6_addr_equal(&treq->loc_addr, daddr) &&
+	       (!treq->iif || treq->iif == dif);
+}
+
+struct request_sock *__inet6_lookup_reqsk(struct net *net,
+					  struct inet_hashinfo *hashinfo,
+					  const struct in6_addr *saddr,
+					  const __be16 sport,
+					  const struct in6_addr *daddr,
+					  const u16 hnum,
+					  const int dif)
+{
+	const __be16 dport = htons(hnum);
+	struct request_sock *req;
+	const struct hlist_nulls_node *node;
+	unsigned int hash = inet6_ehashfn(net, daddr, hnum, saddr, sport);
+	unsigned int slot = hash & hashinfo->ehash_mask;
+	struct inet_ehash_bucket *head = &hashinfo->ehash[slot];
+
+	rcu_read_lock();
+begin:
+	hlist_nulls_for_each_entry_rcu(req, node, &head->reqchain, rsk_node) {
+		if (inet6_req_match(req, hash, saddr, sport, daddr, dport, dif)) {
+			if (unlikely(!atomic_inc_not_zero(&req->rsk_refcnt))) {
+				req = NULL;
+				goto out;
+			}
+			if (unlikely(!inet6_req_match(req, hash, saddr, sport,
+						      daddr, dport, dif) ||
+				     !net_eq(sock_net(req->rsk_listener), net))) {
+				reqsk_put(req);
+				goto begin;
+			}
+			goto out;
+		}
+	}
+	if (get_nulls_value(node) != slot)
+		goto begin;
+	req = NULL;
+out:
+	rcu_read_unlock();
+	return req;
+}
+EXPORT_SYMBOL_GPL(__inet6_lookup_reqsk);
+
 static inline int compute_score(struct sock *sk, struct net *net,
 				const unsigned short hnum,
 				const struct in6_addr *daddr,
@@ -152,13 +218,15 @@ static inline int compute_score(struct sock *sk, struct net *net,
 }
 
 struct sock *inet6_lookup_listener(struct net *net,
-		struct inet_hashinfo *hashinfo, const struct in6_addr *daddr,
+		struct inet_hashinfo *hashinfo, const struct in6_addr *saddr,
+		const __be16 sport, const struct in6_addr *daddr,
 		const unsigned short hnum, const int dif)
 {
 	struct sock *sk;
 	const struct hlist_nulls_node *node;
 	struct sock *result;
-	int score, hiscore;
+	int score, hiscore, matches = 0, reuseport = 0;
+	u32 phash = 0;
 	unsigned int hash = inet_lhashfn(net, hnum);
 	struct inet_listen_hashbucket *ilb = &hashinfo->listening_hash[hash];
 
@@ -166,11 +234,23 @@ struct sock *inet6_lookup_listener(struct net *net,
 begin:
 	result = NULL;
 	hiscore = -1;
+	reuseport = 0;
 	sk_nulls_for_each(sk, node, &ilb->head) {
 		score = compute_score(sk, net, hnum, daddr, dif);
 		if (score > hiscore) {
 			hiscore = score;
 			result = sk;
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				phash = inet6_ehashfn(net, daddr, hnum,
+						      saddr, sport);
+				matches = 1;
+			}
+		} else if (score == hiscore && reuseport) {
+			matches++;
+			if (((u64)phash * matches) >> 32 == 0)
+				result = sk;
+			phash = next_pseudo_random32(phash);
 		}
 	}
 	/*
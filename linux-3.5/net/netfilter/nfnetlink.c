@@ -178,6 +178,10 @@ replay:
 			err = nc->call_rcu(net->nfnl, skb, nlh,
 					   (const struct nlattr **)cda);
 			rcu_read_unlock();
+		} else if (!nc->call) {
+			/* Only valid inside a batch. */
+			rcu_read_unlock();
+			err = -EOPNOTSUPP;
 		} else {
 			rcu_read_unlock();
 			nfnl_lock();
@@ -197,9 +201,188 @@ replay:
 	}
 }
 
+/*
+ * Process a batch of messages for one subsystem as a single transaction.
+ * Every message is handed to its call_batch handler; if all succeed and
+ * the batch is properly terminated the subsystem commits, otherwise it
+ * aborts.  Errors are reported per message and do not stop the batch,
+ * so userspace learns about all of them at once.
+ */
+static void nfnetlink_rcv_batch(struct sk_buff *skb, struct nlmsghdr *nlh,
+				u_int16_t subsys_id)
+{
+	struct sk_buff *nskb, *oskb = skb;
+	struct net *net = sock_net(skb->sk);
+	const struct nfnetlink_subsystem *ss;
+	const struct nfnl_callback *nc;
+	bool success = true, done = false;
+	int err;
+
+	if (subsys_id >= NFNL_SUBSYS_COUNT)
+		return netlink_ack(skb, nlh, -EINVAL);
+replay:
+	nskb = skb_clone(oskb, GFP_KERNEL);
+	if (!nskb)
+		return netlink_ack(oskb, nlh, -ENOMEM);
+
+	nskb->sk = oskb->sk;
+	skb = nskb;
+
+	nfnl_lock();
+	ss = rcu_dereference_protected(subsys_table[subsys_id],
+				       lockdep_is_held(&nfnl_mutex));
+	if (!ss) {
+#ifdef CONFIG_MODULES
+		nfnl_unlock();
+		request_module("nfnetlink-subsys-%d", subsys_id);
+		nfnl_lock();
+		ss = rcu_dereference_protected(subsys_table[subsys_id],
+					       lockdep_is_held(&nfnl_mutex));
+		if (!ss)
+#endif
+		{
+			nfnl_unlock();
+			netlink_ack(skb, nlh, -EOPNOTSUPP);
+			return kfree_skb(skb);
+		}
+	}
+
+	if (!ss->commit || !ss->abort) {
+		nfnl_unlock();
+		netlink_ack(skb, nlh, -EOPNOTSUPP);
+		return kfree_skb(skb);
+	}
+
+	while (skb->len >= nlmsg_total_size(0)) {
+		int msglen, type;
+
+		nlh = nlmsg_hdr(skb);
+		err = 0;
+
+		if (nlh->nlmsg_len < NLMSG_HDRLEN ||
+		    skb->len < nlh->nlmsg_len) {
+			success = false;
+			goto done;
+		}
+
+		/* Only requests are handled by the kernel */
+		if (!(nlh->nlmsg_flags & NLM_F_REQUEST)) {
+			err = -EINVAL;
+			goto ack;
+		}
+
+		type = nlh->nlmsg_type;
+		if (type == NFNL_MSG_BATCH_BEGIN) {
+			/* Malformed: batch begin twice */
+			success = false;
+			goto done;
+		} else if (type == NFNL_MSG_BATCH_END) {
+			done = true;
+			goto done;
+		} else if (type < NLMSG_MIN_TYPE) {
+			err = -EINVAL;
+			goto ack;
+		}
+
+		/* A batch only carries messages for one subsystem. */
+		if (NFNL_SUBSYS_ID(type) != subsys_id) {
+			err = -EINVAL;
+			goto ack;
+		}
+
+		nc = nfnetlink_find_client(type, ss);
+		if (!nc) {
+			err = -EINVAL;
+			goto ack;
+		}
+
+		if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct nfgenmsg))) {
+			err = -EINVAL;
+			goto ack;
+		}
+
+		{
+			int min_len = NLMSG_SPACE(sizeof(struct nfgenmsg));
+			u_int8_t cb_id = NFNL_MSG_TYPE(nlh->nlmsg_type);
+			struct nlattr *cda[ss->cb[cb_id].attr_count + 1];
+			struct nlattr *attr = (void *)nlh + min_len;
+			int attrlen = nlh->nlmsg_len - min_len;
+
+			err = nla_parse(cda, ss->cb[cb_id].attr_count,
+					attr, attrlen, ss->cb[cb_id].policy);
+			if (err < 0)
+				goto ack;
+
+			if (nc->call_batch)
+				err = nc->call_batch(net->nfnl, skb, nlh,
+						     (const struct nlattr **)cda);
+			else
+				err = -EOPNOTSUPP;
+
+			/* The lock was released to autoload some module,
+			 * throw away what we did and start from scratch
+			 * with the original skb.
+			 */
+			if (err == -EAGAIN) {
+				ss->abort(oskb);
+				nfnl_unlock();
+				kfree_skb(nskb);
+				goto replay;
+			}
+		}
+ack:
+		if (nlh->nlmsg_flags & NLM_F_ACK || err) {
+			netlink_ack(skb, nlh, err);
+			if (err)
+				success = false;
+		}
+
+		msglen = NLMSG_ALIGN(nlh->nlmsg_len);
+		if (msglen > skb->len)
+			msglen = skb->len;
+		skb_pull(skb, msglen);
+	}
+done:
+	if (success && done)
+		ss->commit(oskb);
+	else
+		ss->abort(oskb);
+
+	nfnl_unlock();
+	kfree_skb(nskb);
+}
+
 static void nfnetlink_rcv(struct sk_buff *skb)
 {
-	netlink_rcv_skb(skb, &nfnetlink_rcv_msg);
+	struct nlmsghdr *nlh = nlmsg_hdr(skb);
+	struct nfgenmsg *nfgenmsg;
+	int msglen;
+
+	if (skb->len < NLMSG_HDRLEN ||
+	    nlh->nlmsg_len < NLMSG_HDRLEN || skb->len < nlh->nlmsg_len)
+		return;
+
+	if (nlh->nlmsg_type != NFNL_MSG_BATCH_BEGIN) {
+		netlink_rcv_skb(skb, &nfnetlink_rcv_msg);
+		return;
+	}
+
+	if (!capable(CAP_NET_ADMIN)) {
+		netlink_ack(skb, nlh, -EPERM);
+		return;
+	}
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct nfgenmsg)))
+		return;
+
+	msglen = NLMSG_ALIGN(nlh->nlmsg_len);
+	if (msglen > skb->len)
+		msglen = skb->len;
+
+	/* res_id carries the subsystem id, in host byte order. */
+	nfgenmsg = nlmsg_data(nlh);
+	skb_pull(skb, msglen);
+	nfnetlink_rcv_batch(skb, nlh, (__force u16)nfgenmsg->res_id);
 }
 
 static int __net_init nfnetlink_net_init(struct net *net)
@@ -0,0 +1,330 @@
+/*
+ * nf_tables hash set backend
+ *
+ * Elements are kept in an RCU protected hash table that doubles in size
+ * when it becomes three quarters full.  Each element carries two list
+ * nodes so a resize can link every element into the new table while
+ * lookups keep walking the old one.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/netfilter/nf_tables.h>
+
+#define NFT_HASH_MIN_SIZE	4
+#define NFT_HASH_MAX_SIZE	(1 << 20)
+
+struct nft_hash_table {
+	unsigned int			size;
+	unsigned int			idx;
+	struct hlist_head		buckets[];
+};
+
+struct nft_hash {
+	struct nft_hash_table __rcu	*tbl;
+	unsigned int			nelems;
+};
+
+struct nft_hash_elem {
+	struct hlist_node		node[2];
+	struct rcu_head			rcu;
+	struct nft_data			key;
+	struct nft_data			data[];
+};
+
+static u32 nft_hash_rnd __read_mostly;
+static bool nft_hash_rnd_initted __read_mostly;
+
+/* All updates are serialized by the nfnetlink mutex. */
+#define nft_hash_table_protected(priv) \
+	rcu_dereference_protected((priv)->tbl, 1)
+
+static inline struct nft_hash_elem *
+nft_hash_entry(const struct hlist_node *node, unsigned int idx)
+{
+	return container_of(node - idx, struct nft_hash_elem, node[0]);
+}
+
+static unsigned int nft_hash_data(const struct nft_data *data,
+				  unsigned int hsize, unsigned int len)
+{
+	unsigned int h;
+
+	h = jhash(data->data, len, nft_hash_rnd);
+	return ((u64)h * hsize) >> 32;
+}
+
+static struct nft_hash_elem *
+nft_hash_find(const struct nft_set *set, const struct nft_hash_table *tbl,
+	      const struct nft_data *key)
+{
+	struct hlist_node *pos;
+	struct nft_hash_elem *he;
+	unsigned int h;
+
+	h = nft_hash_data(key, tbl->size, set->klen);
+	__hlist_for_each_rcu(pos, &tbl->buckets[h]) {
+		he = nft_hash_entry(pos, tbl->idx);
+		if (!nft_data_cmp(&he->key, key, set->klen))
+			return he;
+	}
+	return NULL;
+}
+
+static bool nft_hash_lookup(const struct nft_set *set,
+			    const struct nft_data *key,
+			    struct nft_data *data)
+{
+	const struct nft_hash *priv = nft_set_priv(set);
+	const struct nft_hash_elem *he;
+
+	he = nft_hash_find(set, rcu_dereference(priv->tbl), key);
+	if (he == NULL)
+		return false;
+
+	if (set->flags & NFT_SET_MAP)
+		nft_data_copy(data, he->data);
+	return true;
+}
+
+static struct nft_hash_table *nft_hash_tbl_alloc(unsigned int size)
+{
+	struct nft_hash_table *tbl;
+	size_t sz;
+
+	sz = sizeof(*tbl) + size * sizeof(tbl->buckets[0]);
+	if (sz <= PAGE_SIZE)
+		tbl = kzalloc(sz, GFP_KERNEL);
+	else
+		tbl = vzalloc(sz);
+	if (tbl == NULL)
+		return NULL;
+
+	tbl->size = size;
+	return tbl;
+}
+
+static void nft_hash_tbl_free(struct nft_hash_table *tbl)
+{
+	if (is_vmalloc_addr(tbl))
+		vfree(tbl);
+	else
+		kfree(tbl);
+}
+
+static void nft_hash_resize(const struct nft_set *set, struct nft_hash *priv,
+			    unsigned int size)
+{
+	struct nft_hash_table *old = nft_hash_table_protected(priv), *tbl;
+	struct nft_hash_elem *he;
+	struct hlist_node *pos;
+	unsigned int i, h;
+
+	tbl = nft_hash_tbl_alloc(size);
+	if (tbl == NULL)
+		return;
+
+	/* Link the elements through the node the old table doesn't use. */
+	tbl->idx = old->idx ^ 1;
+	for (i = 0; i < old->size; i++) {
+		hlist_for_each(pos, &old->buckets[i]) {
+			he = nft_hash_entry(pos, old->idx);
+			h = nft_hash_data(&he->key, tbl->size, set->klen);
+			hlist_add_head_rcu(&he->node[tbl->idx], &tbl->buckets[h]);
+		}
+	}
+
+	rcu_assign_pointer(priv->tbl, tbl);
+	synchronize_rcu();
+	nft_hash_tbl_free(old);
+}
+
+static int nft_hash_insert(const struct nft_set *set,
+			   const struct nft_set_elem *elem)
+{
+	struct nft_hash *priv = nft_set_priv(set);
+	struct nft_hash_table *tbl = nft_hash_table_protected(priv);
+	struct nft_hash_elem *he;
+	unsigned int size, h;
+
+	if (elem->flags != 0)
+		return -EINVAL;
+
+	size = sizeof(*he);
+	if (set->flags & NFT_SET_MAP)
+		size += sizeof(he->data[0]);
+
+	he = kzalloc(size, GFP_KERNEL);
+	if (he == NULL)
+		return -ENOMEM;
+
+	nft_data_copy(&he->key, &elem->key);
+	if (set->flags & NFT_SET_MAP)
+		nft_data_copy(he->data, &elem->data);
+
+	h = nft_hash_data(&he->key, tbl->size, set->klen);
+	hlist_add_head_rcu(&he->node[tbl->idx], &tbl->buckets[h]);
+
+	if (++priv->nelems > tbl->size / 4 * 3 &&
+	    tbl->size < NFT_HASH_MAX_SIZE)
+		nft_hash_resize(set, priv, tbl->size * 2);
+	return 0;
+}
+
+static void nft_hash_elem_destroy(const struct nft_set *set,
+				  struct nft_hash_elem *he)
+{
+	nft_data_uninit(&he->key, NFT_DATA_VALUE);
+	if (set->flags & NFT_SET_MAP)
+		nft_data_uninit(he->data, nft_set_datatype(set));
+	kfree(he);
+}
+
+static void nft_hash_remove(const struct nft_set *set,
+			    const struct nft_set_elem *elem)
+{
+	struct nft_hash *priv = nft_set_priv(set);
+	struct nft_hash_table *tbl = nft_hash_table_protected(priv);
+	struct nft_hash_elem *he = elem->cookie;
+
+	hlist_del_rcu(&he->node[tbl->idx]);
+	priv->nelems--;
+	kfree_rcu(he, rcu);
+}
+
+static int nft_hash_get(const struct nft_set *set, struct nft_set_elem *elem)
+{
+	const struct nft_hash *priv = nft_set_priv(set);
+	struct nft_hash_elem *he;
+
+	rcu_read_lock();
+	he = nft_hash_find(set, rcu_dereference(priv->tbl), &elem->key);
+	rcu_read_unlock();
+	if (he == NULL)
+		return -ENOENT;
+
+	elem->cookie = he;
+	elem->flags  = 0;
+	if (set->flags & NFT_SET_MAP)
+		nft_data_copy(&elem->data, he->data);
+	return 0;
+}
+
+static void nft_hash_walk(const struct nft_ctx *ctx, const struct nft_set *set,
+			  struct nft_set_iter *iter)
+{
+	const struct nft_hash *priv = nft_set_priv(set);
+	const struct nft_hash_table *tbl;
+	const struct nft_hash_elem *he;
+	struct nft_set_elem elem;
+	struct hlist_node *pos;
+	unsigned int i;
+
+	rcu_read_lock();
+	tbl = rcu_dereference(priv->tbl);
+	for (i = 0; i < tbl->size; i++) {
+		__hlist_for_each_rcu(pos, &tbl->buckets[i]) {
+			if (iter->count < iter->skip)
+				goto cont;
+
+			he = nft_hash_entry(pos, tbl->idx);
+			memcpy(&elem.key, &he->key, sizeof(elem.key));
+			if (set->flags & NFT_SET_MAP)
+				memcpy(&elem.data, he->data, sizeof(elem.data));
+			elem.flags = 0;
+
+			iter->err = iter->fn(ctx, set, iter, &elem);
+			if (iter->err < 0)
+				goto out;
+cont:
+			iter->count++;
+		}
+	}
+out:
+	rcu_read_unlock();
+}
+
+static unsigned int nft_hash_privsize(const struct nlattr * const nla[])
+{
+	return sizeof(struct nft_hash);
+}
+
+static int nft_hash_init(const struct nft_set *set,
+			 const struct nlattr * const tb[])
+{
+	struct nft_hash *priv = nft_set_priv(set);
+	struct nft_hash_table *tbl;
+
+	if (unlikely(!nft_hash_rnd_initted)) {
+		get_random_bytes(&nft_hash_rnd, sizeof(nft_hash_rnd));
+		nft_hash_rnd_initted = true;
+	}
+
+	tbl = nft_hash_tbl_alloc(NFT_HASH_MIN_SIZE);
+	if (tbl == NULL)
+		return -ENOMEM;
+
+	RCU_INIT_POINTER(priv->tbl, tbl);
+	priv->nelems = 0;
+	return 0;
+}
+
+static void nft_hash_destroy(const struct nft_set *set)
+{
+	const struct nft_hash *priv = nft_set_priv(set);
+	struct nft_hash_table *tbl = nft_hash_table_protected(priv);
+	struct hlist_node *pos, *next;
+	unsigned int i;
+
+	for (i = 0; i < tbl->size; i++) {
+		hlist_for_each_safe(pos, next, &tbl->buckets[i]) {
+			hlist_del(pos);
+			nft_hash_elem_destroy(set, nft_hash_entry(pos, tbl->idx));
+		}
+	}
+	nft_hash_tbl_free(tbl);
+}
+
+static struct nft_set_ops nft_hash_ops __read_mostly = {
+	.privsize	= nft_hash_privsize,
+	.init		= nft_hash_init,
+	.destroy	= nft_hash_destroy,
+	.get		= nft_hash_get,
+	.insert		= nft_hash_insert,
+	.remove		= nft_hash_remove,
+	.lookup		= nft_hash_lookup,
+	.walk		= nft_hash_walk,
+	.features	= NFT_SET_MAP,
+	.owner		= THIS_MODULE,
+};
+
+static int __init nft_hash_module_init(void)
+{
+	return nft_register_set(&nft_hash_ops);
+}
+
+static void __exit nft_hash_module_exit(void)
+{
+	nft_unregister_set(&nft_hash_ops);
+}
+
+module_init(nft_hash_module_init);
+module_exit(nft_hash_module_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_NFT_SET();
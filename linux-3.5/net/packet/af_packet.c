@@ -218,6 +218,16 @@ struct pgv {
 	char *buffer;
 };
 
+/* TPACKET_V3 tx: a block goes back to user space once the kernel is
+ * done with it and every skb built from it has been freed.
+ */
+struct tpacket_tx_blk {
+	struct tpacket_block_desc	*desc;
+	atomic_t			refs;	/* skbs in flight, +1 while open */
+	unsigned int			num_pkts;
+	unsigned int			status;	/* reported when refs drops to 0 */
+};
+
 struct packet_ring_buffer {
 	struct pgv		*pg_vec;
 	unsigned int		head;
@@ -231,6 +241,11 @@ struct packet_ring_buffer {
 
 	struct tpacket_kbdq_core	prb_bdqc;
 	atomic_t		pending;
+
+	/* TPACKET_V3 tx: position inside the block at head */
+	struct tpacket_tx_blk	*tx_blk;
+	unsigned int		tx_blk_off;	/* next packet, 0 if not open */
+	unsigned int		tx_blk_pkt;	/* packets taken so far */
 };
 
 #define BLOCK_STATUS(x)	((x)->hdr.bh1.block_status)
@@ -284,7 +299,8 @@ struct packet_sock {
 	unsigned int		running:1,	/* prot_hook is attached*/
 				auxdata:1,
 				origdev:1,
-				has_vnet_hdr:1;
+				has_vnet_hdr:1,
+				qdisc_bypass:1;	/* xmit straight to the driver */
 	int			ifindex;	/* bound device		*/
 	__be16			num;
 	struct packet_mclist	*mclist;
@@ -308,6 +324,7 @@ struct packet_fanout {
 	u8			type;
 	u8			defrag;
 	atomic_t		rr_cur;
+	struct sk_filter __rcu	*bpf_prog;	/* PACKET_FANOUT_[CE]BPF */
 	struct list_head	list;
 	struct sock		*arr[PACKET_FANOUT_MAX];
 	spinlock_t		lock;
@@ -452,6 +469,21 @@ static int __packet_get_status(struct packet_sock *po, void *frame)
 	}
 }
 
+static void __packet_set_block_status(struct tpacket_block_desc *pbd,
+				      int status)
+{
+	BLOCK_STATUS(pbd) = status;
+	flush_dcache_page(pgv_to_page(&BLOCK_STATUS(pbd)));
+	smp_wmb();
+}
+
+static int __packet_get_block_status(struct tpacket_block_desc *pbd)
+{
+	smp_rmb();
+	flush_dcache_page(pgv_to_page(&BLOCK_STATUS(pbd)));
+	return BLOCK_STATUS(pbd);
+}
+
 static void *packet_lookup_frame(struct packet_sock *po,
 		struct packet_ring_buffer *rb,
 		unsigned int position,
@@ -1212,6 +1244,20 @@ static struct sock *fanout_demux_cpu(struct packet_fanout *f, struct sk_buff *sk
 	return f->arr[cpu % num];
 }
 
+static struct sock *fanout_demux_bpf(struct packet_fanout *f, struct sk_buff *skb, unsigned int num)
+{
+	struct sk_filter *prog;
+	unsigned int idx = 0;
+
+	rcu_read_lock();
+	prog = rcu_dereference(f->bpf_prog);
+	if (prog)
+		idx = SK_RUN_FILTER(prog, skb) % num;
+	rcu_read_unlock();
+
+	return f->arr[idx];
+}
+
 static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
 			     struct packet_type *pt, struct net_device *orig_dev)
 {
@@ -1243,6 +1289,10 @@ static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
 	case PACKET_FANOUT_CPU:
 		sk = fanout_demux_cpu(f, skb, num);
 		break;
+	case PACKET_FANOUT_CBPF:
+	case PACKET_FANOUT_EBPF:
+		sk = fanout_demux_bpf(f, skb, num);
+		break;
 	}
 
 	po = pkt_sk(sk);
@@ -1292,6 +1342,8 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 	case PACKET_FANOUT_HASH:
 	case PACKET_FANOUT_LB:
 	case PACKET_FANOUT_CPU:
+	case PACKET_FANOUT_CBPF:
+	case PACKET_FANOUT_EBPF:
 		break;
 	default:
 		return -EINVAL;
@@ -1353,6 +1405,94 @@ out:
 	return err;
 }
 
+static void __fanout_set_data_bpf(struct packet_fanout *f,
+				  struct sk_filter *new)
+{
+	struct sk_filter *old;
+
+	spin_lock(&f->lock);
+	old = rcu_dereference_protected(f->bpf_prog, lockdep_is_held(&f->lock));
+	rcu_assign_pointer(f->bpf_prog, new);
+	spin_unlock(&f->lock);
+
+	/* released after a grace period, demux may still be running it */
+	if (old)
+		sk_filter_release(old);
+}
+
+static int fanout_set_data_cbpf(struct packet_fanout *f,
+				char __user *data, unsigned int len)
+{
+	struct sock_filter *insns;
+	struct sk_filter *new;
+	struct sock_fprog fprog;
+	int err;
+
+	if (len != sizeof(fprog))
+		return -EINVAL;
+	if (copy_from_user(&fprog, data, len))
+		return -EFAULT;
+	if (fprog.len == 0 || fprog.len > BPF_MAXINSNS)
+		return -EINVAL;
+
+	insns = memdup_user(fprog.filter, fprog.len * sizeof(*insns));
+	if (IS_ERR(insns))
+		return PTR_ERR(insns);
+
+	fprog.filter = insns;
+	err = sk_unattached_filter_create(&new, &fprog);
+	kfree(insns);
+	if (err)
+		return err;
+
+	__fanout_set_data_bpf(f, new);
+	return 0;
+}
+
+static int fanout_set_data_ebpf(struct packet_fanout *f,
+				char __user *data, unsigned int len)
+{
+	struct sk_filter *new;
+	u32 fd;
+
+	if (len != sizeof(fd))
+		return -EINVAL;
+	if (copy_from_user(&fd, data, len))
+		return -EFAULT;
+
+	new = bpf_prog_get(fd);
+	if (IS_ERR(new))
+		return PTR_ERR(new);
+	if (new->aux->prog_type != BPF_PROG_TYPE_SOCKET_FILTER) {
+		sk_filter_release(new);
+		return -EINVAL;
+	}
+
+	__fanout_set_data_bpf(f, new);
+	return 0;
+}
+
+/* Install the steering program of a PACKET_FANOUT_[CE]BPF group: its
+ * return value modulo the number of members picks the socket.
+ */
+static int fanout_set_data(struct packet_sock *po,
+			   char __user *data, unsigned int len)
+{
+	struct packet_fanout *f = po->fanout;
+
+	if (!f)
+		return -EINVAL;
+
+	switch (f->type) {
+	case PACKET_FANOUT_CBPF:
+		return fanout_set_data_cbpf(f, data, len);
+	case PACKET_FANOUT_EBPF:
+		return fanout_set_data_ebpf(f, data, len);
+	default:
+		return -EINVAL;
+	}
+}
+
 static void fanout_release(struct sock *sk)
 {
 	struct packet_sock *po = pkt_sk(sk);
@@ -1368,6 +1508,7 @@ static void fanout_release(struct sock *sk)
 	if (atomic_dec_and_test(&f->sk_ref)) {
 		list_del(&f->list);
 		dev_remove_pack(&f->prot_hook);
+		__fanout_set_data_bpf(f, NULL);
 		kfree(f);
 	}
 	mutex_unlock(&fanout_mutex);
@@ -1936,6 +2077,156 @@ ring_is_full:
 	goto drop_n_restore;
 }
 
+/*
+ * TPACKET_V3 transmits whole blocks.  User space fills a block with
+ * packets chained by tp_next_offset, sets num_pkts and
+ * offset_to_first_pkt and hands it over with TP_STATUS_SEND_REQUEST.
+ * The block stays TP_STATUS_SENDING until all of its packets have left
+ * and then becomes TP_STATUS_AVAILABLE, or TP_STATUS_WRONG_FORMAT if
+ * sending stopped at a malformed packet.
+ */
+static void tpacket_tx_blk_put(struct tpacket_tx_blk *blk)
+{
+	if (atomic_dec_and_test(&blk->refs))
+		__packet_set_block_status(blk->desc, blk->status);
+}
+
+static void tpacket_tx_close_block(struct packet_ring_buffer *rb)
+{
+	tpacket_tx_blk_put(&rb->tx_blk[rb->head]);
+	rb->tx_blk_off = 0;
+	rb->head = rb->head != rb->pg_vec_len - 1 ? rb->head + 1 : 0;
+}
+
+static void *tpacket_tx_frame_v3(struct packet_sock *po, int *room)
+{
+	struct packet_ring_buffer *rb = &po->tx_ring;
+	unsigned int blk_size = rb->pg_vec_pages << PAGE_SHIFT;
+	struct tpacket_tx_blk *blk;
+	unsigned int off;
+
+	for (;;) {
+		blk = &rb->tx_blk[rb->head];
+
+		if (!rb->tx_blk_off) {
+			if (__packet_get_block_status(blk->desc) !=
+			    TP_STATUS_SEND_REQUEST)
+				return NULL;
+
+			atomic_set(&blk->refs, 1);
+			blk->status = TP_STATUS_AVAILABLE;
+			blk->num_pkts = BLOCK_NUM_PKTS(blk->desc);
+			rb->tx_blk_off = BLOCK_O2FP(blk->desc);
+			rb->tx_blk_pkt = 0;
+			__packet_set_block_status(blk->desc, TP_STATUS_SENDING);
+
+			if (rb->tx_blk_off < sizeof(struct tpacket_block_desc))
+				blk->status = TP_STATUS_WRONG_FORMAT;
+			if (!blk->num_pkts ||
+			    blk->status == TP_STATUS_WRONG_FORMAT) {
+				tpacket_tx_close_block(rb);
+				continue;
+			}
+		}
+
+		off = rb->tx_blk_off;
+		if (likely(off < blk_size &&
+			   !(off & (TPACKET_ALIGNMENT - 1)) &&
+			   blk_size - off >= po->tp_hdrlen))
+			break;
+
+		blk->status = TP_STATUS_WRONG_FORMAT;
+		tpacket_tx_close_block(rb);
+	}
+
+	*room = blk_size - off;
+	return (char *)blk->desc + off;
+}
+
+static void tpacket_tx_advance_v3(struct packet_sock *po,
+				  struct tpacket3_hdr *ppd)
+{
+	struct packet_ring_buffer *rb = &po->tx_ring;
+	struct tpacket_tx_blk *blk = &rb->tx_blk[rb->head];
+	unsigned int next = ACCESS_ONCE(ppd->tp_next_offset);
+
+	if (++rb->tx_blk_pkt == blk->num_pkts) {
+		tpacket_tx_close_block(rb);
+		return;
+	}
+
+	if (unlikely(!next || next >= rb->pg_vec_pages << PAGE_SHIFT)) {
+		blk->status = TP_STATUS_WRONG_FORMAT;
+		tpacket_tx_close_block(rb);
+		return;
+	}
+	rb->tx_blk_off += next;
+}
+
+/* Next frame user space asked us to send, and the room it may use */
+static void *tpacket_tx_frame(struct packet_sock *po, int *room)
+{
+	if (po->tp_version == TPACKET_V3)
+		return tpacket_tx_frame_v3(po, room);
+
+	*room = po->tx_ring.frame_size;
+	return packet_current_frame(po, &po->tx_ring, TP_STATUS_SEND_REQUEST);
+}
+
+static void tpacket_tx_advance(struct packet_sock *po, void *ph)
+{
+	if (po->tp_version == TPACKET_V3)
+		tpacket_tx_advance_v3(po, ph);
+	else
+		packet_increment_head(&po->tx_ring);
+}
+
+/* @skb now carries frame @ph */
+static void tpacket_tx_sending(struct packet_sock *po, struct sk_buff *skb,
+			       void *ph)
+{
+	struct packet_ring_buffer *rb = &po->tx_ring;
+
+	if (po->tp_version == TPACKET_V3) {
+		struct tpacket_tx_blk *blk = &rb->tx_blk[rb->head];
+
+		atomic_inc(&blk->refs);
+		skb_shinfo(skb)->destructor_arg = blk;
+	} else {
+		__packet_set_status(po, ph, TP_STATUS_SENDING);
+	}
+	atomic_inc(&rb->pending);
+}
+
+/* Give frame @ph back to user space unsent */
+static void tpacket_tx_status(struct packet_sock *po, void *ph, int status)
+{
+	struct packet_ring_buffer *rb = &po->tx_ring;
+
+	if (po->tp_version != TPACKET_V3) {
+		__packet_set_status(po, ph, status);
+		return;
+	}
+
+	/* V3 only reports per block, a malformed packet ends it */
+	if (status == TP_STATUS_WRONG_FORMAT) {
+		rb->tx_blk[rb->head].status = status;
+		tpacket_tx_close_block(rb);
+	}
+}
+
+static bool tpacket_tx_writable(struct packet_sock *po)
+{
+	struct packet_ring_buffer *rb = &po->tx_ring;
+
+	if (po->tp_version == TPACKET_V3)
+		return !rb->tx_blk_off &&
+		       __packet_get_block_status(rb->tx_blk[rb->head].desc) ==
+		       TP_STATUS_AVAILABLE;
+
+	return packet_current_frame(po, rb, TP_STATUS_AVAILABLE) != NULL;
+}
+
 static void tpacket_destruct_skb(struct sk_buff *skb)
 {
 	struct packet_sock *po = pkt_sk(skb->sk);
@@ -1943,10 +2234,14 @@ static void tpacket_destruct_skb(struct sk_buff *skb)
 
 	if (likely(po->tx_ring.pg_vec)) {
 		ph = skb_shinfo(skb)->destructor_arg;
-		BUG_ON(__packet_get_status(po, ph) != TP_STATUS_SENDING);
 		BUG_ON(atomic_read(&po->tx_ring.pending) == 0);
 		atomic_dec(&po->tx_ring.pending);
-		__packet_set_status(po, ph, TP_STATUS_AVAILABLE);
+		if (po->tp_version == TPACKET_V3) {
+			tpacket_tx_blk_put(ph);
+		} else {
+			BUG_ON(__packet_get_status(po, ph) != TP_STATUS_SENDING);
+			__packet_set_status(po, ph, TP_STATUS_AVAILABLE);
+		}
 	}
 
 	sock_wfree(skb);
@@ -1959,6 +2254,7 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 	union {
 		struct tpacket_hdr *h1;
 		struct tpacket2_hdr *h2;
+		struct tpacket3_hdr *h3;
 		void *raw;
 	} ph;
 	int to_write, offset, len, tp_len, nr_frags, len_max;
@@ -1976,6 +2272,9 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 	skb_shinfo(skb)->destructor_arg = ph.raw;
 
 	switch (po->tp_version) {
+	case TPACKET_V3:
+		tp_len = ph.h3->tp_len;
+		break;
 	case TPACKET_V2:
 		tp_len = ph.h2->tp_len;
 		break;
@@ -2050,20 +2349,115 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 	return tp_len;
 }
 
+/*
+ * PACKET_QDISC_BYPASS sends @skb to the driver without going through the
+ * qdisc or the taps.  Do in software what the device can't.  Returns 0 if
+ * @skb can go straight to the driver, 1 if it must be segmented by
+ * dev_queue_xmit(), or an error after freeing it.
+ */
+static int packet_direct_prepare(struct sk_buff *skb)
+{
+	struct net_device *dev = skb->dev;
+	netdev_features_t features;
+
+	if (unlikely(!netif_running(dev) || !netif_carrier_ok(dev)))
+		goto drop;
+
+	features = netif_skb_features(skb);
+	if (unlikely(netif_needs_gso(skb, features)))
+		return 1;
+	if (skb_needs_linearize(skb, features) && __skb_linearize(skb))
+		goto drop;
+	if (skb->ip_summed == CHECKSUM_PARTIAL &&
+	    !(features & NETIF_F_ALL_CSUM) && skb_checksum_help(skb))
+		goto drop;
+	return 0;
+
+drop:
+	kfree_skb(skb);
+	return -ENETDOWN;
+}
+
+/*
+ * Hand a prepared @skb to the driver on tx queue @queue.  Like a full
+ * device queue, a stopped one drops the packet.  @more is passed down as
+ * skb->xmit_more: the caller must send the next frame to the same queue,
+ * which is why a batch keeps the queue it started on.
+ */
+static int __packet_direct_xmit(struct sk_buff *skb, u16 queue, bool more)
+{
+	struct net_device *dev = skb->dev;
+	struct netdev_queue *txq;
+	int ret = NETDEV_TX_BUSY;
+
+	if (unlikely(queue >= dev->real_num_tx_queues))
+		queue = 0;
+	skb_set_queue_mapping(skb, queue);
+	txq = netdev_get_tx_queue(dev, queue);
+
+	local_bh_disable();
+	HARD_TX_LOCK(dev, txq, smp_processor_id());
+	if (!netif_xmit_frozen_or_stopped(txq)) {
+		ret = netdev_start_xmit(skb, dev, more);
+		if (dev_xmit_complete(ret))
+			txq_trans_update(txq);
+	}
+	HARD_TX_UNLOCK(dev, txq);
+	local_bh_enable();
+
+	if (likely(dev_xmit_complete(ret)))
+		return ret;
+	kfree_skb(skb);
+	return NET_XMIT_DROP;
+}
+
+/* Tx queue for the frames of one send(), picked by the current cpu */
+static u16 packet_pick_tx_queue(struct net_device *dev)
+{
+	return raw_smp_processor_id() % dev->real_num_tx_queues;
+}
+
+static int packet_direct_xmit(struct sk_buff *skb)
+{
+	int err = packet_direct_prepare(skb);
+
+	if (unlikely(err))
+		return err > 0 ? dev_queue_xmit(skb) : NET_XMIT_DROP;
+	return __packet_direct_xmit(skb, packet_pick_tx_queue(skb->dev),
+				    false);
+}
+
+/* Frames sent with PACKET_QDISC_BYPASS between two tx doorbells */
+#define TPACKET_TX_BATCH	32
+
+/* Bypass send of a tx ring frame; @len counts in @len_sum once queued */
+static int tpacket_direct_xmit(struct sk_buff *skb, u16 queue, bool more,
+			       int len, int *len_sum)
+{
+	int ret = __packet_direct_xmit(skb, queue, more);
+
+	if (ret == NET_XMIT_SUCCESS || ret == NET_XMIT_CN)
+		*len_sum += len;
+	return ret;
+}
+
 static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 {
-	struct sk_buff *skb;
+	struct sk_buff *skb, *held = NULL;
 	struct net_device *dev;
 	__be16 proto;
 	bool need_rls_dev = false;
 	int err, reserve = 0;
 	void *ph;
 	struct sockaddr_ll *saddr = (struct sockaddr_ll *)msg->msg_name;
-	int tp_len, size_max;
+	int tp_len, size_max, room;
 	unsigned char *addr;
 	int len_sum = 0;
+	int held_len = 0;
 	int status = 0;
 	int hlen, tlen;
+	int batch = 0;
+	u16 queue;
 
 	mutex_lock(&po->pg_vec_lock);
 
@@ -2096,27 +2490,48 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 	if (unlikely(!(dev->flags & IFF_UP)))
 		goto out_put;
 
-	size_max = po->tx_ring.frame_size
-		- (po->tp_hdrlen - sizeof(struct sockaddr_ll));
-
-	if (size_max > dev->mtu + reserve)
-		size_max = dev->mtu + reserve;
+	/* Frames sent with xmit_more must be followed on the same queue,
+	 * so the whole send() sticks to one even if we migrate.
+	 */
+	queue = packet_pick_tx_queue(dev);
 
 	do {
-		ph = packet_current_frame(po, &po->tx_ring,
-				TP_STATUS_SEND_REQUEST);
+		ph = tpacket_tx_frame(po, &room);
 
 		if (unlikely(ph == NULL)) {
+			/* Nothing follows, ring the doorbell. */
+			if (held) {
+				err = tpacket_direct_xmit(held, queue, false,
+							  held_len, &len_sum);
+				held = NULL;
+				batch = 0;
+				if (err > 0 && (err = net_xmit_errno(err)) != 0)
+					goto out_put;
+			}
 			schedule();
 			continue;
 		}
 
+		size_max = room - (po->tp_hdrlen - sizeof(struct sockaddr_ll));
+		if (size_max > dev->mtu + reserve)
+			size_max = dev->mtu + reserve;
+
 		status = TP_STATUS_SEND_REQUEST;
 		hlen = LL_RESERVED_SPACE(dev);
 		tlen = dev->needed_tailroom;
 		skb = sock_alloc_send_skb(&po->sk,
 				hlen + tlen + sizeof(struct sockaddr_ll),
-				0, &err);
+				held != NULL, &err);
+		if (unlikely(skb == NULL) && held) {
+			/* Out of sndbuf: let the held frame go before waiting */
+			tpacket_direct_xmit(held, queue, false, held_len,
+					    &len_sum);
+			held = NULL;
+			batch = 0;
+			skb = sock_alloc_send_skb(&po->sk,
+					hlen + tlen + sizeof(struct sockaddr_ll),
+					0, &err);
+		}
 
 		if (unlikely(skb == NULL))
 			goto out_status;
@@ -2126,9 +2541,8 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 
 		if (unlikely(tp_len < 0)) {
 			if (po->tp_loss) {
-				__packet_set_status(po, ph,
-						TP_STATUS_AVAILABLE);
-				packet_increment_head(&po->tx_ring);
+				tpacket_tx_status(po, ph, TP_STATUS_AVAILABLE);
+				tpacket_tx_advance(po, ph);
 				kfree_skb(skb);
 				continue;
 			} else {
@@ -2139,15 +2553,55 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 		}
 
 		skb->destructor = tpacket_destruct_skb;
-		__packet_set_status(po, ph, TP_STATUS_SENDING);
-		atomic_inc(&po->tx_ring.pending);
+		tpacket_tx_sending(po, skb, ph);
 
 		status = TP_STATUS_SEND_REQUEST;
+		if (po->qdisc_bypass) {
+			/*
+			 * Hold each skb back until the next one is built and
+			 * known to reach the driver, so that the driver is
+			 * told another frame follows.
+			 */
+			tpacket_tx_advance(po, ph);
+
+			err = packet_direct_prepare(skb);
+			if (unlikely(err)) {
+				/* dropped: the frame went back to the ring */
+				if (err < 0)
+					continue;
+				if (held) {
+					tpacket_direct_xmit(held, queue, false,
+							    held_len, &len_sum);
+					held = NULL;
+					batch = 0;
+				}
+				err = dev_queue_xmit(skb);
+				if (err > 0 && (err = net_xmit_errno(err)) != 0)
+					goto out_put;
+				if (!err)
+					len_sum += tp_len;
+				continue;
+			}
+
+			swap(held, skb);
+			swap(held_len, tp_len);
+			if (!skb)
+				continue;
+
+			if (++batch == TPACKET_TX_BATCH)
+				batch = 0;
+			err = tpacket_direct_xmit(skb, queue, batch != 0,
+						  tp_len, &len_sum);
+			if (err > 0 && (err = net_xmit_errno(err)) != 0)
+				goto out_put;
+			continue;
+		}
+
 		err = dev_queue_xmit(skb);
 		if (unlikely(err > 0)) {
 			err = net_xmit_errno(err);
-			if (err && __packet_get_status(po, ph) ==
-				   TP_STATUS_AVAILABLE) {
+			if (err && po->tp_version != TPACKET_V3 &&
+			    __packet_get_status(po, ph) == TP_STATUS_AVAILABLE) {
 				/* skb was destructed already */
 				skb = NULL;
 				goto out_status;
@@ -2158,7 +2612,7 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 			 */
 			err = 0;
 		}
-		packet_increment_head(&po->tx_ring);
+		tpacket_tx_advance(po, ph);
 		len_sum += tp_len;
 	} while (likely((ph != NULL) ||
 			((!(msg->msg_flags & MSG_DONTWAIT)) &&
@@ -2169,9 +2623,11 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
 	goto out_put;
 
 out_status:
-	__packet_set_status(po, ph, status);
+	tpacket_tx_status(po, ph, status);
 	kfree_skb(skb);
 out_put:
+	if (held)
+		__packet_direct_xmit(held, queue, false);
 	if (need_rls_dev)
 		dev_put(dev);
 out:
@@ -2380,7 +2836,10 @@ static int packet_snd(struct socket *sock,
 	 *	Now send it
 	 */
 
-	err = dev_queue_xmit(skb);
+	if (po->qdisc_bypass)
+		err = packet_direct_xmit(skb);
+	else
+		err = dev_queue_xmit(skb);
 	if (err > 0 && (err = net_xmit_errno(err)) != 0)
 		goto out_unlock;
 
@@ -3215,6 +3674,20 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 
 		return fanout_add(sk, val & 0xffff, val >> 16);
 	}
+	case PACKET_FANOUT_DATA:
+		return fanout_set_data(po, optval, optlen);
+	case PACKET_QDISC_BYPASS:
+	{
+		int val;
+
+		if (optlen != sizeof(val))
+			return -EINVAL;
+		if (copy_from_user(&val, optval, sizeof(val)))
+			return -EFAULT;
+
+		po->qdisc_bypass = !!val;
+		return 0;
+	}
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -3306,6 +3779,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 			((u32)po->fanout->type << 16)) :
 		       0);
 		break;
+	case PACKET_QDISC_BYPASS:
+		val = po->qdisc_bypass;
+		break;
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -3439,7 +3915,7 @@ static unsigned int packet_poll(struct file *file, struct socket *sock,
 	spin_unlock_bh(&sk->sk_receive_queue.lock);
 	spin_lock_bh(&sk->sk_write_queue.lock);
 	if (po->tx_ring.pg_vec) {
-		if (packet_current_frame(po, &po->tx_ring, TP_STATUS_AVAILABLE))
+		if (tpacket_tx_writable(po))
 			mask |= POLLOUT | POLLWRNORM;
 	}
 	spin_unlock_bh(&sk->sk_write_queue.lock);
@@ -3556,6 +4032,7 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring)
 {
 	struct pgv *pg_vec = NULL;
+	struct tpacket_tx_blk *tx_blk = NULL;
 	struct packet_sock *po = pkt_sk(sk);
 	int was_running, order = 0;
 	struct packet_ring_buffer *rb;
@@ -3564,12 +4041,7 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 	int err = -EINVAL;
 	/* Added to avoid minimal code churn */
 	struct tpacket_req *req = &req_u->req;
-
-	/* Opening a Tx-ring is NOT supported in TPACKET_V3 */
-	if (!closing && tx_ring && (po->tp_version > TPACKET_V2)) {
-		WARN(1, "Tx-ring is not supported.\n");
-		goto out;
-	}
+	int i;
 
 	rb = tx_ring ? &po->tx_ring : &po->rx_ring;
 	rb_queue = tx_ring ? &sk->sk_write_queue : &sk->sk_receive_queue;
@@ -3625,12 +4097,18 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 			goto out;
 		switch (po->tp_version) {
 		case TPACKET_V3:
-		/* Transmit path is not supported. We checked
-		 * it above but just being paranoid
-		 */
-			if (!tx_ring)
+			if (!tx_ring) {
 				init_prb_bdqc(po, rb, pg_vec, req_u, tx_ring);
 				break;
+			}
+			tx_blk = kcalloc(req->tp_block_nr, sizeof(*tx_blk),
+					 GFP_KERNEL);
+			if (unlikely(!tx_blk))
+				goto out_free_pg_vec;
+			for (i = 0; i < req->tp_block_nr; i++)
+				tx_blk[i].desc = (struct tpacket_block_desc *)
+						 pg_vec[i].buffer;
+			break;
 		default:
 			break;
 		}
@@ -3662,9 +4140,11 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		err = 0;
 		spin_lock_bh(&rb_queue->lock);
 		swap(rb->pg_vec, pg_vec);
+		swap(rb->tx_blk, tx_blk);
 		rb->frame_max = (req->tp_frame_nr - 1);
 		rb->head = 0;
 		rb->frame_size = req->tp_frame_size;
+		rb->tx_blk_off = 0;
 		spin_unlock_bh(&rb_queue->lock);
 
 		swap(rb->pg_vec_order, order);
@@ -3687,12 +4167,14 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 	}
 	spin_unlock(&po->bind_lock);
 	if (closing && (po->tp_version > TPACKET_V2)) {
-		/* Because we don't support block-based V3 on tx-ring */
+		/* The tx-ring has no block retire timer */
 		if (!tx_ring)
 			prb_shutdown_retire_blk_timer(po, tx_ring, rb_queue);
 	}
 	release_sock(sk);
 
+	kfree(tx_blk);
+out_free_pg_vec:
 	if (pg_vec)
 		free_pg_vec(pg_vec, order, req->tp_block_nr);
 out:
@@ -25,6 +25,7 @@
 #include <linux/rcupdate.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <net/pkt_sched.h>
 #include <net/dst.h>
 
@@ -39,40 +40,109 @@
  * - updates to tree and tree walking are only done under the rtnl mutex.
  */
 
-static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
+/* Put back an skb the driver did not take, along with the rest of its
+ * bulk that was not tried yet.  Both go out before anything still queued.
+ */
+static inline int dev_requeue_skb(struct sk_buff *skb,
+				  struct sk_buff_head *bulk,
+				  struct Qdisc *q)
 {
+	struct sk_buff *nskb;
+
 	skb_dst_force(skb);
 	q->gso_skb = skb;
-	q->qstats.requeues++;
-	q->q.qlen++;	/* it's still part of the queue */
+	qdisc_qstats_requeue(q);
+	qdisc_qlen_inc(q);	/* it's still part of the queue */
+
+	while (bulk && (nskb = __skb_dequeue_tail(bulk)) != NULL) {
+		__skb_queue_head(&q->requeue, nskb);
+		qdisc_qlen_inc(q);
+	}
 	__netif_schedule(q);
 
 	return 0;
 }
 
-static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
+static inline struct sk_buff *dequeue_one(struct Qdisc *q)
+{
+	/* q->requeue is only tested through its qlen: it is left
+	 * uninitialized in the builtin qdiscs, which never requeue.
+	 */
+	if (unlikely(skb_queue_len(&q->requeue))) {
+		qdisc_qlen_dec(q);
+		return __skb_dequeue(&q->requeue);
+	}
+	return q->dequeue(q);
+}
+
+/*
+ * Dequeue more skbs for the same txq, as long as BQL lets the device
+ * take them, so that they can all be sent under one HARD_TX_LOCK.
+ */
+static void try_bulk_dequeue_skb(struct Qdisc *q, struct sk_buff *skb,
+				 const struct netdev_queue *txq,
+				 struct sk_buff_head *bulk, int *packets)
+{
+	int bytelimit = qdisc_avail_bulklimit(txq) - skb->len;
+
+	while (bytelimit > 0) {
+		struct sk_buff *nskb = dequeue_one(q);
+
+		if (!nskb)
+			break;
+
+		bytelimit -= nskb->len; /* covers GSO len */
+		__skb_queue_tail(bulk, nskb);
+		(*packets)++; /* GSO counts as one pkt */
+	}
+}
+
+/* Note that dequeue_skb can possibly return a bulk of skbs: the first one
+ * is returned, the others are queued on @bulk.
+ */
+static inline struct sk_buff *dequeue_skb(struct Qdisc *q,
+					  struct sk_buff_head *bulk,
+					  int *packets)
 {
+	const struct netdev_queue *txq = q->dev_queue;
 	struct sk_buff *skb = q->gso_skb;
 
+	*packets = 1;
 	if (unlikely(skb)) {
-		struct net_device *dev = qdisc_dev(q);
-		struct netdev_queue *txq;
-
 		/* check the reason of requeuing without tx lock first */
-		txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
+		txq = netdev_get_tx_queue(txq->dev, skb_get_queue_mapping(skb));
 		if (!netif_xmit_frozen_or_stopped(txq)) {
 			q->gso_skb = NULL;
-			q->q.qlen--;
+			qdisc_qlen_dec(q);
 		} else
 			skb = NULL;
-	} else {
-		skb = q->dequeue(q);
+		/* skb may be the head of a partially sent GSO list */
+		return skb;
 	}
 
+	if (!qdisc_may_bulk(q))
+		return q->dequeue(q);
+
+	if (netif_xmit_frozen_or_stopped(txq))
+		return NULL;
+
+	skb = dequeue_one(q);
+	if (skb)
+		try_bulk_dequeue_skb(q, skb, txq, bulk, packets);
+
 	return skb;
 }
 
+/* Lockless qdiscs do not keep a global queue length: report "maybe more"
+ * and let the next dequeue find out.
+ */
+static inline int qdisc_restart_qlen(const struct Qdisc *q)
+{
+	return (q->flags & TCQ_F_NOLOCK) ? 1 : qdisc_qlen(q);
+}
+
 static inline int handle_dev_cpu_collision(struct sk_buff *skb,
+					   struct sk_buff_head *bulk,
 					   struct netdev_queue *dev_queue,
 					   struct Qdisc *q)
 {
@@ -86,25 +156,30 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 		 * deadloop is detected. Return OK to try the next skb.
 		 */
 		kfree_skb(skb);
+		if (bulk)
+			__skb_queue_purge(bulk);
 		net_warn_ratelimited("Dead loop on netdevice %s, fix it urgently!\n",
 				     dev_queue->dev->name);
-		ret = qdisc_qlen(q);
+		ret = qdisc_restart_qlen(q);
 	} else {
 		/*
 		 * Another cpu is holding lock, requeue & delay xmits for
 		 * some time.
 		 */
 		__this_cpu_inc(softnet_data.cpu_collision);
-		ret = dev_requeue_skb(skb, q);
+		ret = dev_requeue_skb(skb, bulk, q);
 	}
 
 	return ret;
 }
 
 /*
- * Transmit one skb, and handle the return status as required. Holding the
- * __QDISC_STATE_RUNNING bit guarantees that only one CPU can execute this
- * function.
+ * Transmit possibly several skbs, and handle the return status as
+ * required. Holding the __QDISC___STATE_RUNNING bit guarantees that
+ * only one CPU can execute this function.
+ *
+ * @skb is sent first, then the skbs of @bulk (may be NULL), all under a
+ * single HARD_TX_LOCK.  @root_lock is NULL for TCQ_F_NOLOCK qdiscs.
  *
  * Returns to the caller:
  *				0  - queue is empty or throttled.
@@ -112,34 +187,43 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
  */
 int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 		    struct net_device *dev, struct netdev_queue *txq,
-		    spinlock_t *root_lock)
+		    spinlock_t *root_lock, struct sk_buff_head *bulk)
 {
 	int ret = NETDEV_TX_BUSY;
 
 	/* And release qdisc */
-	spin_unlock(root_lock);
+	if (root_lock)
+		spin_unlock(root_lock);
 
 	HARD_TX_LOCK(dev, txq, smp_processor_id());
-	if (!netif_xmit_frozen_or_stopped(txq))
-		ret = dev_hard_start_xmit(skb, dev, txq);
-
+	while (!netif_xmit_frozen_or_stopped(txq)) {
+		ret = dev_hard_start_xmit(skb, dev, txq,
+					  bulk && !skb_queue_empty(bulk));
+		if (!dev_xmit_complete(ret))
+			break;
+		skb = bulk ? __skb_dequeue(bulk) : NULL;
+		if (!skb)
+			break;
+		ret = NETDEV_TX_BUSY;
+	}
 	HARD_TX_UNLOCK(dev, txq);
 
-	spin_lock(root_lock);
+	if (root_lock)
+		spin_lock(root_lock);
 
 	if (dev_xmit_complete(ret)) {
-		/* Driver sent out skb successfully or skb was consumed */
-		ret = qdisc_qlen(q);
+		/* Driver sent out all skbs successfully or they were consumed */
+		ret = qdisc_restart_qlen(q);
 	} else if (ret == NETDEV_TX_LOCKED) {
 		/* Driver try lock failed */
-		ret = handle_dev_cpu_collision(skb, txq, q);
+		ret = handle_dev_cpu_collision(skb, bulk, txq, q);
 	} else {
 		/* Driver returned NETDEV_TX_BUSY - requeue skb */
 		if (unlikely(ret != NETDEV_TX_BUSY))
 			net_warn_ratelimited("BUG %s code %d qlen %d\n",
 					     dev->name, ret, q->q.qlen);
 
-		ret = dev_requeue_skb(skb, q);
+		ret = dev_requeue_skb(skb, bulk, q);
 	}
 
 	if (ret && netif_xmit_frozen_or_stopped(txq))
@@ -149,7 +233,8 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 }
 
 /*
- * NOTE: Called under qdisc_lock(q) with locally disabled BH.
+ * NOTE: Called under qdisc_lock(q) with locally disabled BH, unless the
+ * qdisc is TCQ_F_NOLOCK.
  *
  * __QDISC_STATE_RUNNING guarantees only one CPU can process
  * this qdisc at a time. qdisc_lock(q) serializes queue accesses for
@@ -167,36 +252,41 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
  *				>0 - queue is not empty.
  *
  */
-static inline int qdisc_restart(struct Qdisc *q)
+static inline int qdisc_restart(struct Qdisc *q, int *packets)
 {
+	struct sk_buff_head bulk;
 	struct netdev_queue *txq;
 	struct net_device *dev;
 	spinlock_t *root_lock;
 	struct sk_buff *skb;
 
+	__skb_queue_head_init(&bulk);
+
 	/* Dequeue packet */
-	skb = dequeue_skb(q);
+	skb = dequeue_skb(q, &bulk, packets);
 	if (unlikely(!skb))
 		return 0;
 	WARN_ON_ONCE(skb_dst_is_noref(skb));
-	root_lock = qdisc_lock(q);
+	root_lock = (q->flags & TCQ_F_NOLOCK) ? NULL : qdisc_lock(q);
 	dev = qdisc_dev(q);
 	txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
 
-	return sch_direct_xmit(skb, q, dev, txq, root_lock);
+	return sch_direct_xmit(skb, q, dev, txq, root_lock, &bulk);
 }
 
 void __qdisc_run(struct Qdisc *q)
 {
 	int quota = weight_p;
+	int packets;
 
-	while (qdisc_restart(q)) {
+	while (qdisc_restart(q, &packets)) {
 		/*
 		 * Ordered by possible occurrence: Postpone processing if
 		 * 1. we've exceeded packet quota
 		 * 2. another process needs the CPU;
 		 */
-		if (--quota <= 0 || need_resched()) {
+		quota -= packets;
+		if (quota <= 0 || need_resched()) {
 			__netif_schedule(q);
 			break;
 		}
@@ -417,91 +507,144 @@ static const u8 prio2band[TC_PRIO_MAX + 1] = {
 
 /* 3-band FIFO queue: old style, but should be a bit faster than
    generic prio+fifo combination.
+
+   pfifo_fast is TCQ_F_NOLOCK: each band is a fixed size ring of skb
+   pointers, where producers serialize on a per band spinlock and the
+   single consumer is whoever owns __QDISC_STATE_RUNNING.  A NULL slot
+   is free, so producer and consumer never share an index.
  */
 
 #define PFIFO_FAST_BANDS 3
 
+struct pfifo_fast_ring {
+	spinlock_t		producer_lock;
+	unsigned int		producer;
+	unsigned int		size;
+	struct sk_buff		**queue;
+
+	unsigned int		consumer ____cacheline_aligned_in_smp;
+};
+
 /*
  * Private data for a pfifo_fast scheduler containing:
- * 	- queues for the three band
- * 	- bitmap indicating which of the bands contain skbs
+ * 	- rings for the three bands
  */
 struct pfifo_fast_priv {
-	u32 bitmap;
-	struct sk_buff_head q[PFIFO_FAST_BANDS];
+	struct pfifo_fast_ring band[PFIFO_FAST_BANDS];
 };
 
-/*
- * Convert a bitmap to the first band number where an skb is queued, where:
- * 	bitmap=0 means there are no skbs on any band.
- * 	bitmap=1 means there is an skb on band 0.
- *	bitmap=7 means there are skbs on all 3 bands, etc.
- */
-static const int bitmap2band[] = {-1, 0, 1, 0, 2, 0, 1, 0};
+static int pfifo_fast_ring_produce(struct pfifo_fast_ring *r,
+				   struct sk_buff *skb)
+{
+	int err = -ENOSPC;
 
-static inline struct sk_buff_head *band2list(struct pfifo_fast_priv *priv,
-					     int band)
+	spin_lock(&r->producer_lock);
+	if (likely(!r->queue[r->producer])) {
+		/* Make sure the skb is fully written before it can be
+		 * seen by the consumer.
+		 */
+		smp_wmb();
+		r->queue[r->producer] = skb;
+		if (unlikely(++r->producer >= r->size))
+			r->producer = 0;
+		err = 0;
+	}
+	spin_unlock(&r->producer_lock);
+
+	return err;
+}
+
+static struct sk_buff *pfifo_fast_ring_peek(const struct pfifo_fast_ring *r)
 {
-	return priv->q + band;
+	return ACCESS_ONCE(r->queue[r->consumer]);
+}
+
+static struct sk_buff *pfifo_fast_ring_consume(struct pfifo_fast_ring *r)
+{
+	struct sk_buff *skb = pfifo_fast_ring_peek(r);
+
+	if (skb) {
+		smp_read_barrier_depends();
+		r->queue[r->consumer] = NULL;
+		if (unlikely(++r->consumer >= r->size))
+			r->consumer = 0;
+	}
+	return skb;
 }
 
 static int pfifo_fast_enqueue(struct sk_buff *skb, struct Qdisc *qdisc)
 {
-	if (skb_queue_len(&qdisc->q) < qdisc_dev(qdisc)->tx_queue_len) {
-		int band = prio2band[skb->priority & TC_PRIO_MAX];
-		struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
-		struct sk_buff_head *list = band2list(priv, band);
+	int band = prio2band[skb->priority & TC_PRIO_MAX];
+	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
+	unsigned int pkt_len = qdisc_pkt_len(skb);
 
-		priv->bitmap |= (1 << band);
-		qdisc->q.qlen++;
-		return __qdisc_enqueue_tail(skb, qdisc, list);
+	/* skb may be dequeued and freed as soon as it is in the ring */
+	if (unlikely(pfifo_fast_ring_produce(&priv->band[band], skb))) {
+		qdisc_qstats_drop(qdisc);
+		kfree_skb(skb);
+		return NET_XMIT_DROP;
 	}
 
-	return qdisc_drop(skb, qdisc);
+	qdisc_qstats_backlog_inc(qdisc, pkt_len);
+	qdisc_qlen_inc(qdisc);
+	return NET_XMIT_SUCCESS;
 }
 
 static struct sk_buff *pfifo_fast_dequeue(struct Qdisc *qdisc)
 {
 	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
-	int band = bitmap2band[priv->bitmap];
+	struct sk_buff *skb = NULL;
+	int band;
 
-	if (likely(band >= 0)) {
-		struct sk_buff_head *list = band2list(priv, band);
-		struct sk_buff *skb = __qdisc_dequeue_head(qdisc, list);
+	for (band = 0; band < PFIFO_FAST_BANDS && !skb; band++)
+		skb = pfifo_fast_ring_consume(&priv->band[band]);
 
-		qdisc->q.qlen--;
-		if (skb_queue_empty(list))
-			priv->bitmap &= ~(1 << band);
-
-		return skb;
+	if (likely(skb)) {
+		qdisc_qstats_backlog_dec(qdisc, qdisc_pkt_len(skb));
+		qdisc_bstats_update(qdisc, skb);
+		qdisc_qlen_dec(qdisc);
 	}
 
-	return NULL;
+	return skb;
 }
 
 static struct sk_buff *pfifo_fast_peek(struct Qdisc *qdisc)
 {
 	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
-	int band = bitmap2band[priv->bitmap];
-
-	if (band >= 0) {
-		struct sk_buff_head *list = band2list(priv, band);
+	struct sk_buff *skb = NULL;
+	int band;
 
-		return skb_peek(list);
-	}
+	for (band = 0; band < PFIFO_FAST_BANDS && !skb; band++)
+		skb = pfifo_fast_ring_peek(&priv->band[band]);
 
-	return NULL;
+	return skb;
 }
 
+/* Caller makes sure no cpu is enqueueing or dequeueing anymore */
 static void pfifo_fast_reset(struct Qdisc *qdisc)
 {
-	int prio;
 	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
+	struct sk_buff *skb;
+	int band, cpu;
 
-	for (prio = 0; prio < PFIFO_FAST_BANDS; prio++)
-		__qdisc_reset_queue(qdisc, band2list(priv, prio));
+	for (band = 0; band < PFIFO_FAST_BANDS; band++) {
+		struct pfifo_fast_ring *r = &priv->band[band];
+
+		if (!r->queue)
+			continue;
+		while ((skb = pfifo_fast_ring_consume(r)) != NULL)
+			kfree_skb(skb);
+	}
 
-	priv->bitmap = 0;
+	if (qdisc->flags & TCQ_F_NOLOCK) {
+		for_each_possible_cpu(cpu) {
+			struct gnet_stats_queue *q;
+
+			q = per_cpu_ptr(qdisc->cpu_qstats, cpu);
+			q->backlog = 0;
+			q->qlen = 0;
+		}
+	}
 	qdisc->qstats.backlog = 0;
 	qdisc->q.qlen = 0;
 }
@@ -519,17 +662,53 @@ nla_put_failure:
 	return -1;
 }
 
+static void pfifo_fast_destroy(struct Qdisc *qdisc)
+{
+	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++) {
+		struct sk_buff **queue = priv->band[band].queue;
+
+		if (queue && is_vmalloc_addr(queue))
+			vfree(queue);
+		else
+			kfree(queue);
+		priv->band[band].queue = NULL;
+	}
+}
+
 static int pfifo_fast_init(struct Qdisc *qdisc, struct nlattr *opt)
 {
-	int prio;
+	unsigned int size = max_t(unsigned int,
+				  qdisc_dev(qdisc)->tx_queue_len, 1);
 	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++) {
+		struct pfifo_fast_ring *r = &priv->band[band];
+		size_t sz = size * sizeof(struct sk_buff *);
+
+		r->queue = kzalloc(sz, GFP_KERNEL | __GFP_NOWARN);
+		if (!r->queue)
+			r->queue = vzalloc(sz);
+		if (!r->queue)
+			goto nomem;
+		spin_lock_init(&r->producer_lock);
+		r->size = size;
+	}
 
-	for (prio = 0; prio < PFIFO_FAST_BANDS; prio++)
-		skb_queue_head_init(band2list(priv, prio));
+	qdisc->cpu_qstats = alloc_percpu(struct gnet_stats_queue);
+	if (!qdisc->cpu_qstats)
+		goto nomem;
 
 	/* Can by-pass the queue discipline */
-	qdisc->flags |= TCQ_F_CAN_BYPASS;
+	qdisc->flags |= TCQ_F_NOLOCK | TCQ_F_CAN_BYPASS;
 	return 0;
+
+nomem:
+	pfifo_fast_destroy(qdisc);
+	return -ENOMEM;
 }
 
 struct Qdisc_ops pfifo_fast_ops __read_mostly = {
@@ -540,11 +719,52 @@ struct Qdisc_ops pfifo_fast_ops __read_mostly = {
 	.peek		=	pfifo_fast_peek,
 	.init		=	pfifo_fast_init,
 	.reset		=	pfifo_fast_reset,
+	.destroy	=	pfifo_fast_destroy,
 	.dump		=	pfifo_fast_dump,
 	.owner		=	THIS_MODULE,
 };
 EXPORT_SYMBOL(pfifo_fast_ops);
 
+/* Bring q->q.qlen and q->qstats of a TCQ_F_NOLOCK qdisc up to date with
+ * its per-cpu counters, before they are reported.
+ */
+void qdisc_qstats_fold(struct Qdisc *q)
+{
+	struct gnet_stats_queue qstats = { 0 };
+	int cpu;
+
+	if (!(q->flags & TCQ_F_NOLOCK))
+		return;
+
+	for_each_possible_cpu(cpu) {
+		const struct gnet_stats_queue *qcpu;
+
+		qcpu = per_cpu_ptr(q->cpu_qstats, cpu);
+		qstats.qlen += qcpu->qlen;
+		qstats.backlog += qcpu->backlog;
+		qstats.drops += qcpu->drops;
+		qstats.requeues += qcpu->requeues;
+		qstats.overlimits += qcpu->overlimits;
+	}
+	q->q.qlen = qstats.qlen;
+	q->qstats.backlog = qstats.backlog;
+	q->qstats.drops = qstats.drops;
+	q->qstats.requeues = qstats.requeues;
+	q->qstats.overlimits = qstats.overlimits;
+}
+EXPORT_SYMBOL(qdisc_qstats_fold);
+
+/* A TCQ_F_NOLOCK qdisc grafted below a classful qdisc runs under its
+ * parent's lock, and the parent reads its child's q.qlen directly.
+ * Must be called before the qdisc is in use.
+ */
+void qdisc_clear_nolock(struct Qdisc *q)
+{
+	qdisc_qstats_fold(q);
+	q->flags &= ~TCQ_F_NOLOCK;
+}
+EXPORT_SYMBOL(qdisc_clear_nolock);
+
 struct Qdisc *qdisc_alloc(struct netdev_queue *dev_queue,
 			  struct Qdisc_ops *ops)
 {
@@ -571,6 +791,7 @@ struct Qdisc *qdisc_alloc(struct netdev_queue *dev_queue,
 	}
 	INIT_LIST_HEAD(&sch->list);
 	skb_queue_head_init(&sch->q);
+	skb_queue_head_init(&sch->requeue);
 	spin_lock_init(&sch->busylock);
 	sch->ops = ops;
 	sch->enqueue = ops->enqueue;
@@ -617,6 +838,10 @@ void qdisc_reset(struct Qdisc *qdisc)
 		qdisc->gso_skb = NULL;
 		qdisc->q.qlen = 0;
 	}
+	if (skb_queue_len(&qdisc->requeue)) {
+		__skb_queue_purge(&qdisc->requeue);
+		qdisc->q.qlen = 0;
+	}
 }
 EXPORT_SYMBOL(qdisc_reset);
 
@@ -624,6 +849,7 @@ static void qdisc_rcu_free(struct rcu_head *head)
 {
 	struct Qdisc *qdisc = container_of(head, struct Qdisc, rcu_head);
 
+	free_percpu(qdisc->cpu_qstats);
 	kfree((char *) qdisc - qdisc->padded);
 }
 
@@ -650,6 +876,7 @@ void qdisc_destroy(struct Qdisc *qdisc)
 	dev_put(qdisc_dev(qdisc));
 
 	kfree_skb(qdisc->gso_skb);
+	__skb_queue_purge(&qdisc->requeue);
 	/*
 	 * gen_estimator est_timer() might access qdisc->q.lock,
 	 * wait a RCU grace period before freeing qdisc.
@@ -697,6 +924,8 @@ static void attach_one_default_qdisc(struct net_device *dev,
 			netdev_info(dev, "activation failed\n");
 			return;
 		}
+		if (!netif_is_multiqueue(dev))
+			qdisc->flags |= TCQ_F_ONETXQUEUE;
 	}
 	dev_queue->qdisc_sleeping = qdisc;
 }
@@ -782,12 +1011,42 @@ static void dev_deactivate_queue(struct net_device *dev,
 			set_bit(__QDISC_STATE_DEACTIVATED, &qdisc->state);
 
 		rcu_assign_pointer(dev_queue->qdisc, qdisc_default);
-		qdisc_reset(qdisc);
+		/* a lockless qdisc may still be running on another cpu:
+		 * it is reset by dev_deactivate_many() once it is idle.
+		 */
+		if (!(qdisc->flags & TCQ_F_NOLOCK))
+			qdisc_reset(qdisc);
 
 		spin_unlock_bh(qdisc_lock(qdisc));
 	}
 }
 
+static void dev_reset_nolock_queue(struct net_device *dev,
+				   struct netdev_queue *dev_queue,
+				   void *_unused)
+{
+	struct Qdisc *qdisc = dev_queue->qdisc_sleeping;
+
+	if (qdisc->flags & TCQ_F_NOLOCK) {
+		spin_lock_bh(qdisc_lock(qdisc));
+		qdisc_reset(qdisc);
+		spin_unlock_bh(qdisc_lock(qdisc));
+	}
+}
+
+static bool some_qdisc_is_nolock(struct net_device *dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < dev->num_tx_queues; i++) {
+		struct netdev_queue *dev_queue = netdev_get_tx_queue(dev, i);
+
+		if (dev_queue->qdisc_sleeping->flags & TCQ_F_NOLOCK)
+			return true;
+	}
+	return false;
+}
+
 static bool some_qdisc_is_busy(struct net_device *dev)
 {
 	unsigned int i;
@@ -836,19 +1095,26 @@ void dev_deactivate_many(struct list_head *head)
 
 		dev_watchdog_down(dev);
 		sync_needed |= !dev->dismantle;
+		/* __dev_xmit_skb() tests __QDISC_STATE_DEACTIVATED without
+		 * the lock of a lockless qdisc, which must not be reset
+		 * under a sender that got past that test.
+		 */
+		sync_needed |= some_qdisc_is_nolock(dev);
 	}
 
 	/* Wait for outstanding qdisc-less dev_queue_xmit calls.
-	 * This is avoided if all devices are in dismantle phase :
-	 * Caller will call synchronize_net() for us
+	 * This is avoided if all devices are in dismantle phase and
+	 * have no lockless qdisc: caller will call synchronize_net() for us
 	 */
 	if (sync_needed)
 		synchronize_net();
 
 	/* Wait for outstanding qdisc_run calls. */
-	list_for_each_entry(dev, head, unreg_list)
+	list_for_each_entry(dev, head, unreg_list) {
 		while (some_qdisc_is_busy(dev))
 			yield();
+		netdev_for_each_tx_queue(dev, dev_reset_nolock_queue, NULL);
+	}
 }
 
 void dev_deactivate(struct net_device *dev)
@@ -0,0 +1,264 @@
+/*
+ * Kernel TLS (ktls): attaching to TCP sockets and socket options.
+ *
+ * The "tls" upper layer protocol replaces the proto of an established
+ * TCP socket with a copy whose setsockopt, getsockopt and close know
+ * about SOL_TLS.  Once TLS_TX has been set, sendmsg and sendpage are
+ * replaced as well, and frame and encrypt the stream (see tls_sw.c).
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <net/tcp.h>
+#include <net/tls.h>
+
+MODULE_DESCRIPTION("Transport Layer Security Support");
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_TCP_ULP("tls");
+
+enum {
+	TLSV4,
+	TLSV6,
+	TLS_NUM_PROTS,
+};
+
+enum {
+	TLS_BASE_TX,
+	TLS_SW_TX,
+	TLS_NUM_CONFIG,
+};
+
+/* Indexed by address family of the socket and by whether keys are set.
+ * The IPv6 protos are built from tcpv6_prot the first time they are
+ * needed, as ipv6 may be a module that isn't loaded yet.
+ */
+static struct proto tls_prots[TLS_NUM_PROTS][TLS_NUM_CONFIG];
+static struct proto *saved_tcpv6_prot;
+static DEFINE_MUTEX(tcpv6_prot_mutex);
+
+static int tls_ip_ver(const struct sock *sk)
+{
+	return sk->sk_family == AF_INET6 ? TLSV6 : TLSV4;
+}
+
+static void tls_write_space(struct sock *sk)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	/* A writer sleeping in do_tcp_sendpages() pushes the record itself,
+	 * and we must not recurse into it from its own memory wait.
+	 */
+	if (!sk->sk_write_pending && !ctx->in_tcp_sendpages &&
+	    tls_sw_ctx(ctx) && tls_sw_ctx(ctx)->rec_size) {
+		gfp_t sk_allocation = sk->sk_allocation;
+
+		sk->sk_allocation = GFP_ATOMIC;
+		tls_sw_push_pending(sk, MSG_DONTWAIT | MSG_NOSIGNAL);
+		sk->sk_allocation = sk_allocation;
+	}
+
+	ctx->sk_write_space(sk);
+}
+
+static void tls_sk_proto_close(struct sock *sk, long timeout)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	void (*sk_proto_close)(struct sock *sk, long timeout);
+
+	lock_sock(sk);
+	sk_proto_close = ctx->sk_proto_close;
+
+	if (ctx->priv_ctx) {
+		/* Send what is left before TCP queues its FIN. */
+		tls_sw_flush(sk);
+		sk->sk_write_space = ctx->sk_write_space;
+		tls_sw_free_resources(sk);
+	}
+
+	inet_csk(sk)->icsk_ulp_data = NULL;
+	kfree(ctx);
+	release_sock(sk);
+
+	sk_proto_close(sk, timeout);
+}
+
+static int do_tls_getsockopt_tx(struct sock *sk, char __user *optval,
+				int __user *optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	struct tls12_crypto_info_aes_gcm_128 crypto_info;
+	int len;
+
+	if (get_user(len, optlen))
+		return -EFAULT;
+
+	if (!optval || len < sizeof(crypto_info))
+		return -EINVAL;
+
+	lock_sock(sk);
+	if (!ctx->priv_ctx) {
+		release_sock(sk);
+		return -EBUSY;
+	}
+	crypto_info = ctx->crypto_send;
+	memcpy(crypto_info.iv, ctx->iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE,
+	       TLS_CIPHER_AES_GCM_128_IV_SIZE);
+	memcpy(crypto_info.rec_seq, ctx->rec_seq,
+	       TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+	release_sock(sk);
+
+	len = sizeof(crypto_info);
+	if (put_user(len, optlen))
+		return -EFAULT;
+	if (copy_to_user(optval, &crypto_info, len))
+		return -EFAULT;
+	return 0;
+}
+
+static int tls_getsockopt(struct sock *sk, int level, int optname,
+			  char __user *optval, int __user *optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	if (level != SOL_TLS)
+		return ctx->getsockopt(sk, level, optname, optval, optlen);
+
+	switch (optname) {
+	case TLS_TX:
+		return do_tls_getsockopt_tx(sk, optval, optlen);
+	default:
+		return -ENOPROTOOPT;
+	}
+}
+
+static int do_tls_setsockopt_tx(struct sock *sk, char __user *optval,
+				unsigned int optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	struct tls12_crypto_info_aes_gcm_128 crypto_info;
+	int rc;
+
+	if (!optval || optlen < sizeof(struct tls_crypto_info))
+		return -EINVAL;
+
+	if (optlen != sizeof(crypto_info))
+		return -EINVAL;
+
+	if (copy_from_user(&crypto_info, optval, sizeof(crypto_info)))
+		return -EFAULT;
+
+	rc = -EINVAL;
+	if (crypto_info.info.version != TLS_1_2_VERSION ||
+	    crypto_info.info.cipher_type != TLS_CIPHER_AES_GCM_128)
+		goto out;
+
+	lock_sock(sk);
+	if (ctx->priv_ctx) {
+		rc = -EBUSY;
+	} else {
+		ctx->crypto_send = crypto_info;
+		rc = tls_set_sw_offload(sk, ctx);
+		if (rc) {
+			memset(&ctx->crypto_send, 0, sizeof(ctx->crypto_send));
+		} else {
+			ctx->sk_write_space = sk->sk_write_space;
+			sk->sk_write_space = tls_write_space;
+			sk->sk_prot = &tls_prots[tls_ip_ver(sk)][TLS_SW_TX];
+		}
+	}
+	release_sock(sk);
+out:
+	memset(&crypto_info, 0, sizeof(crypto_info));
+	return rc;
+}
+
+static int tls_setsockopt(struct sock *sk, int level, int optname,
+			  char __user *optval, unsigned int optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	if (level != SOL_TLS)
+		return ctx->setsockopt(sk, level, optname, optval, optlen);
+
+	switch (optname) {
+	case TLS_TX:
+		return do_tls_setsockopt_tx(sk, optval, optlen);
+	default:
+		return -ENOPROTOOPT;
+	}
+}
+
+static void build_protos(struct proto *prot, const struct proto *base)
+{
+	prot[TLS_BASE_TX] = *base;
+	prot[TLS_BASE_TX].setsockopt	= tls_setsockopt;
+	prot[TLS_BASE_TX].getsockopt	= tls_getsockopt;
+	prot[TLS_BASE_TX].close		= tls_sk_proto_close;
+
+	prot[TLS_SW_TX] = prot[TLS_BASE_TX];
+	prot[TLS_SW_TX].sendmsg		= tls_sw_sendmsg;
+	prot[TLS_SW_TX].sendpage	= tls_sw_sendpage;
+}
+
+/* Called with the socket locked, from setsockopt(TCP_ULP). */
+static int tls_init(struct sock *sk)
+{
+	int ip_ver = tls_ip_ver(sk);
+	struct tls_context *ctx;
+
+	/* The TLS ulp is currently supported only for TCP sockets
+	 * in ESTABLISHED state.  Supporting sockets in LISTEN state
+	 * would require the child sockets to be set up as well.
+	 */
+	if (sk->sk_state != TCP_ESTABLISHED)
+		return -ENOTCONN;
+
+	if (ip_ver == TLSV6) {
+		mutex_lock(&tcpv6_prot_mutex);
+		if (sk->sk_prot != saved_tcpv6_prot) {
+			build_protos(tls_prots[TLSV6], sk->sk_prot);
+			saved_tcpv6_prot = sk->sk_prot;
+		}
+		mutex_unlock(&tcpv6_prot_mutex);
+	}
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	ctx->setsockopt = sk->sk_prot->setsockopt;
+	ctx->getsockopt = sk->sk_prot->getsockopt;
+	ctx->sk_proto_close = sk->sk_prot->close;
+
+	inet_csk(sk)->icsk_ulp_data = ctx;
+	sk->sk_prot = &tls_prots[ip_ver][TLS_BASE_TX];
+	return 0;
+}
+
+static struct tcp_ulp_ops tcp_tls_ulp_ops __read_mostly = {
+	.name	= "tls",
+	.owner	= THIS_MODULE,
+	.init	= tls_init,
+};
+
+static int __init tls_register(void)
+{
+	build_protos(tls_prots[TLSV4], &tcp_prot);
+
+	return tcp_register_ulp(&tcp_tls_ulp_ops);
+}
+
+static void __exit tls_unregister(void)
+{
+	tcp_unregister_ulp(&tcp_tls_ulp_ops);
+}
+
+module_init(tls_register);
+module_exit(tls_unregister);
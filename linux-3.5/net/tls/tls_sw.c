@@ -0,0 +1,462 @@
+/*
+ * Kernel TLS (ktls): software record framing and encryption.
+ *
+ * Data written to the socket is gathered into a record of at most
+ * TLS_MAX_PAYLOAD_SIZE bytes.  sendmsg() copies user data into pages
+ * owned by the socket; sendpage() only takes a reference to the page it
+ * is given, so sendfile() and splice() never copy the plaintext.  When a
+ * record is closed it is encrypted with gcm(aes) straight into a set of
+ * record pages, which are then handed to TCP with do_tcp_sendpages().
+ *
+ * TCP keeps its own references to the record pages until the data is
+ * acknowledged; a record page is only written again once we hold the
+ * last reference to it, and replaced otherwise.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/completion.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <net/tcp.h>
+#include <net/tls.h>
+
+struct tls_crypt_result {
+	struct completion completion;
+	int err;
+};
+
+static void tls_crypt_done(struct crypto_async_request *req, int err)
+{
+	struct tls_crypt_result *res = req->data;
+
+	if (err == -EINPROGRESS)
+		return;
+
+	res->err = err;
+	complete(&res->completion);
+}
+
+/* Increment a big endian number of the given size. */
+static void tls_bigint_increment(unsigned char *seq, int len)
+{
+	int i;
+
+	for (i = len - 1; i >= 0; i--) {
+		++seq[i];
+		if (seq[i] != 0)
+			break;
+	}
+}
+
+static void tls_advance_record_sn(struct tls_context *tls_ctx)
+{
+	tls_bigint_increment(tls_ctx->rec_seq,
+			     TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+	tls_bigint_increment(tls_ctx->iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE,
+			     TLS_CIPHER_AES_GCM_128_IV_SIZE);
+}
+
+static void tls_make_aad(struct tls_context *tls_ctx, unsigned char *buf,
+			 size_t size)
+{
+	memcpy(buf, tls_ctx->rec_seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+	buf[8] = TLS_RECORD_TYPE_DATA;
+	buf[9] = TLS_1_2_VERSION_MAJOR;
+	buf[10] = TLS_1_2_VERSION_MINOR;
+	buf[11] = size >> 8;
+	buf[12] = size & 0xFF;
+}
+
+static void tls_release_plaintext(struct tls_sw_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->plain_num_elem; i++)
+		put_page(sg_page(&ctx->sg_plain[i]));
+
+	sg_init_table(ctx->sg_plain, MAX_SKB_FRAGS);
+	ctx->plain_num_elem = 0;
+	ctx->plain_size = 0;
+	ctx->copy_size = 0;
+}
+
+static struct scatterlist *tls_last_plaintext(struct tls_sw_context *ctx,
+					      struct page *page, int offset)
+{
+	struct scatterlist *sg;
+
+	if (!ctx->plain_num_elem)
+		return NULL;
+
+	sg = &ctx->sg_plain[ctx->plain_num_elem - 1];
+	if (sg_page(sg) != page || sg->offset + sg->length != offset)
+		return NULL;
+	return sg;
+}
+
+static bool tls_can_add_plaintext(struct tls_sw_context *ctx,
+				  struct page *page, int offset)
+{
+	return ctx->plain_num_elem < MAX_SKB_FRAGS ||
+	       tls_last_plaintext(ctx, page, offset);
+}
+
+/* Append @len bytes at @offset in @page to the open record.  Returns
+ * false if the record has run out of scatterlist entries.
+ */
+static bool tls_add_plaintext(struct tls_sw_context *ctx, struct page *page,
+			      int offset, int len)
+{
+	struct scatterlist *sg = tls_last_plaintext(ctx, page, offset);
+
+	if (sg) {
+		sg->length += len;
+	} else {
+		if (ctx->plain_num_elem == MAX_SKB_FRAGS)
+			return false;
+		get_page(page);
+		sg_set_page(&ctx->sg_plain[ctx->plain_num_elem++], page,
+			    len, offset);
+	}
+	ctx->plain_size += len;
+	return true;
+}
+
+/* Make sure the record pages needed for @size bytes are ours alone, and
+ * describe the part that receives the ciphertext and tag in sg_encrypted.
+ */
+static int tls_prepare_record(struct sock *sk, struct tls_sw_context *ctx,
+			      int size)
+{
+	int nr_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+	int off = TLS_PREPEND_SIZE;
+	int i, n = 0;
+
+	for (i = 0; i < nr_pages; i++) {
+		struct page *page = ctx->rec_pages[i];
+
+		if (page && page_count(page) == 1)
+			continue;
+		if (page)
+			put_page(page);
+		ctx->rec_pages[i] = alloc_page(sk->sk_allocation);
+		if (!ctx->rec_pages[i])
+			return -ENOMEM;
+	}
+
+	sg_init_table(ctx->sg_encrypted, TLS_RECORD_PAGES);
+	for (i = 0; off < size; i++, off = i * PAGE_SIZE) {
+		int len = min_t(int, size - off,
+				PAGE_SIZE - off % PAGE_SIZE);
+
+		sg_set_page(&ctx->sg_encrypted[n++], ctx->rec_pages[i],
+			    len, off % PAGE_SIZE);
+	}
+	sg_mark_end(&ctx->sg_encrypted[n - 1]);
+	return 0;
+}
+
+static int tls_do_encryption(struct tls_context *tls_ctx,
+			     struct tls_sw_context *ctx, gfp_t flags)
+{
+	unsigned char iv[TLS_CIPHER_AES_GCM_128_SALT_SIZE +
+			 TLS_CIPHER_AES_GCM_128_IV_SIZE];
+	struct tls_crypt_result result;
+	struct aead_request *req;
+	int rc;
+
+	req = aead_request_alloc(ctx->aead_send, flags);
+	if (!req)
+		return -ENOMEM;
+
+	memcpy(iv, tls_ctx->iv, sizeof(iv));
+	init_completion(&result.completion);
+
+	sg_mark_end(&ctx->sg_plain[ctx->plain_num_elem - 1]);
+	aead_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+				  tls_crypt_done, &result);
+	aead_request_set_assoc(req, ctx->sg_aad, TLS_AAD_SPACE_SIZE);
+	aead_request_set_crypt(req, ctx->sg_plain, ctx->sg_encrypted,
+			       ctx->plain_size, iv);
+
+	rc = crypto_aead_encrypt(req);
+	if (rc == -EINPROGRESS || rc == -EBUSY) {
+		wait_for_completion(&result.completion);
+		rc = result.err;
+	}
+
+	aead_request_free(req);
+	return rc;
+}
+
+/* Close the open record: encrypt it and start pushing it to TCP. */
+static int tls_push_record(struct sock *sk, int flags)
+{
+	struct tls_context *tls_ctx = tls_get_ctx(sk);
+	struct tls_sw_context *ctx = tls_sw_ctx(tls_ctx);
+	int size = ctx->plain_size + TLS_OVERHEAD_SIZE;
+	unsigned char *hdr;
+	int rc;
+
+	rc = tls_prepare_record(sk, ctx, size);
+	if (rc)
+		return rc;
+
+	tls_make_aad(tls_ctx, ctx->aad_space, ctx->plain_size);
+	rc = tls_do_encryption(tls_ctx, ctx, sk->sk_allocation);
+	tls_release_plaintext(ctx);
+	if (rc) {
+		/* The stream can't be continued without this record. */
+		sk->sk_err = -rc;
+		sk->sk_error_report(sk);
+		return rc;
+	}
+
+	hdr = page_address(ctx->rec_pages[0]);
+	hdr[0] = TLS_RECORD_TYPE_DATA;
+	hdr[1] = TLS_1_2_VERSION_MAJOR;
+	hdr[2] = TLS_1_2_VERSION_MINOR;
+	hdr[3] = (size - TLS_HEADER_SIZE) >> 8;
+	hdr[4] = (size - TLS_HEADER_SIZE) & 0xFF;
+	memcpy(hdr + TLS_NONCE_OFFSET,
+	       tls_ctx->iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE,
+	       TLS_CIPHER_AES_GCM_128_IV_SIZE);
+
+	tls_advance_record_sn(tls_ctx);
+
+	ctx->rec_off = 0;
+	ctx->rec_size = size;
+	return tls_sw_push_pending(sk, flags);
+}
+
+/* Hand what is left of the last encrypted record to TCP.  Called with
+ * the socket locked, or from sk_write_space() in softirq context.
+ */
+int tls_sw_push_pending(struct sock *sk, int flags)
+{
+	struct tls_context *tls_ctx = tls_get_ctx(sk);
+	struct tls_sw_context *ctx = tls_sw_ctx(tls_ctx);
+	int ret;
+
+	flags &= MSG_DONTWAIT | MSG_NOSIGNAL | MSG_MORE | MSG_SENDPAGE_NOTLAST;
+
+	while (ctx->rec_size) {
+		tls_ctx->in_tcp_sendpages = true;
+		ret = do_tcp_sendpages(sk, ctx->rec_pages, ctx->rec_off,
+				       ctx->rec_size, flags);
+		tls_ctx->in_tcp_sendpages = false;
+		if (ret <= 0)
+			return ret ? ret : -EAGAIN;
+
+		ctx->rec_off += ret;
+		ctx->rec_size -= ret;
+	}
+	return 0;
+}
+
+/* Push the open record and any unsent part of the last one. */
+int tls_sw_flush(struct sock *sk)
+{
+	struct tls_sw_context *ctx = tls_sw_ctx(tls_get_ctx(sk));
+	int ret;
+
+	ret = tls_sw_push_pending(sk, 0);
+	if (!ret && ctx->plain_size)
+		ret = tls_push_record(sk, 0);
+	return ret;
+}
+
+static int tls_copy_from_user(struct sock *sk, struct tls_sw_context *ctx,
+			      struct iovec *iov, int len)
+{
+	int copied = 0;
+
+	while (copied < len) {
+		int offset = ctx->copy_size % PAGE_SIZE;
+		int copy = min_t(int, len - copied, PAGE_SIZE - offset);
+		struct page **page = &ctx->copy_pages[ctx->copy_size /
+						      PAGE_SIZE];
+
+		if (!*page) {
+			*page = alloc_page(sk->sk_allocation);
+			if (!*page)
+				return copied ? copied : -ENOMEM;
+		}
+
+		if (!tls_can_add_plaintext(ctx, *page, offset))
+			break;
+
+		if (memcpy_fromiovec(page_address(*page) + offset, iov, copy))
+			return copied ? copied : -EFAULT;
+
+		tls_add_plaintext(ctx, *page, offset, copy);
+
+		ctx->copy_size += copy;
+		copied += copy;
+	}
+	return copied;
+}
+
+static bool tls_record_full(struct tls_sw_context *ctx)
+{
+	return ctx->plain_size == TLS_MAX_PAYLOAD_SIZE ||
+	       ctx->plain_num_elem == MAX_SKB_FRAGS;
+}
+
+int tls_sw_sendmsg(struct kiocb *iocb, struct sock *sk,
+		   struct msghdr *msg, size_t size)
+{
+	struct tls_sw_context *ctx = tls_sw_ctx(tls_get_ctx(sk));
+	int flags = msg->msg_flags;
+	bool eor = !(flags & MSG_MORE);
+	size_t copied = 0;
+	int ret = 0;
+
+	if (flags & ~(MSG_MORE | MSG_DONTWAIT | MSG_NOSIGNAL))
+		return -EOPNOTSUPP;
+
+	lock_sock(sk);
+
+	ret = tls_sw_push_pending(sk, flags);
+	if (ret)
+		goto send_end;
+
+	while (copied < size) {
+		int copy = min_t(size_t, size - copied,
+				 TLS_MAX_PAYLOAD_SIZE - ctx->plain_size);
+
+		ret = tls_copy_from_user(sk, ctx, msg->msg_iov, copy);
+		if (ret < 0)
+			break;
+		copied += ret;
+		ret = 0;
+
+		if (tls_record_full(ctx) || (copied == size && eor)) {
+			ret = tls_push_record(sk, copied < size ?
+					      flags | MSG_SENDPAGE_NOTLAST :
+					      flags);
+			if (ret)
+				break;
+		}
+	}
+
+send_end:
+	release_sock(sk);
+	return copied ? copied : ret;
+}
+
+int tls_sw_sendpage(struct sock *sk, struct page *page,
+		    int offset, size_t size, int flags)
+{
+	struct tls_sw_context *ctx = tls_sw_ctx(tls_get_ctx(sk));
+	bool eor = !(flags & (MSG_MORE | MSG_SENDPAGE_NOTLAST));
+	size_t copied = 0;
+	int ret = 0;
+
+	if (flags & ~(MSG_MORE | MSG_DONTWAIT | MSG_NOSIGNAL |
+		      MSG_SENDPAGE_NOTLAST))
+		return -EOPNOTSUPP;
+
+	lock_sock(sk);
+
+	ret = tls_sw_push_pending(sk, flags);
+	if (ret)
+		goto sendpage_end;
+
+	while (copied < size) {
+		int copy = min_t(size_t, size - copied,
+				 TLS_MAX_PAYLOAD_SIZE - ctx->plain_size);
+
+		if (tls_add_plaintext(ctx, page, offset + copied, copy))
+			copied += copy;
+
+		if (tls_record_full(ctx) || (copied == size && eor)) {
+			ret = tls_push_record(sk, copied < size ?
+					      flags | MSG_SENDPAGE_NOTLAST :
+					      flags);
+			if (ret)
+				break;
+		}
+	}
+
+sendpage_end:
+	release_sock(sk);
+	return copied ? copied : ret;
+}
+
+void tls_sw_free_resources(struct sock *sk)
+{
+	struct tls_context *tls_ctx = tls_get_ctx(sk);
+	struct tls_sw_context *ctx = tls_sw_ctx(tls_ctx);
+	int i;
+
+	tls_release_plaintext(ctx);
+	for (i = 0; i < TLS_PAYLOAD_PAGES; i++)
+		if (ctx->copy_pages[i])
+			put_page(ctx->copy_pages[i]);
+	for (i = 0; i < TLS_RECORD_PAGES; i++)
+		if (ctx->rec_pages[i])
+			put_page(ctx->rec_pages[i]);
+
+	crypto_free_aead(ctx->aead_send);
+	kfree(ctx);
+	tls_ctx->priv_ctx = NULL;
+}
+
+/*
+ * gcm(aes) is used rather than the rfc4106(gcm(aes)) that aesni-intel
+ * implements in one piece: the latter only takes the 8 or 12 bytes of
+ * associated data of IPsec, not the 13 of TLS.  The gcm template picks
+ * up the aesni ctr(aes) and the clmul ghash where they are available.
+ */
+int tls_set_sw_offload(struct sock *sk, struct tls_context *tls_ctx)
+{
+	struct tls12_crypto_info_aes_gcm_128 *gcm_128_info =
+		&tls_ctx->crypto_send;
+	struct tls_sw_context *ctx;
+	int rc;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	ctx->aead_send = crypto_alloc_aead("gcm(aes)", 0, 0);
+	if (IS_ERR(ctx->aead_send)) {
+		rc = PTR_ERR(ctx->aead_send);
+		goto free_ctx;
+	}
+
+	rc = crypto_aead_setkey(ctx->aead_send, gcm_128_info->key,
+				TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+	if (rc)
+		goto free_aead;
+
+	rc = crypto_aead_setauthsize(ctx->aead_send,
+				     TLS_CIPHER_AES_GCM_128_TAG_SIZE);
+	if (rc)
+		goto free_aead;
+
+	memcpy(tls_ctx->iv, gcm_128_info->salt,
+	       TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+	memcpy(tls_ctx->iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE,
+	       gcm_128_info->iv, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+	memcpy(tls_ctx->rec_seq, gcm_128_info->rec_seq,
+	       TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+
+	sg_init_table(ctx->sg_plain, MAX_SKB_FRAGS);
+	sg_init_one(ctx->sg_aad, ctx->aad_space, sizeof(ctx->aad_space));
+
+	tls_ctx->priv_ctx = ctx;
+	return 0;
+
+free_aead:
+	crypto_free_aead(ctx->aead_send);
+free_ctx:
+	kfree(ctx);
+	return rc;
+}
@@ -0,0 +1,254 @@
+/*
+ * aio_buffered_read - benchmark buffered reads through io_submit()
+ *
+ * Released under the GPL v2.
+ *
+ * Creates (or reuses) a file, drops a chosen fraction of its pages from
+ * the page cache, then reads random blocks from it with io_submit() at
+ * a fixed queue depth.  Buffered aio reads must not block the submitter
+ * on a page cache miss, so the interesting numbers are the time spent
+ * inside io_submit() and how many submissions were slow.
+ *
+ * Usage: aio_buffered_read [-f file] [-s size_mb] [-b block_size]
+ *			    [-d depth] [-n nr_ios] [-m miss_percent]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/aio_abi.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/* a submission taking longer than this almost certainly slept */
+#define SLOW_SUBMIT_US	1000
+
+static const char *filename = "aio_buffered_read.dat";
+static unsigned long size_mb = 256;
+static unsigned long block_size = 4096;
+static unsigned depth = 32;
+static unsigned long nr_ios = 100000;
+static unsigned miss_percent = 50;
+
+static int io_setup(unsigned nr, aio_context_t *ctx)
+{
+	return syscall(__NR_io_setup, nr, ctx);
+}
+
+static int io_destroy(aio_context_t ctx)
+{
+	return syscall(__NR_io_destroy, ctx);
+}
+
+static int io_submit(aio_context_t ctx, long nr, struct iocb **iocbs)
+{
+	return syscall(__NR_io_submit, ctx, nr, iocbs);
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long nr,
+			struct io_event *events, struct timespec *timeout)
+{
+	return syscall(__NR_io_getevents, ctx, min_nr, nr, events, timeout);
+}
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-f file] [-s size_mb] [-b block_size] "
+		"[-d depth] [-n nr_ios] [-m miss_percent]\n", prog);
+	exit(1);
+}
+
+static int prepare_file(void)
+{
+	off_t size = (off_t)size_mb << 20;
+	struct stat st;
+	char *buf;
+	off_t off;
+	int fd;
+
+	fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		die("open");
+
+	if (fstat(fd, &st))
+		die("fstat");
+
+	if (st.st_size < size) {
+		buf = malloc(1 << 20);
+		if (!buf)
+			die("malloc");
+		memset(buf, 0x5a, 1 << 20);
+		for (off = 0; off < size; off += 1 << 20)
+			if (pwrite(fd, buf, 1 << 20, off) != 1 << 20)
+				die("pwrite");
+		free(buf);
+	}
+
+	if (fsync(fd))
+		die("fsync");
+
+	return fd;
+}
+
+/*
+ * Pull the whole file into the page cache, then drop miss_percent of
+ * its blocks again.
+ */
+static void set_cache_state(int fd)
+{
+	unsigned long nr_blocks = (size_mb << 20) / block_size;
+	unsigned long i;
+	char *buf;
+
+	buf = malloc(1 << 20);
+	if (!buf)
+		die("malloc");
+
+	for (i = 0; i < (size_mb << 20) >> 20; i++)
+		if (pread(fd, buf, 1 << 20, (off_t)i << 20) != 1 << 20)
+			die("pread");
+	free(buf);
+
+	for (i = 0; i < nr_blocks; i++)
+		if ((unsigned)(random() % 100) < miss_percent)
+			posix_fadvise(fd, (off_t)i * block_size, block_size,
+				      POSIX_FADV_DONTNEED);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long nr_blocks, submitted = 0, completed = 0, slow = 0;
+	double start, end, t, submit_total = 0, submit_max = 0;
+	struct io_event *events;
+	struct iocb *iocbs, **free_iocbs;
+	aio_context_t ctx = 0;
+	unsigned nr_free, i;
+	char *bufs;
+	int fd, opt, r;
+
+	while ((opt = getopt(argc, argv, "f:s:b:d:n:m:")) != -1) {
+		switch (opt) {
+		case 'f':
+			filename = optarg;
+			break;
+		case 's':
+			size_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			depth = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nr_ios = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			miss_percent = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!size_mb || !block_size || !depth || miss_percent > 100 ||
+	    block_size > (size_mb << 20))
+		usage(argv[0]);
+
+	nr_blocks = (size_mb << 20) / block_size;
+	srandom(getpid());
+
+	fd = prepare_file();
+	set_cache_state(fd);
+
+	if (io_setup(depth, &ctx))
+		die("io_setup");
+
+	iocbs = calloc(depth, sizeof(*iocbs));
+	free_iocbs = calloc(depth, sizeof(*free_iocbs));
+	events = calloc(depth, sizeof(*events));
+	if (!iocbs || !free_iocbs || !events)
+		die("calloc");
+	if (posix_memalign((void **)&bufs, 4096, depth * block_size))
+		die("posix_memalign");
+
+	for (i = 0; i < depth; i++) {
+		iocbs[i].aio_fildes = fd;
+		iocbs[i].aio_lio_opcode = IOCB_CMD_PREAD;
+		iocbs[i].aio_buf = (unsigned long)(bufs + i * block_size);
+		iocbs[i].aio_nbytes = block_size;
+		iocbs[i].aio_data = i;
+		free_iocbs[i] = &iocbs[i];
+	}
+	nr_free = depth;
+
+	start = now_us();
+	while (completed < nr_ios) {
+		while (nr_free && submitted < nr_ios) {
+			struct iocb *iocb = free_iocbs[--nr_free];
+
+			iocb->aio_offset = (random() % nr_blocks) * block_size;
+
+			t = now_us();
+			r = io_submit(ctx, 1, &iocb);
+			t = now_us() - t;
+			if (r != 1)
+				die("io_submit");
+
+			submit_total += t;
+			if (t > submit_max)
+				submit_max = t;
+			if (t > SLOW_SUBMIT_US)
+				slow++;
+			submitted++;
+		}
+
+		r = io_getevents(ctx, 1, depth, events, NULL);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			die("io_getevents");
+		}
+
+		for (i = 0; i < (unsigned)r; i++) {
+			if ((long)events[i].res != (long)block_size) {
+				fprintf(stderr, "read returned %lld\n",
+					(long long)events[i].res);
+				exit(1);
+			}
+			free_iocbs[nr_free++] = &iocbs[events[i].data];
+		}
+		completed += r;
+	}
+	end = now_us();
+
+	printf("%lu reads of %lu bytes, depth %u, %u%% misses\n",
+	       completed, block_size, depth, miss_percent);
+	printf("  elapsed %.0f ms, %.0f reads/s\n",
+	       (end - start) / 1e3, completed / ((end - start) / 1e6));
+	printf("  io_submit: avg %.1f us, max %.0f us, %lu over %d us\n",
+	       submit_total / submitted, submit_max, slow, SLOW_SUBMIT_US);
+
+	io_destroy(ctx);
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,217 @@
+/*
+ * conntrack_stress - create and expire conntrack entries from many threads
+ *
+ * Released under the GPL v2.
+ *
+ * Each thread sends single UDP datagrams over loopback, walking through
+ * destination addresses in 127.0.0.0/8 and destination ports so that
+ * every datagram opens a new connection.  The closed ports answer with
+ * ICMP errors, which are looked up as related traffic.  With a short
+ * UDP timeout (-T) entries keep expiring while new ones are inserted,
+ * so creation, lookup and destruction all run concurrently.
+ *
+ * Needs nf_conntrack_ipv4 loaded; -T needs root.
+ *
+ * Usage: conntrack_stress [-t threads] [-d seconds] [-T udp_timeout]
+ */
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CT_COUNT	"/proc/sys/net/netfilter/nf_conntrack_count"
+#define CT_MAX		"/proc/sys/net/netfilter/nf_conntrack_max"
+#define CT_UDP_TIMEOUT	"/proc/sys/net/netfilter/nf_conntrack_udp_timeout"
+
+static unsigned nr_threads = 4;
+static unsigned duration = 10;
+static int udp_timeout = -1;
+static volatile int stop;
+
+struct worker {
+	pthread_t thread;
+	unsigned id;
+	unsigned long sent;
+	unsigned long failed;
+};
+
+static long read_long(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	long val = -1;
+
+	if (!f)
+		return -1;
+	if (fscanf(f, "%ld", &val) != 1)
+		val = -1;
+	fclose(f);
+	return val;
+}
+
+static int write_long(const char *path, long val)
+{
+	FILE *f = fopen(path, "w");
+	int ret;
+
+	if (!f)
+		return -1;
+	ret = fprintf(f, "%ld\n", val) < 0 ? -1 : 0;
+	if (fclose(f))
+		ret = -1;
+	return ret;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	struct sockaddr_in dst;
+	unsigned long n = 0;
+	char payload = 0;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return NULL;
+	}
+
+	memset(&dst, 0, sizeof(dst));
+	dst.sin_family = AF_INET;
+
+	while (!stop) {
+		/* 127.<id>.x.y:port, a fresh tuple for every datagram */
+		dst.sin_addr.s_addr = htonl(0x7f000000 |
+					    ((w->id & 0xff) << 16) |
+					    ((n >> 14) & 0xffff));
+		dst.sin_port = htons(1024 + (n & 0x3fff));
+		n++;
+
+		if (sendto(fd, &payload, sizeof(payload), MSG_DONTWAIT,
+			   (struct sockaddr *)&dst, sizeof(dst)) < 0) {
+			/* ICMP errors come back as ECONNREFUSED */
+			if (errno != ECONNREFUSED && errno != EAGAIN &&
+			    errno != ENOBUFS && errno != EPERM)
+				w->failed++;
+			continue;
+		}
+		w->sent++;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-t threads] [-d seconds] [-T udp_timeout]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long total = 0, failed = 0;
+	long count_before, count_peak, count, ct_max, old_timeout = -1;
+	struct worker *workers;
+	double start, elapsed;
+	unsigned i, s;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:d:T:")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			udp_timeout = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!nr_threads || !duration)
+		usage(argv[0]);
+
+	count_before = read_long(CT_COUNT);
+	if (count_before < 0) {
+		printf("conntrack_stress: %s not found, is nf_conntrack_ipv4 loaded? [SKIP]\n",
+		       CT_COUNT);
+		return 0;
+	}
+	ct_max = read_long(CT_MAX);
+
+	if (udp_timeout >= 0) {
+		old_timeout = read_long(CT_UDP_TIMEOUT);
+		if (write_long(CT_UDP_TIMEOUT, udp_timeout)) {
+			perror(CT_UDP_TIMEOUT);
+			return 1;
+		}
+	}
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].id = i;
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	count_peak = count_before;
+	for (s = 0; s < duration; s++) {
+		sleep(1);
+		count = read_long(CT_COUNT);
+		if (count > count_peak)
+			count_peak = count;
+	}
+	stop = 1;
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].sent;
+		failed += workers[i].failed;
+	}
+	elapsed = now() - start;
+
+	if (old_timeout >= 0)
+		write_long(CT_UDP_TIMEOUT, old_timeout);
+
+	printf("threads %u: %lu new flows in %.1fs, %.0f flows/s\n",
+	       nr_threads, total, elapsed, total / elapsed);
+	printf("conntrack count: %ld before, %ld peak, max %ld\n",
+	       count_before, count_peak, ct_max);
+
+	free(workers);
+	if (failed) {
+		printf("conntrack_stress: %lu sends failed [FAIL]\n", failed);
+		return 1;
+	}
+	printf("conntrack_stress: [PASS]\n");
+	return 0;
+}